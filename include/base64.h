@@ -16,6 +16,10 @@
 
 /*!
  * @defgroup base64 base64 encoding/decoding functions
+ *
+ * The functions keep no state between calls and may be used by any number of
+ * threads at once.
+ *
  * @{
  */
 
@@ -32,6 +32,8 @@
  *
  * These functions are mainly used by the flist family of functions.
  *
+ * The conversions are plain arithmetic and can be called from any thread.
+ *
  * @{
  */
 
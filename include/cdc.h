@@ -0,0 +1,170 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+/*!
+ * @defgroup cdc Content-defined chunking
+ *
+ * Content-defined chunking splits data at boundaries determined by the data
+ * itself rather than by fixed offsets. Inserting or removing bytes therefore
+ * only changes the chunks around the modification, while all other chunks -
+ * and their digests - stay the same. This makes chunks a good unit for
+ * deduplication and incremental transfers.
+ *
+ * Boundaries are found with the FastCDC algorithm: a Gear rolling hash is
+ * computed over the data, and a boundary is declared where the upper bits of
+ * the hash are zero. No boundary is declared before the minimum chunk size and
+ * one is forced at the maximum chunk size. Below the average chunk size a
+ * stricter mask is used than above it, which narrows the distribution of
+ * chunk sizes around the average (normalized chunking).
+ *
+ * The cdc_init() function validates the chunk size parameters and initializes
+ * a chunker. The digest used for chunks defaults to whirlpool and can be
+ * changed or disabled through the digest member; with the threads member set,
+ * chunk digests are computed by that many worker threads while the calling
+ * thread keeps searching for boundaries. Chunks are always passed to the
+ * callback in order and from the calling thread.
+ *
+ * The cdc_cut() function returns the length of the first chunk in a buffer.
+ * The cdc_buf() and cdc_fd() functions split a whole buffer or file into
+ * chunks and pass each of them to a callback. Regular files are mapped into
+ * memory window by window; other file descriptors are read into a buffer.
+ *
+ * A chunker is used by one call at a time, while separate chunkers may run in
+ * parallel. The worker threads started for the threads member belong to a
+ * single call and are joined before it returns.
+ *
+ * @{
+ */
+
+#ifndef _LUCID_CDC_H
+#define _LUCID_CDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _LUCID_BUILD_
+#include "digest.h"
+#else
+#include <lucid/digest.h>
+#endif
+
+/*! @brief smallest minimum chunk size */
+#define CDC_MIN_SIZE 64
+
+/*! @brief largest maximum chunk size */
+#define CDC_MAX_SIZE (64 * 1024 * 1024)
+
+/*!
+ * @brief chunker parameters
+ *
+ * The members not marked private may be changed after cdc_init().
+ */
+typedef struct {
+	size_t min;             /*!< minimum chunk size */
+	size_t avg;             /*!< average chunk size */
+	size_t max;             /*!< maximum chunk size */
+	const digest_t *digest; /*!< chunk digest, NULL to skip hashing */
+	int threads;            /*!< number of hashing threads, 0 for none */
+	uint64_t mask_s;        /*!< mask below avg (private) */
+	uint64_t mask_l;        /*!< mask above avg (private) */
+} cdc_t;
+
+/*! @brief chunk description */
+typedef struct {
+	uint64_t offset;        /*!< offset of the chunk in the input */
+	size_t len;             /*!< length of the chunk */
+	const void *data;       /*!< chunk data, valid during the callback */
+	unsigned char digest[DIGEST_MAXBYTES]; /*!< raw chunk digest */
+} cdc_chunk_t;
+
+/*!
+ * @brief chunk callback
+ *
+ * @param[in] chunk chunk description
+ * @param[in] data  user data
+ *
+ * @return 0 to continue, any other value to stop chunking
+ */
+typedef int cdc_callback_t(const cdc_chunk_t *chunk, void *data);
+
+/*!
+ * @brief initialize a chunker
+ *
+ * @param[out] cdc chunker
+ * @param[in]  min minimum chunk size
+ * @param[in]  avg average chunk size
+ * @param[in]  max maximum chunk size
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @note The sizes must satisfy CDC_MIN_SIZE <= min < avg < max <=
+ *       CDC_MAX_SIZE, otherwise errno is set to EINVAL.
+ */
+int cdc_init(cdc_t *cdc, size_t min, size_t avg, size_t max);
+
+/*!
+ * @brief find the first chunk boundary
+ *
+ * @param[in] cdc chunker
+ * @param[in] buf data to search
+ * @param[in] len length of buf
+ *
+ * @return length of the first chunk in buf, at most len
+ *
+ * @note If the returned length equals len and len is less than the maximum
+ *       chunk size, no boundary was found and more data may extend the chunk.
+ */
+size_t cdc_cut(const cdc_t *cdc, const void *buf, size_t len);
+
+/*!
+ * @brief split a buffer into chunks
+ *
+ * @param[in] cdc  chunker
+ * @param[in] buf  data to split
+ * @param[in] len  length of buf
+ * @param[in] cb   callback invoked for every chunk
+ * @param[in] data user data passed to cb
+ *
+ * @return 0 on success, the non-zero return value of cb if it stopped
+ *         chunking, -1 on error with errno set
+ */
+int cdc_buf(const cdc_t *cdc, const void *buf, size_t len,
+		cdc_callback_t *cb, void *data);
+
+/*!
+ * @brief split a file into chunks
+ *
+ * @param[in] cdc  chunker
+ * @param[in] fd   file descriptor to read from
+ * @param[in] cb   callback invoked for every chunk
+ * @param[in] data user data passed to cb
+ *
+ * @return 0 on success, the non-zero return value of cb if it stopped
+ *         chunking, -1 on error with errno set
+ *
+ * @note Regular files are chunked from their current offset to their end;
+ *       the file offset is left unchanged. Chunk offsets are relative to the
+ *       starting offset.
+ * @note Truncating a regular file while it is being chunked raises SIGBUS.
+ *
+ * @see mmap(2)
+ */
+int cdc_fd(const cdc_t *cdc, int fd, cdc_callback_t *cb, void *data);
+
+#endif
+
+/*! @} cdc */
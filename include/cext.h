@@ -17,6 +17,8 @@
 /*!
  * @defgroup cext Extensions for the C standard library
  *
+ * The extensions only operate on their arguments and are thread-safe.
+ *
  * @{
  */
 
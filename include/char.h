@@ -57,6 +57,9 @@
  *
  * char_toupper() converts a character to uppercase if applicable.
  *
+ * The macros use no locale and no shared state, so they are safe in any
+ * thread.
+ *
  * @{
  */
 
@@ -35,6 +35,11 @@
  *
  * The main usage of these functions is to get a file descriptor, safe against
  * symlink attacks, reffering to a directory inside a new root.
+ *
+ * The working directory and the root directory are attributes of the process
+ * shared by all its threads. These functions change both, so they must not
+ * run while other threads resolve relative paths or depend on the root.
+ *
  * @{
  */
 
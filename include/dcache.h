@@ -0,0 +1,148 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+/*!
+ * @defgroup dcache Persistent digest cache
+ *
+ * The digest cache remembers the whirlpool digest of regular files, keyed by
+ * their inode metadata (device, inode, size, modification and change time).
+ * As long as none of these change, the digest of a file can be looked up
+ * instead of being recomputed.
+ *
+ * The cache is stored in a file that is mapped into memory. It consists of a
+ * small header followed by a fixed number of slots forming an open-addressing
+ * hash table indexed by device and inode number. A lookup therefore costs one
+ * stat(2) and usually one probe. Entries whose metadata does not match the
+ * current stat(2) result are treated as misses and are overwritten on the
+ * next store.
+ *
+ * Every slot is protected by a sequence counter, so any number of threads or
+ * processes may read and update the same cache file concurrently without
+ * locks. A store that races with another store to the same slot is silently
+ * dropped; the digest is simply recomputed next time. Writable handles hold a
+ * shared flock(2) on the cache file until they are closed; if dcache_open()
+ * finds no other writable handle, it resets slots left behind by a store that
+ * was killed halfway through.
+ *
+ * The dcache_open() function opens or creates a cache file. If the file is
+ * created, it gets room for nslots entries (rounded up to the next power of
+ * two); otherwise the size stored in the file is used. If the file is not
+ * writable, it is opened read-only and stores fail with EROFS.
+ *
+ * The dcache_lookup() and dcache_store() functions find and record the
+ * digest belonging to a stat(2) result, respectively. The
+ * dcache_digest_path() function combines both with whirlpool_add_fd() and is
+ * a caching drop-in replacement for whirlpool_digest_path().
+ *
+ * @note The cache file uses native byte order and is not portable between
+ *       architectures.
+ *
+ * A dcache_t may be shared by threads between dcache_open() and
+ * dcache_close().
+ *
+ * @{
+ */
+
+#ifndef _LUCID_DCACHE_H
+#define _LUCID_DCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*! @brief maximum number of slots probed per lookup */
+#define DCACHE_PROBES 8
+
+/*!
+ * @brief digest cache handle
+ *
+ * This struct is used to keep track of an opened cache file and its memory
+ * mapping.
+ */
+typedef struct {
+	int fd;            /*!< file descriptor of the cache file */
+	int readonly;      /*!< cache was opened read-only */
+	void *map;         /*!< start of the mapping */
+	size_t maplen;     /*!< length of the mapping */
+	void *slots;       /*!< first slot in the mapping */
+	uint32_t mask;     /*!< number of slots - 1 */
+} dcache_t;
+
+/*!
+ * @brief open or create a digest cache
+ *
+ * @param[out] dc     cache handle
+ * @param[in]  path   cache file
+ * @param[in]  nslots number of slots if the file is created
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @see mmap(2)
+ */
+int dcache_open(dcache_t *dc, const char *path, uint32_t nslots);
+
+/*!
+ * @brief close a digest cache
+ *
+ * @param[in] dc cache handle
+ */
+void dcache_close(dcache_t *dc);
+
+/*!
+ * @brief look up a digest
+ *
+ * @param[in]  dc     cache handle
+ * @param[in]  sb     current metadata of the file
+ * @param[out] digest raw digest of DIGESTBYTES bytes
+ *
+ * @return 1 if a matching entry was found, 0 otherwise
+ */
+int dcache_lookup(dcache_t *dc, const struct stat *sb, unsigned char *digest);
+
+/*!
+ * @brief store a digest
+ *
+ * @param[in] dc     cache handle
+ * @param[in] sb     metadata of the file at the time it was hashed
+ * @param[in] digest raw digest of DIGESTBYTES bytes
+ *
+ * @return 1 if the entry was stored, 0 if it lost a race with another store,
+ *         -1 on error with errno set
+ */
+int dcache_store(dcache_t *dc, const struct stat *sb,
+		const unsigned char *digest);
+
+/*!
+ * @brief create digest from file using the cache
+ *
+ * @param[in] dc   cache handle
+ * @param[in] path file to read from
+ *
+ * @return digest string (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using free(3)
+ * @note Files modified less than two seconds ago are hashed but not stored,
+ *       since a later modification within the same timestamp granularity
+ *       would go unnoticed.
+ *
+ * @see whirlpool_digest_path()
+ */
+char *dcache_digest_path(dcache_t *dc, const char *path);
+
+#endif
+
+/*! @} dcache */
@@ -0,0 +1,155 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+/*!
+ * @defgroup delta Delta compression of files
+ *
+ * The delta module transforms an old version of a file into a new one by
+ * transferring only the parts that changed, using the rsync algorithm.
+ *
+ * First, a signature of the old file is built with delta_sig_fd(). The
+ * signature contains a weak rolling checksum and a truncated strong digest
+ * (whirlpool by default) for every block of the old file.
+ *
+ * Then delta_fd() scans the new file with the rolling checksum. Wherever a
+ * window of the new file matches a block of the old file, the delta refers
+ * to that block with a copy operation. Everything else is stored literally
+ * as an insert operation. Adjacent copies are merged, so an unchanged file
+ * results in a single copy operation.
+ *
+ * Finally, delta_patch() applies a delta to the old file and writes the new
+ * file to another file descriptor. The delta_patch_inplace() function updates
+ * the old file directly. Copies whose source and destination coincide cost
+ * no I/O at all, which makes in-place patching of large, mostly unchanged
+ * images cheap. In-place patching is only possible with deltas created using
+ * the DELTA_INPLACE flag; such deltas never copy from a region of the file
+ * that has already been overwritten.
+ *
+ * Deltas are written in a portable big-endian format. Old files are accessed
+ * through mmap(2).
+ *
+ * A signature is not modified after it has been built and may be shared by
+ * threads; everything else belongs to the call that uses it.
+ *
+ * @{
+ */
+
+#ifndef _LUCID_DELTA_H
+#define _LUCID_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _LUCID_BUILD_
+#include "digest.h"
+#else
+#include <lucid/digest.h>
+#endif
+
+/*! @brief default block size */
+#define DELTA_BLOCKSIZE 4096
+
+/*! @brief bytes of the strong digest kept per block */
+#define DELTA_STRONGBYTES 16
+
+/*! @brief only copy from regions not yet overwritten by delta_patch_inplace() */
+#define DELTA_INPLACE 0x01
+
+/*! @brief signature of a single block */
+typedef struct {
+	uint32_t weak;                            /*!< rolling checksum */
+	uint32_t next;                            /*!< hash chain (private) */
+	unsigned char strong[DELTA_STRONGBYTES];  /*!< truncated strong digest */
+} delta_block_t;
+
+/*! @brief signature of a file */
+typedef struct {
+	size_t blocksize;          /*!< block size */
+	uint64_t size;             /*!< size of the file */
+	uint32_t nblocks;          /*!< number of blocks */
+	const digest_t *digest;    /*!< strong digest */
+	delta_block_t *blocks;     /*!< block signatures */
+	uint32_t *buckets;         /*!< hash table (private) */
+	uint32_t mask;             /*!< number of buckets - 1 (private) */
+} delta_sig_t;
+
+/*!
+ * @brief build the signature of a file
+ *
+ * @param[out] sig       signature
+ * @param[in]  fd        file descriptor of the old file
+ * @param[in]  blocksize block size, 0 for DELTA_BLOCKSIZE
+ * @param[in]  digest    strong digest, NULL for whirlpool
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @note The caller should release the signature using delta_sig_free()
+ */
+int delta_sig_fd(delta_sig_t *sig, int fd, size_t blocksize,
+		const digest_t *digest);
+
+/*!
+ * @brief release a signature
+ *
+ * @param[in] sig signature
+ */
+void delta_sig_free(delta_sig_t *sig);
+
+/*!
+ * @brief compute a delta
+ *
+ * @param[in] sig     signature of the old file
+ * @param[in] fd      file descriptor of the new file
+ * @param[in] deltafd file descriptor to write the delta to
+ * @param[in] flags   0 or DELTA_INPLACE
+ *
+ * @return 0 on success, -1 on error with errno set
+ */
+int delta_fd(const delta_sig_t *sig, int fd, int deltafd, int flags);
+
+/*!
+ * @brief apply a delta to a new file
+ *
+ * @param[in] oldfd   file descriptor of the old file
+ * @param[in] deltafd file descriptor to read the delta from
+ * @param[in] newfd   file descriptor to write the new file to
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @note errno is set to EINVAL if the delta is malformed or does not fit the
+ *       old file.
+ */
+int delta_patch(int oldfd, int deltafd, int newfd);
+
+/*!
+ * @brief apply a delta in place
+ *
+ * @param[in] fd      file descriptor of the old file, opened for reading and
+ *                    writing
+ * @param[in] deltafd file descriptor to read the delta from
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @note errno is set to EINVAL if the delta was not created with
+ *       DELTA_INPLACE. A malformed delta may leave the file partially
+ *       updated.
+ */
+int delta_patch_inplace(int fd, int deltafd);
+
+#endif
+
+/*! @} delta */
@@ -0,0 +1,244 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+/*!
+ * @defgroup digest Generic message digest interface
+ *
+ * The digest family of functions provides one interface to all message
+ * digest algorithms contained in lucid. Each algorithm is described by a
+ * digest_t, a table of functions to initialize, update and finalize its
+ * state, together with the size of the digest it produces.
+ *
+ * Currently the following algorithms are available:
+ *
+ * - digest_whirlpool<br>
+ *   WHIRLPOOL, 512-bit digest; see whirlpool.
+ * - digest_sha256<br>
+ *   SHA-256, 256-bit digest. On x86 processors with the SHA extensions the
+ *   compression function uses the SHA-NI instructions, selected at runtime.
+ * - digest_blake3<br>
+ *   BLAKE3 in default hash mode, 256-bit digest. Complete 1 KiB chunks are
+ *   compressed eight at a time using vector instructions (AVX2 where
+ *   available, SSE2 otherwise on x86).
+ *
+ * The digest_init() function initializes the context pointed to by ctx for the
+ * given algorithm. After initialization input can be added using
+ * digest_update() or digest_add_fd(). Once all bytes have been added the digest
+ * is obtained by calling digest_final(), which stores digest_size() bytes.
+ *
+ * The digest_str(), digest_fd() and digest_path() functions combine the
+ * procedure explained above for a single string, file descriptor or file,
+ * respectively, and return the digest in hexadecimal notation like
+ * whirlpool_digest().
+ *
+ * The digest_byname() function looks up an algorithm by its name, allowing
+ * the algorithm to be chosen by configuration.
+ *
+ * The algorithm descriptors are constant. A context must not be updated by two
+ * threads at once. The implementation for the processor is selected at the
+ * first use; concurrent first uses make the same choice.
+ *
+ * @{
+ */
+
+#ifndef _LUCID_DIGEST_H
+#define _LUCID_DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _LUCID_BUILD_
+#include "whirlpool.h"
+#else
+#include <lucid/whirlpool.h>
+#endif
+
+/*! @brief largest digest size of all algorithms in bytes */
+#define DIGEST_MAXBYTES DIGESTBYTES
+
+/*! @brief SHA-256 digest size in bytes */
+#define SHA256_DIGESTBYTES 32
+
+/*! @brief BLAKE3 digest size in bytes */
+#define BLAKE3_DIGESTBYTES 32
+
+/*! @brief BLAKE3 chunk size in bytes */
+#define BLAKE3_CHUNKBYTES 1024
+
+/*! @brief BLAKE3 maximum tree depth */
+#define BLAKE3_MAXDEPTH 54
+
+/*! @brief SHA-256 state data */
+typedef struct {
+	uint32_t h[8];      /*!< the hashing state */
+	uint64_t len;       /*!< number of hashed bytes */
+	uint8_t  buf[64];   /*!< buffer of data to hash */
+	int      pos;       /*!< number of bytes on the buffer */
+} sha256_t;
+
+/*! @brief BLAKE3 state data */
+typedef struct {
+	uint32_t cv[8];                             /*!< current chunk chaining value */
+	uint64_t chunk;                             /*!< current chunk counter */
+	uint8_t  buf[64];                           /*!< buffer of data to hash */
+	int      pos;                               /*!< number of bytes on the buffer */
+	int      blocks;                            /*!< blocks compressed in chunk */
+	int      depth;                             /*!< number of stacked chaining values */
+	uint32_t stack[BLAKE3_MAXDEPTH][8];         /*!< chaining value stack */
+} blake3_t;
+
+typedef void digest_init_t(void *state);
+typedef void digest_update_t(void *state, const void *src, size_t len);
+typedef void digest_final_t(void *state, unsigned char *digest);
+
+/*!
+ * @brief digest algorithm description
+ */
+typedef struct digest_s {
+	const char *name;        /*!< algorithm name */
+	size_t size;             /*!< digest size in bytes */
+	digest_init_t *init;     /*!< initialize state */
+	digest_update_t *update; /*!< add bytes to the state */
+	digest_final_t *final;   /*!< finalize state and store digest */
+} digest_t;
+
+/*!
+ * @brief generic digest context
+ */
+typedef struct {
+	const digest_t *type;    /*!< algorithm in use */
+	union {
+		whirlpool_t whirlpool;
+		sha256_t sha256;
+		blake3_t blake3;
+	} state;                 /*!< algorithm specific state */
+} digest_ctx_t;
+
+extern const digest_t digest_whirlpool;
+extern const digest_t digest_sha256;
+extern const digest_t digest_blake3;
+
+/*!
+ * @brief look up digest algorithm by name
+ *
+ * @param[in] name algorithm name (e.g. "sha256")
+ *
+ * @return algorithm description, NULL if not found
+ */
+const digest_t *digest_byname(const char *name);
+
+/*!
+ * @brief get digest size of an algorithm
+ *
+ * @param[in] type algorithm description
+ *
+ * @return number of bytes stored by digest_final()
+ */
+size_t digest_size(const digest_t *type);
+
+/*!
+ * @brief initialize digest context
+ *
+ * @param[out] ctx  digest context
+ * @param[in]  type algorithm to use
+ */
+void digest_init(digest_ctx_t *ctx, const digest_t *type);
+
+/*!
+ * @brief add bytes to the digest
+ *
+ * @param[in] ctx digest context
+ * @param[in] src source buffer
+ * @param[in] len number of bytes in src
+ */
+void digest_update(digest_ctx_t *ctx, const void *src, size_t len);
+
+/*!
+ * @brief add bytes from a file descriptor to the digest
+ *
+ * @param[in] ctx digest context
+ * @param[in] fd  file descriptor to read from
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @see uio_read_stream()
+ */
+int digest_add_fd(digest_ctx_t *ctx, int fd);
+
+/*!
+ * @brief finalize digest
+ *
+ * @param[in]  ctx    digest context
+ * @param[out] digest buffer of at least digest_size() bytes
+ */
+void digest_final(digest_ctx_t *ctx, unsigned char *digest);
+
+/*!
+ * @brief convert digest to hexadecimal notation
+ *
+ * @param[in] type   algorithm description
+ * @param[in] digest raw digest
+ *
+ * @return digest string (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using free(3)
+ */
+char *digest_hex(const digest_t *type, const unsigned char *digest);
+
+/*!
+ * @brief create digest from string
+ *
+ * @param[in] type algorithm to use
+ * @param[in] str  source string
+ *
+ * @return digest string (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using free(3)
+ */
+char *digest_str(const digest_t *type, const char *str);
+
+/*!
+ * @brief create digest from file descriptor
+ *
+ * @param[in] type algorithm to use
+ * @param[in] fd   file descriptor to read from
+ *
+ * @return digest string (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using free(3)
+ */
+char *digest_fd(const digest_t *type, int fd);
+
+/*!
+ * @brief create digest from file
+ *
+ * @param[in] type algorithm to use
+ * @param[in] path file to read from
+ *
+ * @return digest string (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using free(3)
+ */
+char *digest_path(const digest_t *type, const char *path);
+
+#endif
+
+/*! @} digest */
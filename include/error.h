@@ -16,6 +16,26 @@
 
 /*!
  * @defgroup error Advanced error handling
+ *
+ * Errors are recorded as frames on an error stack: the function that detects
+ * an error pushes the first frame with error_set(), and each caller may add
+ * context with error_pass() or error_dof() while the error propagates.
+ *
+ * Every thread has its own stack, and the frames of a stack come from a pool
+ * of ERROR_FRAMES frames that is allocated with the first frame and reused
+ * afterwards. Once the pool is full, the most recent frame replaces the top
+ * frame and the replaced frames are only counted, so the innermost frames that
+ * describe the cause are kept.
+ *
+ * A frame stores its format and copies of the arguments; the message is only
+ * rendered by error_describe() and error_print_trace(). String arguments are
+ * copied up to their precision, and up to ERROR_STRMAX bytes per frame in
+ * total. Formats with conversions that cannot be stored this way are rendered
+ * when the frame is pushed.
+ *
+ * A stack passed explicitly to the functions must not be used by two threads
+ * at once.
+ *
  * @{
  */
 
@@ -29,45 +49,132 @@
 #undef NDEBUG
 #include <assert.h>
 
-#ifdef _LUCID_BUILD_
-#include "list.h"
-#else
-#include <lucid/list.h>
-#endif
-
 /* assert stuff */
 #define assert_not_reached() assert(true)
 
-typedef struct error_s {
-	list_t list;
-	const char *file;
-	const char *func;
-	int line;
-	int errnum;
-	char *msg;
+/*! @brief frames per stack */
+#define ERROR_FRAMES 32
+
+/*! @brief arguments stored per frame */
+#define ERROR_ARGS 8
+
+/*! @brief bytes of string arguments, or of a rendered message, per frame */
+#define ERROR_STRMAX 128
+
+/*! @brief one frame of an error stack */
+typedef struct {
+	const char *file;           /*!< source file */
+	const char *func;           /*!< function */
+	int line;                   /*!< source line */
+	int errnum;                 /*!< errno value */
+	const char *fmt;            /*!< format, NULL if strs holds the message */
+	int nargs;                  /*!< number of stored arguments */
+	char types[ERROR_ARGS];     /*!< class of each stored argument */
+	union {
+		long long i;
+		double d;
+		const void *p;
+	} args[ERROR_ARGS];         /*!< stored arguments */
+	char strs[ERROR_STRMAX];    /*!< copied strings or rendered message */
+} error_frame_t;
+
+/*! @brief error stack */
+typedef struct {
+	int count;                  /*!< frames in use */
+	int dropped;                /*!< frames replaced while the pool was full */
+	error_frame_t *frames;      /*!< pool, bottom first, or NULL */
 } error_t;
 
+/*!
+ * @brief initialize an error stack
+ *
+ * @param[out] err error stack
+ */
 void error_init(error_t *err);
 
+/*!
+ * @brief check whether an error stack holds no error
+ *
+ * @param[in] err error stack
+ *
+ * @return true if no frame was pushed since the stack was last cleared
+ */
 bool error_empty(error_t *err);
 
+/*!
+ * @brief push a frame on an error stack
+ *
+ * @param[in,out] err    error stack
+ * @param[in]     file   source file
+ * @param[in]     line   source line
+ * @param[in]     func   function
+ * @param[in]     errnum errno value
+ * @param[in]     fmt    format of the message, or NULL for no message; it
+ *                       must stay valid until the frame is rendered
+ * @param[in]     ...    arguments according to fmt
+ */
 void error_push(error_t *err, const char *file, int line, const char *func,
 		int errnum, const char *fmt, ...);
 
-error_t *error_pop(error_t *err);
+/*!
+ * @brief remove the top frame of an error stack
+ *
+ * @param[in,out] err error stack
+ *
+ * @return the frame, valid until the next push, or NULL if the stack is empty
+ */
+error_frame_t *error_pop(error_t *err);
 
-void error_free_node(error_t *err);
+/*!
+ * @brief forget all frames of an error stack and keep its pool
+ *
+ * @param[in,out] err error stack
+ */
+void error_reset(error_t *err);
 
+/*!
+ * @brief forget all frames of an error stack and release its pool
+ *
+ * @param[in,out] err error stack
+ */
 void error_free(error_t *err);
 
+/*!
+ * @brief count the frames of an error stack
+ *
+ * @param[in] err error stack
+ *
+ * @return number of frames held, replaced frames not included
+ */
 int error_count(error_t *err);
 
-char *error_describe(error_t *err, const char *prefix);
+/*!
+ * @brief describe a frame
+ *
+ * @param[in] frame  frame to describe
+ * @param[in] prefix prefix of the description
+ *
+ * @return newly allocated description, or NULL on error
+ */
+char *error_describe(const error_frame_t *frame, const char *prefix);
 
+/*!
+ * @brief write and remove all frames of an error stack
+ *
+ * @param[in,out] err error stack holding at least two frames
+ * @param[in]     fd  file descriptor to write to
+ */
 void error_print_trace(error_t *err, int fd);
 
+/*!
+ * @brief error stack of the calling thread
+ *
+ * @return error stack, released when the thread exits
+ */
+error_t *error_stack(void);
+
 /* global error handling */
-extern error_t *__lucid_error;
+#define __lucid_error (error_stack())
 
 #define error_set(E, ...) do { \
 	error_push(__lucid_error, __FILE__, __LINE__, __FUNCTION__, E, __VA_ARGS__); \
@@ -83,7 +190,7 @@ extern error_t *__lucid_error;
 
 #define error_dump(fd) error_print_trace(__lucid_error, fd)
 
-#define error_clear() error_free(__lucid_error)
+#define error_clear() error_reset(__lucid_error)
 
 #endif
 
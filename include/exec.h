@@ -23,6 +23,11 @@
  * These functions combine one or more of the above system calls in one
  * function, thus allowing fast and simple process creation in applications.
  *
+ * The command line is parsed before fork(2), so the functions may be called
+ * from several threads. exec_fork_background() runs the command in a
+ * grandchild that is reparented to init instead of ignoring SIGCHLD for the
+ * whole process.
+ *
  * @{
  */
 
@@ -43,6 +43,9 @@
  * according to a given list to a string consisting of zero or more flag list
  * keys seperated by a delimiter.
  *
+ * Flag lists are constant data; lookups and conversions are safe from any
+ * thread.
+ *
  * @{
  */
 
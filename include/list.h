@@ -30,6 +30,9 @@
  * The list family of functions and macros provide routines to create a list,
  * add, move or remove elements and iterate over the list.
  *
+ * Lists are not locked internally. A list shared between threads needs a lock
+ * held by the caller around every operation.
+ *
  * @{
  */
 
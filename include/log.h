@@ -27,6 +27,72 @@
  * argument is a pointer to a log_options_t structure used for the multiplexer
  * configuration.
  *
+ * With the LOGO_ASYNC option, messages are formatted in the calling thread and
+ * appended to a ring buffer owned by that thread; no lock is taken and no
+ * system call is made. A background thread collects the records of all
+ * threads, renders the line prefixes and writes them in large batches to the
+ * destinations. Messages of one thread keep their order; messages of
+ * different threads may be written grouped by thread. If a ring is full,
+ * log_overflow selects whether the message is dropped silently (LOGQ_DROP),
+ * dropped and counted in a later warning (LOGQ_COUNT), or whether the caller
+ * waits for the writer (LOGQ_BLOCK).
+ * log_close() writes all pending messages before it returns, and so do
+ * exit(3) and the *_and_die() functions. A child created by fork(2) has no
+ * writer thread and logs synchronously; records of the parent still queued
+ * at the time of the fork are written by the parent only.
+ *
+ * The LOGD_BINARY destination defers formatting to an offline decoder. The
+ * calling thread appends a record with the format id, a timestamp and the raw
+ * argument values, strings copied, to its ring without taking a lock; the
+ * writer thread, which is started for LOGD_BINARY even without LOGO_ASYNC,
+ * writes each format once before its first message. Formatting is deferred
+ * only if LOGD_BINARY is the only destination, otherwise the text formatted
+ * for the other destinations is recorded. Formats with conversions that
+ * cannot be deferred, e.g. extension conversions, are recorded as text too. A
+ * forked child does not write to the binary log. log_decode() and the
+ * lucid-logdec tool render a binary log as text.
+ *
+ * The LOGD_MMAP destination keeps the most recent messages in a ring file
+ * mapped into memory. The calling thread copies each message into the
+ * mapping, so logging costs a memcpy and no system call, and what was logged
+ * survives a crash of the process since the pages belong to the file. The
+ * oldest messages are overwritten once the ring is full. A ring file is
+ * continued by the next log_init() with the same size, so the messages before
+ * a crash are kept across a restart. log_decode() and lucid-logdec dump a
+ * ring file in order.
+ *
+ * Messages below the level bound in log_mask are discarded before they are
+ * formatted. The LOG() macro goes further: each call site gets a static
+ * log_site_t descriptor whose state is computed on the first call. From then
+ * on, a disabled statement costs a single branch and does not even evaluate
+ * its arguments. Sites can be switched on or off at runtime by source file and
+ * line with log_site_enable(), independently of log_mask:
+ *
+ * @code
+ * LOG(LOGP_DEBUG, "request %d from %s", id, peer);
+ * log_site_enable("server.c", 0, 1);
+ * @endcode
+ *
+ * LOG_RATELIMIT() and LOG_SAMPLE() bound the output of a single site during
+ * message storms. The first lets rate messages per second pass, with bursts
+ * of up to burst messages; the second lets one in every messages pass. The
+ * decision is made with atomic operations on the site descriptor before
+ * anything is formatted. Suppressed messages are counted and reported at most
+ * once per second, with the next message that passes, in a line of the form
+ * "file:line: N messages suppressed"; counts still pending are reported by
+ * log_close(). LOG_PRATELIMIT() and LOG_PSAMPLE() append the error of errno
+ * like log_perror(), so a storm of failing system calls can be bounded too:
+ *
+ * @code
+ * if (accept(fd, NULL, NULL) == -1)
+ *         LOG_PRATELIMIT(LOGP_WARN, 1, 5, "accept");
+ * @endcode
+ *
+ * All functions may be called from any thread. A log_init() that replaces the
+ * connection while other threads log is safe; their messages go to either the
+ * old or the new connection. log_close() releases the connections, so other
+ * threads must have stopped logging when it is called.
+ *
  * @see log_options_t
  * @see syslog(3)
  *
@@ -36,12 +102,15 @@
 #ifndef _LUCID_LOG_H
 #define _LUCID_LOG_H
 
+#include <errno.h>
 #include <stdarg.h>
 
 /* destinations */
 #define LOGD_SYSLOG 0x01 /*!< Log to syslog */
 #define LOGD_FILE   0x02 /*!< Log to a file */
 #define LOGD_STDERR 0x04 /*!< Log to STDERR */
+#define LOGD_BINARY 0x08 /*!< Log binary records to a file */
+#define LOGD_MMAP   0x10 /*!< Log to a memory mapped ring file */
 
 /* priorities */
 #define LOGP_ALERT 0 /*!< action must be taken immediately */
@@ -57,10 +126,84 @@
 #define LOGO_TIME  0x02 /*!< log the time with each message */
 #define LOGO_PRIO  0x04 /*!< log the priority with each message */
 #define LOGO_IDENT 0x08 /*!< log the ident string with each message */
+#define LOGO_ASYNC 0x10 /*!< write messages from a background thread */
+
+/* overflow policies for LOGO_ASYNC */
+#define LOGQ_DROP  0 /*!< drop messages while the ring is full */
+#define LOGQ_COUNT 1 /*!< drop messages and report how many were lost */
+#define LOGQ_BLOCK 2 /*!< wait until the writer made room */
 
 /*! @brief simple trace helper */
 #define LOG_TRACEME log_traceme(__FILE__, __FUNCTION__, __LINE__);
 
+/*! @brief state of a call site that has not been reached yet */
+#define LOG_SITE_UNKNOWN -1
+
+/*!
+ * @brief static description of a log call site
+ *
+ * The state member is LOG_SITE_UNKNOWN until the site is first reached, and
+ * then 1 or 0 depending on whether the site is enabled.
+ */
+typedef struct log_site {
+	const char *file;         /*!< source file */
+	int line;                 /*!< source line */
+	const char *fmt;          /*!< format string */
+	int prio;                 /*!< priority */
+	int state;                /*!< 1 if enabled, 0 if not, or LOG_SITE_UNKNOWN */
+	int force;                /*!< 1 or 0 if switched on or off, -1 otherwise */
+	struct log_site *next;    /*!< next registered site */
+	struct printf_prog *prog; /*!< compiled format */
+	int rate;                 /*!< messages per second, or 0 for no limit */
+	int burst;                /*!< messages passed at once within rate */
+	int every;                /*!< pass one in every messages, or 0 for all */
+	unsigned long long tat;   /*!< time the rate limit is met again, in ns */
+	unsigned long long report; /*!< earliest time of the next summary, in ns */
+	unsigned long hits;       /*!< messages seen, for sampling */
+	unsigned long suppressed; /*!< messages suppressed and not yet reported */
+	int perror;               /*!< 1 to append the error of the saved errno */
+} log_site_t;
+
+/* errno is saved before the arguments are evaluated */
+#define __LOG_SITE(prio, perror, rate, burst, every, fmt, ...) do { \
+	static log_site_t _log_site = { \
+		__FILE__, __LINE__, fmt, prio, LOG_SITE_UNKNOWN, -1, 0, 0, \
+		rate, burst, every, 0, 0, 0, 0, perror, \
+	}; \
+	if (__builtin_expect(__atomic_load_n(&_log_site.state, __ATOMIC_RELAXED), 0)) { \
+		int _log_errno = errno; \
+		log_site(&_log_site, _log_errno, ##__VA_ARGS__); \
+	} \
+} while (0)
+
+/*! @brief send message from a static call site with the given limits */
+#define LOG_SITE(prio, rate, burst, every, fmt, ...) \
+	__LOG_SITE(prio, 0, rate, burst, every, fmt, ##__VA_ARGS__)
+
+/*! @brief like LOG_SITE(), appending the error of errno like log_perror() */
+#define LOG_PSITE(prio, rate, burst, every, fmt, ...) \
+	__LOG_SITE(prio, 1, rate, burst, every, fmt, ##__VA_ARGS__)
+
+/*! @brief send message from a static call site; disabled sites cost one branch */
+#define LOG(prio, fmt, ...) \
+	LOG_SITE(prio, 0, 0, 0, fmt, ##__VA_ARGS__)
+
+/*! @brief send at most rate messages per second, in bursts of up to burst */
+#define LOG_RATELIMIT(prio, rate, burst, fmt, ...) \
+	LOG_SITE(prio, rate, burst, 0, fmt, ##__VA_ARGS__)
+
+/*! @brief send one in every messages */
+#define LOG_SAMPLE(prio, every, fmt, ...) \
+	LOG_SITE(prio, 0, 0, every, fmt, ##__VA_ARGS__)
+
+/*! @brief LOG_RATELIMIT() appending the error of errno */
+#define LOG_PRATELIMIT(prio, rate, burst, fmt, ...) \
+	LOG_PSITE(prio, rate, burst, 0, fmt, ##__VA_ARGS__)
+
+/*! @brief LOG_SAMPLE() appending the error of errno */
+#define LOG_PSAMPLE(prio, every, fmt, ...) \
+	LOG_PSITE(prio, 0, 0, every, fmt, ##__VA_ARGS__)
+
 /*!
  * @brief multiplexer configuration data
  *
@@ -72,6 +215,14 @@
  * - The log_opts argument specifies flags which control the operation of the
  *   multiplexer.
  * - The log_mask argument is the lower level bound of messages being multiplexed.
+ * - The log_ring argument is the size in bytes of the ring buffer of each
+ *   thread for LOGO_ASYNC; 0 selects a default of 64 KiB.
+ * - The log_overflow argument is one of the LOGQ_* policies for LOGO_ASYNC.
+ * - The log_binfd argument is the file descriptor for LOGD_BINARY.
+ * - The log_mapfd argument is the file descriptor of the ring file for
+ *   LOGD_MMAP, which must be open for reading and writing.
+ * - The log_mapsize argument is the size in bytes of the ring in the ring
+ *   file, rounded up to a power of two; 0 selects a default of 1 MiB.
  */
 typedef struct {
 	const char *log_ident; /*!< program identifier */
@@ -80,6 +231,11 @@ typedef struct {
 	int log_facility;      /*!< program facility */
 	int log_opts;          /*!< control flags */
 	int log_mask;          /*!< lower log level bound */
+	int log_ring;          /*!< per-thread ring size for LOGO_ASYNC */
+	int log_overflow;      /*!< overflow policy for LOGO_ASYNC */
+	int log_binfd;         /*!< file descriptor for LOGD_BINARY target */
+	int log_mapfd;         /*!< file descriptor for LOGD_MMAP target */
+	int log_mapsize;       /*!< ring size for LOGD_MMAP target */
 } log_options_t;
 
 /*!
@@ -319,11 +475,61 @@ void log_palert_and_die(const char *fmt, ...);
  */
 void log_perror_and_die(const char *fmt, ...);
 
+/*!
+ * @brief write all pending messages
+ *
+ * Returns once every message logged before the call, by any thread, has been
+ * written to the destinations. Does nothing without a writer thread.
+ */
+void log_flush(void);
+
 /*!
  * @brief close connection to logging system
  */
 void log_close(void);
 
+/*!
+ * @brief send message from a call site
+ *
+ * @param[in,out] site   call site descriptor
+ * @param[in]     errnum errno saved at the call site, appended if
+ *                       site->perror is set
+ * @param[in]     ...    variable number of arguments according to site->fmt
+ *
+ * @note This function is called by the LOG() macro, it should not be used
+ *       directly.
+ */
+void log_site(log_site_t *site, int errnum, ...);
+
+/*!
+ * @brief switch call sites on or off
+ *
+ * The setting applies to sites already reached and is remembered for sites
+ * reached later.
+ *
+ * @param[in] file source file, matched against the end of the file name of
+ *                 a site, or NULL for all files
+ * @param[in] line source line, or 0 for all lines
+ * @param[in] on   1 to enable, 0 to disable, -1 to follow log_mask again
+ *
+ * @return 0 on success, -1 on error with errno set
+ */
+int log_site_enable(const char *file, int line, int on);
+
+/*!
+ * @brief render a binary log or a ring file as text
+ *
+ * Lines are prefixed according to the options the log was written with. The
+ * messages of a ring file are written from the oldest to the newest; messages
+ * that were being written when the process died are skipped.
+ *
+ * @param[in] in  file descriptor to read the binary log or ring file from
+ * @param[in] out file descriptor to write text to
+ *
+ * @return 0 on success, -1 on error with errno set, EINVAL for malformed input
+ */
+int log_decode(int in, int out);
+
 #endif
 
 /*! @} log */
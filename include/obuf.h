@@ -0,0 +1,175 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+/*!
+ * @defgroup obuf Buffered output streams
+ *
+ * An output buffer collects small writes to a file descriptor and passes
+ * them to the kernel in as few system calls as possible.
+ *
+ * The obuf_init() function binds a buffer to a file descriptor. The storage
+ * may be supplied by the caller, e.g. on the stack, or is allocated if buf is
+ * NULL. The obuf_catb(), obuf_cats() and obuf_catf() functions append raw
+ * bytes, a string or a formatted conversion, analogous to the stralloc
+ * functions. Formatted output is rendered directly into the free space of the
+ * buffer and only spills to the heap if it does not fit. Producers may also
+ * write into the free space at buf + len themselves and account for it with
+ * obuf_commit().
+ *
+ * Data larger than the buffer is not copied: the buffered bytes and the new
+ * data are written together with a single writev(2). The buffer is also
+ * flushed when it holds at least thresh bytes, and after every append
+ * containing a newline if OBUF_LINE is set. The obuf_flush() function writes
+ * out whatever is buffered, obuf_free() flushes and releases allocated
+ * storage.
+ *
+ * Write errors are sticky: the first one is kept in the error member, and
+ * all later operations fail with it until obuf_init() is called again.
+ *
+ * An output buffer has no lock and belongs to one thread at a time. Separate
+ * buffers may be used concurrently, even on the same file descriptor; their
+ * output is then interleaved at the granularity of flushes.
+ *
+ * @{
+ */
+
+#ifndef _LUCID_OBUF_H
+#define _LUCID_OBUF_H
+
+#include <stdarg.h>
+
+#ifdef _LUCID_BUILD_
+#include "printf.h"
+#else
+#include <lucid/printf.h>
+#endif
+
+/*! @brief default buffer size */
+#define OBUF_SIZE 4096
+
+/*! @brief flush after every append containing a newline */
+#define OBUF_LINE  0x01
+
+/*! @brief storage was allocated by obuf_init() */
+#define OBUF_ALLOC 0x02
+
+/*! @brief output buffer */
+typedef struct {
+	int fd;     /*!< destination file descriptor */
+	char *buf;  /*!< buffer storage */
+	int size;   /*!< size of buf */
+	int len;    /*!< number of buffered bytes */
+	int thresh; /*!< flush once this many bytes are buffered */
+	int flags;  /*!< OBUF_* flags */
+	int error;  /*!< errno of the first failed write, 0 if none */
+} obuf_t;
+
+/*!
+ * @brief initialize output buffer
+ *
+ * @param[out] ob    output buffer
+ * @param[in]  fd    destination file descriptor
+ * @param[in]  buf   buffer storage, NULL to allocate
+ * @param[in]  size  size of buf, OBUF_SIZE if 0 and buf is NULL
+ * @param[in]  flags OBUF_LINE or 0
+ *
+ * @return 0 on success, -1 on error with errno set (EINVAL if buf is given
+ *         without a size)
+ */
+int obuf_init(obuf_t *ob, int fd, char *buf, int size, int flags);
+
+/*!
+ * @brief write buffered data
+ *
+ * @param[in] ob output buffer
+ *
+ * @return 0 on success, -1 on error with errno set
+ */
+int obuf_flush(obuf_t *ob);
+
+/*!
+ * @brief flush and release an output buffer
+ *
+ * @param[in] ob output buffer
+ *
+ * @return 0 on success, -1 if the final flush failed
+ */
+int obuf_free(obuf_t *ob);
+
+/*!
+ * @brief account for bytes written directly into the free space
+ *
+ * @param[in] ob  output buffer
+ * @param[in] len number of bytes written at ob->buf + ob->len
+ *
+ * @return 0 on success, -1 if an automatic flush failed
+ */
+int obuf_commit(obuf_t *ob, int len);
+
+/*!
+ * @brief append bytes
+ *
+ * @param[in] ob  output buffer
+ * @param[in] src source bytes
+ * @param[in] len number of bytes
+ *
+ * @return len on success, -1 on error with errno set
+ */
+int obuf_catb(obuf_t *ob, const void *src, int len);
+
+/*!
+ * @brief append string
+ *
+ * @param[in] ob  output buffer
+ * @param[in] src source string
+ *
+ * @return number of bytes appended, -1 on error with errno set
+ */
+int obuf_cats(obuf_t *ob, const char *src);
+
+/*!
+ * @brief append formatted conversion using va_list
+ *
+ * @param[in] ob  output buffer
+ * @param[in] fmt format string
+ * @param[in] ap  variable number of arguments
+ *
+ * @return number of bytes appended, -1 on error with errno set
+ */
+int obuf_vcatf(obuf_t *ob, const char *fmt, va_list ap);
+
+/*!
+ * @brief append formatted conversion
+ *
+ * @see obuf_vcatf()
+ */
+int obuf_catf(obuf_t *ob, const char *fmt, /*args*/ ...);
+
+/*!
+ * @brief append compiled format using va_list
+ *
+ * @param[in] ob   output buffer
+ * @param[in] prog compiled format
+ * @param[in] ap   variable number of arguments
+ *
+ * @return number of bytes appended, -1 on error with errno set
+ */
+int obuf_vcatp(obuf_t *ob, const printf_prog_t *prog, va_list ap);
+
+#endif
+
+/*! @} obuf */
@@ -32,6 +32,11 @@
  * Consequently, the value of ap is undefined after the call. The application
  * should call va_end(ap) itself afterwards.
  *
+ * Formatting is reentrant. printf_register() publishes a conversion
+ * atomically; conversions run in the calling thread and must be thread-safe
+ * themselves. A compiled format is immutable and may be shared, and
+ * printf_compile_once() may be called by racing threads on the same cache.
+ *
  * @section format Format of the format string
  *
  * The format string is composed of zero or more directives: ordinary characters
@@ -102,6 +107,9 @@
  * - ll<br>
  *   (ell-ell). A following integer conversion corresponds to a long long int or
  *   unsigned long long int argument.
+ * - L<br>
+ *   A following e, f, or g conversion corresponds to a long double argument.
+ *   It is converted to double before formatting.
  *
  * Note however that internally, hh, h, and l are handled as long int, ll as
  * long long int, respectively.
@@ -124,6 +132,23 @@
  *   digits that must appear; if the converted value requires fewer digits, it
  *   is padded on the left with zeros. The default precision is 1. When 0 is
  *   printed with an explicit precision 0, the output is empty.
+ * - e,E<br>
+ *   The double argument is rounded and converted in the style [-]d.ddde+dd
+ *   where there is one digit before the decimal-point character and the number
+ *   of digits after it is equal to the precision; if the precision is missing,
+ *   it is taken as 6. The exponent always contains at least two digits.
+ * - f,F<br>
+ *   The double argument is rounded and converted to decimal notation in the
+ *   style [-]ddd.ddd, where the number of digits after the decimal-point
+ *   character is equal to the precision (default 6). Infinity and NaN are
+ *   written as inf and nan (INF and NAN for F).
+ * - g,G<br>
+ *   The double argument is converted in style f or e. The precision specifies
+ *   the number of significant digits (default 6, 0 is treated as 1). Style e
+ *   is used if the exponent is less than -4 or greater than or equal to the
+ *   precision. Trailing zeros are removed from the fractional part unless the
+ *   # flag is given.
+ *
  * - c<br>
  *   The int argument is converted to an unsigned char, and the resulting
  *   character is written.
@@ -144,6 +169,49 @@
  *   A `%' is written. No argument is converted. The complete conversion
  *   specification is `%%'.
  *
+ * Floating-point digits are generated exactly and rounded half to even, so
+ * the output matches the C library for all precisions.
+ *
+ * @section extensions Extension conversions
+ *
+ * The following conversions are not part of C99. They stream their argument
+ * straight into the output, without building a temporary string first:
+ *
+ * - S<br>
+ *   The stralloc_t * argument is written like a string; a precision limits
+ *   the number of bytes written.
+ * - B<br>
+ *   A size_t length followed by a const void * pointer; the data is written
+ *   base64 encoded.
+ * - H<br>
+ *   A size_t length followed by a const void * pointer; the data is written
+ *   as lower-case hexadecimal digits.
+ * - M<br>
+ *   A const flist32_t * list, a const flag32_t * flag set, an int clear
+ *   modifier, and a const char * delimiter, written like flist32_encode()
+ *   does. With the l modifier the list and flag set are flist64_t and
+ *   flag64_t.
+ *
+ * More conversions can be registered with printf_register(). A handler
+ * receives the parsed specification and the argument list and writes with
+ * printf_write(); the field width is applied by the caller. Handlers should be
+ * registered before formats using them are compiled.
+ *
+ * @section compile Compiled formats
+ *
+ * Formats used over and over again can be compiled with printf_compile() into
+ * a list of literal runs and parsed conversion specifications. The
+ * printf_exec_*() functions render a compiled format without parsing it
+ * again. printf_compile_once() caches the compiled format in a pointer, so a
+ * call site compiles its format only once:
+ *
+ * @code
+ * static printf_prog_t *prog;
+ * printf_exec_dprintf(printf_compile_once(&prog, "%s: %d\n"), fd, s, i);
+ * @endcode
+ *
+ * Conversions not listed above are copied to the output unchanged.
+ *
  * @section conform Note on conformance
  *
  * This printf implementation is not fully C99 or SUS compliant, though most
@@ -160,6 +228,12 @@
 
 #include <stdarg.h>
 
+#ifdef _LUCID_BUILD_
+#include "stralloc.h"
+#else
+#include <lucid/stralloc.h>
+#endif
+
 /*!
  * @brief write conversion to string using va_list
  *
@@ -194,7 +268,11 @@ int _lucid_snprintf (char *str, int size, const char *fmt, /*args*/ ...);
  * @param[in]  fmt  format string
  * @param[in]  ap   variable number of arguments
  *
- * @return number of bytes (that would have been) written
+ * @return number of bytes (that would have been) written, -1 on error
+ *
+ * @note The conversion is done in a single pass into a small stack buffer
+ *       that is moved to the heap only if it overflows. The returned string
+ *       is allocated with the exact size, even if it is empty.
  *
  * @see malloc(3)
  * @see free(3)
@@ -257,6 +335,163 @@ int _lucid_vprintf(const char *fmt, va_list ap);
  */
 int _lucid_printf(const char *fmt, /*args*/ ...);
 
+/*! @brief compiled format string */
+typedef struct printf_prog printf_prog_t;
+
+/*! @brief output handle passed to extension conversions */
+typedef struct printf_out printf_out_t;
+
+/*! @brief conversion specification passed to extension conversions */
+typedef struct {
+	char conv; /*!< conversion character */
+	int  alt;  /*!< the # flag was given */
+	int  len;  /*!< length modifier: -2 (hh) to 2 (ll), 0 if none */
+	int  prec; /*!< precision, -1 if none was given */
+} printf_spec_t;
+
+/*! @brief extension conversion handler */
+typedef void printf_conv_t(printf_out_t *out, const printf_spec_t *spec,
+		va_list *ap);
+
+/*!
+ * @brief register an extension conversion
+ *
+ * @param[in] c    conversion character, a letter not used by C99
+ * @param[in] conv handler, NULL to remove the conversion
+ *
+ * @return 0 on success, -1 with errno set to EINVAL for reserved characters
+ */
+int printf_register(char c, printf_conv_t *conv);
+
+/*!
+ * @brief write bytes from an extension conversion
+ *
+ * @param[in] out output handle
+ * @param[in] buf bytes to write
+ * @param[in] len number of bytes
+ */
+void printf_write(printf_out_t *out, const char *buf, int len);
+
+/*!
+ * @brief compile a format string
+ *
+ * @param[in] fmt format string
+ *
+ * @return compiled format (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using printf_free()
+ */
+printf_prog_t *printf_compile(const char *fmt);
+
+/*!
+ * @brief compile a format string once
+ *
+ * @param[in,out] cache pointer caching the compiled format, initially NULL
+ * @param[in]     fmt   format string
+ *
+ * @return compiled format, NULL on error with errno set
+ *
+ * @note The cache may be shared between threads. The compiled format lives
+ *       as long as the cache pointer; it is usually never freed.
+ */
+const printf_prog_t *printf_compile_once(printf_prog_t **cache, const char *fmt);
+
+/*!
+ * @brief free a compiled format
+ *
+ * @param[in] prog compiled format
+ */
+void printf_free(printf_prog_t *prog);
+
+/*!
+ * @brief render compiled format to string using va_list
+ *
+ * @param[in]  prog compiled format
+ * @param[out] str  buffer to store conversion
+ * @param[in]  size size of str
+ * @param[in]  ap   variable number of arguments
+ *
+ * @return number of bytes (that would have been) written, -1 on error
+ *
+ * @see _lucid_vsnprintf()
+ */
+int printf_exec_vsnprintf(const printf_prog_t *prog, char *str, int size,
+		va_list ap);
+
+/*!
+ * @brief render compiled format to string using variable number of arguments
+ *
+ * @see printf_exec_vsnprintf()
+ */
+int printf_exec_snprintf(const printf_prog_t *prog, char *str, int size,
+		/*args*/ ...);
+
+/*!
+ * @brief render compiled format to allocated string using va_list
+ *
+ * @param[in]  prog compiled format
+ * @param[out] ptr  pointer to string to store conversion
+ * @param[in]  ap   variable number of arguments
+ *
+ * @return number of bytes written, -1 on error
+ *
+ * @see _lucid_vasprintf()
+ */
+int printf_exec_vasprintf(const printf_prog_t *prog, char **ptr, va_list ap);
+
+/*!
+ * @brief render compiled format to allocated string using variable number of
+ *        arguments
+ *
+ * @see printf_exec_vasprintf()
+ */
+int printf_exec_asprintf(const printf_prog_t *prog, char **ptr, /*args*/ ...);
+
+/*!
+ * @brief render compiled format to file descriptor using va_list
+ *
+ * @param[in] prog compiled format
+ * @param[in] fd   open file descriptor
+ * @param[in] ap   variable number of arguments
+ *
+ * @return number of bytes written, -1 on error
+ *
+ * @see _lucid_vdprintf()
+ */
+int printf_exec_vdprintf(const printf_prog_t *prog, int fd, va_list ap);
+
+/*!
+ * @brief render compiled format to file descriptor using variable number of
+ *        arguments
+ *
+ * @see printf_exec_vdprintf()
+ */
+int printf_exec_dprintf(const printf_prog_t *prog, int fd, /*args*/ ...);
+
+/*!
+ * @brief append compiled format to dynamic string using va_list
+ *
+ * @param[in] prog compiled format
+ * @param[in] sa   dynamic string to append to
+ * @param[in] ap   variable number of arguments
+ *
+ * @return number of bytes appended, -1 on error
+ *
+ * @see stralloc_catf()
+ */
+int printf_exec_vstralloc(const printf_prog_t *prog, stralloc_t *sa,
+		va_list ap);
+
+/*!
+ * @brief append compiled format to dynamic string using variable number of
+ *        arguments
+ *
+ * @see printf_exec_vstralloc()
+ */
+int printf_exec_stralloc(const printf_prog_t *prog, stralloc_t *sa,
+		/*args*/ ...);
+
 #define vsnprintf _lucid_vsnprintf
 #define snprintf  _lucid_snprintf
 #define vasprintf _lucid_vasprintf
@@ -17,6 +17,12 @@
 /*!
  * @defgroup rpc Remote Procedure Call
  *
+ * The library that methods are resolved in is set with rpc_init() for the
+ * whole process, before threads start to make calls. Whether calls are
+ * dispatched to a remote end is a setting of each thread: rpc_remote_enable()
+ * and rpc_remote_disable() only affect the calling thread, so worker threads
+ * may talk to different servers or call methods locally at the same time.
+ *
  * @{
  */
 
@@ -26,18 +32,18 @@
 #include <stdbool.h>
 #include <netinet/in.h>
 
-#ifdef _LUCID_BUILD
+#ifdef _LUCID_BUILD_
 #include "rtti.h"
 #else
 #include <lucid/rtti.h>
 #endif
 
+/* per-thread rpc state */
 struct rpc_env {
-	void *handle;
 	struct sockaddr_in *remote;
 };
 
-extern struct rpc_env __rpc_env;
+extern __thread struct rpc_env __rpc_env;
 
 #define RPC_TYPE_START(func) \
 	struct __rpc_ ## func ## _signature { func ## _signature; }; \
@@ -71,6 +77,10 @@ extern struct rpc_env __rpc_env;
 	} \
 	rtype __rpc_ ## func ## _controller(__VA_ARGS__) func ## _signature;
 
+void rpc_init(const char *lib);
+void rpc_remote_enable(struct sockaddr_in *addr);
+void rpc_remote_disable(void);
+
 char *rpc_receive(const char *name, const char *data);
 void rpc_send(const char *name, void *data, void *ret);
 
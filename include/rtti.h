@@ -174,6 +174,26 @@ extern rtti_decode_t rtti_flist32_decode;
 extern rtti_encode_t rtti_flist64_encode;
 extern rtti_decode_t rtti_flist64_decode;
 
+/* floating-point type */
+#define RTTI_FLOAT_TYPE(type) { \
+	sizeof(type), \
+	#type, \
+	RTTI_TYPE_PRIMITIVE, \
+	&ffi_type_ ## type, \
+	rtti_region_init, \
+	rtti_region_copy, \
+	rtti_region_equal, \
+	rtti_float_encode, \
+	rtti_float_decode, \
+	{ { NULL }, { NULL }, { NULL } } \
+}
+
+extern rtti_encode_t rtti_float_encode;
+extern rtti_decode_t rtti_float_decode;
+
+extern const rtti_t rtti_float_type;
+extern const rtti_t rtti_double_type;
+
 /* integer type */
 #define RTTI_INT_TYPE(type, sign) { \
 	sizeof(type ## _t), \
@@ -249,6 +269,8 @@ extern rtti_decode_t rtti_pointer_decode;
 
 extern const rtti_t rtti_bool_ptype;
 extern const rtti_t rtti_data_ptype;
+extern const rtti_t rtti_float_ptype;
+extern const rtti_t rtti_double_ptype;
 extern const rtti_t rtti_int8_ptype;
 extern const rtti_t rtti_uint8_ptype;
 extern const rtti_t rtti_int16_ptype;
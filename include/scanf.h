@@ -96,6 +96,9 @@
  * - ll<br>
  *   (ell-ell). A following integer conversion corresponds to a long long int or
  *   unsigned long long int argument.
+ * - l, L<br>
+ *   A following e, f, or g conversion corresponds to a pointer to double or
+ *   long double, respectively.
  *
  * The following conversion specifiers are available:
  *
@@ -119,6 +122,11 @@
  * - x,X<br>
  *   Matches an unsigned hexadecimal integer; the next pointer must be a
  *   pointer to unsigned int.
+ * - e,E,f,F,g,G<br>
+ *   Matches an optionally signed floating-point number, infinity or NaN; the
+ *   next pointer must be a pointer to float. Values are rounded correctly:
+ *   mantissas of up to 19 digits are converted with a single 128 bit
+ *   multiplication, longer ones fall back to exact big integer arithmetic.
  * - s<br>
  *   Matches a sequence of non-white-space characters; the next pointer must be
  *   a pointer to character array that is long enough to hold the input
@@ -140,6 +148,29 @@
  *   to int. This is not a conversion, although it can be suppressed with the *
  *   assignment-suppression character.
  *
+ * @section bulk Scanning many lines
+ *
+ * Line oriented files, e.g. from /proc or accounting logs, can be scanned in
+ * bulk. A format is compiled once with scanf_compile() and then applied to
+ * every line of a buffer with scanf_exec_buf(), or of a file descriptor with
+ * scanf_exec_fd(). Regular files are mapped into memory and scanned in place,
+ * other descriptors are read in large blocks.
+ *
+ * Instead of pointer arguments, the results of the n-th assigning conversion
+ * are stored in the n-th array of a scanf_cols_t, one element per matching
+ * line. The element type follows the conversion and length modifier as for
+ * scanf(), and scanf_colsize() returns its size. String conversions require a
+ * field width w and store null terminated strings in cells of w + 1 bytes; %c
+ * stores cells of exactly w bytes. For example, the format "%15s %lu %lf"
+ * fills an array of char[16], of unsigned long int and of double.
+ *
+ * Each line is scanned like a separate sscanf() call and trailing input is
+ * ignored. Lines for which a directive fails are skipped, and their zero based
+ * index is recorded in the bad array of scanf_cols_t. Scanning stops once the
+ * columns are full.
+ *
+ * Scanning keeps no state between calls and is thread-safe.
+ *
  * @{
  */
 
@@ -147,6 +178,7 @@
 #define _LUCID_SCANF_H
 
 #include <stdarg.h>
+#include <sys/types.h>
 
 /*!
  * @brief read conversion from string using va_list
@@ -173,6 +205,87 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list ap);
  */
 int _lucid_sscanf(const char *str, const char *fmt, /*args*/ ...);
 
+/*! @brief compiled format string */
+typedef struct scanf_prog scanf_prog_t;
+
+/*! @brief column storage for bulk scanning */
+typedef struct {
+	void **cols;    /*!< one array per assigning conversion */
+	size_t size;    /*!< capacity of each array, in rows */
+	size_t rows;    /*!< number of rows stored */
+	size_t lines;   /*!< number of lines scanned */
+	size_t *bad;    /*!< indices of lines that did not match, may be NULL */
+	size_t badsize; /*!< capacity of bad */
+	size_t nbad;    /*!< number of lines that did not match */
+} scanf_cols_t;
+
+/*!
+ * @brief compile a format string for bulk scanning
+ *
+ * @param[in] fmt format string
+ *
+ * @return compiled format (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using scanf_free()
+ */
+scanf_prog_t *scanf_compile(const char *fmt);
+
+/*!
+ * @brief number of columns filled by a compiled format
+ *
+ * @param[in] prog compiled format
+ *
+ * @return number of assigning conversions
+ */
+int scanf_ncols(const scanf_prog_t *prog);
+
+/*!
+ * @brief element size of a column
+ *
+ * @param[in] prog compiled format
+ * @param[in] col  column index
+ *
+ * @return size in bytes, -1 with errno set to EINVAL if col does not exist
+ */
+int scanf_colsize(const scanf_prog_t *prog, int col);
+
+/*!
+ * @brief free a compiled format
+ *
+ * @param[in] prog compiled format
+ */
+void scanf_free(scanf_prog_t *prog);
+
+/*!
+ * @brief scan every line of a buffer
+ *
+ * @param[in]     prog compiled format
+ * @param[in]     buf  input, need not be null terminated
+ * @param[in]     len  length of buf
+ * @param[in,out] cols column storage, rows, lines and nbad are advanced
+ *
+ * @return number of bytes consumed, less than len if the columns are full
+ */
+size_t scanf_exec_buf(const scanf_prog_t *prog, const char *buf, size_t len,
+		scanf_cols_t *cols);
+
+/*!
+ * @brief scan every line of a file descriptor
+ *
+ * @param[in]     prog compiled format
+ * @param[in]     fd   file descriptor to read from
+ * @param[in,out] cols column storage, rows, lines and nbad are advanced
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @note Scanning starts at the current file offset, whether the file is
+ *       mapped or read. The offset of a seekable file is left after the last
+ *       line scanned, so a full column storage can be emptied and the scan
+ *       continued with another call.
+ */
+int scanf_exec_fd(const scanf_prog_t *prog, int fd, scanf_cols_t *cols);
+
 #define vsscanf _lucid_vsscanf
 #define sscanf  _lucid_sscanf
 
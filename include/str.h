@@ -61,12 +61,29 @@
  * The str_toumax() function converts the string pointed to by str to an
  * unsigned long long int val using base as conversion base.
  *
+ * The str_fmt_u32(), str_fmt_u64() and str_fmt_i64() functions write the
+ * decimal representation of an integer to dst, two digits at a time from a
+ * digit pair table. The str_fmt_x64() function writes the hexadecimal
+ * representation. None of them write a terminating null byte; dst must have
+ * room for at least STR_FMT_MAX bytes.
+ *
+ * The str_fmt_double() and str_fmt_float() functions write the shortest
+ * decimal representation that converts back to the same value, in plain
+ * notation for decimal exponents from -4 to 15 and scientific notation
+ * otherwise. The str_todouble() and str_tofloat() functions convert decimal
+ * strings to the nearest floating-point value. Neither direction allocates
+ * memory.
+ *
+ * The functions are reentrant. Allocated results belong to the caller.
+ *
  * @{
  */
 
 #ifndef _LUCID_STR_H
 #define _LUCID_STR_H
 
+#include <stdint.h>
+
 /*! @brief class for alpha-numerical characters */
 #define CC_ALNUM  (1 <<  1)
 
@@ -213,6 +230,17 @@ char *str_cpyn(char *dst, const char *src, int n);
  */
 char *str_dup(const char *str);
 
+/*!
+ * @brief duplicate a string
+ *
+ * @param[in] str source string
+ * @param[in] n   copy at most n bytes
+ *
+ * @return A pointer to the duplicated string, or NULL if insufficient memory
+ *         was available.
+ */
+char *str_dupn(const char *str, int n);
+
 /*!
  * @brief scan string for character
  *
@@ -349,6 +377,102 @@ char *str_toupper(char *str);
  */
 int str_toumax(const char *str, unsigned long long int *val, int base, int n);
 
+/*! @brief longest output of the str_fmt functions (sign and 19 digits) */
+#define STR_FMT_MAX 20
+
+/*!
+ * @brief convert 32 bit unsigned integer to decimal string
+ *
+ * @param[out] dst destination buffer of at least STR_FMT_MAX bytes
+ * @param[in]  val integer to convert
+ *
+ * @return number of bytes written, without terminating null byte
+ */
+int str_fmt_u32(char *dst, uint32_t val);
+
+/*!
+ * @brief convert 64 bit unsigned integer to decimal string
+ *
+ * @param[out] dst destination buffer of at least STR_FMT_MAX bytes
+ * @param[in]  val integer to convert
+ *
+ * @return number of bytes written, without terminating null byte
+ */
+int str_fmt_u64(char *dst, uint64_t val);
+
+/*!
+ * @brief convert 64 bit signed integer to decimal string
+ *
+ * @param[out] dst destination buffer of at least STR_FMT_MAX bytes
+ * @param[in]  val integer to convert
+ *
+ * @return number of bytes written, without terminating null byte
+ */
+int str_fmt_i64(char *dst, int64_t val);
+
+/*!
+ * @brief convert 64 bit unsigned integer to hexadecimal string
+ *
+ * @param[out] dst   destination buffer of at least STR_FMT_MAX bytes
+ * @param[in]  val   integer to convert
+ * @param[in]  upper use upper-case digits
+ *
+ * @return number of bytes written, without terminating null byte
+ */
+int str_fmt_x64(char *dst, uint64_t val, int upper);
+
+/*! @brief longest output of str_fmt_double (sign, 17 digits, point and
+ * exponent) */
+#define STR_FMT_DBL_MAX 24
+
+/*!
+ * @brief convert double to shortest round-trip decimal string
+ *
+ * @param[out] dst destination buffer of at least STR_FMT_DBL_MAX bytes
+ * @param[in]  val value to convert
+ *
+ * @return number of bytes written, without terminating null byte
+ */
+int str_fmt_double(char *dst, double val);
+
+/*!
+ * @brief convert float to shortest round-trip decimal string
+ *
+ * @param[out] dst destination buffer of at least STR_FMT_DBL_MAX bytes
+ * @param[in]  val value to convert
+ *
+ * @return number of bytes written, without terminating null byte
+ */
+int str_fmt_float(char *dst, float val);
+
+/*!
+ * @brief convert string to double
+ *
+ * Accepts an optional sign followed by a decimal mantissa with optional
+ * exponent, or inf, infinity and nan in any case. Values out of range set
+ * errno to ERANGE.
+ *
+ * @param[in]  str source string
+ * @param[out] val destination value
+ * @param[in]  n   convert first n bytes
+ *
+ * @return Number of bytes read from str
+ */
+int str_todouble(const char *str, double *val, int n);
+
+/*!
+ * @brief convert string to float
+ *
+ * @param[in]  str source string
+ * @param[out] val destination value
+ * @param[in]  n   convert first n bytes
+ *
+ * @return Number of bytes read from str
+ *
+ * @see str_todouble
+ */
+int str_tofloat(const char *str, float *val, int n);
+
 #endif
 
 /*! @} str */
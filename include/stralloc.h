@@ -52,6 +52,8 @@
  * number of arguments, respectively, and appends these to the string stored in
  * dst.
  *
+ * A string has no lock; only one thread at a time may modify it.
+ *
  * @{
  */
 
@@ -17,6 +17,9 @@
 /*!
  * @defgroup strtok String tokenizer
  *
+ * Unlike strtok(3), the tokenizer keeps no hidden state: a strtok_t belongs to
+ * the thread using it, and separate tokenizers may be used concurrently.
+ *
  * @{
  */
 
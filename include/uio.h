@@ -17,9 +17,20 @@
 #ifndef _LUCID_UIO_H
 #define _LUCID_UIO_H
 
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
 /*!
  * @defgroup uio Universal Input/Output
  *
+ * All functions are safe to call from multiple threads. uio_mkdir() walks the
+ * path with directory descriptors and never changes the working directory.
+ * uio_copy() falls back to mapping the files it copies and then catches the
+ * SIGBUS raised if the source is truncated meanwhile: the handler is installed
+ * once, returns to the copy in the faulting thread, and passes any other
+ * SIGBUS on to the handler that was installed before.
+ *
  * @{
  */
 
@@ -32,13 +43,14 @@ int uio_open(const char *filename, const char *flags, mode_t mode);
  * @param[out] str pointer to a string
  * @param[in]  len bytes to be read
  *
- * @return bytes read on success, -1 on error with errno set
+ * @return bytes read on success, less than len only at end of file, -1 on
+ *         error with errno set
  *
  * @note The caller should free obtained memory for str using free(3)
  *
+ * @see uio_reader_read_exact()
  * @see malloc(3)
  * @see free(3)
- * @see read(2)
  */
 int uio_read(int fd, char **str, int len);
 
@@ -50,11 +62,16 @@ int uio_read(int fd, char **str, int len);
  *
  * @return bytes on success, -1 on error with errno set
  *
- * @note The caller should free obtained memory for line using free(3)
+ * @note The line ends at "\n" or "\r", which is consumed but not stored.
+ *       The caller should free obtained memory for line using free(3)
+ *
+ * @note Each call creates a shared reader, so the file offset of a seekable
+ *       descriptor ends up right after the line. Use uio_reader_read_line()
+ *       to read many lines, or to read lines from pipes and sockets without
+ *       one system call per byte.
  *
  * @see malloc(3)
  * @see free(3)
- * @see read(2)
  */
 int uio_read_eol(int fd, char **line);
 
@@ -64,29 +81,258 @@ int uio_read_eol(int fd, char **line);
  * @param[in]  fd   file descriptor to read from
  * @param[out] str  pointer to a string
  *
- * @return bytes on success, -1 on error with errno set
+ * @return bytes on success, -1 on error with errno set (EFBIG if the input
+ *         does not fit an int)
  *
- * @note The caller should free obtained memory for file using free(3)
+ * @note The rest of a regular file is read into a buffer of its exact size,
+ *       other input into a buffer that doubles as needed. The string is NUL
+ *       terminated. The caller should free obtained memory for str using
+ *       free(3)
  *
+ * @see uio_read_eofn()
+ * @see uio_map_eof()
  * @see malloc(3)
  * @see free(3)
- * @see read(2)
  */
 int uio_read_eof(int fd, char **str);
 
+/*!
+ * @brief read until end of file into caller storage
+ *
+ * @param[in]  fd   file descriptor to read from
+ * @param[out] buf  destination buffer
+ * @param[in]  size size of buf
+ *
+ * @return bytes on success, -1 on error with errno set (EFBIG if the input is
+ *         larger than size)
+ *
+ * @note The buffer is not terminated. Input larger than size has been
+ *       consumed up to size + 1 bytes when EFBIG is returned.
+ */
+int uio_read_eofn(int fd, char *buf, int size);
+
+/*!
+ * @brief map a regular file until end of file
+ *
+ * @param[in]  fd   file descriptor of a regular file
+ * @param[out] view pointer to the read-only contents
+ * @param[out] len  number of bytes at view
+ *
+ * @return 0 on success, -1 on error with errno set (ENODEV if fd is not a
+ *         regular file)
+ *
+ * @note The contents from the current file offset to the end of the file are
+ *       mapped without copying, and the file offset is moved to the end of
+ *       the file. Truncating the file while it is mapped raises SIGBUS on
+ *       access. The view must be released with uio_unmap_eof().
+ *
+ * @see mmap(2)
+ */
+int uio_map_eof(int fd, const char **view, size_t *len);
+
+/*!
+ * @brief release a view obtained from uio_map_eof()
+ *
+ * @param[in] view pointer to the contents
+ * @param[in] len  number of bytes at view
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @see munmap(2)
+ */
+int uio_unmap_eof(const char *view, size_t len);
+
+/*!
+ * @brief callback for uio_read_stream()
+ *
+ * @param[in] buf  chunk of input
+ * @param[in] len  number of bytes in buf
+ * @param[in] data user data passed to uio_read_stream()
+ */
+typedef void uio_stream_t(const void *buf, size_t len, void *data);
+
+/*!
+ * @brief read until end of file in chunks
+ *
+ * @param[in] fd   file descriptor to read from
+ * @param[in] cb   function called for every chunk read
+ * @param[in] data user data passed to cb
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @note Input is read through one reused page aligned buffer. Regular files
+ *       are read with sequential access hints, and the next chunk is
+ *       prefetched while cb processes the current one.
+ *
+ * @see read(2)
+ * @see posix_fadvise(2)
+ */
+int uio_read_stream(int fd, uio_stream_t *cb, void *data);
+
+/*! @brief default readahead buffer size */
+#define UIO_READER_SIZE 65536
+
+/*! @brief never take bytes from the descriptor that were not consumed */
+#define UIO_READER_SHARED 0x01
+
+/*! @brief storage was allocated by uio_reader_init() */
+#define UIO_READER_ALLOC  0x02
+
+/*! @brief descriptor is seekable */
+#define UIO_READER_SEEK   0x04
+
+/*!
+ * @brief buffered reader
+ *
+ * A reader fills its buffer with as few read(2) calls as possible and hands
+ * out records as views into the buffer. Records are located with memchr(3).
+ * A view stays valid until the next call on the same reader.
+ *
+ * Storage allocated by uio_reader_init() grows to hold records larger than the
+ * buffer. Caller supplied storage does not grow, and such records fail with
+ * ENOBUFS.
+ *
+ * When the reader is released, unconsumed bytes are handed back to a seekable
+ * descriptor by moving its file offset back. With UIO_READER_SHARED set, the
+ * reader also leaves unconsumed bytes in pipes and sockets. It does this by
+ * reading them only as far as the current operation needs, which is one byte
+ * at a time while scanning for a delimiter. This is what the uio_read_*
+ * functions use, so they can be mixed with plain read(2) on the same
+ * descriptor.
+ *
+ * A reader has no lock and belongs to one thread at a time.
+ */
+typedef struct {
+	int fd;    /*!< source file descriptor */
+	char *buf; /*!< buffer storage */
+	int size;  /*!< size of buf */
+	int start; /*!< offset of the first unconsumed byte */
+	int end;   /*!< offset past the last buffered byte */
+	int flags; /*!< UIO_READER_* flags */
+	int eof;   /*!< end of file was reached */
+} uio_reader_t;
+
+/*!
+ * @brief initialize buffered reader
+ *
+ * @param[out] r     buffered reader
+ * @param[in]  fd    file descriptor to read from
+ * @param[in]  buf   buffer storage, NULL to allocate
+ * @param[in]  size  size of buf, UIO_READER_SIZE if 0 and buf is NULL
+ * @param[in]  flags UIO_READER_SHARED or 0
+ *
+ * @return 0 on success, -1 on error with errno set (EINVAL if buf is given
+ *         without a size)
+ */
+int uio_reader_init(uio_reader_t *r, int fd, char *buf, int size, int flags);
+
+/*!
+ * @brief release buffered reader
+ *
+ * @param[in] r buffered reader
+ *
+ * @return 0 on success, -1 if unconsumed bytes could not be handed back
+ *
+ * @see lseek(2)
+ */
+int uio_reader_free(uio_reader_t *r);
+
+/*!
+ * @brief look at buffered bytes without consuming them
+ *
+ * @param[in]  r    buffered reader
+ * @param[in]  len  number of bytes wanted
+ * @param[out] view pointer to the buffered bytes
+ *
+ * @return number of bytes available at view, less than len only at end of
+ *         file, -1 on error with errno set
+ */
+int uio_reader_peek(uio_reader_t *r, int len, const char **view);
+
+/*!
+ * @brief discard bytes
+ *
+ * @param[in] r   buffered reader
+ * @param[in] len number of bytes to discard
+ *
+ * @return bytes discarded, less than len only at end of file, -1 on error
+ *         with errno set
+ */
+int uio_reader_skip(uio_reader_t *r, int len);
+
+/*!
+ * @brief read exact number of bytes
+ *
+ * @param[in]  r   buffered reader
+ * @param[out] dst destination buffer
+ * @param[in]  len number of bytes to read
+ *
+ * @return bytes read, less than len only at end of file, -1 on error with
+ *         errno set
+ *
+ * @note Bytes that are not buffered yet are read directly into dst if at
+ *       least a full buffer is missing.
+ */
+int uio_reader_read_exact(uio_reader_t *r, void *dst, int len);
+
+/*!
+ * @brief read up to and including a delimiter
+ *
+ * @param[in]  r     buffered reader
+ * @param[in]  delim delimiter
+ * @param[out] view  pointer to the record
+ *
+ * @return length of the record including the delimiter, 0 at end of file,
+ *         -1 on error with errno set
+ *
+ * @note The last record of the input may lack the delimiter.
+ */
+int uio_reader_read_until(uio_reader_t *r, int delim, const char **view);
+
+/*!
+ * @brief read a line of input
+ *
+ * @param[in]  r    buffered reader
+ * @param[out] line pointer to the line
+ * @param[out] len  length of the line without "\n" or "\r\n"
+ *
+ * @return bytes consumed including the line terminator, 0 at end of file,
+ *         -1 on error with errno set
+ */
+int uio_reader_read_line(uio_reader_t *r, const char **line, int *len);
+
+/*!
+ * @brief read a netstring
+ *
+ * @param[in]  r   buffered reader
+ * @param[out] str pointer to the payload
+ * @param[out] len length of the payload
+ *
+ * @return bytes consumed including length prefix and trailing comma, 0 at end
+ *         of file, -1 on error with errno set (EINVAL for malformed input,
+ *         ERANGE if the length does not fit an int)
+ *
+ * @note The whole netstring is held in the buffer, so payloads larger than
+ *       caller supplied storage fail with ENOBUFS and nothing is consumed.
+ *       Malformed input is consumed up to the offending byte, so the caller
+ *       may resynchronize.
+ */
+int uio_reader_read_netstring(uio_reader_t *r, const char **str, int *len);
+
 /*!
  * @brief read exact number of bytes based on netstring format
  *
  * @param[in]  fd  file descriptor to read from
  * @param[out] str pointer to a string
  *
- * @return bytes read on success, -1 on error with errno set
+ * @return bytes read on success, 0 at end of file or for an empty netstring,
+ *         -1 on error with errno set (EINVAL for malformed input)
  *
- * @note The caller should free obtained memory for str using free(3)
+ * @note str is only set if the payload is not empty. The caller should free
+ *       obtained memory for str using free(3)
  *
  * @see malloc(3)
  * @see free(3)
- * @see read(2)
  */
 int uio_read_netstring(int fd, char **str);
 
@@ -97,9 +343,28 @@ int uio_read_netstring(int fd, char **str);
  * @param[out] str pointer to a string
  *
  * @return bytes written on success, -1 on error with errno set
+ *
+ * @see uio_write_netstringv()
  */
 int uio_write_netstring(int fd, char *str);
 
+/*!
+ * @brief write many buffers in netstring format
+ *
+ * @param[in] fd     file descriptor to write to
+ * @param[in] iov    payloads
+ * @param[in] iovcnt number of payloads
+ *
+ * @return bytes written on success, -1 on error with errno set
+ *
+ * @note Length prefixes and commas are passed to writev(2) together with the
+ *       payloads, which are not copied. Up to 128 netstrings go into a single
+ *       system call, and partial writes are continued.
+ *
+ * @see writev(2)
+ */
+ssize_t uio_write_netstringv(int fd, const struct iovec *iov, int iovcnt);
+
 /*!
  * @brief close a file
  *
@@ -218,10 +483,63 @@ int uio_unlink(const char *path);
  * @param[in] srcfd filedescriptor to read from
  * @param[in] dstfd filedescriptor to write to
  *
- * @return 0 on success, -1 on error with errno set
+ * @return 0 on success, -1 on error with errno set (EINVAL if both refer to
+ *         the same file, EIO if the source was truncated meanwhile)
+ *
+ * @note The destination is replaced by a reflink of the source where the
+ *       filesystem supports it. Otherwise the destination is emptied, and
+ *       the data segments of the source found with SEEK_DATA and SEEK_HOLE
+ *       are copied in the kernel with copy_file_range(2), or sendfile(2),
+ *       or as a last resort through shared mappings. Holes are left
+ *       unwritten. The file offsets of both descriptors are preserved.
+ *
+ * @see ioctl_ficlone(2)
+ * @see copy_file_range(2)
+ * @see lseek(2)
  */
 int uio_copy(int srcfd, int dstfd);
 
+/*! @brief default range size for uio_copy_parallel() */
+#define UIO_COPY_CHUNK (8 << 20)
+
+/*!
+ * @brief progress callback for uio_copy_parallel()
+ *
+ * @param[in] done  bytes of the source handled so far, holes included
+ * @param[in] total size of the source
+ * @param[in] data  user data from uio_copy_options_t
+ */
+typedef void uio_copy_progress_t(off_t done, off_t total, void *data);
+
+/*! @brief options for uio_copy_parallel() */
+typedef struct {
+	int threads;                   /*!< number of workers, 0 for one per CPU */
+	off_t chunk;                   /*!< range size, UIO_COPY_CHUNK if 0 */
+	uio_copy_progress_t *progress; /*!< called after every range, or NULL */
+	void *data;                    /*!< user data passed to progress */
+} uio_copy_options_t;
+
+/*!
+ * @brief copy a large file with a pool of workers
+ *
+ * @param[in] srcfd filedescriptor to read from
+ * @param[in] dstfd filedescriptor to write to
+ * @param[in] opts  options, NULL for defaults
+ *
+ * @return 0 on success, -1 on error with errno set (EINVAL if both refer to
+ *         the same file, EIO if the source was truncated meanwhile)
+ *
+ * @note The source is split into ranges aligned to the page size. Each
+ *       worker copies one range at a time with copy_file_range(2), or with
+ *       pread(2) and pwrite(2) where that is not supported, skipping holes.
+ *       Reflinks are used as in uio_copy(). Nothing is mapped, so no
+ *       signal handler is involved. The calling thread is one of the
+ *       workers, and progress is never reported concurrently.
+ *
+ * @see uio_copy()
+ */
+int uio_copy_parallel(int srcfd, int dstfd, const uio_copy_options_t *opts);
+
 #endif
 
 /*! @} uio */
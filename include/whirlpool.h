@@ -33,6 +33,17 @@
  * The whirlpool_digest() function combines the procedure explained above for a
  * single string and returns the digest in hexadecimal notation.
  *
+ * The whirlpool_add_fd() function adds all bytes read from a file descriptor
+ * until end of file to the transform routine. Input is streamed through one
+ * reused buffer, so files of arbitrary size can be hashed without reading them
+ * into memory first. The whirlpool_digest_fd() and whirlpool_digest_path()
+ * functions are the file equivalents of whirlpool_digest().
+ *
+ * The whirlpool_hex() function converts a raw digest as returned by
+ * whirlpool_finalize() to hexadecimal notation.
+ *
+ * The tables are constant; a context is updated by one thread at a time.
+ *
  * @{
  */
 
@@ -121,6 +132,60 @@ void whirlpool_add(whirlpool_t * const context,
  */
 char *whirlpool_digest(const char *str);
 
+/*!
+ * @brief add bytes from a file descriptor to the transform routine
+ *
+ * @param[in] context whirlpool state context
+ * @param[in] fd      file descriptor to read from
+ *
+ * @return 0 on success, -1 on error with errno set
+ *
+ * @note Input is read from the current file offset until end of file.
+ *
+ * @see uio_read_stream()
+ */
+int whirlpool_add_fd(whirlpool_t * const context, int fd);
+
+/*!
+ * @brief create digest from file descriptor
+ *
+ * @param[in] fd file descriptor to read from
+ *
+ * @return digest string (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using free(3)
+ *
+ * @see whirlpool_add_fd()
+ */
+char *whirlpool_digest_fd(int fd);
+
+/*!
+ * @brief create digest from file
+ *
+ * @param[in] path file to read from
+ *
+ * @return digest string (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using free(3)
+ *
+ * @see whirlpool_add_fd()
+ */
+char *whirlpool_digest_path(const char *path);
+
+/*!
+ * @brief convert digest to hexadecimal notation
+ *
+ * @param[in] digest raw digest of DIGESTBYTES bytes
+ *
+ * @return digest string (memory obtained by malloc(3)), NULL on error with
+ *         errno set
+ *
+ * @note The caller should free obtained memory using free(3)
+ */
+char *whirlpool_hex(const unsigned char * const digest);
+
 #endif
 
-/*! @} str */
+/*! @} whirlpool */
@@ -0,0 +1,576 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "cdc.h"
+
+/* chunk boundaries depend on this table; never change it */
+static const uint64_t GEAR[256] = {
+	0xc5745b9d1ec9c1ecULL, 0xbc5b51f6f71d7256ULL, 0xfe2a6fce43350441ULL,
+	0x36d1225d4fb1291fULL, 0xa9d9521b1e91a422ULL, 0xfb5f757b2bfcaeaeULL,
+	0x520f5c47860e983cULL, 0x743183231a190ab4ULL, 0xf542e215cf25a627ULL,
+	0xa1bc6f39aee78335ULL, 0xcff06961f2a07606ULL, 0xf0521d567793cdebULL,
+	0xdab8e82288ae6483ULL, 0x8d66a718839b39c5ULL, 0x6e9bb1e0a39f654aULL,
+	0xf5d43faed3bb4a1dULL, 0x2c83884ad468128dULL, 0x44bcb4811a9cdcefULL,
+	0xeca7cd3ad1ae18a4ULL, 0x0b5916752f05558dULL, 0x8cc02e96bda95c19ULL,
+	0x53e2e3e0d3443e2eULL, 0xa8a64ad7921820cfULL, 0x5c67c9d2fd5ec9c8ULL,
+	0x8e59651f5b36a5e3ULL, 0x05f1049383977074ULL, 0x2d141170a8548eebULL,
+	0xfc3b2c03895b783fULL, 0xedadab0abecb12fdULL, 0xb31b5092130c2834ULL,
+	0x43e5fcaaf07764caULL, 0x0eac33f64375bd95ULL, 0x8be577dda35e3823ULL,
+	0x3068c27c870b5daeULL, 0x3dfb589c92c0b06aULL, 0x6a80b947f658869bULL,
+	0x593bc5cb439c3e3cULL, 0x405d30db4dc15585ULL, 0xc249a65cbed556edULL,
+	0x66d417598946846bULL, 0x7d5ca84b892ca548ULL, 0xb47bfc047f9f8ce8ULL,
+	0xc547663b98e6bafaULL, 0x9d3118a8a66c9992ULL, 0x80a5a83495ad90b0ULL,
+	0xa0f262fabc4c8032ULL, 0x8cfd98189b7ed64aULL, 0x8d874d8e1d185364ULL,
+	0x72170795b7b15060ULL, 0x1deb9424e3011ebcULL, 0xb5835fd668795128ULL,
+	0xfb671422097145a9ULL, 0x17a99889941e5ef4ULL, 0xd8e8d5bf2d3a98d4ULL,
+	0x5e0f6336e239e61dULL, 0xe22a71c37b4f4114ULL, 0x4b3928bbc16d13faULL,
+	0xc93d2f460a26419bULL, 0x9122367ec5a0bc1fULL, 0xfcbb1889146cf075ULL,
+	0xcfac9532f50c1a11ULL, 0xb0954bc65c837b1aULL, 0x053106e48964bbb6ULL,
+	0x7ea9fd0bf30bebbbULL, 0x41f3b3ff2b431d73ULL, 0xeb535bd22f27d1d8ULL,
+	0x388ddd4d59378508ULL, 0x673b55930cf1aa22ULL, 0x2c460f5318f50b99ULL,
+	0xe9b158b25d7edc94ULL, 0x051a17d5f39d0a65ULL, 0xf2364e842ab34244ULL,
+	0xbdd62851966b6604ULL, 0x04116733a8675214ULL, 0x3bf3f2dbd049fc8fULL,
+	0xf609dba919e155ccULL, 0x23d1939623ca978eULL, 0xa73fac36336c36d6ULL,
+	0xb6880ced59be6739ULL, 0x53540d16ea35e057ULL, 0x384413b59b03ec0bULL,
+	0x65e5d8e34d8bd892ULL, 0x0e5f44c6a2d7c091ULL, 0x7dcd4598dbed5f9eULL,
+	0xf5724e84dfc60d04ULL, 0xf3557474caaaec55ULL, 0x946d1eddf344a3ddULL,
+	0x38a347beef4390f2ULL, 0x5f664652bee133ebULL, 0xc69ef953a0f6fcf3ULL,
+	0xa774c2529fde1adbULL, 0xa472e5563400647eULL, 0x769506f8c4045259ULL,
+	0xbb27e74d2e1c43abULL, 0x633281ddf4190964ULL, 0xf58b2ff5be037d51ULL,
+	0x6fce7c278dc3ab50ULL, 0xec427be70bb0b643ULL, 0x09ac4b35add1470bULL,
+	0xeceecb9039049bbdULL, 0x0e61b43612b5a439ULL, 0x3467e643a1adc06dULL,
+	0x2e387be389a66a59ULL, 0xd86b734adfa70aaaULL, 0x6cc11fd1c865e8c1ULL,
+	0xb5b2cd8c9e9c20a7ULL, 0x7f598f9e238ffb81ULL, 0xf68a2e500438c5b9ULL,
+	0xff96bbf7fb2ab818ULL, 0xbff88a66803b6d3eULL, 0xc0f6ec9b942c81a6ULL,
+	0x48126848ca903ac5ULL, 0xe817839c3dce48b0ULL, 0x35b5710838f5348fULL,
+	0x91c629af32daa5c1ULL, 0xf079cee7d2b28e69ULL, 0x6623131390734f4cULL,
+	0x42137bd516c273eaULL, 0x36119a5e220c23c7ULL, 0x5ee85cbdfd78e129ULL,
+	0x3ab91526091950e8ULL, 0xf77042e665e4ff46ULL, 0x74cb1d380744187fULL,
+	0x7f01be893e321977ULL, 0x39b6f3b216e1a9b7ULL, 0xb3390661165b8217ULL,
+	0x5c8767aa3c41b199ULL, 0x92e3f932190e4bc2ULL, 0x01e76403786bd2a6ULL,
+	0xe2d1643938ca2b13ULL, 0xfa302ef860da23ddULL, 0xc650a67863aa77f9ULL,
+	0xd8abcec1bf695d73ULL, 0xfefb9421bbeee900ULL, 0x2082f22568d2107eULL,
+	0x491d498c3f811335ULL, 0x6b1f30db906a978dULL, 0x1a8ce24b6711e1b3ULL,
+	0x0af985d4582fbdd2ULL, 0xdb7b40813da2d232ULL, 0x71289a01f9a457e7ULL,
+	0x33dd5a7c73eaac11ULL, 0xe7bea43864ba42abULL, 0x0795080820a7f621ULL,
+	0xe849e9eb2a7c446bULL, 0x6ef172b538dd2fa0ULL, 0x7099a9e6fc0f880dULL,
+	0xc759342d7e4b602fULL, 0x3a6892c5fcdc7859ULL, 0x85fd98f214f73e2cULL,
+	0x78e9f1d79d9b37daULL, 0x24d4a8b83127f079ULL, 0xba6e649745647dfcULL,
+	0xbc9b7aeaccbb8df3ULL, 0xcd18e69bfde2ccc4ULL, 0x52eb8aeb26a4d366ULL,
+	0x8fd1d27c2dc277e3ULL, 0x10dbe0a0dd6483d4ULL, 0xdeb5617de1442d4eULL,
+	0x904459fe06c2bb87ULL, 0xae58bb8111fe0ae3ULL, 0x25889a7199f3cbc0ULL,
+	0x6a359df9e237e4b0ULL, 0x69133df4354ba907ULL, 0xa6b9ae0836e0d09cULL,
+	0xa5afc40a35eebc94ULL, 0xfedb5f94e3cafe33ULL, 0xbcb802431ff26864ULL,
+	0xe10530d78f9d2664ULL, 0x66055ced07cdbf27ULL, 0x92a8620ca07b5a93ULL,
+	0xa89f2c8d26fefbb9ULL, 0x95cf843481220420ULL, 0x498dc46ff4bee97cULL,
+	0x4f49279ebaf8db7bULL, 0x6389925251920ccbULL, 0x13cef334d07eb390ULL,
+	0xabe9aa4482317cd0ULL, 0x9710b67399221791ULL, 0x09661020ccca6af9ULL,
+	0x995ed43203ef945fULL, 0x15964f7cee1879f6ULL, 0x82d410cfe9db6624ULL,
+	0xcbba301782f5b312ULL, 0x88b3d41d0b1bece5ULL, 0xe3ef1812ea96b8ffULL,
+	0x6b99e4379b088070ULL, 0x35a7298e9d44724eULL, 0xdcbdde831388a9c9ULL,
+	0x5092898906272e73ULL, 0xdeede74b7f956628ULL, 0xcc5c556bb74a8f59ULL,
+	0xf3fdab1f411bb514ULL, 0x22fd4fb9073849a7ULL, 0x45aa0ca6ad95b6bdULL,
+	0x37865fcc510e097cULL, 0x251aa3e1a0b5734cULL, 0xa0a0dd6ef6f6bf4fULL,
+	0xbbe6888f462d61dfULL, 0x33951167de04a0c4ULL, 0x0fec9e11dcd4a0a2ULL,
+	0x82d49acf3a0173f8ULL, 0xa252cdb0303c91beULL, 0x5c7736f5b44f7dffULL,
+	0x1a075e127c011acaULL, 0x7f6da6b59d5c66eaULL, 0x163c0f89a809c72aULL,
+	0xcee9dc1edc4f3932ULL, 0xe2997b4ee3d8ea3aULL, 0xa57ad0daf93d354aULL,
+	0x61ea5d24060eec07ULL, 0x540c3ade8be72c9bULL, 0x2cac4bca0525211fULL,
+	0x76c91c549ac2a80fULL, 0x8dc9332c967640b7ULL, 0x5e1f99c933542fa9ULL,
+	0xdb7b15a564cb2b74ULL, 0x36a681d74edee34bULL, 0x79b9a7e24a8bdb65ULL,
+	0x4887b5dd218c87fcULL, 0x9d1d025720fbd08bULL, 0x977a8d348e9a0c8aULL,
+	0x2b6c1e24455dfce7ULL, 0xb9a5a0811240f3f2ULL, 0x0e8dbcb81bbd927eULL,
+	0xcb554dd9fa34dcd9ULL, 0x46913e3dd2fbfe5dULL, 0x5a09c5fe3ab0a623ULL,
+	0xe988f7c15ab29e32ULL, 0xda4df45d62c7951eULL, 0x009f03db059d754cULL,
+	0x5d282ecd044d7029ULL, 0xfb989ef956619b88ULL, 0xc51925fb09dfa41aULL,
+	0x7b8b82884122157dULL, 0x80a2b6519703ceb7ULL, 0x56394175640d828aULL,
+	0xec85c1accf108174ULL, 0x2f5af4bdd157de7fULL, 0x5452f0b04d36c292ULL,
+	0x041ea64a328e9061ULL, 0x6b2a021338c9b981ULL, 0xc1b06b65553efb7cULL,
+	0xfc30be9b2268e0a4ULL, 0x8d1c646983ea4886ULL, 0x68ec74645f22df82ULL,
+	0xb55d24765da1b414ULL, 0x5196ebc0ec805becULL, 0xd5c2f2833a5079a0ULL,
+	0x1369f335a1cc7833ULL, 0x1c859ac2644b7f29ULL, 0x653e796c7d0628b0ULL,
+	0x06ceee0d52fa66f7ULL, 0x4c0e203f609eb72dULL, 0xea3652dd33856cfbULL,
+	0x665a51642313852bULL,
+};
+
+/* a chunk waiting to be hashed or passed to the callback */
+typedef struct {
+	cdc_chunk_t chunk;
+	int done;
+} cdc_slot_t;
+
+/* chunking and hashing pipeline */
+typedef struct {
+	const cdc_t *cdc;
+	cdc_callback_t *cb;
+	void *data;
+	int rc;
+
+	/* slots are filled at tail, hashed at next and delivered at head */
+	cdc_slot_t *slots;
+	unsigned int nslots, head, next, tail;
+	int quit;
+
+	pthread_t *workers;
+	int nworkers;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+} cdc_pipe_t;
+
+int cdc_init(cdc_t *cdc, size_t min, size_t avg, size_t max)
+{
+	int bits = 0;
+
+	if (min < CDC_MIN_SIZE || min >= avg || avg >= max || max > CDC_MAX_SIZE)
+		return errno = EINVAL, -1;
+
+	while (((size_t) 2 << bits) <= avg)
+		bits++;
+
+	cdc->min     = min;
+	cdc->avg     = avg;
+	cdc->max     = max;
+	cdc->digest  = &digest_whirlpool;
+	cdc->threads = 0;
+
+	/* the upper bits of a gear hash depend on the last 64 bytes, the lower
+	 * bits only on the last few, so boundaries are tested on the upper bits */
+	cdc->mask_s = ~UINT64_C(0) << (64 - (bits + 1));
+	cdc->mask_l = ~UINT64_C(0) << (64 - (bits - 1));
+
+	return 0;
+}
+
+size_t cdc_cut(const cdc_t *cdc, const void *_buf, size_t len)
+{
+	const unsigned char *buf = _buf;
+	size_t i, normal;
+	uint64_t h = 0;
+
+	if (len <= cdc->min)
+		return len;
+
+	if (len > cdc->max)
+		len = cdc->max;
+
+	normal = len < cdc->avg ? len : cdc->avg;
+
+	for (i = cdc->min; i < normal; i++) {
+		h = (h << 1) + GEAR[buf[i]];
+
+		if (!(h & cdc->mask_s))
+			return i + 1;
+	}
+
+	for (; i < len; i++) {
+		h = (h << 1) + GEAR[buf[i]];
+
+		if (!(h & cdc->mask_l))
+			return i + 1;
+	}
+
+	return len;
+}
+
+static
+void cdc_hash(const cdc_t *cdc, cdc_chunk_t *chunk)
+{
+	digest_ctx_t ctx;
+
+	/* unused digest bytes are zeroed so chunks can be compared with memcmp */
+	memset(chunk->digest, 0, DIGEST_MAXBYTES);
+
+	if (!cdc->digest)
+		return;
+
+	digest_init(&ctx, cdc->digest);
+	digest_update(&ctx, chunk->data, chunk->len);
+	digest_final(&ctx, chunk->digest);
+}
+
+static
+void *cdc_worker(void *_pipe)
+{
+	cdc_pipe_t *pipe = _pipe;
+	cdc_slot_t *slot;
+
+	pthread_mutex_lock(&pipe->lock);
+
+	for (;;) {
+		while (pipe->next == pipe->tail && !pipe->quit)
+			pthread_cond_wait(&pipe->work, &pipe->lock);
+
+		if (pipe->next == pipe->tail)
+			break;
+
+		slot = &pipe->slots[pipe->next++ % pipe->nslots];
+
+		pthread_mutex_unlock(&pipe->lock);
+		cdc_hash(pipe->cdc, &slot->chunk);
+		pthread_mutex_lock(&pipe->lock);
+
+		slot->done = 1;
+		pthread_cond_signal(&pipe->done);
+	}
+
+	pthread_mutex_unlock(&pipe->lock);
+
+	return NULL;
+}
+
+static
+int cdc_pipe_open(cdc_pipe_t *pipe, const cdc_t *cdc,
+		cdc_callback_t *cb, void *data)
+{
+	int i, errno_orig;
+
+	memset(pipe, 0, sizeof(*pipe));
+
+	pipe->cdc  = cdc;
+	pipe->cb   = cb;
+	pipe->data = data;
+
+	if (cdc->threads <= 0 || !cdc->digest)
+		return 0;
+
+	pipe->nslots = 4 * cdc->threads;
+
+	if (!(pipe->slots = calloc(pipe->nslots, sizeof(cdc_slot_t))) ||
+			!(pipe->workers = calloc(cdc->threads, sizeof(pthread_t)))) {
+		free(pipe->slots);
+		return -1;
+	}
+
+	pthread_mutex_init(&pipe->lock, NULL);
+	pthread_cond_init(&pipe->work, NULL);
+	pthread_cond_init(&pipe->done, NULL);
+
+	for (i = 0; i < cdc->threads; i++) {
+		if ((errno = pthread_create(&pipe->workers[i], NULL,
+				cdc_worker, pipe)))
+			break;
+
+		pipe->nworkers++;
+	}
+
+	/* degrade gracefully as long as at least one worker is running */
+	if (pipe->nworkers == 0) {
+		errno_orig = errno;
+		pthread_cond_destroy(&pipe->done);
+		pthread_cond_destroy(&pipe->work);
+		pthread_mutex_destroy(&pipe->lock);
+		free(pipe->workers);
+		free(pipe->slots);
+		return errno = errno_orig, -1;
+	}
+
+	return 0;
+}
+
+/* pass hashed chunks to the callback in order; called with lock held */
+static
+void cdc_pipe_deliver(cdc_pipe_t *pipe, int wait)
+{
+	cdc_slot_t *slot;
+	int rc;
+
+	while (pipe->head != pipe->tail) {
+		slot = &pipe->slots[pipe->head % pipe->nslots];
+
+		if (!slot->done) {
+			if (!wait)
+				break;
+
+			pthread_cond_wait(&pipe->done, &pipe->lock);
+			continue;
+		}
+
+		/* after an error, chunks are only waited for, not delivered */
+		if (pipe->rc == 0) {
+			pthread_mutex_unlock(&pipe->lock);
+			rc = pipe->cb(&slot->chunk, pipe->data);
+			pthread_mutex_lock(&pipe->lock);
+
+			pipe->rc = rc;
+		}
+
+		pipe->head++;
+	}
+}
+
+static
+int cdc_pipe_push(cdc_pipe_t *pipe, uint64_t offset,
+		const unsigned char *buf, size_t len)
+{
+	cdc_chunk_t chunk;
+	cdc_slot_t *slot;
+
+	if (pipe->nworkers == 0) {
+		chunk.offset = offset;
+		chunk.len    = len;
+		chunk.data   = buf;
+
+		cdc_hash(pipe->cdc, &chunk);
+
+		return pipe->rc = pipe->cb(&chunk, pipe->data);
+	}
+
+	pthread_mutex_lock(&pipe->lock);
+
+	while (pipe->tail - pipe->head == pipe->nslots && pipe->rc == 0) {
+		cdc_pipe_deliver(pipe, 0);
+
+		if (pipe->tail - pipe->head == pipe->nslots)
+			pthread_cond_wait(&pipe->done, &pipe->lock);
+	}
+
+	if (pipe->rc == 0) {
+		slot = &pipe->slots[pipe->tail % pipe->nslots];
+
+		slot->chunk.offset = offset;
+		slot->chunk.len    = len;
+		slot->chunk.data   = buf;
+		slot->done         = 0;
+
+		pipe->tail++;
+		pthread_cond_signal(&pipe->work);
+
+		cdc_pipe_deliver(pipe, 0);
+	}
+
+	pthread_mutex_unlock(&pipe->lock);
+
+	return pipe->rc;
+}
+
+/* wait for all chunks in flight, so their data may be released */
+static
+int cdc_pipe_drain(cdc_pipe_t *pipe)
+{
+	if (pipe->nworkers > 0) {
+		pthread_mutex_lock(&pipe->lock);
+		cdc_pipe_deliver(pipe, 1);
+		pthread_mutex_unlock(&pipe->lock);
+	}
+
+	return pipe->rc;
+}
+
+static
+void cdc_pipe_close(cdc_pipe_t *pipe)
+{
+	int i;
+
+	if (pipe->nworkers == 0)
+		return;
+
+	pthread_mutex_lock(&pipe->lock);
+	pipe->quit = 1;
+	pthread_cond_broadcast(&pipe->work);
+	pthread_mutex_unlock(&pipe->lock);
+
+	for (i = 0; i < pipe->nworkers; i++)
+		pthread_join(pipe->workers[i], NULL);
+
+	pthread_cond_destroy(&pipe->done);
+	pthread_cond_destroy(&pipe->work);
+	pthread_mutex_destroy(&pipe->lock);
+
+	free(pipe->workers);
+	free(pipe->slots);
+}
+
+/* chunk a window of data; unless it is the end of the input, the tail that
+ * may still grow into a longer chunk is left for the next window */
+static
+size_t cdc_window(cdc_pipe_t *pipe, const unsigned char *buf, size_t len,
+		uint64_t offset, int eof)
+{
+	const cdc_t *cdc = pipe->cdc;
+	size_t pos = 0, n;
+
+	while (pos < len) {
+		if (!eof && len - pos < cdc->max)
+			break;
+
+		n = cdc_cut(cdc, buf + pos, len - pos);
+
+		if (cdc_pipe_push(pipe, offset + pos, buf + pos, n) != 0)
+			break;
+
+		pos += n;
+	}
+
+	return pos;
+}
+
+int cdc_buf(const cdc_t *cdc, const void *buf, size_t len,
+		cdc_callback_t *cb, void *data)
+{
+	cdc_pipe_t pipe;
+	int rc;
+
+	if (cdc_pipe_open(&pipe, cdc, cb, data) == -1)
+		return -1;
+
+	cdc_window(&pipe, buf, len, 0, 1);
+
+	rc = cdc_pipe_drain(&pipe);
+	cdc_pipe_close(&pipe);
+
+	return rc;
+}
+
+/* size of mapped or buffered windows */
+static
+size_t cdc_window_size(const cdc_t *cdc)
+{
+	size_t size = 8 * 1024 * 1024;
+
+	if (size < 4 * cdc->max)
+		size = 4 * cdc->max;
+
+	return size;
+}
+
+static
+int cdc_mmap(cdc_pipe_t *pipe, int fd, off_t start, off_t size)
+{
+	size_t wsize = cdc_window_size(pipe->cdc);
+	off_t off = start, aoff;
+	size_t delta, mlen, n;
+	void *map;
+	int eof;
+
+	while (off < size) {
+		aoff  = off & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+		delta = off - aoff;
+		mlen  = delta + wsize;
+
+		if ((off_t) mlen > size - aoff)
+			mlen = size - aoff;
+
+		eof = aoff + (off_t) mlen == size;
+
+		map = mmap(NULL, mlen, PROT_READ, MAP_PRIVATE, fd, aoff);
+
+		if (map == MAP_FAILED)
+			return -1;
+
+		madvise(map, mlen, MADV_SEQUENTIAL);
+
+		n = cdc_window(pipe, (unsigned char *) map + delta, mlen - delta,
+				off - start, eof);
+
+		cdc_pipe_drain(pipe);
+		munmap(map, mlen);
+
+		if (pipe->rc != 0)
+			break;
+
+		off += n;
+	}
+
+	return 0;
+}
+
+static
+int cdc_read(cdc_pipe_t *pipe, int fd)
+{
+	size_t wsize = cdc_window_size(pipe->cdc);
+	size_t have = 0, n;
+	uint64_t offset = 0;
+	unsigned char *buf;
+	ssize_t r;
+	int eof = 0;
+
+	if (!(buf = malloc(wsize)))
+		return -1;
+
+	while (!eof) {
+		while (have < wsize && !eof) {
+			r = read(fd, buf + have, wsize - have);
+
+			if (r == -1 && errno == EINTR)
+				continue;
+
+			if (r == -1) {
+				free(buf);
+				return -1;
+			}
+
+			if (r == 0)
+				eof = 1;
+
+			have += r;
+		}
+
+		n = cdc_window(pipe, buf, have, offset, eof);
+
+		cdc_pipe_drain(pipe);
+
+		if (pipe->rc != 0)
+			break;
+
+		memmove(buf, buf + n, have - n);
+		have   -= n;
+		offset += n;
+	}
+
+	free(buf);
+
+	return 0;
+}
+
+int cdc_fd(const cdc_t *cdc, int fd, cdc_callback_t *cb, void *data)
+{
+	cdc_pipe_t pipe;
+	struct stat sb;
+	off_t start = -1;
+	int rc, errno_orig;
+
+	if (fstat(fd, &sb) == -1)
+		return -1;
+
+	if (S_ISREG(sb.st_mode))
+		start = lseek(fd, 0, SEEK_CUR);
+
+	if (cdc_pipe_open(&pipe, cdc, cb, data) == -1)
+		return -1;
+
+	if (start >= 0)
+		rc = cdc_mmap(&pipe, fd, start, sb.st_size);
+	else
+		rc = cdc_read(&pipe, fd);
+
+	errno_orig = errno;
+	cdc_pipe_drain(&pipe);
+	cdc_pipe_close(&pipe);
+	errno = errno_orig;
+
+	return rc == -1 ? -1 : pipe.rc;
+}
@@ -0,0 +1,381 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dcache.h"
+#include "whirlpool.h"
+
+#define DCACHE_MAGIC   "LUCIDDC"
+#define DCACHE_VERSION 1
+
+struct dcache_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t slotsize;
+	uint32_t digestsize;
+	uint32_t nslots;
+	uint8_t  reserved[104];
+};
+
+struct dcache_slot {
+	uint32_t seq;     /* even: stable, odd: being written, 0: empty */
+	uint32_t reserved;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime;   /* nanoseconds */
+	uint64_t ctime;   /* nanoseconds */
+	uint8_t  digest[DIGESTBYTES];
+	uint8_t  pad[16];
+};
+
+#define NSEC(TS) ((uint64_t) (TS).tv_sec * 1000000000ULL + (TS).tv_nsec)
+
+static inline
+uint32_t __dcache_hash(const struct stat *sb)
+{
+	uint64_t h = (uint64_t) sb->st_ino ^ ((uint64_t) sb->st_dev << 32);
+
+	/* 64-bit finalizer from MurmurHash3 */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return (uint32_t) h;
+}
+
+static inline
+int __dcache_match_inode(const struct dcache_slot *s, const struct stat *sb)
+{
+	return s->ino == (uint64_t) sb->st_ino && s->dev == (uint64_t) sb->st_dev;
+}
+
+static inline
+int __dcache_match_meta(const struct dcache_slot *s, const struct stat *sb)
+{
+	return s->size  == (uint64_t) sb->st_size &&
+	       s->mtime == NSEC(sb->st_mtim) &&
+	       s->ctime == NSEC(sb->st_ctim);
+}
+
+int dcache_open(dcache_t *dc, const char *path, uint32_t nslots)
+{
+	struct dcache_header *hdr;
+	struct dcache_slot *s;
+	struct stat sb;
+	int errno_orig, excl = 0, prot = PROT_READ|PROT_WRITE;
+	uint32_t n, seq;
+
+	memset(dc, 0, sizeof(dcache_t));
+
+	dc->fd = open(path, O_RDWR|O_CREAT|O_NOCTTY, 0644);
+
+	if (dc->fd == -1 && (errno == EACCES || errno == EROFS)) {
+		dc->fd = open(path, O_RDONLY|O_NOCTTY);
+		dc->readonly = 1;
+		prot = PROT_READ;
+	}
+
+	if (dc->fd == -1)
+		return -1;
+
+	/* writable handles hold a shared lock until dcache_close(), so an
+	 * exclusive lock means no store can be in progress; creators are
+	 * serialized and readers wait for them, so nobody sees a file whose
+	 * header has not been written yet */
+	if (dc->readonly) {
+		if (flock(dc->fd, LOCK_SH) == -1)
+			goto err;
+	}
+
+	else if (flock(dc->fd, LOCK_EX|LOCK_NB) == 0)
+		excl = 1;
+
+	else if (errno != EWOULDBLOCK || flock(dc->fd, LOCK_SH) == -1)
+		goto err;
+
+	if (fstat(dc->fd, &sb) == -1)
+		goto err;
+
+	/* another opener of a new file may have beaten us to the lock */
+	if (sb.st_size == 0 && !dc->readonly && !excl) {
+		if (flock(dc->fd, LOCK_EX) == -1 || fstat(dc->fd, &sb) == -1)
+			goto err;
+
+		excl = 1;
+	}
+
+	/* initialize a new cache file */
+	if (sb.st_size == 0) {
+		struct dcache_header init;
+
+		if (dc->readonly) {
+			errno = EINVAL;
+			goto err;
+		}
+
+		for (n = 1; n < nslots && n < (1U << 31); n <<= 1);
+
+		memset(&init, 0, sizeof(init));
+		memcpy(init.magic, DCACHE_MAGIC, sizeof(DCACHE_MAGIC));
+		init.version    = DCACHE_VERSION;
+		init.slotsize   = sizeof(struct dcache_slot);
+		init.digestsize = DIGESTBYTES;
+		init.nslots     = n;
+
+		if (ftruncate(dc->fd, sizeof(init) +
+					(off_t) n * sizeof(struct dcache_slot)) == -1)
+			goto err;
+
+		if (pwrite(dc->fd, &init, sizeof(init), 0) != sizeof(init))
+			goto err;
+
+		if (fstat(dc->fd, &sb) == -1)
+			goto err;
+	}
+
+	if (sb.st_size < sizeof(struct dcache_header)) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	dc->maplen = sb.st_size;
+	dc->map    = mmap(NULL, dc->maplen, prot, MAP_SHARED, dc->fd, 0);
+
+	if (dc->map == MAP_FAILED) {
+		dc->map = NULL;
+		goto err;
+	}
+
+	hdr = dc->map;
+
+	if (memcmp(hdr->magic, DCACHE_MAGIC, sizeof(DCACHE_MAGIC)) != 0 ||
+			hdr->version    != DCACHE_VERSION ||
+			hdr->slotsize   != sizeof(struct dcache_slot) ||
+			hdr->digestsize != DIGESTBYTES ||
+			hdr->nslots == 0 || (hdr->nslots & (hdr->nslots - 1)) != 0 ||
+			dc->maplen < sizeof(*hdr) +
+				(size_t) hdr->nslots * sizeof(struct dcache_slot)) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	dc->slots = (char *) dc->map + sizeof(*hdr);
+	dc->mask  = hdr->nslots - 1;
+
+	/* a slot left odd can only belong to a store that died before
+	 * publishing it; invalidate its contents and make it stable again */
+	if (excl) {
+		for (n = 0; n <= dc->mask; n++) {
+			s   = (struct dcache_slot *) dc->slots + n;
+			seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+
+			if (!(seq & 1))
+				continue;
+
+			s->dev = s->ino = s->size = s->mtime = s->ctime = 0;
+			memset(s->digest, 0, DIGESTBYTES);
+
+			__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	/* keep the lock of writable handles to tell later openers that stores
+	 * may be in progress */
+	if (flock(dc->fd, dc->readonly ? LOCK_UN : LOCK_SH) == -1)
+		goto err;
+
+	/* slots are visited in hash order */
+	madvise(dc->map, dc->maplen, MADV_RANDOM);
+
+	return 0;
+
+err:
+	errno_orig = errno;
+	dcache_close(dc);
+	errno = errno_orig;
+	return -1;
+}
+
+void dcache_close(dcache_t *dc)
+{
+	if (dc->map)
+		munmap(dc->map, dc->maplen);
+
+	if (dc->fd >= 0)
+		close(dc->fd);
+
+	dc->map = dc->slots = NULL;
+	dc->fd  = -1;
+}
+
+int dcache_lookup(dcache_t *dc, const struct stat *sb, unsigned char *digest)
+{
+	struct dcache_slot *slots = dc->slots, *s, copy;
+	uint32_t i, h, seq;
+
+	if (!S_ISREG(sb->st_mode))
+		return 0;
+
+	h = __dcache_hash(sb);
+
+	for (i = 0; i < DCACHE_PROBES; i++) {
+		s = &slots[(h + i) & dc->mask];
+
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+		/* end of probe sequence */
+		if (seq == 0)
+			return 0;
+
+		/* slot is being written */
+		if (seq & 1)
+			continue;
+
+		memcpy(&copy, s, sizeof(copy));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		/* slot was changed while copying */
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		if (!__dcache_match_inode(&copy, sb))
+			continue;
+
+		if (!__dcache_match_meta(&copy, sb))
+			return 0;
+
+		memcpy(digest, copy.digest, DIGESTBYTES);
+		return 1;
+	}
+
+	return 0;
+}
+
+int dcache_store(dcache_t *dc, const struct stat *sb,
+		const unsigned char *digest)
+{
+	struct dcache_slot *slots = dc->slots, *s, *victim = NULL;
+	uint32_t i, h, seq;
+
+	if (dc->readonly)
+		return errno = EROFS, -1;
+
+	if (!S_ISREG(sb->st_mode))
+		return errno = EINVAL, -1;
+
+	h = __dcache_hash(sb);
+
+	/* prefer the slot already holding this inode, then the first free
+	 * slot, and evict the home slot if the probe sequence is full */
+	for (i = 0; i < DCACHE_PROBES; i++) {
+		s   = &slots[(h + i) & dc->mask];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == 0) {
+			if (!victim)
+				victim = s;
+			break;
+		}
+
+		if (!(seq & 1) && __dcache_match_inode(s, sb)) {
+			victim = s;
+			break;
+		}
+	}
+
+	if (!victim)
+		victim = &slots[h & dc->mask];
+
+	/* claim the slot by making its sequence odd */
+	seq = __atomic_load_n(&victim->seq, __ATOMIC_RELAXED);
+
+	if ((seq & 1) || !__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1,
+				0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	victim->dev   = sb->st_dev;
+	victim->ino   = sb->st_ino;
+	victim->size  = sb->st_size;
+	victim->mtime = NSEC(sb->st_mtim);
+	victim->ctime = NSEC(sb->st_ctim);
+	memcpy(victim->digest, digest, DIGESTBYTES);
+
+	__atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+char *dcache_digest_path(dcache_t *dc, const char *path)
+{
+	whirlpool_t ctx;
+	struct stat sb, sb2;
+	struct timespec now;
+	uint8_t digest[DIGESTBYTES];
+	int fd, errno_orig;
+
+	if (stat(path, &sb) == -1)
+		return NULL;
+
+	if (dcache_lookup(dc, &sb, digest) == 1)
+		return whirlpool_hex(digest);
+
+	if ((fd = open(path, O_RDONLY|O_NOCTTY)) == -1)
+		return NULL;
+
+	whirlpool_init(&ctx);
+
+	if (fstat(fd, &sb) == -1 || whirlpool_add_fd(&ctx, fd) == -1 ||
+			fstat(fd, &sb2) == -1) {
+		errno_orig = errno;
+		close(fd);
+		errno = errno_orig;
+		return NULL;
+	}
+
+	close(fd);
+
+	whirlpool_finalize(&ctx, digest);
+
+	/* only remember digests of files that did not change while being
+	 * hashed and are old enough for their timestamps to be trusted */
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	if (S_ISREG(sb.st_mode) && !dc->readonly &&
+			sb.st_size == sb2.st_size &&
+			NSEC(sb.st_mtim) == NSEC(sb2.st_mtim) &&
+			NSEC(sb.st_ctim) == NSEC(sb2.st_ctim) &&
+			sb.st_mtim.tv_sec < now.tv_sec - 1 &&
+			sb.st_ctim.tv_sec < now.tv_sec - 1)
+		dcache_store(dc, &sb, digest);
+
+	return whirlpool_hex(digest);
+}
@@ -0,0 +1,697 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "delta.h"
+
+#define DELTA_MAGIC   "LUCIDDL"
+#define DELTA_VERSION 1
+
+#define DELTA_OP_END    0
+#define DELTA_OP_COPY   1
+#define DELTA_OP_INSERT 2
+
+/* largest literal stored in a single insert operation */
+#define DELTA_INSERT_MAX (1024 * 1024)
+
+/* header: magic, version, flags, block size, size of the new file */
+#define DELTA_HDRSIZE (8 + 4 + 4 + 4 + 8)
+
+#define DELTA_IOSIZE (64 * 1024)
+
+/* buffered delta output */
+typedef struct {
+	int fd;
+	size_t len;
+	unsigned char buf[DELTA_IOSIZE];
+} delta_out_t;
+
+static
+void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static
+void put64(unsigned char *p, uint64_t v)
+{
+	put32(p, v >> 32);
+	put32(p + 4, v);
+}
+
+static
+uint32_t get32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+	       ((uint32_t) p[2] <<  8) |  (uint32_t) p[3];
+}
+
+static
+uint64_t get64(const unsigned char *p)
+{
+	return ((uint64_t) get32(p) << 32) | get32(p + 4);
+}
+
+static
+int delta_write(int fd, const void *_buf, size_t len)
+{
+	const unsigned char *buf = _buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		if (n == -1)
+			return -1;
+
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static
+int delta_pwrite(int fd, const void *_buf, size_t len, off_t off)
+{
+	const unsigned char *buf = _buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, off);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		if (n == -1)
+			return -1;
+
+		buf += n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+/* read exactly len bytes; a short read is a malformed delta */
+static
+int delta_read(int fd, void *_buf, size_t len)
+{
+	unsigned char *buf = _buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, buf, len);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		if (n == -1)
+			return -1;
+
+		if (n == 0)
+			return errno = EINVAL, -1;
+
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static
+int delta_out_flush(delta_out_t *out)
+{
+	if (delta_write(out->fd, out->buf, out->len) == -1)
+		return -1;
+
+	out->len = 0;
+	return 0;
+}
+
+static
+int delta_out(delta_out_t *out, const void *buf, size_t len)
+{
+	if (out->len + len > sizeof(out->buf) && delta_out_flush(out) == -1)
+		return -1;
+
+	/* large literals bypass the buffer */
+	if (len > sizeof(out->buf))
+		return delta_write(out->fd, buf, len);
+
+	memcpy(out->buf + out->len, buf, len);
+	out->len += len;
+	return 0;
+}
+
+static
+int delta_out_copy(delta_out_t *out, uint64_t src, uint64_t len)
+{
+	unsigned char op[17];
+
+	if (len == 0)
+		return 0;
+
+	op[0] = DELTA_OP_COPY;
+	put64(op + 1, src);
+	put64(op + 9, len);
+
+	return delta_out(out, op, sizeof(op));
+}
+
+static
+int delta_out_insert(delta_out_t *out, const unsigned char *buf, uint64_t len)
+{
+	unsigned char op[5];
+	size_t n;
+
+	while (len > 0) {
+		n = len > DELTA_INSERT_MAX ? DELTA_INSERT_MAX : len;
+
+		op[0] = DELTA_OP_INSERT;
+		put32(op + 1, n);
+
+		if (delta_out(out, op, sizeof(op)) == -1 ||
+				delta_out(out, buf, n) == -1)
+			return -1;
+
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* rsync rolling checksum: a is the byte sum, b the weighted byte sum */
+static
+uint32_t delta_weak(const unsigned char *buf, size_t len,
+		uint32_t *a, uint32_t *b)
+{
+	size_t i;
+
+	*a = *b = 0;
+
+	for (i = 0; i < len; i++) {
+		*a += buf[i];
+		*b += (len - i) * buf[i];
+	}
+
+	return (*a & 0xffff) | (*b << 16);
+}
+
+static
+uint32_t delta_bucket(const delta_sig_t *sig, uint32_t weak)
+{
+	return (weak * 0x9e3779b1U) & sig->mask;
+}
+
+static
+void delta_strong(const delta_sig_t *sig, const unsigned char *buf,
+		size_t len, unsigned char *strong)
+{
+	digest_ctx_t ctx;
+	unsigned char digest[DIGEST_MAXBYTES];
+
+	digest_init(&ctx, sig->digest);
+	digest_update(&ctx, buf, len);
+	digest_final(&ctx, digest);
+
+	memcpy(strong, digest, DELTA_STRONGBYTES);
+}
+
+static
+size_t delta_blocklen(const delta_sig_t *sig, uint32_t i)
+{
+	uint64_t off = (uint64_t) i * sig->blocksize;
+
+	return sig->size - off < sig->blocksize ? sig->size - off : sig->blocksize;
+}
+
+/* map a whole file; empty files are represented by a NULL mapping */
+static
+int delta_map(int fd, int prot, void **map, uint64_t *size)
+{
+	struct stat sb;
+
+	*map = NULL;
+
+	if (fstat(fd, &sb) == -1)
+		return -1;
+
+	*size = sb.st_size;
+
+	if (*size == 0)
+		return 0;
+
+	if ((uint64_t) (size_t) *size != *size)
+		return errno = EFBIG, -1;
+
+	*map = mmap(NULL, *size, prot, MAP_SHARED, fd, 0);
+
+	if (*map == MAP_FAILED)
+		return *map = NULL, -1;
+
+	madvise(*map, *size, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+int delta_sig_fd(delta_sig_t *sig, int fd, size_t blocksize,
+		const digest_t *digest)
+{
+	void *map;
+	uint32_t i, j, a, b, h, nbuckets;
+	uint64_t nblocks;
+	delta_block_t *blk;
+	size_t len;
+
+	memset(sig, 0, sizeof(*sig));
+
+	sig->blocksize = blocksize ? blocksize : DELTA_BLOCKSIZE;
+	sig->digest    = digest ? digest : &digest_whirlpool;
+
+	/* the block size is stored in 32 bits */
+	if (sig->blocksize > UINT32_MAX)
+		return errno = EINVAL, -1;
+
+	if (delta_map(fd, PROT_READ, &map, &sig->size) == -1)
+		return -1;
+
+	nblocks = (sig->size + sig->blocksize - 1) / sig->blocksize;
+
+	if (nblocks > UINT32_MAX / 2) {
+		munmap(map, sig->size);
+		return errno = EFBIG, -1;
+	}
+
+	sig->nblocks = nblocks;
+
+	for (nbuckets = 16; nbuckets < 2 * sig->nblocks; nbuckets <<= 1);
+
+	sig->mask    = nbuckets - 1;
+	sig->blocks  = calloc(sig->nblocks ? sig->nblocks : 1, sizeof(delta_block_t));
+	sig->buckets = calloc(nbuckets, sizeof(uint32_t));
+
+	if (!sig->blocks || !sig->buckets) {
+		if (map)
+			munmap(map, sig->size);
+		delta_sig_free(sig);
+		return errno = ENOMEM, -1;
+	}
+
+	for (i = 0; i < sig->nblocks; i++) {
+		blk = &sig->blocks[i];
+		len = delta_blocklen(sig, i);
+
+		blk->weak = delta_weak((unsigned char *) map + (uint64_t) i * sig->blocksize,
+				len, &a, &b);
+		delta_strong(sig, (unsigned char *) map + (uint64_t) i * sig->blocksize,
+				len, blk->strong);
+
+		/* identical blocks are only chained once to keep chains short for
+		 * repetitive data such as zero-filled images; buckets and chain
+		 * links store block index + 1 */
+		h = delta_bucket(sig, blk->weak);
+
+		for (j = sig->buckets[h]; j; j = sig->blocks[j - 1].next)
+			if (sig->blocks[j - 1].weak == blk->weak &&
+					delta_blocklen(sig, j - 1) == len &&
+					!memcmp(sig->blocks[j - 1].strong, blk->strong,
+					        DELTA_STRONGBYTES))
+				break;
+
+		if (j == 0) {
+			blk->next = sig->buckets[h];
+			sig->buckets[h] = i + 1;
+		}
+	}
+
+	if (map)
+		munmap(map, sig->size);
+
+	return 0;
+}
+
+void delta_sig_free(delta_sig_t *sig)
+{
+	free(sig->blocks);
+	free(sig->buckets);
+
+	sig->blocks  = NULL;
+	sig->buckets = NULL;
+}
+
+/* find an old block matching the window at pos of the new file; returns
+ * block index + 1 or 0 if there is none */
+static
+uint32_t delta_match(const delta_sig_t *sig, const unsigned char *buf,
+		uint64_t pos, size_t len, uint32_t weak, uint64_t next, int flags)
+{
+	unsigned char strong[DELTA_STRONGBYTES];
+	uint32_t i, j, found = 0;
+	uint64_t src;
+	int have_strong = 0;
+
+	/* prefer the block continuing the previous copy, then the block at the
+	 * same offset, both of which merge into longer copies or no I/O */
+	uint64_t want[2] = { next, pos };
+
+	for (i = 0; i < 2; i++) {
+		if (want[i] % sig->blocksize || want[i] / sig->blocksize >= sig->nblocks)
+			continue;
+
+		if ((flags & DELTA_INPLACE) && want[i] < pos)
+			continue;
+
+		j = want[i] / sig->blocksize;
+
+		if (sig->blocks[j].weak != weak || delta_blocklen(sig, j) != len)
+			continue;
+
+		if (!have_strong++)
+			delta_strong(sig, buf + pos, len, strong);
+
+		if (!memcmp(sig->blocks[j].strong, strong, DELTA_STRONGBYTES))
+			return j + 1;
+	}
+
+	for (j = sig->buckets[delta_bucket(sig, weak)]; j && !found;
+			j = sig->blocks[j - 1].next) {
+		src = (uint64_t) (j - 1) * sig->blocksize;
+
+		if (sig->blocks[j - 1].weak != weak ||
+				delta_blocklen(sig, j - 1) != len)
+			continue;
+
+		if ((flags & DELTA_INPLACE) && src < pos)
+			continue;
+
+		if (!have_strong++)
+			delta_strong(sig, buf + pos, len, strong);
+
+		if (!memcmp(sig->blocks[j - 1].strong, strong, DELTA_STRONGBYTES))
+			found = j;
+	}
+
+	return found;
+}
+
+int delta_fd(const delta_sig_t *sig, int fd, int deltafd, int flags)
+{
+	delta_out_t *out;
+	void *map;
+	unsigned char *buf, hdr[DELTA_HDRSIZE];
+	uint64_t size, pos = 0, lit = 0, copy_src = 0, copy_len = 0;
+	uint32_t a, b, weak = 0, j;
+	size_t bs = sig->blocksize, taillen;
+	int errno_orig, rc = -1;
+
+	if (!(out = malloc(sizeof(*out))))
+		return -1;
+
+	out->fd  = deltafd;
+	out->len = 0;
+
+	if (delta_map(fd, PROT_READ, &map, &size) == -1) {
+		free(out);
+		return -1;
+	}
+
+	buf = map;
+
+	memcpy(hdr, DELTA_MAGIC, 8);
+	put32(hdr + 8, DELTA_VERSION);
+	put32(hdr + 12, flags & DELTA_INPLACE);
+	put32(hdr + 16, bs);
+	put64(hdr + 20, size);
+
+	if (delta_out(out, hdr, sizeof(hdr)) == -1)
+		goto out;
+
+	/* the last old block may be shorter and can only match at the end */
+	taillen = sig->nblocks ? delta_blocklen(sig, sig->nblocks - 1) : 0;
+
+	if (size >= bs)
+		weak = delta_weak(buf, bs, &a, &b);
+
+	while (pos < size) {
+		if (size - pos >= bs)
+			j = delta_match(sig, buf, pos, bs, weak,
+					copy_src + copy_len, flags);
+		else if (size - pos == taillen && taillen < bs)
+			j = delta_match(sig, buf, pos, taillen,
+					delta_weak(buf + pos, taillen, &a, &b),
+					copy_src + copy_len, flags);
+		else
+			j = 0;
+
+		if (j) {
+			uint64_t src = (uint64_t) (j - 1) * bs;
+			size_t len = delta_blocklen(sig, j - 1);
+
+			/* merge with the previous copy if nothing lies in between */
+			if (lit == pos && copy_len > 0 && copy_src + copy_len == src)
+				copy_len += len;
+
+			else {
+				if (delta_out_copy(out, copy_src, copy_len) == -1 ||
+						delta_out_insert(out, buf + lit, pos - lit) == -1)
+					goto out;
+
+				copy_src = src;
+				copy_len = len;
+			}
+
+			pos += len;
+			lit  = pos;
+
+			if (size - pos >= bs)
+				weak = delta_weak(buf + pos, bs, &a, &b);
+
+			continue;
+		}
+
+		if (size - pos > bs) {
+			/* roll the checksum one byte forward */
+			a = a - buf[pos] + buf[pos + bs];
+			b = b - bs * buf[pos] + a;
+			weak = (a & 0xffff) | (b << 16);
+			pos++;
+			continue;
+		}
+
+		/* no more full windows, but the short last block may still match */
+		if (taillen < bs && size - pos > taillen) {
+			pos = size - taillen;
+			continue;
+		}
+
+		break;
+	}
+
+	if (delta_out_copy(out, copy_src, copy_len) == -1 ||
+			delta_out_insert(out, buf + lit, size - lit) == -1)
+		goto out;
+
+	hdr[0] = DELTA_OP_END;
+
+	if (delta_out(out, hdr, 1) == -1 || delta_out_flush(out) == -1)
+		goto out;
+
+	rc = 0;
+
+out:
+	errno_orig = errno;
+
+	if (map)
+		munmap(map, size);
+
+	free(out);
+
+	errno = errno_orig;
+	return rc;
+}
+
+/* apply a delta; with oldmap set the new file is written sequentially to
+ * newfd, otherwise fd is patched in place */
+static
+int delta_apply(const unsigned char *oldmap, uint64_t oldsize,
+		int fd, int deltafd, int inplace)
+{
+	unsigned char hdr[DELTA_HDRSIZE], op[17], *buf;
+	uint64_t newsize, pos = 0, src, len;
+	size_t n;
+	int errno_orig, rc = -1;
+
+	if (delta_read(deltafd, hdr, sizeof(hdr)) == -1)
+		return -1;
+
+	if (memcmp(hdr, DELTA_MAGIC, 8) || get32(hdr + 8) != DELTA_VERSION)
+		return errno = EINVAL, -1;
+
+	if (inplace && !(get32(hdr + 12) & DELTA_INPLACE))
+		return errno = EINVAL, -1;
+
+	newsize = get64(hdr + 20);
+
+	if (!(buf = malloc(DELTA_IOSIZE)))
+		return -1;
+
+	for (;;) {
+		if (delta_read(deltafd, op, 1) == -1)
+			goto out;
+
+		if (op[0] == DELTA_OP_END)
+			break;
+
+		switch (op[0]) {
+		case DELTA_OP_COPY:
+			if (delta_read(deltafd, op + 1, 16) == -1)
+				goto out;
+
+			src = get64(op + 1);
+			len = get64(op + 9);
+
+			if (src > oldsize || len > oldsize - src ||
+					len > newsize - pos ||
+					(inplace && src < pos)) {
+				errno = EINVAL;
+				goto out;
+			}
+
+			/* unchanged data is not touched at all */
+			if (inplace && src == pos)
+				break;
+
+			if (!inplace) {
+				if (delta_write(fd, oldmap + src, len) == -1)
+					goto out;
+				break;
+			}
+
+			/* the source lies ahead of the destination and is copied
+			 * forward, so it is read before it gets overwritten */
+			for (n = 0; n < len; n += DELTA_IOSIZE) {
+				size_t m = len - n > DELTA_IOSIZE ? DELTA_IOSIZE : len - n;
+
+				memcpy(buf, oldmap + src + n, m);
+
+				if (delta_pwrite(fd, buf, m, pos + n) == -1)
+					goto out;
+			}
+
+			break;
+
+		case DELTA_OP_INSERT:
+			if (delta_read(deltafd, op + 1, 4) == -1)
+				goto out;
+
+			len = get32(op + 1);
+
+			if (len > newsize - pos) {
+				errno = EINVAL;
+				goto out;
+			}
+
+			for (n = 0; n < len; n += DELTA_IOSIZE) {
+				size_t m = len - n > DELTA_IOSIZE ? DELTA_IOSIZE : len - n;
+
+				if (delta_read(deltafd, buf, m) == -1)
+					goto out;
+
+				if (inplace ? delta_pwrite(fd, buf, m, pos + n) :
+						delta_write(fd, buf, m))
+					goto out;
+			}
+
+			break;
+
+		default:
+			errno = EINVAL;
+			goto out;
+		}
+
+		pos += len;
+	}
+
+	if (pos != newsize) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	if (inplace && ftruncate(fd, newsize) == -1)
+		goto out;
+
+	rc = 0;
+
+out:
+	errno_orig = errno;
+	free(buf);
+	errno = errno_orig;
+	return rc;
+}
+
+int delta_patch(int oldfd, int deltafd, int newfd)
+{
+	void *map;
+	uint64_t size;
+	int rc, errno_orig;
+
+	if (delta_map(oldfd, PROT_READ, &map, &size) == -1)
+		return -1;
+
+	rc = delta_apply(map, size, newfd, deltafd, 0);
+
+	errno_orig = errno;
+
+	if (map)
+		munmap(map, size);
+
+	errno = errno_orig;
+	return rc;
+}
+
+int delta_patch_inplace(int fd, int deltafd)
+{
+	void *map;
+	uint64_t size;
+	int rc, errno_orig;
+
+	if (delta_map(fd, PROT_READ, &map, &size) == -1)
+		return -1;
+
+	rc = delta_apply(map, size, fd, deltafd, 1);
+
+	errno_orig = errno;
+
+	if (map)
+		munmap(map, size);
+
+	errno = errno_orig;
+	return rc;
+}
@@ -0,0 +1,380 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+#include <string.h>
+
+#include "digest.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2 1
+#include <cpuid.h>
+#endif
+
+#define CHUNK_START (1 << 0)
+#define CHUNK_END   (1 << 1)
+#define PARENT      (1 << 2)
+#define ROOT        (1 << 3)
+
+/* number of chunks compressed in parallel */
+#define LANES 8
+
+static const uint32_t IV[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint8_t SCHEDULE[7][16] = {
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+	{  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+	{ 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+	{ 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+	{  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+	{ 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 },
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* the quarter round works on scalars and vectors alike */
+#define G(v, a, b, c, d, x, y) do { \
+	v[a] = v[a] + v[b] + (x); \
+	v[d] = ROTR(v[d] ^ v[a], 16); \
+	v[c] = v[c] + v[d]; \
+	v[b] = ROTR(v[b] ^ v[c], 12); \
+	v[a] = v[a] + v[b] + (y); \
+	v[d] = ROTR(v[d] ^ v[a], 8); \
+	v[c] = v[c] + v[d]; \
+	v[b] = ROTR(v[b] ^ v[c], 7); \
+} while (0)
+
+#define ROUNDS(v, m) do { \
+	int r; \
+	for (r = 0; r < 7; r++) { \
+		const uint8_t *s = SCHEDULE[r]; \
+		G(v, 0, 4,  8, 12, m[s[ 0]], m[s[ 1]]); \
+		G(v, 1, 5,  9, 13, m[s[ 2]], m[s[ 3]]); \
+		G(v, 2, 6, 10, 14, m[s[ 4]], m[s[ 5]]); \
+		G(v, 3, 7, 11, 15, m[s[ 6]], m[s[ 7]]); \
+		G(v, 0, 5, 10, 15, m[s[ 8]], m[s[ 9]]); \
+		G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]); \
+		G(v, 2, 7,  8, 13, m[s[12]], m[s[13]]); \
+		G(v, 3, 4,  9, 14, m[s[14]], m[s[15]]); \
+	} \
+} while (0)
+
+static inline
+uint32_t load32(const uint8_t *p)
+{
+	return ((uint32_t) p[0]      ) | ((uint32_t) p[1] <<  8) |
+	       ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static
+void __blake3_compress(const uint32_t cv[8], const uint32_t m[16],
+		uint32_t len, uint64_t counter, uint32_t flags, uint32_t out[8])
+{
+	uint32_t v[16];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		v[i] = cv[i];
+
+	v[ 8] = IV[0];
+	v[ 9] = IV[1];
+	v[10] = IV[2];
+	v[11] = IV[3];
+	v[12] = (uint32_t) counter;
+	v[13] = (uint32_t) (counter >> 32);
+	v[14] = len;
+	v[15] = flags;
+
+	ROUNDS(v, m);
+
+	for (i = 0; i < 8; i++)
+		out[i] = v[i] ^ v[i + 8];
+}
+
+static
+void __blake3_compress_block(const uint32_t cv[8], const uint8_t *block,
+		uint32_t len, uint64_t counter, uint32_t flags, uint32_t out[8])
+{
+	uint32_t m[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = load32(block + 4 * i);
+
+	__blake3_compress(cv, m, len, counter, flags, out);
+}
+
+static
+void __blake3_parent(const uint32_t left[8], const uint32_t right[8],
+		uint32_t flags, uint32_t out[8])
+{
+	uint32_t m[16];
+
+	memcpy(m, left, 32);
+	memcpy(m + 8, right, 32);
+
+	__blake3_compress(IV, m, 64, 0, PARENT|flags, out);
+}
+
+typedef uint32_t u32xN __attribute__((vector_size(4 * LANES)));
+
+/* compress LANES complete chunks at once, one chunk per vector lane */
+static inline __attribute__((always_inline))
+void __blake3_hash_chunks_body(const uint8_t *src, uint64_t counter,
+		uint32_t out[LANES][8])
+{
+	u32xN h[8], v[16], m[16], lo, hi;
+	uint32_t flags;
+	int b, i, l;
+
+	for (i = 0; i < 8; i++)
+		for (l = 0; l < LANES; l++)
+			h[i][l] = IV[i];
+
+	for (l = 0; l < LANES; l++) {
+		lo[l] = (uint32_t) (counter + l);
+		hi[l] = (uint32_t) ((counter + l) >> 32);
+	}
+
+	for (b = 0; b < BLAKE3_CHUNKBYTES / 64; b++) {
+		for (i = 0; i < 16; i++)
+			for (l = 0; l < LANES; l++)
+				m[i][l] = load32(src + l * BLAKE3_CHUNKBYTES + b * 64 + 4 * i);
+
+		flags = (b == 0 ? CHUNK_START : 0) |
+		        (b == BLAKE3_CHUNKBYTES / 64 - 1 ? CHUNK_END : 0);
+
+		for (i = 0; i < 8; i++)
+			v[i] = h[i];
+
+		for (l = 0; l < LANES; l++) {
+			v[ 8][l] = IV[0];
+			v[ 9][l] = IV[1];
+			v[10][l] = IV[2];
+			v[11][l] = IV[3];
+			v[14][l] = 64;
+			v[15][l] = flags;
+		}
+
+		v[12] = lo;
+		v[13] = hi;
+
+		ROUNDS(v, m);
+
+		for (i = 0; i < 8; i++)
+			h[i] = v[i] ^ v[i + 8];
+	}
+
+	for (l = 0; l < LANES; l++)
+		for (i = 0; i < 8; i++)
+			out[l][i] = h[i][l];
+}
+
+typedef void __blake3_hash_chunks_t(const uint8_t *src, uint64_t counter,
+		uint32_t out[LANES][8]);
+
+static
+void __blake3_hash_chunks_generic(const uint8_t *src, uint64_t counter,
+		uint32_t out[LANES][8])
+{
+	__blake3_hash_chunks_body(src, counter, out);
+}
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+static
+void __blake3_hash_chunks_avx2(const uint8_t *src, uint64_t counter,
+		uint32_t out[LANES][8])
+{
+	__blake3_hash_chunks_body(src, counter, out);
+}
+
+static
+__blake3_hash_chunks_t *__blake3_select(void)
+{
+	unsigned int a, b, c, d;
+
+	/* AVX state must be enabled by the operating system */
+	if (!__get_cpuid(1, &a, &b, &c, &d) ||
+			(c & (bit_OSXSAVE|bit_AVX)) != (bit_OSXSAVE|bit_AVX))
+		return __blake3_hash_chunks_generic;
+
+	__asm__ ("xgetbv" : "=a" (a), "=d" (d) : "c" (0));
+
+	if ((a & 6) != 6)
+		return __blake3_hash_chunks_generic;
+
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & bit_AVX2))
+		return __blake3_hash_chunks_generic;
+
+	return __blake3_hash_chunks_avx2;
+}
+#else
+static
+__blake3_hash_chunks_t *__blake3_select(void)
+{
+	return __blake3_hash_chunks_generic;
+}
+#endif
+
+static
+void __blake3_hash_chunks(const uint8_t *src, uint64_t counter,
+		uint32_t out[LANES][8])
+{
+	static __blake3_hash_chunks_t *hash_chunks = NULL;
+	__blake3_hash_chunks_t *fn = __atomic_load_n(&hash_chunks, __ATOMIC_RELAXED);
+
+	/* racing initializers store the same pointer */
+	if (!fn) {
+		fn = __blake3_select();
+		__atomic_store_n(&hash_chunks, fn, __ATOMIC_RELAXED);
+	}
+
+	fn(src, counter, out);
+}
+
+/* add the chaining value of a completed chunk to the tree and merge all
+ * subtrees completed by it; chunks is the total number of chunks so far */
+static
+void __blake3_push(blake3_t *ctx, const uint32_t cv[8], uint64_t chunks)
+{
+	uint32_t merged[8];
+
+	memcpy(merged, cv, 32);
+
+	while ((chunks & 1) == 0) {
+		ctx->depth--;
+		__blake3_parent(ctx->stack[ctx->depth], merged, 0, merged);
+		chunks >>= 1;
+	}
+
+	memcpy(ctx->stack[ctx->depth], merged, 32);
+	ctx->depth++;
+}
+
+static
+void __blake3_init(void *state)
+{
+	blake3_t *ctx = state;
+
+	memcpy(ctx->cv, IV, sizeof(IV));
+	ctx->chunk  = 0;
+	ctx->pos    = 0;
+	ctx->blocks = 0;
+	ctx->depth  = 0;
+}
+
+static
+void __blake3_update(void *state, const void *_src, size_t len)
+{
+	blake3_t *ctx = state;
+	const uint8_t *src = _src;
+	uint32_t cvs[LANES][8];
+	size_t n;
+	int l;
+
+	while (len > 0) {
+		/* the current chunk is complete and more input follows */
+		if (ctx->blocks == BLAKE3_CHUNKBYTES / 64 - 1 && ctx->pos == 64) {
+			__blake3_compress_block(ctx->cv, ctx->buf, 64, ctx->chunk,
+					(ctx->blocks == 0 ? CHUNK_START : 0)|CHUNK_END, ctx->cv);
+
+			__blake3_push(ctx, ctx->cv, ++ctx->chunk);
+
+			memcpy(ctx->cv, IV, sizeof(IV));
+			ctx->pos    = 0;
+			ctx->blocks = 0;
+		}
+
+		/* compress whole chunks in parallel, but never the last one since
+		 * it might have to be finalized as root */
+		if (ctx->pos == 0 && ctx->blocks == 0 &&
+				len > LANES * BLAKE3_CHUNKBYTES) {
+			__blake3_hash_chunks(src, ctx->chunk, cvs);
+
+			for (l = 0; l < LANES; l++)
+				__blake3_push(ctx, cvs[l], ++ctx->chunk);
+
+			src += LANES * BLAKE3_CHUNKBYTES;
+			len -= LANES * BLAKE3_CHUNKBYTES;
+			continue;
+		}
+
+		/* the block buffer is full and more input follows */
+		if (ctx->pos == 64) {
+			__blake3_compress_block(ctx->cv, ctx->buf, 64, ctx->chunk,
+					ctx->blocks == 0 ? CHUNK_START : 0, ctx->cv);
+
+			ctx->blocks++;
+			ctx->pos = 0;
+		}
+
+		n = 64 - ctx->pos;
+
+		if (len < n)
+			n = len;
+
+		memcpy(ctx->buf + ctx->pos, src, n);
+		ctx->pos += n;
+		src += n;
+		len -= n;
+	}
+}
+
+static
+void __blake3_final(void *state, unsigned char *digest)
+{
+	blake3_t *ctx = state;
+	uint32_t flags, out[8];
+	int i;
+
+	flags = (ctx->blocks == 0 ? CHUNK_START : 0)|CHUNK_END;
+
+	memset(ctx->buf + ctx->pos, 0, 64 - ctx->pos);
+
+	if (ctx->depth == 0)
+		__blake3_compress_block(ctx->cv, ctx->buf, ctx->pos, ctx->chunk,
+				flags|ROOT, out);
+
+	else {
+		__blake3_compress_block(ctx->cv, ctx->buf, ctx->pos, ctx->chunk,
+				flags, out);
+
+		for (i = ctx->depth - 1; i > 0; i--)
+			__blake3_parent(ctx->stack[i], out, 0, out);
+
+		__blake3_parent(ctx->stack[0], out, ROOT, out);
+	}
+
+	for (i = 0; i < 8; i++) {
+		digest[4*i    ] = (uint8_t) (out[i]      );
+		digest[4*i + 1] = (uint8_t) (out[i] >>  8);
+		digest[4*i + 2] = (uint8_t) (out[i] >> 16);
+		digest[4*i + 3] = (uint8_t) (out[i] >> 24);
+	}
+}
+
+const digest_t digest_blake3 = {
+	"blake3",
+	BLAKE3_DIGESTBYTES,
+	__blake3_init,
+	__blake3_update,
+	__blake3_final,
+};
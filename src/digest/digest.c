@@ -0,0 +1,164 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+
+#include "digest.h"
+#include "str.h"
+#include "uio.h"
+
+static
+void __digest_whirlpool_init(void *state)
+{
+	whirlpool_init(state);
+}
+
+static
+void __digest_whirlpool_update(void *state, const void *src, size_t len)
+{
+	whirlpool_add(state, src, (unsigned long) len * 8);
+}
+
+static
+void __digest_whirlpool_final(void *state, unsigned char *digest)
+{
+	whirlpool_finalize(state, digest);
+}
+
+const digest_t digest_whirlpool = {
+	"whirlpool",
+	DIGESTBYTES,
+	__digest_whirlpool_init,
+	__digest_whirlpool_update,
+	__digest_whirlpool_final,
+};
+
+const digest_t *digest_byname(const char *name)
+{
+	static const digest_t *types[] = {
+		&digest_whirlpool,
+		&digest_sha256,
+		&digest_blake3,
+		NULL,
+	};
+
+	int i;
+
+	for (i = 0; types[i]; i++)
+		if (str_equal(types[i]->name, name))
+			return types[i];
+
+	return NULL;
+}
+
+size_t digest_size(const digest_t *type)
+{
+	return type->size;
+}
+
+void digest_init(digest_ctx_t *ctx, const digest_t *type)
+{
+	ctx->type = type;
+	type->init(&ctx->state);
+}
+
+void digest_update(digest_ctx_t *ctx, const void *src, size_t len)
+{
+	ctx->type->update(&ctx->state, src, len);
+}
+
+static
+void __digest_add_chunk(const void *buf, size_t len, void *data)
+{
+	digest_update(data, buf, len);
+}
+
+int digest_add_fd(digest_ctx_t *ctx, int fd)
+{
+	return uio_read_stream(fd, __digest_add_chunk, ctx);
+}
+
+void digest_final(digest_ctx_t *ctx, unsigned char *digest)
+{
+	ctx->type->final(&ctx->state, digest);
+}
+
+char *digest_hex(const digest_t *type, const unsigned char *digest)
+{
+	static const char hexdigits[] = "0123456789ABCDEF";
+	char *buf, *p;
+	size_t i;
+
+	if (!(p = buf = malloc(2 * type->size + 1)))
+		return NULL;
+
+	for (i = 0; i < type->size; i++) {
+		*p++ = hexdigits[digest[i] >> 4];
+		*p++ = hexdigits[digest[i] & 0x0f];
+	}
+
+	*p = '\0';
+
+	return buf;
+}
+
+char *digest_str(const digest_t *type, const char *str)
+{
+	digest_ctx_t ctx;
+	unsigned char digest[DIGEST_MAXBYTES];
+
+	digest_init(&ctx, type);
+	digest_update(&ctx, str, str_len(str));
+	digest_final(&ctx, digest);
+
+	return digest_hex(type, digest);
+}
+
+char *digest_fd(const digest_t *type, int fd)
+{
+	digest_ctx_t ctx;
+	unsigned char digest[DIGEST_MAXBYTES];
+
+	digest_init(&ctx, type);
+
+	if (digest_add_fd(&ctx, fd) == -1)
+		return NULL;
+
+	digest_final(&ctx, digest);
+
+	return digest_hex(type, digest);
+}
+
+char *digest_path(const digest_t *type, const char *path)
+{
+	int fd, errno_orig;
+	char *buf;
+
+	if ((fd = open(path, O_RDONLY|O_NOCTTY)) == -1)
+		return NULL;
+
+	buf = digest_fd(type, fd);
+
+	errno_orig = errno;
+	close(fd);
+	errno = errno_orig;
+
+	return buf;
+}
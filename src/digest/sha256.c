@@ -0,0 +1,280 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+
+#include <string.h>
+
+#include "digest.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define S0(x) (ROTR(x,  2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x) (ROTR(x,  6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define s0(x) (ROTR(x,  7) ^ ROTR(x, 18) ^ ((x) >>  3))
+#define s1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+typedef void __sha256_blocks_t(uint32_t *h, const uint8_t *src, size_t n);
+
+static
+void __sha256_blocks_generic(uint32_t *h, const uint8_t *src, size_t n)
+{
+	uint32_t W[64], a, b, c, d, e, f, g, hh, t1, t2;
+	int i;
+
+	for (; n > 0; n--, src += 64) {
+		for (i = 0; i < 16; i++)
+			W[i] = ((uint32_t) src[4*i    ] << 24) |
+			       ((uint32_t) src[4*i + 1] << 16) |
+			       ((uint32_t) src[4*i + 2] <<  8) |
+			       ((uint32_t) src[4*i + 3]      );
+
+		for (i = 16; i < 64; i++)
+			W[i] = s1(W[i-2]) + W[i-7] + s0(W[i-15]) + W[i-16];
+
+		a = h[0]; b = h[1]; c = h[2]; d = h[3];
+		e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+
+		for (i = 0; i < 64; i++) {
+			t1 = hh + S1(e) + CH(e, f, g) + K[i] + W[i];
+			t2 = S0(a) + MAJ(a, b, c);
+			hh = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+		h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+	}
+}
+
+#ifdef HAVE_SHA_NI
+/* four rounds using the SHA extensions; the message schedule for round
+ * group i+1 is completed while group i is processed */
+#define SHA_NI_ROUNDS(i) do { \
+	MSG    = _mm_add_epi32(M[(i) & 3], _mm_loadu_si128((const __m128i *) &K[4 * (i)])); \
+	STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG); \
+	if ((i) >= 3 && (i) <= 14) { \
+		TMP = _mm_alignr_epi8(M[(i) & 3], M[((i) - 1) & 3], 4); \
+		M[((i) + 1) & 3] = _mm_add_epi32(M[((i) + 1) & 3], TMP); \
+		M[((i) + 1) & 3] = _mm_sha256msg2_epu32(M[((i) + 1) & 3], M[(i) & 3]); \
+	} \
+	MSG    = _mm_shuffle_epi32(MSG, 0x0E); \
+	STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG); \
+	if ((i) >= 1 && (i) <= 12) \
+		M[((i) - 1) & 3] = _mm_sha256msg1_epu32(M[((i) - 1) & 3], M[(i) & 3]); \
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static
+void __sha256_blocks_shani(uint32_t *h, const uint8_t *src, size_t n)
+{
+	const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	                                    0x0405060700010203ULL);
+	__m128i STATE0, STATE1, ABEF, CDGH, MSG, TMP, M[4];
+	int i;
+
+	/* the SHA instructions expect the state as ABEF/CDGH */
+	TMP    = _mm_loadu_si128((const __m128i *) &h[0]);
+	STATE1 = _mm_loadu_si128((const __m128i *) &h[4]);
+
+	TMP    = _mm_shuffle_epi32(TMP, 0xB1);
+	STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);
+	STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+	STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+	for (; n > 0; n--, src += 64) {
+		ABEF = STATE0;
+		CDGH = STATE1;
+
+		for (i = 0; i < 4; i++)
+			M[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+						(const __m128i *) (src + 16 * i)), MASK);
+
+		SHA_NI_ROUNDS(0);  SHA_NI_ROUNDS(1);
+		SHA_NI_ROUNDS(2);  SHA_NI_ROUNDS(3);
+		SHA_NI_ROUNDS(4);  SHA_NI_ROUNDS(5);
+		SHA_NI_ROUNDS(6);  SHA_NI_ROUNDS(7);
+		SHA_NI_ROUNDS(8);  SHA_NI_ROUNDS(9);
+		SHA_NI_ROUNDS(10); SHA_NI_ROUNDS(11);
+		SHA_NI_ROUNDS(12); SHA_NI_ROUNDS(13);
+		SHA_NI_ROUNDS(14); SHA_NI_ROUNDS(15);
+
+		STATE0 = _mm_add_epi32(STATE0, ABEF);
+		STATE1 = _mm_add_epi32(STATE1, CDGH);
+	}
+
+	TMP    = _mm_shuffle_epi32(STATE0, 0x1B);
+	STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+	STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);
+	STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);
+
+	_mm_storeu_si128((__m128i *) &h[0], STATE0);
+	_mm_storeu_si128((__m128i *) &h[4], STATE1);
+}
+
+static
+__sha256_blocks_t *__sha256_select(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1))
+		return __sha256_blocks_generic;
+
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & (1 << 29)))
+		return __sha256_blocks_generic;
+
+	return __sha256_blocks_shani;
+}
+#else
+static
+__sha256_blocks_t *__sha256_select(void)
+{
+	return __sha256_blocks_generic;
+}
+#endif
+
+static
+void __sha256_blocks(uint32_t *h, const uint8_t *src, size_t n)
+{
+	static __sha256_blocks_t *blocks = NULL;
+	__sha256_blocks_t *fn = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+
+	/* racing initializers store the same pointer */
+	if (!fn) {
+		fn = __sha256_select();
+		__atomic_store_n(&blocks, fn, __ATOMIC_RELAXED);
+	}
+
+	fn(h, src, n);
+}
+
+static
+void __sha256_init(void *state)
+{
+	static const uint32_t IV[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	sha256_t *ctx = state;
+
+	memcpy(ctx->h, IV, sizeof(IV));
+	ctx->len = 0;
+	ctx->pos = 0;
+}
+
+static
+void __sha256_update(void *state, const void *_src, size_t len)
+{
+	sha256_t *ctx = state;
+	const uint8_t *src = _src;
+	size_t n;
+
+	ctx->len += len;
+
+	if (ctx->pos > 0) {
+		n = 64 - ctx->pos;
+
+		if (len < n)
+			n = len;
+
+		memcpy(ctx->buf + ctx->pos, src, n);
+		ctx->pos += n;
+		src += n;
+		len -= n;
+
+		if (ctx->pos < 64)
+			return;
+
+		__sha256_blocks(ctx->h, ctx->buf, 1);
+		ctx->pos = 0;
+	}
+
+	/* hash complete blocks directly from the source */
+	if (len >= 64) {
+		n = len / 64;
+		__sha256_blocks(ctx->h, src, n);
+		src += n * 64;
+		len -= n * 64;
+	}
+
+	memcpy(ctx->buf, src, len);
+	ctx->pos = len;
+}
+
+static
+void __sha256_final(void *state, unsigned char *digest)
+{
+	sha256_t *ctx = state;
+	uint64_t bits = ctx->len * 8;
+	int i;
+
+	ctx->buf[ctx->pos++] = 0x80;
+
+	if (ctx->pos > 56) {
+		memset(ctx->buf + ctx->pos, 0, 64 - ctx->pos);
+		__sha256_blocks(ctx->h, ctx->buf, 1);
+		ctx->pos = 0;
+	}
+
+	memset(ctx->buf + ctx->pos, 0, 56 - ctx->pos);
+
+	for (i = 0; i < 8; i++)
+		ctx->buf[56 + i] = (uint8_t) (bits >> (56 - 8 * i));
+
+	__sha256_blocks(ctx->h, ctx->buf, 1);
+
+	for (i = 0; i < 8; i++) {
+		digest[4*i    ] = (uint8_t) (ctx->h[i] >> 24);
+		digest[4*i + 1] = (uint8_t) (ctx->h[i] >> 16);
+		digest[4*i + 2] = (uint8_t) (ctx->h[i] >>  8);
+		digest[4*i + 3] = (uint8_t) (ctx->h[i]      );
+	}
+}
+
+const digest_t digest_sha256 = {
+	"sha256",
+	SHA256_DIGESTBYTES,
+	__sha256_init,
+	__sha256_update,
+	__sha256_final,
+};
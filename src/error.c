@@ -14,138 +14,403 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
 
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "error.h"
+#include "char.h"
 #include "printf.h"
 #include "str.h"
+#include "stralloc.h"
+
+/* a conversion of a format; len is 0 for a plain string */
+typedef struct {
+	const char *start;
+	int len;
+	int stars;      /* number of '*' for width and precision */
+	int prec;       /* precision, or -1 */
+	int pstar;      /* 1 if the precision is the last '*' argument */
+	char length;    /* 'H', 'h', 'l', 'q' for long long, 'L', or 0 */
+	char conv;
+} error_spec_t;
+
+static __thread error_t error_tls;
+
+static pthread_key_t error_key;
+static pthread_once_t error_once = PTHREAD_ONCE_INIT;
+
+static
+void error_tls_free(void *arg)
+{
+	error_free(arg);
+}
 
-error_t ___lucid_error = { { NULL, NULL }, NULL, NULL, 0, 0, NULL };
-error_t *__lucid_error = &___lucid_error;
+static
+void error_key_init(void)
+{
+	pthread_key_create(&error_key, error_tls_free);
+}
+
+error_t *error_stack(void)
+{
+	return &error_tls;
+}
 
 void error_init(error_t *err)
 {
-	INIT_LIST_HEAD(&(err->list));
+	err->count   = 0;
+	err->dropped = 0;
+	err->frames  = NULL;
 }
 
-void error_push(error_t *err, const char *file, int line, const char *func,
-		int errnum, const char *fmt, ...)
+/* parse the conversion at *fmt; returns 0 at the end of the format */
+static
+int error_spec(const char **fmt, error_spec_t *spec)
 {
-	if (!err->list.next)
-		error_init(err);
+	const char *p = *fmt;
 
-	error_t *new = malloc(sizeof(error_t));
+	spec->start = p;
+	spec->len   = 0;
 
-	new->file   = file;
-	new->func   = func;
-	new->line   = line;
-	new->errnum = errnum;
+	while (*p && (*p != '%' || p[1] == '%'))
+		p += *p == '%' ? 2 : 1;
+
+	if (p > spec->start) {
+		*fmt = p;
+		return 1;
+	}
 
-	if (fmt == NULL)
-		new->msg = NULL;
+	if (!*p)
+		return 0;
 
-	else {
-		char *buf;
+	spec->stars  = 0;
+	spec->prec   = -1;
+	spec->pstar  = 0;
+	spec->length = 0;
+
+	for (p++; *p && strchr("-+ #0'", *p); p++);
+
+	if (*p == '*') {
+		spec->stars++;
+		p++;
+	} else {
+		while (char_isdigit(*p))
+			p++;
+	}
 
-		va_list ap;
-		va_start(ap, fmt);
-		_lucid_vasprintf(&buf, fmt, ap);
-		va_end(ap);
+	if (*p == '.') {
+		p++;
+
+		if (*p == '*') {
+			spec->stars++;
+			spec->pstar = 1;
+			p++;
+		} else {
+			for (spec->prec = 0; char_isdigit(*p); p++)
+				spec->prec = spec->prec * 10 + *p - '0';
+		}
+	}
 
-		new->msg = buf;
+	switch (*p) {
+	case 'h':
+		spec->length = p[1] == 'h' ? 'H' : 'h';
+		p += spec->length == 'H' ? 2 : 1;
+		break;
+
+	case 'l':
+		spec->length = p[1] == 'l' ? 'q' : 'l';
+		p += spec->length == 'q' ? 2 : 1;
+		break;
+
+	case 'q': case 'j': case 'z': case 't':
+		spec->length = 'q';
+		p++;
+		break;
+
+	case 'L':
+		spec->length = 'L';
+		p++;
+		break;
 	}
 
-	list_add(&(new->list), &(err->list));
+	spec->conv = *p;
+	spec->len  = *p ? p + 1 - spec->start : p - spec->start;
+
+	*fmt = *p ? p + 1 : p;
+
+	return 1;
 }
 
-bool error_empty(error_t *err)
+/* class of the argument of a conversion, or 0 if it cannot be stored */
+static
+char error_spec_type(const error_spec_t *spec)
 {
-	if (!err->list.next)
-		error_init(err);
+	switch (spec->conv) {
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+		return spec->length == 'q' ? 'q' : spec->length == 'l' ? 'l' :
+			spec->length == 'L' ? 0 : 'i';
+
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		return spec->length == 'L' ? 0 : 'd';
+
+	case 's':
+		return spec->length ? 0 : 's';
+
+	case 'p':
+		return 'p';
 
-	return list_empty(&(err->list));
+	default:
+		return 0;
+	}
 }
 
-error_t *error_pop(error_t *err)
+/* store the arguments of a format in a frame; returns -1 if they cannot be
+ * stored */
+static
+int error_capture(error_frame_t *frame, const char *fmt, va_list ap)
 {
-	if (!err->list.next)
-		error_init(err);
+	error_spec_t spec;
+	const char *str;
+	size_t off = 0, len;
+	char type;
+	int i, n = 0, prec;
+
+	while (error_spec(&fmt, &spec)) {
+		if (spec.len == 0)
+			continue;
+
+		if (!(type = error_spec_type(&spec)) || n + spec.stars >= ERROR_ARGS)
+			return -1;
+
+		for (i = 0; i < spec.stars; i++) {
+			frame->types[n] = 'i';
+			frame->args[n++].i = va_arg(ap, int);
+		}
+
+		frame->types[n] = type;
+
+		switch (type) {
+		case 'i': frame->args[n].i = va_arg(ap, int); break;
+		case 'l': frame->args[n].i = va_arg(ap, long); break;
+		case 'q': frame->args[n].i = va_arg(ap, long long); break;
+		case 'd': frame->args[n].d = va_arg(ap, double); break;
+		case 'p': frame->args[n].p = va_arg(ap, void *); break;
+
+		/* strings are copied, as far as they are printed */
+		case 's':
+			if (!(str = va_arg(ap, const char *))) {
+				frame->args[n].p = NULL;
+				break;
+			}
+
+			/* the string need not be terminated within its
+			 * precision, which may have been captured just now */
+			prec = spec.pstar ? (int) frame->args[n - 1].i : spec.prec;
+			len  = prec >= 0 ? strnlen(str, prec) : str_len(str);
+
+			if (len > ERROR_STRMAX - 1 - off)
+				len = ERROR_STRMAX - 1 - off;
+
+			memcpy(frame->strs + off, str, len);
+			frame->strs[off + len] = '\0';
+			frame->args[n].p = frame->strs + off;
+			off += len + 1;
+
+			if (off >= ERROR_STRMAX)
+				off = ERROR_STRMAX - 1;
+			break;
+		}
 
-	error_t *top;
-	list_t *pos;
+		n++;
+	}
 
-	if (error_empty(err))
-		return NULL;
+	frame->nargs = n;
 
-	pos = err->list.next;
-	top = list_entry(pos, error_t, list);
+	return 0;
+}
 
-	list_del(pos);
-	return top;
+void error_push(error_t *err, const char *file, int line, const char *func,
+		int errnum, const char *fmt, ...)
+{
+	error_frame_t *frame;
+	va_list ap, aq;
+
+	if (!err->frames) {
+		if (!(err->frames = malloc(ERROR_FRAMES * sizeof(error_frame_t)))) {
+			err->dropped++;
+			return;
+		}
+
+		/* the pool of a thread is released when the thread exits */
+		if (err == &error_tls) {
+			pthread_once(&error_once, error_key_init);
+			pthread_setspecific(error_key, err);
+		}
+	}
+
+	/* the frames below the top, and so the cause, are kept */
+	if (err->count == ERROR_FRAMES)
+		err->dropped++;
+	else
+		err->count++;
+
+	frame = &err->frames[err->count - 1];
+
+	frame->file   = file;
+	frame->func   = func;
+	frame->line   = line;
+	frame->errnum = errnum;
+	frame->fmt    = fmt;
+	frame->nargs  = 0;
+	frame->strs[0] = '\0';
+
+	if (!fmt)
+		return;
+
+	va_start(ap, fmt);
+	va_copy(aq, ap);
+
+	/* formats that cannot be stored are rendered now */
+	if (error_capture(frame, fmt, ap) == -1) {
+		_lucid_vsnprintf(frame->strs, ERROR_STRMAX, fmt, aq);
+		frame->fmt = NULL;
+	}
+
+	va_end(aq);
+	va_end(ap);
 }
 
-void error_free_node(error_t *err)
+bool error_empty(error_t *err)
 {
-	if (err->msg) free(err->msg);
-	free(err);
+	return err->count == 0 && err->dropped == 0;
 }
 
-void error_free(error_t *err)
+error_frame_t *error_pop(error_t *err)
 {
-	if (!err->list.next)
-		error_init(err);
+	if (err->count == 0)
+		return NULL;
 
+	return &err->frames[--err->count];
+}
+
+void error_reset(error_t *err)
+{
+	err->count   = 0;
+	err->dropped = 0;
+}
+
+void error_free(error_t *err)
+{
 	int errno_orig = errno;
-	error_t *p;
-	list_t *pos, *tmp;
 
-	list_for_each_safe(pos, tmp, &(err->list)) {
-		p = list_entry(pos, error_t, list);
-		list_del(pos);
-		error_free_node(p);
-	}
+	free(err->frames);
+	error_init(err);
 
 	errno = errno_orig;
 }
 
 int error_count(error_t *err)
 {
-	if (!err->list.next)
-		error_init(err);
+	return err->count;
+}
 
-	list_t *pos;
-	int count = 0;
+#define ERROR_CATF(val) \
+	(spec.stars == 0 ? stralloc_catf(sa, buf, val) : \
+	 spec.stars == 1 ? stralloc_catf(sa, buf, (int) w[0], val) : \
+	 stralloc_catf(sa, buf, (int) w[0], (int) w[1], val))
 
-	list_for_each(pos, &(err->list))
-		count++;
+/* render the message of a frame */
+static
+int error_render(const error_frame_t *frame, stralloc_t *sa)
+{
+	error_spec_t spec;
+	const char *fmt = frame->fmt;
+	long long w[2];
+	char buf[32];
+	int i, n = 0;
+
+	if (!fmt)
+		return stralloc_cats(sa, frame->strs);
+
+	while (error_spec(&fmt, &spec)) {
+		if (spec.len == 0) {
+			for (; spec.start < fmt; spec.start++) {
+				if (stralloc_catb(sa, spec.start, 1) == -1)
+					return -1;
+
+				if (*spec.start == '%')
+					spec.start++;
+			}
+
+			continue;
+		}
+
+		for (i = 0; i < spec.stars; i++)
+			w[i] = frame->args[n++].i;
+
+		/* the stored values are passed with the length they were read */
+		if (spec.len >= (int) sizeof(buf) - 2)
+			return errno = EINVAL, -1;
+
+		memcpy(buf, spec.start, spec.len);
+
+		if (spec.length == 'q') {
+			for (i = spec.len - 2; strchr("hlqjzt", buf[i]); i--);
+			buf[i + 1] = 'l';
+			buf[i + 2] = 'l';
+			buf[i + 3] = spec.conv;
+			buf[i + 4] = '\0';
+		} else {
+			buf[spec.len] = '\0';
+		}
+
+		switch (frame->types[n]) {
+		case 'i': i = ERROR_CATF((int) frame->args[n].i); break;
+		case 'l': i = ERROR_CATF((long) frame->args[n].i); break;
+		case 'q': i = ERROR_CATF(frame->args[n].i); break;
+		case 'd': i = ERROR_CATF(frame->args[n].d); break;
+		default:  i = ERROR_CATF(frame->args[n].p); break;
+		}
+
+		if (i == -1)
+			return -1;
+
+		n++;
+	}
 
-	return count;
+	return 0;
 }
 
-char *error_describe(error_t *err, const char *prefix)
+char *error_describe(const error_frame_t *frame, const char *prefix)
 {
+	stralloc_t msg;
 	char *buf    = NULL,
 		 *errmsg = NULL,
 		 *errstr = NULL,
-		 *file   = str_path_basename(err->file);
+		 *file   = str_path_basename(frame->file);
 
-	if (err->msg) {
-		char *flat = str_flatten(err->msg);
+	stralloc_init(&msg);
+
+	if ((frame->fmt || frame->strs[0]) && error_render(frame, &msg) != -1 &&
+			stralloc_catb(&msg, "", 1) != -1) {
+		char *flat = str_flatten(msg.s);
 		asprintf(&errmsg, "\n%10s%s", "", flat);
 	}
 
-	if (err->errnum > 0)
+	if (frame->errnum > 0)
 		asprintf(&errstr, "\n%10serrno = %d: %s", "",
-				err->errnum, strerror(err->errnum));
+				frame->errnum, strerror(frame->errnum));
 
 	asprintf(&buf, "%s %s (%s:%d):%s%s",
-			prefix, err->func, file, err->line,
+			prefix, frame->func, file, frame->line,
 			errmsg ? errmsg : "",
 			errstr ? errstr : "");
 
 	if (errmsg) free(errmsg);
 	if (errstr) free(errstr);
+	stralloc_free(&msg);
 	free(file);
 
 	return buf;
@@ -153,7 +418,7 @@ char *error_describe(error_t *err, const char *prefix)
 
 void error_print_trace(error_t *err, int fd)
 {
-	error_t *next = NULL, *cur = error_pop(err);
+	error_frame_t *next = NULL, *cur = error_pop(err);
 	assert(cur != NULL);
 
 	dprintf(fd, "FATAL: caught runtime error\n");
@@ -161,7 +426,9 @@ void error_print_trace(error_t *err, int fd)
 	char *desc = error_describe(cur, "in  ");
 	dprintf(fd, "%s\n", desc);
 	free(desc);
-	error_free_node(cur);
+
+	if (err->dropped > 0)
+		dprintf(fd, "     (%d frames omitted)\n", err->dropped);
 
 	cur = error_pop(err);
 	assert(cur != NULL);
@@ -173,7 +440,6 @@ void error_print_trace(error_t *err, int fd)
 		desc = error_describe(cur, "from");
 		dprintf(fd, "%s\n", desc);
 		free(desc);
-		error_free_node(cur);
 
 		cur = next;
 	} while (true);
@@ -181,5 +447,6 @@ void error_print_trace(error_t *err, int fd)
 	desc = error_describe(cur, "by  ");
 	dprintf(fd, "%s\n", desc);
 	free(desc);
-	error_free_node(cur);
+
+	err->dropped = 0;
 }
@@ -15,8 +15,10 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
 
 #include <unistd.h>
+#include <errno.h>
 #include <stdarg.h>
-#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
 
 #include "exec.h"
 #include "cext.h"
@@ -61,24 +63,35 @@ int exec_fork_background(const char *fmt, ...)
 	}
 
 	pid_t pid;
-	int i;
+	int i, status;
 
+	/* the command runs in a grandchild that is reparented to init, so
+	 * nobody has to wait for it and SIGCHLD is left alone */
 	switch ((pid = fork())) {
 	case -1:
+		free(argv);
+		strtok_free(st);
 		return -1;
 
 	case 0:
+		if (fork() != 0)
+			_exit(0);
+
 		usleep(200);
 
 		for (i = 0; i < 100; i++)
 			close(i);
 
 		execvp(argv[0], argv);
+		_exit(1);
 
 	default:
 		free(argv);
 		strtok_free(st);
-		signal(SIGCHLD, SIG_IGN);
+
+		while (waitpid(pid, &status, 0) == -1)
+			if (errno != EINTR)
+				return -1;
 	}
 
 	return 0;
@@ -0,0 +1,176 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+#include "internal.h"
+
+/* Exact decimal digits of a double: the integer part is split into base 10^9
+ * chunks, the fraction is kept as a big integer over a power of two and
+ * multiplied by ten for each digit. Digits are rounded half to even at the
+ * requested position. Returns the number of digits in buf; the value is
+ * 0.buf * 10^exp10. */
+int __float_digits(double val, int mode, int prec, char *buf, int *exp10)
+{
+	__float_big_t ip, fp;
+	uint64_t bits, m, one;
+	int e2, s, n = 0, x, need, i, d, r = 0, sticky = 0;
+	char chunks[40][9];
+	int nchunks = 0;
+	uint32_t c;
+
+	memcpy(&bits, &val, sizeof(bits));
+
+	m  = bits & ((1ULL << 52) - 1);
+	e2 = (bits >> 52) & 0x7ff;
+
+	if (e2 == 0)
+		e2 = -1074;
+	else {
+		m |= 1ULL << 52;
+		e2 -= 1075;
+	}
+
+	*exp10 = 0;
+
+	if (m == 0)
+		return 0;
+
+	/* val = ip + fp / 2^s */
+	s = 0;
+
+	if (e2 >= 0) {
+		__float_big_set(&ip, m);
+		__float_big_shl(&ip, e2);
+		__float_big_set(&fp, 0);
+	}
+
+	else if (-e2 < 64) {
+		s   = -e2;
+		one = 1ULL << s;
+		__float_big_set(&ip, m >> s);
+		__float_big_set(&fp, m & (one - 1));
+	}
+
+	else {
+		s = -e2;
+		__float_big_set(&ip, 0);
+		__float_big_set(&fp, m);
+	}
+
+	/* integer digits, most significant chunk first */
+	while (!__float_big_iszero(&ip)) {
+		c = __float_big_divmod(&ip, 1000000000);
+
+		for (i = 8; i >= 0; i--, c /= 10)
+			chunks[nchunks][i] = '0' + c % 10;
+
+		nchunks++;
+	}
+
+	for (i = nchunks - 1; i >= 0; i--) {
+		for (d = 0; d < 9; d++) {
+			if (n == 0 && chunks[i][d] == '0')
+				continue;
+
+			buf[n++] = chunks[i][d];
+		}
+	}
+
+	x = n;
+
+	/* fraction digits: next = floor(fp * 10 / 2^s) */
+#define NEXT_DIGIT(D) do { \
+		__float_big_muladd(&fp, 10, 0); \
+		D = 0; \
+		if (s / 32 < fp.len) { \
+			D = fp.w[s / 32] >> (s % 32); \
+			if (s % 32 && s / 32 + 1 < fp.len) \
+				D |= fp.w[s / 32 + 1] << (32 - s % 32); \
+			fp.w[s / 32] &= (1U << (s % 32)) - 1; \
+			fp.len = s / 32 + 1; \
+			while (fp.len > 0 && fp.w[fp.len - 1] == 0) \
+				fp.len--; \
+		} \
+	} while (0)
+
+	/* skip leading zeros of pure fractions */
+	if (x == 0) {
+		do {
+			NEXT_DIGIT(d);
+			x--;
+		} while (d == 0);
+
+		x++;
+		buf[n++] = '0' + d;
+	}
+
+	need = mode == FLOAT_DIGITS_SIG ? prec + 1 : x + prec;
+
+	if (need > FLOAT_DIGITS_MAX - 1)
+		need = FLOAT_DIGITS_MAX - 1;
+
+	/* exact digits run out before the requested precision */
+	while (n < need && !__float_big_iszero(&fp)) {
+		NEXT_DIGIT(d);
+		buf[n++] = '0' + d;
+	}
+
+	*exp10 = x;
+
+	/* the exact expansion is shorter than requested */
+	if (n < need)
+		return n;
+
+	/* the rounding digit was already generated */
+	if (need >= 0 && need < n) {
+		r = buf[need] - '0';
+
+		for (i = need + 1; i < n && !sticky; i++)
+			sticky = buf[i] != '0';
+	}
+
+	else if (need == n && !__float_big_iszero(&fp))
+		NEXT_DIGIT(r);
+
+	/* all digits are below the rounding position */
+	else
+		r = 0;
+
+	sticky |= !__float_big_iszero(&fp);
+#undef NEXT_DIGIT
+
+	n = need < 0 ? 0 : need;
+
+	if (r > 5 || (r == 5 && (sticky || (n > 0 && (buf[n - 1] - '0') % 2)))) {
+		for (i = n - 1; i >= 0 && buf[i] == '9'; i--)
+			buf[i] = '0';
+
+		if (i >= 0)
+			buf[i]++;
+
+		/* carry out of the first digit */
+		else {
+			memmove(buf + 1, buf, n);
+			buf[0] = '1';
+			*exp10 = x + 1;
+
+			/* a fixed number of decimals gains a digit */
+			if (mode == FLOAT_DIGITS_FIX || n == 0)
+				n++;
+		}
+	}
+
+	return n;
+}
@@ -0,0 +1,188 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+#ifndef _LUCID_FLOAT_INTERNAL_H
+#define _LUCID_FLOAT_INTERNAL_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* full 64x64 bit products; __extension__ keeps -pedantic quiet */
+__extension__ typedef unsigned __int128 __float_u128_t;
+
+/* IEEE 754 binary interchange format */
+typedef struct {
+	int mbits;   /* explicitly stored mantissa bits */
+	int ebits;   /* exponent bits */
+	int bias;    /* exponent bias */
+	int pow10;   /* largest power of ten exactly representable */
+	int minq;    /* powers of ten below this always round to zero */
+	int maxq;    /* powers of ten above this always overflow */
+	int evenmin; /* power of ten range where round-to-even can occur */
+	int evenmax;
+} __float_fmt_t;
+
+extern const __float_fmt_t __float_double;
+extern const __float_fmt_t __float_single;
+
+/* shortest decimal representation: mantissa * 10^exponent */
+typedef struct {
+	uint64_t mantissa;
+	int exponent;
+} __float_dec_t;
+
+__float_dec_t __float_shortest(const __float_fmt_t *fmt, uint64_t bits);
+
+int __float_fmt(char *dst, const __float_fmt_t *fmt, uint64_t bits);
+
+int __float_parse(const char *str, int n, const __float_fmt_t *fmt,
+		uint64_t *bits);
+
+/* maximum number of significant digits in the exact decimal expansion of a
+ * double, plus room for rounding */
+#define FLOAT_DIGITS_MAX 800
+
+/* digit generation modes */
+#define FLOAT_DIGITS_SIG 0 /* prec significant digits */
+#define FLOAT_DIGITS_FIX 1 /* prec digits after the decimal point */
+
+int __float_digits(double val, int mode, int prec, char *buf, int *exp10);
+
+/* fixed size unsigned big integers, large enough for the comparisons made
+ * while parsing: 768 decimal digits scaled by powers of two and five */
+#define FLOAT_BIG_WORDS 128
+
+typedef struct {
+	uint32_t w[FLOAT_BIG_WORDS];
+	int len;
+} __float_big_t;
+
+static inline
+void __float_big_set(__float_big_t *b, uint64_t v)
+{
+	b->len = 0;
+
+	while (v) {
+		b->w[b->len++] = (uint32_t) v;
+		v >>= 32;
+	}
+}
+
+static inline
+int __float_big_iszero(const __float_big_t *b)
+{
+	return b->len == 0;
+}
+
+/* b = b * m + a */
+static inline
+void __float_big_muladd(__float_big_t *b, uint32_t m, uint32_t a)
+{
+	uint64_t carry = a;
+	int i;
+
+	for (i = 0; i < b->len; i++) {
+		carry += (uint64_t) b->w[i] * m;
+		b->w[i] = (uint32_t) carry;
+		carry >>= 32;
+	}
+
+	if (carry && b->len < FLOAT_BIG_WORDS)
+		b->w[b->len++] = (uint32_t) carry;
+}
+
+static inline
+void __float_big_mulpow5(__float_big_t *b, int k)
+{
+	/* 5^13 is the largest power of five fitting 32 bits */
+	for (; k >= 13; k -= 13)
+		__float_big_muladd(b, 1220703125, 0);
+
+	if (k > 0) {
+		uint32_t m = 1;
+
+		while (k--)
+			m *= 5;
+
+		__float_big_muladd(b, m, 0);
+	}
+}
+
+static inline
+void __float_big_shl(__float_big_t *b, int k)
+{
+	int words = k / 32, bits = k % 32, i;
+
+	if (b->len == 0)
+		return;
+
+	if (b->len + words + 1 > FLOAT_BIG_WORDS)
+		words = FLOAT_BIG_WORDS - b->len - 1;
+
+	if (bits && b->len < FLOAT_BIG_WORDS) {
+		b->w[b->len] = 0;
+
+		for (i = b->len; i > 0; i--)
+			b->w[i] = (b->w[i] << bits) | (b->w[i - 1] >> (32 - bits));
+
+		b->w[0] <<= bits;
+
+		if (b->w[b->len])
+			b->len++;
+	}
+
+	if (words) {
+		memmove(b->w + words, b->w, b->len * sizeof(uint32_t));
+		memset(b->w, 0, words * sizeof(uint32_t));
+		b->len += words;
+	}
+}
+
+static inline
+int __float_big_cmp(const __float_big_t *a, const __float_big_t *b)
+{
+	int i;
+
+	if (a->len != b->len)
+		return a->len < b->len ? -1 : 1;
+
+	for (i = a->len - 1; i >= 0; i--)
+		if (a->w[i] != b->w[i])
+			return a->w[i] < b->w[i] ? -1 : 1;
+
+	return 0;
+}
+
+/* b = b / d, returns the remainder */
+static inline
+uint32_t __float_big_divmod(__float_big_t *b, uint32_t d)
+{
+	uint64_t rem = 0;
+	int i;
+
+	for (i = b->len - 1; i >= 0; i--) {
+		rem = (rem << 32) | b->w[i];
+		b->w[i] = (uint32_t) (rem / d);
+		rem %= d;
+	}
+
+	while (b->len > 0 && b->w[b->len - 1] == 0)
+		b->len--;
+
+	return (uint32_t) rem;
+}
+
+#endif
@@ -0,0 +1,440 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+#include <errno.h>
+
+#include "char.h"
+
+#include "internal.h"
+#include "tables.h"
+
+/* significant digits kept by the exact fallback; digits beyond this only
+ * matter through whether they are all zero */
+#define FLOAT_BIG_DIGITS 768
+
+/* powers of ten exactly representable as double */
+static
+const double __float_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/* decimal mantissa as scanned from the input */
+typedef struct {
+	const char *start; /* first mantissa character */
+	const char *end;   /* first character after the mantissa */
+	int exp;           /* explicit exponent */
+} __float_src_t;
+
+static inline
+uint64_t __float_inf(const __float_fmt_t *fmt)
+{
+	return (uint64_t) ((1U << fmt->ebits) - 1) << fmt->mbits;
+}
+
+/* case insensitive match of word against the first n bytes of str */
+static
+int __float_word(const char *str, int n, const char *word)
+{
+	int len = 0;
+	char c;
+
+	for (; word[len]; len++) {
+		if (len >= n)
+			return 0;
+
+		c = str[len];
+		char_tolower(c);
+
+		if (c != word[len])
+			return 0;
+	}
+
+	return len;
+}
+
+/* Eisel-Lemire: multiply the normalized decimal mantissa by a 128 bit
+ * approximation of 5^q and round; fails when the truncated product is too
+ * close to a halfway point to decide */
+static
+int __float_eisel_lemire(const __float_fmt_t *fmt, int q, uint64_t w,
+		uint64_t *bits)
+{
+	const uint64_t *pow5;
+	__float_u128_t first, second;
+	uint64_t hi, lo, mant, mask;
+	int lz, upper, shift, power2, err;
+
+	if (w == 0 || q < fmt->minq) {
+		*bits = 0;
+		return 0;
+	}
+
+	if (q > fmt->maxq) {
+		*bits = __float_inf(fmt);
+		return 0;
+	}
+
+	lz   = __builtin_clzll(w);
+	w  <<= lz;
+	pow5 = FLOAT_POW5_128[q - FLOAT_POW5_128_MIN];
+
+	first = (__float_u128_t) w * pow5[0];
+	hi    = first >> 64;
+	lo    = (uint64_t) first;
+	mask  = ~0ULL >> (fmt->mbits + 3);
+
+	/* the low half of the table entry only matters if the bits below the
+	 * mantissa are all ones */
+	if ((hi & mask) == mask) {
+		second = (__float_u128_t) w * pow5[1];
+		lo    += (uint64_t) (second >> 64);
+
+		if ((uint64_t) (second >> 64) > lo)
+			hi++;
+	}
+
+	/* 5^q is exact in 128 bits for -27 <= q <= 55; the result is still
+	 * used as the starting point of the exact fallback */
+	err = lo == ~0ULL && (q < -27 || q > 55) ? -1 : 0;
+
+	upper  = hi >> 63;
+	shift  = upper + 64 - fmt->mbits - 3;
+	mant   = hi >> shift;
+	power2 = (((152170 + 65536) * q) >> 16) + 63 + upper - lz + fmt->bias;
+
+	/* subnormal */
+	if (power2 <= 0) {
+		if (-power2 + 1 >= 64) {
+			*bits = 0;
+			return err;
+		}
+
+		mant >>= -power2 + 1;
+		mant  += mant & 1;
+		mant >>= 1;
+
+		power2 = mant < (1ULL << fmt->mbits) ? 0 : 1;
+		*bits  = ((uint64_t) power2 << fmt->mbits) |
+			(mant & ((1ULL << fmt->mbits) - 1));
+		return err;
+	}
+
+	/* exactly halfway: round to even instead of up */
+	if (lo <= 1 && q >= fmt->evenmin && q <= fmt->evenmax &&
+			(mant & 3) == 1 && (mant << shift) == hi)
+		mant &= ~1ULL;
+
+	mant  += mant & 1;
+	mant >>= 1;
+
+	if (mant >= (2ULL << fmt->mbits)) {
+		mant = 1ULL << fmt->mbits;
+		power2++;
+	}
+
+	if (power2 >= (1 << fmt->ebits) - 1)
+		*bits = __float_inf(fmt);
+	else
+		*bits = ((uint64_t) power2 << fmt->mbits) |
+			(mant & ((1ULL << fmt->mbits) - 1));
+
+	return err;
+}
+
+/* compare d * 10^e (plus a nonzero tail if sticky) with b * 2^p2 */
+static
+int __float_big_compare(const __float_big_t *d, int e, int sticky,
+		uint64_t b, int p2)
+{
+	__float_big_t x = *d, y;
+	int k, c;
+
+	__float_big_set(&y, b);
+
+	if (e >= 0)
+		__float_big_mulpow5(&x, e);
+	else
+		__float_big_mulpow5(&y, -e);
+
+	k = p2 - e;
+
+	if (k >= 0)
+		__float_big_shl(&y, k);
+	else
+		__float_big_shl(&x, -k);
+
+	c = __float_big_cmp(&x, &y);
+
+	return c == 0 && sticky ? 1 : c;
+}
+
+/* exact fallback: adjust the candidate by whole units in the last place
+ * until the input lies within its rounding interval */
+static
+uint64_t __float_exact(const __float_fmt_t *fmt, const __float_src_t *src,
+		uint64_t bits)
+{
+	__float_big_t d;
+	const char *p;
+	uint64_t m, hidden = 1ULL << fmt->mbits;
+	int e, emin, emax, biased, dot = 0, nd = 0, sticky = 0, exp = src->exp;
+	uint32_t chunk = 0, scale = 1;
+
+	/* collect up to FLOAT_BIG_DIGITS significant digits */
+	__float_big_set(&d, 0);
+
+	for (p = src->start; p < src->end; p++) {
+		if (*p == '.') {
+			dot = 1;
+			continue;
+		}
+
+		if (nd == 0 && *p == '0') {
+			if (dot)
+				exp--;
+			continue;
+		}
+
+		if (nd < FLOAT_BIG_DIGITS) {
+			chunk  = chunk * 10 + (*p - '0');
+			scale *= 10;
+			nd++;
+
+			if (dot)
+				exp--;
+
+			if (scale == 1000000000) {
+				__float_big_muladd(&d, scale, chunk);
+				chunk = 0;
+				scale = 1;
+			}
+		}
+
+		else {
+			sticky |= *p != '0';
+
+			if (!dot)
+				exp++;
+		}
+	}
+
+	if (scale > 1)
+		__float_big_muladd(&d, scale, chunk);
+
+	/* bits = m * 2^e */
+	emin   = 1 - fmt->bias - fmt->mbits;
+	emax   = (1 << fmt->ebits) - 2 - fmt->bias - fmt->mbits;
+	biased = bits >> fmt->mbits;
+
+	if (bits == __float_inf(fmt)) {
+		m = 2 * hidden - 1;
+		e = emax;
+	}
+
+	else if (biased == 0) {
+		m = bits;
+		e = emin;
+	}
+
+	else {
+		m = (bits & (hidden - 1)) | hidden;
+		e = biased - 1 + emin;
+	}
+
+	for (;;) {
+		int c = __float_big_compare(&d, exp, sticky, 2 * m + 1, e - 1);
+
+		/* above the upper halfway point, or on it with an odd mantissa */
+		if (c > 0 || (c == 0 && (m & 1))) {
+			if (++m == 2 * hidden) {
+				m = hidden;
+				e++;
+			}
+
+			if (e > emax)
+				return __float_inf(fmt);
+
+			continue;
+		}
+
+		if (m == 0)
+			break;
+
+		/* the gap below a power of two is half as wide */
+		if (m == hidden && e > emin)
+			c = __float_big_compare(&d, exp, sticky, 4 * m - 1, e - 2);
+		else
+			c = __float_big_compare(&d, exp, sticky, 2 * m - 1, e - 1);
+
+		if (c < 0 || (c == 0 && (m & 1))) {
+			if (m == hidden && e > emin) {
+				m = 2 * hidden - 1;
+				e--;
+			}
+
+			else
+				m--;
+
+			continue;
+		}
+
+		break;
+	}
+
+	if (m < hidden)
+		return m;
+
+	return ((uint64_t) (e - emin + 1) << fmt->mbits) | (m & (hidden - 1));
+}
+
+int __float_parse(const char *str, int n, const __float_fmt_t *fmt,
+		uint64_t *bits)
+{
+	const char *p = str;
+	__float_src_t src;
+	uint64_t sign = 0, w = 0, alt;
+	int len, q = 0, nd = 0, any = 0, dot = 0, truncated = 0, e = 0, esign;
+	double dv;
+	float fv;
+	uint32_t fb;
+
+	while (n && char_isspace(*p)) {
+		p++;
+		n--;
+	}
+
+	if (n && (*p == '-' || *p == '+')) {
+		if (*p == '-')
+			sign = 1ULL << (fmt->mbits + fmt->ebits);
+
+		p++;
+		n--;
+	}
+
+	/* special values */
+	if ((len = __float_word(p, n, "infinity")) ||
+			(len = __float_word(p, n, "inf"))) {
+		*bits = sign | __float_inf(fmt);
+		return p + len - str;
+	}
+
+	if ((len = __float_word(p, n, "nan"))) {
+		*bits = __float_inf(fmt) | (1ULL << (fmt->mbits - 1));
+		return p + len - str;
+	}
+
+	/* mantissa: the first 19 significant digits fit 64 bits */
+	src.start = p;
+
+	for (; n; p++, n--) {
+		if (*p == '.' && !dot) {
+			dot = 1;
+			continue;
+		}
+
+		if (!char_isdigit(*p))
+			break;
+
+		any = 1;
+
+		if (nd == 0 && *p == '0') {
+			if (dot)
+				q--;
+			continue;
+		}
+
+		if (nd < 19) {
+			w = w * 10 + (*p - '0');
+			nd++;
+
+			if (dot)
+				q--;
+		}
+
+		else {
+			truncated |= *p != '0';
+
+			if (!dot)
+				q++;
+		}
+	}
+
+	if (!any)
+		return 0;
+
+	src.end = p;
+
+	/* exponent, only if followed by digits */
+	if (n >= 2 && (*p == 'e' || *p == 'E')) {
+		esign = 0;
+		len   = 1;
+
+		if (p[1] == '-' || p[1] == '+') {
+			esign = p[1] == '-';
+			len++;
+		}
+
+		if (len < n && char_isdigit(p[len])) {
+			for (; len < n && char_isdigit(p[len]); len++)
+				if (e < 100000)
+					e = e * 10 + (p[len] - '0');
+
+			e  = esign ? -e : e;
+			q += e;
+			p += len;
+		}
+	}
+
+	src.exp = e;
+
+	/* Clinger: both mantissa and power of ten are exact */
+	if (!truncated && w <= (2ULL << fmt->mbits) &&
+			q >= -fmt->pow10 && q <= fmt->pow10) {
+		if (fmt == &__float_single) {
+			fv = (float) w;
+			fv = q < 0 ? fv / (float) __float_pow10[-q] :
+			             fv * (float) __float_pow10[q];
+			memcpy(&fb, &fv, sizeof(fb));
+			*bits = sign | fb;
+		}
+
+		else {
+			dv = (double) w;
+			dv = q < 0 ? dv / __float_pow10[-q] : dv * __float_pow10[q];
+			memcpy(bits, &dv, sizeof(*bits));
+			*bits |= sign;
+		}
+
+		return p - str;
+	}
+
+	/* a truncated mantissa lies between w and w + 1; if both round to the
+	 * same value it is the result */
+	if (__float_eisel_lemire(fmt, q, w, bits) < 0 ||
+			(truncated && (__float_eisel_lemire(fmt, q, w + 1, &alt) < 0 ||
+			               alt != *bits)))
+		*bits = __float_exact(fmt, &src, *bits);
+
+	/* overflow, and underflow to zero or to a subnormal like strtod(3) */
+	if (*bits == __float_inf(fmt) || (*bits == 0 && w != 0) ||
+			(*bits != 0 && (*bits >> fmt->mbits) == 0))
+		errno = ERANGE;
+
+	*bits |= sign;
+
+	return p - str;
+}
@@ -0,0 +1,302 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+#include "str.h"
+
+#include "internal.h"
+#include "tables.h"
+
+const __float_fmt_t __float_double = { 52, 11, 1023, 22, -342, 308,  -4, 23 };
+const __float_fmt_t __float_single = { 23,  8,  127, 10,  -65,  38, -17, 10 };
+
+/* ceil(log2(5^e)), exact for 0 <= e <= 3528 */
+static inline
+int __pow5bits(int e)
+{
+	return (int) (((uint32_t) e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)), exact for 0 <= e <= 1650 */
+static inline
+int __log10pow2(int e)
+{
+	return (int) (((uint32_t) e * 78913) >> 18);
+}
+
+/* floor(log10(5^e)), exact for 0 <= e <= 2620 */
+static inline
+int __log10pow5(int e)
+{
+	return (int) (((uint32_t) e * 732923) >> 20);
+}
+
+static inline
+int __pow5factor(uint64_t v)
+{
+	int count = 0;
+
+	while (v % 5 == 0) {
+		v /= 5;
+		count++;
+	}
+
+	return count;
+}
+
+static inline
+int __multiple_of_pow5(uint64_t v, int p)
+{
+	return __pow5factor(v) >= p;
+}
+
+static inline
+int __multiple_of_pow2(uint64_t v, int p)
+{
+	return (v & ((1ULL << p) - 1)) == 0;
+}
+
+/* (m * mul) >> j with a 125 bit multiplier, j >= 64 */
+static inline
+uint64_t __mulshift(uint64_t m, const uint64_t *mul, int j)
+{
+	__float_u128_t lo = (__float_u128_t) m * mul[0];
+	__float_u128_t hi = (__float_u128_t) m * mul[1];
+
+	return (uint64_t) (((lo >> 64) + hi) >> (j - 64));
+}
+
+/* Ryu: scale the interval of values that round to the input to a power of
+ * ten using the precomputed tables, then drop digits until the interval
+ * holds a single shortest decimal; zero, infinity and NaN are handled by the
+ * callers */
+__float_dec_t __float_shortest(const __float_fmt_t *fmt, uint64_t bits)
+{
+	uint64_t ieeem = bits & ((1ULL << fmt->mbits) - 1);
+	uint32_t ieeee = (bits >> fmt->mbits) & ((1U << fmt->ebits) - 1);
+	uint64_t m2, mv, vr, vp, vm, output;
+	uint32_t mmshift;
+	int e2, e10, q, i, j, k, removed = 0;
+	int vmtz = 0, vrtz = 0, accept, roundup = 0;
+	uint8_t last = 0;
+	__float_dec_t dec;
+
+	if (ieeee == 0) {
+		e2 = 1 - fmt->bias - fmt->mbits - 2;
+		m2 = ieeem;
+	} else {
+		e2 = (int) ieeee - fmt->bias - fmt->mbits - 2;
+		m2 = (1ULL << fmt->mbits) | ieeem;
+	}
+
+	/* ties round to even, so bounds are inclusive for even mantissas */
+	accept = (m2 & 1) == 0;
+
+	/* the interval is [mv - 1 - mmshift, mv + 2] / 4 * 2^e2; the lower
+	 * gap is halved at powers of two */
+	mv      = 4 * m2;
+	mmshift = ieeem != 0 || ieeee <= 1;
+
+	if (e2 >= 0) {
+		q   = __log10pow2(e2) - (e2 > 3);
+		e10 = q;
+		k   = FLOAT_POW5_INV_BITCOUNT + __pow5bits(q) - 1;
+		i   = -e2 + q + k;
+
+		vr = __mulshift(4 * m2,               FLOAT_POW5_INV_SPLIT[q], i);
+		vp = __mulshift(4 * m2 + 2,           FLOAT_POW5_INV_SPLIT[q], i);
+		vm = __mulshift(4 * m2 - 1 - mmshift, FLOAT_POW5_INV_SPLIT[q], i);
+
+		if (q <= 21) {
+			/* only one of mp, mv and mm can be a multiple of 5 */
+			if (mv % 5 == 0)
+				vrtz = __multiple_of_pow5(mv, q);
+			else if (accept)
+				vmtz = __multiple_of_pow5(mv - 1 - mmshift, q);
+			else
+				vp -= __multiple_of_pow5(mv + 2, q);
+		}
+	}
+
+	else {
+		q   = __log10pow5(-e2) - (-e2 > 1);
+		e10 = q + e2;
+		i   = -e2 - q;
+		k   = __pow5bits(i) - FLOAT_POW5_BITCOUNT;
+		j   = q - k;
+
+		vr = __mulshift(4 * m2,               FLOAT_POW5_SPLIT[i], j);
+		vp = __mulshift(4 * m2 + 2,           FLOAT_POW5_SPLIT[i], j);
+		vm = __mulshift(4 * m2 - 1 - mmshift, FLOAT_POW5_SPLIT[i], j);
+
+		if (q <= 1) {
+			/* mv has at least two trailing zero bits */
+			vrtz = 1;
+
+			if (accept)
+				vmtz = mmshift == 1;
+			else
+				vp--;
+		}
+
+		else if (q < 63)
+			vrtz = __multiple_of_pow2(mv, q);
+	}
+
+	/* general case: the exact value may end in zeros, which matters for
+	 * inclusive bounds and for round-half-even */
+	if (vmtz || vrtz) {
+		while (vp / 10 > vm / 10) {
+			vmtz &= vm % 10 == 0;
+			vrtz &= last == 0;
+			last   = vr % 10;
+			vr    /= 10;
+			vp    /= 10;
+			vm    /= 10;
+			removed++;
+		}
+
+		if (vmtz) {
+			while (vm % 10 == 0) {
+				vrtz &= last == 0;
+				last   = vr % 10;
+				vr    /= 10;
+				vp    /= 10;
+				vm    /= 10;
+				removed++;
+			}
+		}
+
+		/* exactly ...50..0 rounds to even */
+		if (vrtz && last == 5 && vr % 2 == 0)
+			last = 4;
+
+		output = vr + ((vr == vm && (!accept || !vmtz)) || last >= 5);
+	}
+
+	/* common case: remove two digits at a time while possible */
+	else {
+		if (vp / 100 > vm / 100) {
+			roundup  = vr % 100 >= 50;
+			vr      /= 100;
+			vp      /= 100;
+			vm      /= 100;
+			removed += 2;
+		}
+
+		while (vp / 10 > vm / 10) {
+			roundup = vr % 10 >= 5;
+			vr     /= 10;
+			vp     /= 10;
+			vm     /= 10;
+			removed++;
+		}
+
+		output = vr + (vr == vm || roundup);
+	}
+
+	dec.mantissa = output;
+	dec.exponent = e10 + removed;
+
+	return dec;
+}
+
+/* render the shortest representation like %g does: plain notation for
+ * decimal exponents in [-4, 16), scientific notation otherwise */
+int __float_fmt(char *dst, const __float_fmt_t *fmt, uint64_t bits)
+{
+	uint64_t mask = (1ULL << fmt->mbits) - 1;
+	uint32_t emax = (1U << fmt->ebits) - 1;
+	uint32_t ieeee = (bits >> fmt->mbits) & emax;
+	char digits[STR_FMT_MAX], *p = dst;
+	__float_dec_t dec;
+	int n, x, i;
+
+	if (ieeee == emax && (bits & mask)) {
+		memcpy(dst, "nan", 3);
+		return 3;
+	}
+
+	if (bits >> (fmt->mbits + fmt->ebits))
+		*p++ = '-';
+
+	if (ieeee == emax) {
+		memcpy(p, "inf", 3);
+		return p - dst + 3;
+	}
+
+	if ((bits & (mask | ((uint64_t) emax << fmt->mbits))) == 0) {
+		*p++ = '0';
+		return p - dst;
+	}
+
+	dec = __float_shortest(fmt, bits);
+	n   = str_fmt_u64(digits, dec.mantissa);
+	x   = dec.exponent + n - 1;
+
+	/* plain notation */
+	if (x >= -4 && x < 16) {
+		if (x < 0) {
+			*p++ = '0';
+			*p++ = '.';
+
+			for (i = -1; i > x; i--)
+				*p++ = '0';
+
+			memcpy(p, digits, n);
+			p += n;
+		}
+
+		else if (n <= x + 1) {
+			memcpy(p, digits, n);
+			p += n;
+
+			for (i = n; i <= x; i++)
+				*p++ = '0';
+		}
+
+		else {
+			memcpy(p, digits, x + 1);
+			p += x + 1;
+			*p++ = '.';
+			memcpy(p, digits + x + 1, n - x - 1);
+			p += n - x - 1;
+		}
+
+		return p - dst;
+	}
+
+	/* scientific notation */
+	*p++ = digits[0];
+
+	if (n > 1) {
+		*p++ = '.';
+		memcpy(p, digits + 1, n - 1);
+		p += n - 1;
+	}
+
+	*p++ = 'e';
+	*p++ = x < 0 ? '-' : '+';
+
+	if (x < 0)
+		x = -x;
+
+	if (x < 10)
+		*p++ = '0';
+
+	p += str_fmt_u32(p, x);
+
+	return p - dst;
+}
@@ -17,61 +17,1621 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <syslog.h>
 #include <string.h>
 #include <time.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "log.h"
 #include "cext.h"
+#include "char.h"
+#include "obuf.h"
 #include "printf.h"
 #include "str.h"
 
 #define MASK_PRIO(p) (1 << (p))
 
+/* options that add a prefix to each line */
+#define LOGO_PREFIX (LOGO_PID|LOGO_TIME|LOGO_PRIO|LOGO_IDENT)
+
+/* destinations that take formatted text */
+#define LOGD_TEXT (LOGD_SYSLOG|LOGD_FILE|LOGD_STDERR)
+
+/* destinations that need a message formatted */
+#define LOGD_FORMAT (LOGD_TEXT|LOGD_MMAP)
+
+/* default size of the per-thread rings in async mode */
+#define LOG_RINGSIZE 65536
+
+/* size of the batch buffers of the writer thread */
+#define LOG_BATCHSIZE 65536
+
+/* interval in which the writer thread polls the rings, in milliseconds */
+#define LOG_INTERVAL 10
+
+/* binary log stream: a header, then records starting with a kind byte; all
+ * values are in host byte order */
+#define LOG_BIN_MAGIC   "LUCIDLOG"
+#define LOG_BIN_VERSION 1
+#define LOG_BIN_HEADER  'L' /* magic, version, options, pid and ident */
+#define LOG_BIN_FORMAT  'F' /* id, line, argument types, file and format */
+#define LOG_BIN_MSG     'M' /* id, priority, time, errno and arguments */
+#define LOG_BIN_TEXT    'T' /* priority, time, errno and formatted text */
+
+/* maximum number of arguments of a deferred format */
+#define LOG_BIN_MAXARGS 32
+
+/* size of the format table; it is never filled beyond three quarters */
+#define LOG_BIN_FORMATS 1024
+
+/* string argument that was a NULL pointer */
+#define LOG_BIN_NULL UINT32_MAX
+
+/* async record; the message follows, and the whole record is padded to a
+ * multiple of its alignment. Records never wrap around the end of a ring, a
+ * length of LOG_WRAP skips the rest of the ring instead */
+typedef struct {
+	uint32_t len;
+	int32_t prio;
+	int64_t time;
+} log_rec_t;
+
+#define LOG_WRAP UINT32_MAX
+#define LOG_RECSIZE(len) \
+	((sizeof(log_rec_t) + (len) + sizeof(log_rec_t) - 1) & ~(sizeof(log_rec_t) - 1))
+
+/* priority flag of records holding a record of the binary log */
+#define LOG_REC_BIN 0x100
+
+/* ring file: a header followed by the ring. Records are laid out like async
+ * records and wrap the same way; the header is only changed with the lock
+ * held, while the messages are copied without it. All values are in host byte
+ * order */
+#define LOG_MAP_MAGIC   "LUCIDMAP"
+#define LOG_MAP_VERSION 1
+
+/* default and maximum size of the ring of a ring file */
+#define LOG_MAPSIZE    1048576
+#define LOG_MAPSIZEMAX 1073741824
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;     /* power of two */
+	uint32_t opts;     /* log_opts of the writer */
+	uint32_t lock;     /* shared with forked children */
+	uint64_t head;     /* position of the oldest record */
+	uint64_t tail;     /* position after the newest record */
+	char ident[32];
+} log_map_t;
+
+typedef struct {
+	uint32_t len;      /* LOG_MAP_DONE is set once the message is copied */
+	int32_t prio;
+	int32_t pid;
+	int32_t pad;
+	int64_t time;      /* nanoseconds */
+} log_maprec_t;
+
+#define LOG_MAP_DONE 0x80000000
+#define LOG_MAP_RECSIZE(len) \
+	((sizeof(log_maprec_t) + (len) + 7) & ~(size_t) 7)
+
+/* single producer, single consumer ring; head and tail are free running
+ * positions, the owner thread only writes tail and the writer only head */
+typedef struct log_ring {
+	struct log_ring *next;
+	char *buf;
+	size_t size;         /* power of two */
+	size_t head;
+	size_t tail;
+	unsigned long lost;  /* messages dropped with LOGQ_COUNT */
+	int dead;            /* owner thread has exited */
+} log_ring_t;
+
+static struct {
+	pthread_mutex_t lock;  /* protects rings */
+	pthread_cond_t wake;
+	pthread_t writer;
+	pthread_key_t key;
+	const struct log_conn *conn; /* connection of the writer */
+	log_ring_t *rings;
+	unsigned int gen;      /* incremented whenever the rings are released */
+	int keyed;             /* key is valid */
+	int stop;
+	int running;
+	unsigned char binfmts[LOG_BIN_FORMATS]; /* formats already written */
+} log_async = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+};
+
+/* format of deferred messages; the id is the index in log_fmts plus one.
+ * An entry is claimed by setting its key and may be used once it is ready */
+typedef struct {
+	const void *key;  /* format string or call site */
+	const char *file; /* call site, if known */
+	int line;
+	char *fmt;        /* copy of the format string */
+	int nargs;        /* -1 if the format cannot be deferred */
+	int ready;
+	char types[LOG_BIN_MAXARGS + 1];
+	int precs[LOG_BIN_MAXARGS];   /* precision of strings, see log_bin_spec() */
+} log_fmt_t;
+
+static log_fmt_t log_fmts[LOG_BIN_FORMATS];
+static unsigned int log_nfmts;
+
+/* ring of the calling thread, valid if its generation is current */
+static __thread log_ring_t *log_tls_ring;
+static __thread unsigned int log_tls_gen;
+
+/* a connection: the options and the line prefix tail rendered from them.
+ * log_init() publishes a new connection as a whole; replaced connections are
+ * kept until log_close(), so readers may use the one they loaded while
+ * another thread reinitializes */
+typedef struct log_conn {
+	log_options_t opts;    /* first member, _log_options points here */
+	struct log_conn *prev; /* replaced connection */
+	log_map_t *map;        /* mapped ring file for LOGD_MMAP */
+	int pid;
+	int taillen;
+	char tail[];           /* ident, pid and ": " */
+} log_conn_t;
+
 log_options_t *_log_options = NULL;
 
-static int errno_orig = 0;
+/* serializes log_init() and log_close() */
+static pthread_mutex_t log_conn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline
+log_conn_t *log_conn(void)
+{
+	return (log_conn_t *) __atomic_load_n(&_log_options, __ATOMIC_ACQUIRE);
+}
+
+static
+int mask_to_syslog(int mask)
+{
+	int newmask = 0;
+
+	if (mask & MASK_PRIO(LOGP_ALERT))
+		newmask |= MASK_PRIO(LOG_ALERT);
+	if (mask & MASK_PRIO(LOGP_ERROR))
+		newmask |= MASK_PRIO(LOG_ERR);
+	if (mask & MASK_PRIO(LOGP_WARN))
+		newmask |= MASK_PRIO(LOG_WARNING);
+	if (mask & MASK_PRIO(LOGP_NOTE))
+		newmask |= MASK_PRIO(LOG_NOTICE);
+	if (mask & MASK_PRIO(LOGP_INFO))
+		newmask |= MASK_PRIO(LOG_INFO);
+	if (mask & MASK_PRIO(LOGP_DEBUG))
+		newmask |= MASK_PRIO(LOG_DEBUG);
+
+	return newmask;
+}
+
+static
+int prio_to_syslog(int prio)
+{
+	switch (prio) {
+		case LOGP_ALERT: return LOG_ALERT;
+		case LOGP_ERROR: return LOG_ERR;
+		case LOGP_WARN:  return LOG_WARNING;
+		case LOGP_NOTE:  return LOG_NOTICE;
+		case LOGP_INFO:  return LOG_INFO;
+		case LOGP_DEBUG: return LOG_DEBUG;
+	}
+
+	return -1;
+}
+
+/* cached rendering of the local time of the last second seen by a thread */
+static __thread time_t log_tls_sec = -1;
+static __thread char log_tls_time[32];
+static __thread int log_tls_timelen;
+
+static const char *log_tags[] = {
+	"[alert]", "[error]", "[warn ]", "[note ]",
+	"[info ]", "[debug]", "[trace]", "[none ]",
+};
+
+/* current time; the coarse clock is read without a system call */
+static
+time_t log_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == -1)
+		return time(0);
+
+	return ts.tv_sec;
+}
+
+/* render the tail of the line prefix; the pid is rewritten in place in a
+ * forked child */
+static
+void log_tail_render(log_conn_t *c)
+{
+	int len = 0;
+
+	c->pid = getpid();
+
+	if (c->opts.log_opts & LOGO_IDENT) {
+		c->tail[len++] = ' ';
+		len += str_len(strcpy(c->tail + len, c->opts.log_ident));
+	}
+
+	if (c->opts.log_opts & LOGO_PID) {
+		c->tail[len++] = '[';
+		len += str_fmt_u32(c->tail + len, c->pid);
+		c->tail[len++] = ']';
+	}
+
+	if (c->opts.log_opts & LOGO_PREFIX) {
+		c->tail[len++] = ':';
+		c->tail[len++] = ' ';
+	}
+
+	c->taillen = len;
+}
+
+/* render priority and time of a line prefix to buf; returns the length */
+static
+int log_head(const log_conn_t *c, char *buf, int prio, time_t t)
+{
+	struct tm tm;
+	int len = 0;
+
+	if (c->opts.log_opts & LOGO_PRIO) {
+		if (prio < 0 || prio > LOGP_TRACE)
+			prio = LOGP_TRACE + 1;
+
+		memcpy(buf, log_tags[prio], 7);
+		len = 7;
+	}
+
+	if (c->opts.log_opts & LOGO_TIME) {
+		if (t != log_tls_sec) {
+			localtime_r(&t, &tm);
+			log_tls_timelen = strftime(log_tls_time, sizeof(log_tls_time),
+					"%b %d %T", &tm);
+			log_tls_sec = t;
+		}
+
+		buf[len++] = ' ';
+		memcpy(buf + len, log_tls_time, log_tls_timelen);
+		len += log_tls_timelen;
+	}
+
+	return len;
+}
+
+/* append a complete line to ob */
+static
+void log_line(obuf_t *ob, const log_conn_t *c, int prio, time_t t,
+		const char *msg, int len)
+{
+	char head[64];
+
+	obuf_catb(ob, head, log_head(c, head, prio, t));
+	obuf_catb(ob, c->tail, c->taillen);
+	obuf_catb(ob, msg, len);
+	obuf_catb(ob, "\n", 1);
+}
+
+/* write a complete line with a single system call, unless interrupted */
+static
+void log_fd(int fd, struct iovec *iov, int n)
+{
+	ssize_t res;
+
+	while (n > 0) {
+		if ((res = writev(fd, iov, n)) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		for (; n > 0 && (size_t) res >= iov->iov_len; iov++, n--)
+			res -= iov->iov_len;
+
+		if (n > 0) {
+			iov->iov_base  = (char *) iov->iov_base + res;
+			iov->iov_len  -= res;
+		}
+	}
+}
+
+static
+void log_ring_exit(void *ring)
+{
+	__atomic_store_n(&((log_ring_t *) ring)->dead, 1, __ATOMIC_RELEASE);
+}
+
+/* get the ring of the calling thread; only the first message of a thread
+ * takes the lock to register a new ring */
+static
+log_ring_t *log_ring_get(const log_conn_t *c)
+{
+	log_ring_t *ring;
+	size_t size = LOG_RINGSIZE;
+
+	if (log_tls_ring && log_tls_gen == log_async.gen)
+		return log_tls_ring;
+
+	if (c->opts.log_ring > 0)
+		for (size = 1024; size < (size_t) c->opts.log_ring; size <<= 1);
+
+	if (!(ring = calloc(1, sizeof(*ring) + size)))
+		return NULL;
+
+	ring->buf  = (char *) (ring + 1);
+	ring->size = size;
+
+	pthread_mutex_lock(&log_async.lock);
+	ring->next = log_async.rings;
+	log_async.rings = ring;
+	pthread_mutex_unlock(&log_async.lock);
+
+	pthread_setspecific(log_async.key, ring);
+
+	log_tls_ring = ring;
+	log_tls_gen  = log_async.gen;
+
+	return ring;
+}
+
+/* reserve room for a record with len bytes of payload in a ring; returns
+ * the record or NULL if the message is dropped, and the tail to publish once
+ * the record is complete */
+static
+char *log_ring_reserve(const log_conn_t *c, log_ring_t *ring, size_t len,
+		size_t *tail)
+{
+	size_t need = LOG_RECSIZE(len), pad, off, head;
+
+	for (;;) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		off  = ring->tail & (ring->size - 1);
+		pad  = off + need > ring->size ? ring->size - off : 0;
+
+		if (ring->size - (ring->tail - head) >= need + pad)
+			break;
+
+		switch (c->opts.log_overflow) {
+		case LOGQ_BLOCK:
+			pthread_cond_signal(&log_async.wake);
+			usleep(100);
+			continue;
+
+		case LOGQ_COUNT:
+			__atomic_fetch_add(&ring->lost, 1, __ATOMIC_RELAXED);
+
+		default:
+			return NULL;
+		}
+	}
+
+	if (pad) {
+		*(uint32_t *) (ring->buf + off) = LOG_WRAP;
+		off = 0;
+	}
+
+	*tail = ring->tail + pad + need;
+
+	return ring->buf + off;
+}
+
+/* append a message to the ring of the calling thread */
+static
+int log_ring_push(const log_conn_t *c, int prio, const char *msg)
+{
+	log_ring_t *ring;
+	log_rec_t rec;
+	size_t len = str_len(msg), tail;
+	char *buf;
+
+	if (!(ring = log_ring_get(c)))
+		return -1;
+
+	/* keep room for other messages */
+	if (len > ring->size / 4)
+		len = ring->size / 4;
+
+	if (!(buf = log_ring_reserve(c, ring, len, &tail)))
+		return 0;
+
+	rec.len  = len;
+	rec.prio = prio;
+	rec.time = log_now();
+
+	memcpy(buf, &rec, sizeof(rec));
+	memcpy(buf + sizeof(rec), msg, len);
+
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* precision given by the preceding argument */
+#define LOG_BIN_PREC_STAR -2
+
+/* scan the conversion specification following a '%'; returns its end. The
+ * precision is -1 if there is none */
+static
+const char *log_bin_spec(const char *p, int *stars, int *l, int *prec, char *c)
+{
+	*stars = 0;
+	*l     = 0;
+	*prec  = -1;
+
+	while (*p && strchr("#0- +", *p))
+		p++;
+
+	if (*p == '*') {
+		(*stars)++;
+		p++;
+	}
+
+	else while (char_isdigit(*p))
+		p++;
+
+	if (*p == '.') {
+		*prec = 0;
+
+		if (*++p == '*') {
+			(*stars)++;
+			*prec = LOG_BIN_PREC_STAR;
+			p++;
+		}
+
+		else while (char_isdigit(*p)) {
+			if (*prec < INT_MAX / 10)
+				*prec = *prec * 10 + (*p - '0');
+
+			p++;
+		}
+	}
+
+	/* long double is not deferred, mark it as invalid */
+	for (; *p == 'h' || *p == 'l' || *p == 'L'; p++)
+		*l += *p == 'l' ? 1 : *p == 'h' ? 0 : 100;
+
+	if ((*c = *p))
+		p++;
+
+	return p;
+}
+
+/* argument types of a format: int, long, long long (q), double, pointer and
+ * string, with the precision of strings in precs; returns the number of
+ * arguments or -1 if they cannot be deferred */
+static
+int log_bin_types(const char *fmt, char *types, int *precs)
+{
+	const char *p = fmt;
+	int n = 0, stars, l, prec;
+	char c;
+
+	while ((p = strchr(p, '%'))) {
+		p = log_bin_spec(p + 1, &stars, &l, &prec, &c);
+
+		if (c == '%')
+			continue;
+
+		if (n + stars + 1 > LOG_BIN_MAXARGS || l >= 100)
+			return -1;
+
+		while (stars--)
+			types[n++] = 'i';
+
+		switch (c) {
+		case 'c':
+			types[n++] = 'i';
+			break;
+
+		case 'd':
+		case 'i':
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			types[n++] = l >= 2 ? 'q' : l == 1 ? 'l' : 'i';
+			break;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+			types[n++] = 'd';
+			break;
+
+		case 'p':
+		case 'P':
+			types[n++] = 'p';
+			break;
+
+		case 's':
+			precs[n]   = prec;
+			types[n++] = 's';
+			break;
+
+		default:
+			return -1;
+		}
+	}
+
+	types[n] = '\0';
+
+	return n;
+}
+
+static
+int64_t log_bin_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* find or add the format of a key without taking a lock; returns NULL if
+ * messages with this key cannot be deferred */
+static
+log_fmt_t *log_bin_format(const void *key, const char *file, int line,
+		const char *fmt)
+{
+	const void *cur;
+	log_fmt_t *f;
+	uint32_t i;
+
+	i = ((uintptr_t) key >> 3) * 0x9E3779B97F4A7C15ULL >> 54;
+
+	for (;; i = (i + 1) % LOG_BIN_FORMATS) {
+		f   = &log_fmts[i];
+		cur = __atomic_load_n(&f->key, __ATOMIC_ACQUIRE);
+
+		if (cur == key)
+			break;
+
+		if (cur)
+			continue;
+
+		if (__atomic_load_n(&log_nfmts, __ATOMIC_RELAXED) >= LOG_BIN_FORMATS / 4 * 3)
+			return NULL;
+
+		if (!__atomic_compare_exchange_n(&f->key, &cur, key, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			if (cur == key)
+				break;
+
+			continue;
+		}
+
+		__atomic_fetch_add(&log_nfmts, 1, __ATOMIC_RELAXED);
+
+		f->file  = file;
+		f->line  = line;
+		f->nargs = (f->fmt = str_dup(fmt)) ? log_bin_types(fmt, f->types, f->precs) : -1;
+
+		__atomic_store_n(&f->ready, 1, __ATOMIC_RELEASE);
+
+		break;
+	}
+
+	/* a format string may be a buffer that is reused for another one */
+	if (!__atomic_load_n(&f->ready, __ATOMIC_ACQUIRE) || f->nargs < 0 ||
+			(key == fmt && strcmp(f->fmt, fmt)))
+		return NULL;
+
+	return f;
+}
+
+#define LOG_BIN_PUT(p, v) (memcpy((p), &(v), sizeof(v)), (p) += sizeof(v))
+
+/* render a text record; returns its length */
+static
+size_t log_bin_text_rec(char *buf, int prio, int64_t t, int32_t err,
+		const char *msg, uint32_t len)
+{
+	char *p = buf, kind = LOG_BIN_TEXT;
+	uint8_t p8 = prio;
+
+	LOG_BIN_PUT(p, kind);
+	LOG_BIN_PUT(p, p8);
+	LOG_BIN_PUT(p, t);
+	LOG_BIN_PUT(p, err);
+	LOG_BIN_PUT(p, len);
+	memcpy(p, msg, len);
+
+	return p + len - buf;
+}
+
+/* append an already formatted message to the binary log */
+static
+void log_bin_text(const log_conn_t *c, int prio, const char *msg)
+{
+	log_ring_t *ring;
+	log_rec_t rec;
+	uint32_t len = str_len(msg);
+	size_t tail;
+	char *buf;
+
+	if (!(ring = log_ring_get(c)))
+		return;
+
+	if (len > ring->size / 4)
+		len = ring->size / 4;
+
+	rec.len  = 1 + 1 + 8 + 4 + 4 + len;
+	rec.prio = prio|LOG_REC_BIN;
+	rec.time = 0;
+
+	if (!(buf = log_ring_reserve(c, ring, rec.len, &tail)))
+		return;
+
+	memcpy(buf, &rec, sizeof(rec));
+	log_bin_text_rec(buf + sizeof(rec), prio, log_bin_time(), -1, msg, len);
+
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+/* append a message to the binary log without formatting it; returns -1 if
+ * the caller has to format it, ap is left untouched */
+static
+int log_bin_msg(const log_conn_t *c, const void *key, const char *file,
+		int line, int prio, const char *fmt, int32_t err, va_list ap)
+{
+	uint32_t slen[LOG_BIN_MAXARGS], id;
+	const char *str;
+	log_ring_t *ring;
+	log_fmt_t *f;
+	log_rec_t rec;
+	int64_t t, v;
+	int prec, star = -1;
+	size_t tail;
+	char *buf, *p, kind = LOG_BIN_MSG;
+	uint8_t p8 = prio;
+	double d;
+	va_list aq;
+	int i;
+
+	if (!(f = log_bin_format(key, file, line, fmt)) || !(ring = log_ring_get(c)))
+		return -1;
+
+	/* the size of the record depends on the strings */
+	rec.len  = 1 + 4 + 1 + 8 + 4;
+	rec.prio = prio|LOG_REC_BIN;
+	rec.time = 0;
+
+	va_copy(aq, ap);
+
+	for (i = 0; i < f->nargs; i++) {
+		switch (f->types[i]) {
+		case 'i':
+			star = va_arg(aq, int);
+			break;
+
+		case 'l':
+			va_arg(aq, long int);
+			break;
+
+		case 'q':
+			va_arg(aq, long long int);
+			break;
+
+		case 'p':
+			va_arg(aq, void *);
+			break;
+
+		case 'd':
+			va_arg(aq, double);
+			break;
+
+		case 's':
+			str  = va_arg(aq, const char *);
+			prec = f->precs[i] == LOG_BIN_PREC_STAR ? star : f->precs[i];
+
+			/* the string need not be terminated within its precision */
+			if (!str)
+				slen[i] = LOG_BIN_NULL;
+			else if (prec >= 0)
+				slen[i] = strnlen(str, prec);
+			else
+				slen[i] = str_len(str);
+
+			rec.len += 4 + (str ? slen[i] : 0);
+			continue;
+		}
+
+		rec.len += 8;
+	}
+
+	va_end(aq);
+
+	if (rec.len > ring->size / 4)
+		return -1;
+
+	if (!(buf = log_ring_reserve(c, ring, rec.len, &tail)))
+		return 0;
+
+	memcpy(buf, &rec, sizeof(rec));
+
+	p  = buf + sizeof(rec);
+	id = f - log_fmts + 1;
+	t  = log_bin_time();
+
+	LOG_BIN_PUT(p, kind);
+	LOG_BIN_PUT(p, id);
+	LOG_BIN_PUT(p, p8);
+	LOG_BIN_PUT(p, t);
+	LOG_BIN_PUT(p, err);
+
+	va_copy(aq, ap);
+
+	for (i = 0; i < f->nargs; i++) {
+		switch (f->types[i]) {
+		case 'i':
+			v = va_arg(aq, int);
+			LOG_BIN_PUT(p, v);
+			break;
+
+		case 'l':
+			v = va_arg(aq, long int);
+			LOG_BIN_PUT(p, v);
+			break;
+
+		case 'q':
+			v = va_arg(aq, long long int);
+			LOG_BIN_PUT(p, v);
+			break;
+
+		case 'p':
+			v = (uintptr_t) va_arg(aq, void *);
+			LOG_BIN_PUT(p, v);
+			break;
+
+		case 'd':
+			d = va_arg(aq, double);
+			LOG_BIN_PUT(p, d);
+			break;
+
+		case 's':
+			str = va_arg(aq, const char *);
+			LOG_BIN_PUT(p, slen[i]);
+
+			if (str) {
+				memcpy(p, str, slen[i]);
+				p += slen[i];
+			}
+
+			break;
+		}
+	}
+
+	va_end(aq);
+
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* output buffers for the records of the rings */
+typedef struct {
+	const log_conn_t *c;
+	obuf_t err;
+	obuf_t file;
+	obuf_t bin;
+} log_out_t;
+
+/* buf holds three buffers of size bytes, or is NULL to allocate them */
+static
+void log_out_init(log_out_t *out, const log_conn_t *c, char *buf, int size)
+{
+	out->c = c;
+
+	obuf_init(&out->err, STDERR_FILENO, buf, size, 0);
+	obuf_init(&out->file, c->opts.log_fd, buf ? buf + size : NULL, size, 0);
+	obuf_init(&out->bin, c->opts.log_binfd, buf ? buf + 2 * size : NULL, size, 0);
+}
+
+static
+void log_out_flush(log_out_t *out)
+{
+	obuf_flush(&out->err);
+	obuf_flush(&out->file);
+	obuf_flush(&out->bin);
+}
+
+/* write the format of a message before its first use */
+static
+void log_out_format(log_out_t *out, uint32_t id)
+{
+	const log_fmt_t *f = &log_fmts[id - 1];
+	uint32_t u;
+	char kind = LOG_BIN_FORMAT;
+
+	if (log_async.binfmts[id - 1])
+		return;
+
+	log_async.binfmts[id - 1] = 1;
+
+	obuf_catb(&out->bin, &kind, 1);
+	obuf_catb(&out->bin, &id, 4);
+	u = f->line;
+	obuf_catb(&out->bin, &u, 4);
+	u = f->nargs;
+	obuf_catb(&out->bin, &u, 4);
+	obuf_catb(&out->bin, f->types, f->nargs);
+	u = f->file ? str_len(f->file) : 0;
+	obuf_catb(&out->bin, &u, 4);
+
+	if (f->file)
+		obuf_catb(&out->bin, f->file, u);
+	u = str_len(f->fmt);
+	obuf_catb(&out->bin, &u, 4);
+	obuf_catb(&out->bin, f->fmt, u);
+}
+
+/* emit one record to all destinations */
+static
+void log_out_emit(log_out_t *out, int prio, time_t t, const char *msg, int len)
+{
+	const log_conn_t *c = out->c;
+	uint32_t id;
+	int sprio;
+
+	if (prio & LOG_REC_BIN) {
+		if (!(c->opts.log_dest & LOGD_BINARY))
+			return;
+
+		if (msg[0] == LOG_BIN_MSG) {
+			memcpy(&id, msg + 1, 4);
+			log_out_format(out, id);
+		}
+
+		obuf_catb(&out->bin, msg, len);
+		return;
+	}
+
+	if (c->opts.log_dest & LOGD_STDERR)
+		log_line(&out->err, c, prio, t, msg, len);
+
+	if (c->opts.log_dest & LOGD_FILE)
+		log_line(&out->file, c, prio, t, msg, len);
+
+	if (c->opts.log_dest & LOGD_SYSLOG)
+		if ((sprio = prio_to_syslog(prio)) >= 0)
+			syslog(c->opts.log_facility|sprio, "%.*s", len, msg);
+}
+
+/* write all records of a ring; returns the number of records */
+static
+int log_ring_drain(log_ring_t *ring, log_out_t *out)
+{
+	size_t head = ring->head, tail, off;
+	unsigned long lost;
+	log_rec_t rec;
+	char buf[64], bin[96];
+	int n = 0, len;
+
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		off = head & (ring->size - 1);
+
+		if (*(uint32_t *) (ring->buf + off) == LOG_WRAP) {
+			head += ring->size - off;
+			continue;
+		}
+
+		memcpy(&rec, ring->buf + off, sizeof(rec));
+
+		log_out_emit(out, rec.prio, rec.time,
+				ring->buf + off + sizeof(rec), rec.len);
+
+		head += LOG_RECSIZE(rec.len);
+		n++;
+	}
+
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+	if ((lost = __atomic_exchange_n(&ring->lost, 0, __ATOMIC_RELAXED))) {
+		len = _lucid_snprintf(buf, sizeof(buf), "%lu log messages dropped", lost);
+
+		log_out_emit(out, LOGP_WARN, log_now(), buf, len);
+		log_out_emit(out, LOGP_WARN|LOG_REC_BIN, 0, bin,
+				log_bin_text_rec(bin, LOGP_WARN, log_bin_time(), -1, buf, len));
+	}
+
+	return n;
+}
+
+static
+void *log_writer(void *arg)
+{
+	log_out_t out;
+	log_ring_t *ring, **rp;
+	struct timespec ts;
+	int n, stop;
+
+	log_out_init(&out, arg, NULL, LOG_BATCHSIZE);
+
+	pthread_mutex_lock(&log_async.lock);
+
+	for (;;) {
+		stop = log_async.stop;
+
+		for (n = 0, rp = &log_async.rings; (ring = *rp);) {
+			n += log_ring_drain(ring, &out);
+
+			/* rings of exited threads are released once empty */
+			if (__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE) &&
+					ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+				*rp = ring->next;
+				free(ring);
+			}
+
+			else
+				rp = &ring->next;
+		}
+
+		log_out_flush(&out);
+
+		/* the stop flag was read before draining, so nothing is lost */
+		if (stop)
+			break;
+
+		/* give others a chance to take the lock while busy */
+		if (n > 0) {
+			pthread_mutex_unlock(&log_async.lock);
+			sched_yield();
+			pthread_mutex_lock(&log_async.lock);
+		}
+
+		else {
+			clock_gettime(CLOCK_REALTIME, &ts);
+
+			ts.tv_nsec += LOG_INTERVAL * 1000000L;
+
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+
+			pthread_cond_timedwait(&log_async.wake, &log_async.lock, &ts);
+		}
+	}
+
+	pthread_mutex_unlock(&log_async.lock);
+
+	obuf_free(&out.err);
+	obuf_free(&out.file);
+	obuf_free(&out.bin);
+
+	return NULL;
+}
+
+static
+int log_async_start(log_conn_t *c)
+{
+	if (!log_async.keyed) {
+		if ((errno = pthread_key_create(&log_async.key, log_ring_exit)))
+			return -1;
+
+		log_async.keyed = 1;
+	}
+
+	log_async.stop = 0;
+	log_async.conn = c;
+
+	/* formats are written again to every binary log */
+	memset(log_async.binfmts, 0, sizeof(log_async.binfmts));
+
+	if ((errno = pthread_create(&log_async.writer, NULL, log_writer, c)))
+		return -1;
+
+	log_async.running = 1;
+
+	return 0;
+}
+
+/* free all rings; the next message of a thread sets up a new one */
+static
+void log_async_release(void)
+{
+	log_ring_t *ring;
+
+	while ((ring = log_async.rings)) {
+		log_async.rings = ring->next;
+		free(ring);
+	}
+
+	if (log_async.keyed)
+		pthread_key_delete(log_async.key);
+
+	/* invalidate the rings cached by threads */
+	log_async.gen++;
+	log_async.keyed = 0;
+}
+
+/* write all pending records; the rings stay in place unless released, since
+ * other threads may still append to them */
+static
+void log_async_stop(int release)
+{
+	if (log_async.running) {
+		pthread_mutex_lock(&log_async.lock);
+		log_async.stop = 1;
+		pthread_cond_signal(&log_async.wake);
+		pthread_mutex_unlock(&log_async.lock);
+
+		pthread_join(log_async.writer, NULL);
+
+		log_async.running = 0;
+	}
+
+	if (release)
+		log_async_release();
+}
+
+/* write all pending records from the calling thread; the writer drains and
+ * flushes with the lock held, so everything logged before is out on return */
+static
+void log_async_flush(void)
+{
+	char buf[3 * OBUF_SIZE];
+	log_out_t out;
+	log_ring_t *ring;
+
+	if (!log_async.running)
+		return;
+
+	log_out_init(&out, log_async.conn, buf, OBUF_SIZE);
+
+	pthread_mutex_lock(&log_async.lock);
+
+	for (ring = log_async.rings; ring; ring = ring->next)
+		log_ring_drain(ring, &out);
+
+	log_out_flush(&out);
+
+	pthread_mutex_unlock(&log_async.lock);
+}
+
+/* the writer thread does not survive fork(2): records left in the rings are
+ * written by the parent, the child drops them and logs synchronously */
+static
+void log_atfork_prepare(void)
+{
+	pthread_mutex_lock(&log_conn_lock);
+	pthread_mutex_lock(&log_async.lock);
+}
+
+static
+void log_atfork_parent(void)
+{
+	pthread_mutex_unlock(&log_async.lock);
+	pthread_mutex_unlock(&log_conn_lock);
+}
+
+static
+void log_atfork_child(void)
+{
+	log_conn_t *c = log_conn();
+
+	if (log_async.keyed) {
+		log_async_release();
+		pthread_cond_init(&log_async.wake, NULL);
+		log_async.running = 0;
+	}
+
+	pthread_mutex_unlock(&log_async.lock);
+	pthread_mutex_unlock(&log_conn_lock);
+
+	/* the child is single threaded, the connection can be changed in place */
+	if (c) {
+		c->opts.log_opts &= ~LOGO_ASYNC;
+		c->opts.log_dest &= ~LOGD_BINARY;
+		log_tail_render(c);
+	}
+}
+
+static
+void log_atfork_register(void)
+{
+	pthread_atfork(log_atfork_prepare, log_atfork_parent, log_atfork_child);
+	atexit(log_async_flush);
+}
+
+/* start a binary log */
+static
+void log_bin_header(const log_conn_t *c)
+{
+	char buf[OBUF_SIZE], kind = LOG_BIN_HEADER;
+	obuf_t ob;
+	uint32_t u;
+
+	obuf_init(&ob, c->opts.log_binfd, buf, sizeof(buf), 0);
+
+	obuf_catb(&ob, &kind, 1);
+	obuf_catb(&ob, LOG_BIN_MAGIC, 8);
+	u = LOG_BIN_VERSION;
+	obuf_catb(&ob, &u, 4);
+	u = c->opts.log_opts;
+	obuf_catb(&ob, &u, 4);
+	u = getpid();
+	obuf_catb(&ob, &u, 4);
+	u = str_len(c->opts.log_ident);
+	obuf_catb(&ob, &u, 4);
+	obuf_catb(&ob, c->opts.log_ident, u);
+
+	obuf_flush(&ob);
+}
+
+/* map the ring file, continuing a ring of the same size */
+static
+int log_map_open(log_conn_t *c)
+{
+	log_map_t *m;
+	struct stat sb;
+	uint32_t size = LOG_MAPSIZE;
+	size_t len;
+
+	if (c->opts.log_mapsize > 0)
+		for (size = 4096; size < (uint32_t) c->opts.log_mapsize &&
+				size < LOG_MAPSIZEMAX; size <<= 1);
+
+	len = sizeof(*m) + size;
+
+	if (fstat(c->opts.log_mapfd, &sb) == -1)
+		return -1;
+
+	if ((size_t) sb.st_size != len && ftruncate(c->opts.log_mapfd, len) == -1)
+		return -1;
+
+	m = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, c->opts.log_mapfd, 0);
+
+	if (m == MAP_FAILED)
+		return -1;
+
+	if (memcmp(m->magic, LOG_MAP_MAGIC, 8) || m->version != LOG_MAP_VERSION ||
+			m->size != size || m->tail < m->head ||
+			m->tail - m->head > size) {
+		memset(m, 0, sizeof(*m));
+		memcpy(m->magic, LOG_MAP_MAGIC, 8);
+		m->version = LOG_MAP_VERSION;
+		m->size    = size;
+	}
+
+	m->opts = c->opts.log_opts;
+	strncpy(m->ident, c->opts.log_ident, sizeof(m->ident) - 1);
+
+	/* a process that died holding the lock will not release it */
+	m->lock = 0;
+
+	c->map = m;
+
+	return 0;
+}
+
+/* copy a message into the ring file */
+static
+void log_map_text(const log_conn_t *c, int prio, const char *msg)
+{
+	log_map_t *m = c->map;
+	log_maprec_t rec;
+	char *ring = (char *) (m + 1);
+	uint64_t head, pos;
+	uint32_t len = str_len(msg), off, pad, need, u;
+
+	/* a message never takes more than a quarter of the ring */
+	if (len > m->size / 4 - sizeof(rec))
+		len = m->size / 4 - sizeof(rec);
+
+	need = LOG_MAP_RECSIZE(len);
+
+	while (__atomic_exchange_n(&m->lock, 1, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	head = m->head;
+	off  = m->tail & (m->size - 1);
+	pad  = off + need > m->size ? m->size - off : 0;
+	pos  = m->tail + pad;
+
+	/* overwrite the oldest records */
+	while (pos + need - head > m->size) {
+		u = __atomic_load_n((uint32_t *) (ring + (head & (m->size - 1))),
+				__ATOMIC_RELAXED);
+
+		if (u == LOG_WRAP)
+			head += m->size - (head & (m->size - 1));
+		else
+			head += LOG_MAP_RECSIZE(u & ~LOG_MAP_DONE);
+	}
+
+	if (pad)
+		*(uint32_t *) (ring + off) = LOG_WRAP;
+
+	rec.len  = len;
+	rec.prio = prio;
+	rec.pid  = c->pid;
+	rec.pad  = 0;
+	rec.time = log_bin_time();
+
+	off = pos & (m->size - 1);
+	memcpy(ring + off, &rec, sizeof(rec));
+
+	m->head = head;
+	m->tail = pos + need;
+
+	__atomic_store_n(&m->lock, 0, __ATOMIC_RELEASE);
+
+	memcpy(ring + off + sizeof(rec), msg, len);
+	__atomic_store_n((uint32_t *) (ring + off), len | LOG_MAP_DONE,
+			__ATOMIC_RELEASE);
+}
+
+/* send a formatted message to all destinations */
+static
+void log_msg(const log_conn_t *c, int prio, const char *msg)
+{
+	struct iovec line[4], iov[4];
+	char head[64];
+	int sprio;
+
+	if (c->opts.log_dest & LOGD_BINARY)
+		log_bin_text(c, prio, msg);
+
+	/* the ring file is written by the calling thread in any mode */
+	if (c->opts.log_dest & LOGD_MMAP)
+		log_map_text(c, prio, msg);
+
+	if (!(c->opts.log_dest & LOGD_TEXT))
+		return;
+
+	/* fall back to writing directly if the ring cannot be set up */
+	if ((c->opts.log_opts & LOGO_ASYNC) && log_ring_push(c, prio, msg) == 0)
+		return;
+
+	/* the line is assembled once and written with one call per destination */
+	if (c->opts.log_dest & (LOGD_STDERR|LOGD_FILE)) {
+		line[0].iov_base = head;
+		line[0].iov_len  = log_head(c, head, prio, log_now());
+		line[1].iov_base = (char *) c->tail;
+		line[1].iov_len  = c->taillen;
+		line[2].iov_base = (char *) msg;
+		line[2].iov_len  = str_len(msg);
+		line[3].iov_base = "\n";
+		line[3].iov_len  = 1;
+	}
+
+	if (c->opts.log_dest & LOGD_STDERR) {
+		memcpy(iov, line, sizeof(line));
+		log_fd(STDERR_FILENO, iov, 4);
+	}
+
+	if (c->opts.log_dest & LOGD_FILE) {
+		memcpy(iov, line, sizeof(line));
+		log_fd(c->opts.log_fd, iov, 4);
+	}
+
+	if (c->opts.log_dest & LOGD_SYSLOG)
+		if ((sprio = prio_to_syslog(prio)) >= 0)
+			syslog(c->opts.log_facility|sprio, "%s", msg);
+}
+
+/* rule set by log_site_enable() */
+typedef struct log_rule {
+	struct log_rule *next;
+	char *file;
+	int line;
+	int on;
+} log_rule_t;
+
+static struct {
+	pthread_mutex_t lock;  /* protects sites and rules */
+	log_site_t *sites;
+	log_rule_t *rules;     /* most recent first */
+} log_sites = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static
+int log_rule_match(const log_rule_t *rule, const log_site_t *site)
+{
+	size_t len, flen;
+
+	if (rule->line && rule->line != site->line)
+		return 0;
+
+	if (!rule->file)
+		return 1;
+
+	len  = str_len(rule->file);
+	flen = str_len(site->file);
+
+	return flen >= len && !strcmp(site->file + flen - len, rule->file) &&
+		(flen == len || site->file[flen - len - 1] == '/');
+}
+
+/* compute the state of a site; called with log_sites.lock held */
+static
+void log_site_update(log_site_t *site)
+{
+	log_conn_t *c = log_conn();
+	int state;
+
+	/* without a connection every site is disabled */
+	if (!c)
+		state = 0;
+	else if (site->force >= 0)
+		state = site->force;
+	else
+		state = (c->opts.log_mask & (1 << site->prio)) != 0;
+
+	__atomic_store_n(&site->state, state, __ATOMIC_RELAXED);
+}
+
+static
+void log_site_update_all(void)
+{
+	log_site_t *site;
+
+	pthread_mutex_lock(&log_sites.lock);
+
+	for (site = log_sites.sites; site; site = site->next)
+		log_site_update(site);
+
+	pthread_mutex_unlock(&log_sites.lock);
+}
+
+static
+void log_site_register(log_site_t *site)
+{
+	log_rule_t *rule;
+
+	pthread_mutex_lock(&log_sites.lock);
+
+	/* another thread may have been faster */
+	if (__atomic_load_n(&site->state, __ATOMIC_RELAXED) == LOG_SITE_UNKNOWN) {
+		for (rule = log_sites.rules; rule; rule = rule->next)
+			if (log_rule_match(rule, site))
+				break;
+
+		site->force = rule ? rule->on : -1;
+		site->next  = log_sites.sites;
+		log_sites.sites = site;
+
+		log_site_update(site);
+	}
+
+	pthread_mutex_unlock(&log_sites.lock);
+}
+
+/* monotonic time in ns for rate limits */
+static
+unsigned long long log_site_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* decide whether a limited site may send a message; lock-free */
+static
+int log_site_pass(log_site_t *site, unsigned long long *now)
+{
+	unsigned long long tat, next, interval, slack;
+
+	if (site->every > 0 &&
+			__atomic_fetch_add(&site->hits, 1, __ATOMIC_RELAXED) % site->every)
+		goto suppress;
+
+	if (site->rate <= 0)
+		return 1;
+
+	/* token bucket kept in one word: tat is the time at which the bucket
+	 * would be full again, and it may run ahead of now by burst messages */
+	*now     = log_site_time();
+	interval = 1000000000ULL / site->rate;
+	slack    = interval * (site->burst > 1 ? site->burst - 1 : 0);
+	tat      = __atomic_load_n(&site->tat, __ATOMIC_RELAXED);
+
+	do {
+		if (tat > *now + slack)
+			goto suppress;
+
+		next = (tat > *now ? tat : *now) + interval;
+	} while (!__atomic_compare_exchange_n(&site->tat, &tat, next, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return 1;
+
+suppress:
+	__atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* report suppressed messages of a site, or those pending for one second */
+static
+void log_site_report(const log_conn_t *c, log_site_t *site,
+		unsigned long long now)
+{
+	unsigned long long next;
+	unsigned long n;
+	char buf[256];
+
+	if (!__atomic_load_n(&site->suppressed, __ATOMIC_RELAXED))
+		return;
+
+	if (now) {
+		next = __atomic_load_n(&site->report, __ATOMIC_RELAXED);
+
+		/* only one thread reports in each period */
+		if (now < next || !__atomic_compare_exchange_n(&site->report, &next,
+				now + 1000000000ULL, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return;
+	}
+
+	if (!(n = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED)))
+		return;
+
+	_lucid_snprintf(buf, sizeof(buf), "%s:%d: %lu messages suppressed",
+			site->file, site->line, n);
+
+	log_msg(c, site->prio, buf);
+}
 
+/* report suppressed messages of all sites */
 static
-int mask_to_syslog(int mask)
+void log_site_report_all(const log_conn_t *c)
 {
-	int newmask = 0;
+	log_site_t *site;
 
-	if (mask & MASK_PRIO(LOGP_ALERT))
-		newmask |= MASK_PRIO(LOG_ALERT);
-	if (mask & MASK_PRIO(LOGP_ERROR))
-		newmask |= MASK_PRIO(LOG_ERR);
-	if (mask & MASK_PRIO(LOGP_WARN))
-		newmask |= MASK_PRIO(LOG_WARNING);
-	if (mask & MASK_PRIO(LOGP_NOTE))
-		newmask |= MASK_PRIO(LOG_NOTICE);
-	if (mask & MASK_PRIO(LOGP_INFO))
-		newmask |= MASK_PRIO(LOG_INFO);
-	if (mask & MASK_PRIO(LOGP_DEBUG))
-		newmask |= MASK_PRIO(LOG_DEBUG);
+	pthread_mutex_lock(&log_sites.lock);
 
-	return newmask;
+	for (site = log_sites.sites; site; site = site->next)
+		log_site_report(c, site, 0);
+
+	pthread_mutex_unlock(&log_sites.lock);
 }
 
+/* append ": strerror(errnum)" to a message of len bytes unless errnum is
+ * negative; the message is released on failure */
 static
-int prio_to_syslog(int prio)
+int log_strerror_cat(char **msg, int len, int errnum)
 {
-	switch (prio) {
-		case LOGP_ALERT: return LOG_ALERT;
-		case LOGP_ERROR: return LOG_ERR;
-		case LOGP_WARN:  return LOG_WARNING;
-		case LOGP_NOTE:  return LOG_NOTICE;
-		case LOGP_INFO:  return LOG_INFO;
-		case LOGP_DEBUG: return LOG_DEBUG;
+	const char *err;
+	char *tmp;
+	int errlen;
+
+	if (errnum < 0)
+		return 0;
+
+	err    = strerror(errnum);
+	errlen = str_len(err);
+
+	if (!(tmp = realloc(*msg, len + errlen + 3))) {
+		free(*msg);
+		return -1;
 	}
 
-	return -1;
+	memcpy(tmp + len, ": ", 2);
+	memcpy(tmp + len + 2, err, errlen + 1);
+
+	*msg = tmp;
+	return 0;
+}
+
+void log_site(log_site_t *site, int errnum, ...)
+{
+	unsigned long long now = 0;
+	const printf_prog_t *prog;
+	log_conn_t *c = log_conn();
+	va_list ap;
+	char *msg;
+	int len;
+
+	/* sites are registered once a connection exists, so that they are
+	 * updated by the next log_init() */
+	if (!c)
+		return;
+
+	if (__atomic_load_n(&site->state, __ATOMIC_RELAXED) == LOG_SITE_UNKNOWN) {
+		log_site_register(site);
+
+		if (!__atomic_load_n(&site->state, __ATOMIC_RELAXED))
+			return;
+	}
+
+	/* limits are checked before anything is formatted */
+	if (site->rate > 0 || site->every > 0) {
+		if (!log_site_pass(site, &now))
+			return;
+
+		log_site_report(c, site, now ? now : log_site_time());
+	}
+
+	if (!site->perror)
+		errnum = -1;
+
+	va_start(ap, errnum);
+
+	/* formatting is deferred if nothing else needs the text */
+	if ((c->opts.log_dest & (LOGD_FORMAT|LOGD_BINARY)) == LOGD_BINARY &&
+			log_bin_msg(c, site, site->file, site->line, site->prio,
+				site->fmt, errnum, ap) == 0) {
+		va_end(ap);
+		return;
+	}
+
+	if ((prog = printf_compile_once(&site->prog, site->fmt)))
+		len = printf_exec_vasprintf(prog, &msg, ap);
+	else
+		len = _lucid_vasprintf(&msg, site->fmt, ap);
+
+	va_end(ap);
+
+	if (len == -1 || log_strerror_cat(&msg, len, errnum) == -1)
+		return;
+
+	log_msg(c, site->prio, msg);
+	free(msg);
+}
+
+int log_site_enable(const char *file, int line, int on)
+{
+	log_rule_t *rule;
+	log_site_t *site;
+
+	if (on < -1 || on > 1)
+		return errno = EINVAL, -1;
+
+	if (!(rule = calloc(1, sizeof(*rule))) ||
+			(file && !(rule->file = str_dup(file)))) {
+		free(rule);
+		return -1;
+	}
+
+	rule->line = line;
+	rule->on   = on;
+
+	pthread_mutex_lock(&log_sites.lock);
+
+	rule->next = log_sites.rules;
+	log_sites.rules = rule;
+
+	for (site = log_sites.sites; site; site = site->next) {
+		if (log_rule_match(rule, site)) {
+			site->force = on;
+			log_site_update(site);
+		}
+	}
+
+	pthread_mutex_unlock(&log_sites.lock);
+
+	return 0;
 }
 
 void log_init(log_options_t *options)
 {
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	log_conn_t *c;
 	struct stat sb;
 
 	/* check file destination */
@@ -79,6 +1639,11 @@ void log_init(log_options_t *options)
 		if (options->log_fd < 0 || fstat(options->log_fd, &sb) == -1)
 			options->log_dest &= ~LOGD_FILE;
 
+	/* check binary destination */
+	if (options->log_dest & LOGD_BINARY)
+		if (options->log_binfd < 0 || fstat(options->log_binfd, &sb) == -1)
+			options->log_dest &= ~LOGD_BINARY;
+
 	/* check if STDERR is available */
 	if (options->log_dest & LOGD_STDERR)
 		if (fstat(STDERR_FILENO, &sb) == -1)
@@ -99,92 +1664,114 @@ void log_init(log_options_t *options)
 		setlogmask(mask_to_syslog(options->log_mask));
 	}
 
-	_log_options = (log_options_t *) malloc(sizeof(log_options_t));
+	/* room for ident, "[pid]" and ": " in the tail */
+	if (!(c = malloc(sizeof(*c) + str_len(options->log_ident) + STR_FMT_MAX + 8)))
+		return;
+
+	memcpy(&c->opts, options, sizeof(log_options_t));
+	log_tail_render(c);
+
+	c->map = NULL;
+
+	if ((c->opts.log_dest & LOGD_MMAP) && log_map_open(c) == -1)
+		c->opts.log_dest &= ~LOGD_MMAP;
+
+	pthread_once(&once, log_atfork_register);
+	pthread_mutex_lock(&log_conn_lock);
+
+	c->prev = log_conn();
+
+	/* a previous connection may still have a writer thread; the new one
+	 * is started before publishing, so no record is left unwritten */
+	log_async_stop(0);
+
+	if (c->opts.log_dest & LOGD_BINARY)
+		log_bin_header(c);
+
+	/* binary records are always written by the writer thread */
+	if ((c->opts.log_opts & LOGO_ASYNC) || (c->opts.log_dest & LOGD_BINARY)) {
+		if (log_async_start(c) == -1) {
+			c->opts.log_opts &= ~LOGO_ASYNC;
+			c->opts.log_dest &= ~LOGD_BINARY;
+		}
+	}
+
+	__atomic_store_n(&_log_options, &c->opts, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&log_conn_lock);
 
-	memcpy(_log_options, options, sizeof(log_options_t));
+	log_site_update_all();
+}
+
+void log_flush(void)
+{
+	log_async_flush();
 }
 
 void log_close(void)
 {
-	if (!_log_options)
+	log_conn_t *c, *prev;
+
+	pthread_mutex_lock(&log_conn_lock);
+
+	if (!(c = log_conn())) {
+		pthread_mutex_unlock(&log_conn_lock);
 		return;
+	}
+
+	log_site_report_all(c);
+
+	log_async_stop(1);
 
-	if (_log_options->log_dest & LOGD_SYSLOG)
+	if (c->opts.log_dest & LOGD_SYSLOG)
 		closelog();
 
-	if (_log_options->log_dest & LOGD_FILE)
-		close(_log_options->log_fd);
+	if (c->opts.log_dest & LOGD_FILE)
+		close(c->opts.log_fd);
 
-	free(_log_options);
+	if (c->opts.log_dest & LOGD_BINARY)
+		close(c->opts.log_binfd);
 
-	_log_options = 0;
-}
+	if (c->opts.log_dest & LOGD_MMAP)
+		close(c->opts.log_mapfd);
 
-static
-void log_fd(int fd, int prio, const char *msg)
-{
-	char timebuf[17];
-	time_t curtime = time(0);
+	__atomic_store_n(&_log_options, NULL, __ATOMIC_RELEASE);
 
-	if (!(_log_options->log_mask & (1 << prio)))
-		return;
+	for (; c; c = prev) {
+		prev = c->prev;
 
-	if (_log_options->log_opts & LOGO_PRIO) {
-		switch (prio) {
-			case LOGP_ALERT: _lucid_dprintf(fd, "[alert]"); break;
-			case LOGP_ERROR: _lucid_dprintf(fd, "[error]"); break;
-			case LOGP_WARN:  _lucid_dprintf(fd, "[warn ]"); break;
-			case LOGP_NOTE:  _lucid_dprintf(fd, "[note ]"); break;
-			case LOGP_INFO:  _lucid_dprintf(fd, "[info ]"); break;
-			case LOGP_DEBUG: _lucid_dprintf(fd, "[debug]"); break;
-			case LOGP_TRACE: _lucid_dprintf(fd, "[trace]"); break;
-			default:         _lucid_dprintf(fd, "[none ]"); break;
-		}
-	}
+		if (c->map)
+			munmap(c->map, sizeof(*c->map) + c->map->size);
 
-	if (_log_options->log_opts & LOGO_TIME) {
-		memset(timebuf, 0, 17);
-		strftime(timebuf, 17, "%b %d %T", localtime(&curtime));
-		_lucid_dprintf(fd, " %s", timebuf);
+		free(c);
 	}
 
-	if (_log_options->log_opts & LOGO_IDENT)
-		_lucid_dprintf(fd, " %s", _log_options->log_ident);
+	pthread_mutex_unlock(&log_conn_lock);
 
-	if (_log_options->log_opts & LOGO_PID)
-		_lucid_dprintf(fd, "[%d]", getpid());
-
-	_lucid_dprintf(fd, "%s%s\n",
-			_log_options->log_opts ? ": " : "", msg);
+	log_site_update_all();
 }
 
 static
-void log_internal(int prio, int strerr, const char *fmt, va_list ap)
+void log_internal(int prio, int errnum, const char *fmt, va_list ap)
 {
-	char *buf, *msg;
+	log_conn_t *c = log_conn();
+	char *msg;
+	int len;
 
-	if (!_log_options)
+	/* nothing is formatted for disabled levels */
+	if (!c || !(c->opts.log_mask & (1 << prio)))
 		return;
 
-	_lucid_vasprintf(&msg, fmt, ap);
-
-	if (strerr) {
-		buf = msg;
-		_lucid_asprintf(&msg, "%s: %s", buf, strerror(errno_orig));
-		free(buf);
-	}
-
-	if (_log_options->log_dest & LOGD_STDERR)
-		log_fd(STDERR_FILENO, prio, msg);
-
-	if (_log_options->log_dest & LOGD_FILE)
-		log_fd(_log_options->log_fd, prio, msg);
+	/* formatting is deferred if nothing else needs the text */
+	if ((c->opts.log_dest & (LOGD_FORMAT|LOGD_BINARY)) == LOGD_BINARY &&
+			log_bin_msg(c, fmt, NULL, 0, prio, fmt, errnum, ap) == 0)
+		return;
 
-	if (_log_options->log_dest & LOGD_SYSLOG) {
-		if ((prio = prio_to_syslog(prio)) >= 0)
-			syslog(_log_options->log_facility|prio, "%s", msg);
-	}
+	if ((len = _lucid_vasprintf(&msg, fmt, ap)) == -1 ||
+			log_strerror_cat(&msg, len, errnum) == -1)
+		return;
 
+	log_msg(c, prio, msg);
 	free(msg);
 }
 
@@ -202,7 +1789,7 @@ int log_traceme(const char *file, const char *func, int line)
 #define LOGFUNC(name, level, rc) \
 int log_ ## name (const char *fmt, ...) { \
 	va_list ap; va_start(ap, fmt); \
-	log_internal(level, 0, fmt, ap); \
+	log_internal(level, -1, fmt, ap); \
 	va_end(ap); \
 	return rc; \
 }
@@ -218,8 +1805,9 @@ LOGFUNC(trace,  LOGP_TRACE, EXIT_SUCCESS)
 #define LOGFUNCDIE(name, level) \
 void log_ ## name ## _and_die(const char *fmt, ...) { \
 	va_list ap; va_start(ap, fmt); \
-	log_internal(level, 0, fmt, ap); \
+	log_internal(level, -1, fmt, ap); \
 	va_end(ap); \
+	log_async_flush(); \
 	exit(EXIT_FAILURE); \
 }
 
@@ -228,9 +1816,9 @@ LOGFUNCDIE(error, LOGP_ERROR)
 
 #define LOGPFUNC(name, level, rc) \
 int log_p ## name (const char *fmt, ...) { \
-	errno_orig = errno; \
+	int errnum = errno; \
 	va_list ap; va_start(ap, fmt); \
-	log_internal(level, 1, fmt, ap); \
+	log_internal(level, errnum, fmt, ap); \
 	va_end(ap); \
 	return rc; \
 }
@@ -245,12 +1833,438 @@ LOGPFUNC(trace,  LOGP_TRACE, EXIT_SUCCESS)
 
 #define LOGPFUNCDIE(name, level) \
 void log_p ## name ## _and_die(const char *fmt, ...) { \
-	errno_orig = errno; \
+	int errnum = errno; \
 	va_list ap; va_start(ap, fmt); \
-	log_internal(level, 1, fmt, ap); \
+	log_internal(level, errnum, fmt, ap); \
 	va_end(ap); \
+	log_async_flush(); \
 	exit(EXIT_FAILURE); \
 }
 
 LOGPFUNCDIE(alert, LOGP_ALERT)
 LOGPFUNCDIE(error, LOGP_ERROR)
+
+/* decoder state for a binary log */
+typedef struct {
+	const char *p, *end;
+	obuf_t ob;
+	uint32_t opts, pid;
+	char *ident;
+	struct {
+		char *fmt;
+		char *types;
+	} *fmts;     /* indexed by id - 1 */
+} log_dec_t;
+
+static
+int log_dec_get(log_dec_t *dec, void *dst, size_t n)
+{
+	if ((size_t) (dec->end - dec->p) < n)
+		return errno = EINVAL, -1;
+
+	memcpy(dst, dec->p, n);
+	dec->p += n;
+
+	return 0;
+}
+
+/* copy a string of the given length from the input */
+static
+char *log_dec_str(log_dec_t *dec, uint32_t len)
+{
+	char *str;
+
+	if ((size_t) (dec->end - dec->p) < len)
+		return errno = EINVAL, NULL;
+
+	if (!(str = str_dupn(dec->p, len)))
+		return NULL;
+
+	dec->p += len;
+
+	return str;
+}
+
+static
+void log_dec_head(log_dec_t *dec, int prio, int64_t t)
+{
+	char buf[64];
+	struct tm tm;
+	time_t sec = t / 1000000000LL;
+
+	if (dec->opts & LOGO_PRIO)
+		obuf_cats(&dec->ob, log_tags[prio < 0 || prio > LOGP_TRACE ?
+				LOGP_TRACE + 1 : prio]);
+
+	if (dec->opts & LOGO_TIME) {
+		localtime_r(&sec, &tm);
+		strftime(buf, sizeof(buf), "%b %d %T", &tm);
+		obuf_catf(&dec->ob, " %s.%06d", buf,
+				(int) (t % 1000000000LL / 1000));
+	}
+
+	if (dec->opts & LOGO_IDENT)
+		obuf_catf(&dec->ob, " %s", dec->ident);
+
+	if (dec->opts & LOGO_PID)
+		obuf_catf(&dec->ob, "[%u]", dec->pid);
+
+	if (dec->opts & LOGO_PREFIX)
+		obuf_catb(&dec->ob, ": ", 2);
+}
+
+#define LOG_DEC_CATF(val) \
+	(stars == 0 ? obuf_catf(&dec->ob, spec, val) : \
+	 stars == 1 ? obuf_catf(&dec->ob, spec, (int) w[0], val) : \
+	 obuf_catf(&dec->ob, spec, (int) w[0], (int) w[1], val))
+
+/* render a format with the arguments of a message record */
+static
+int log_dec_render(log_dec_t *dec, const char *fmt, const char *types)
+{
+	const char *p = fmt, *q;
+	char spec[64], *str, c;
+	int stars, l, prec, i;
+	int64_t v, w[2];
+	uint32_t len;
+	double d;
+
+	while ((q = strchr(p, '%'))) {
+		obuf_catb(&dec->ob, p, q - p);
+
+		p = log_bin_spec(q + 1, &stars, &l, &prec, &c);
+
+		if (c == '%') {
+			obuf_catb(&dec->ob, "%", 1);
+			continue;
+		}
+
+		if (p - q >= (int) sizeof(spec))
+			return errno = EINVAL, -1;
+
+		memcpy(spec, q, p - q);
+		spec[p - q] = '\0';
+
+		for (i = 0; i < stars; i++, types++)
+			if (!*types || log_dec_get(dec, &w[i], 8) == -1)
+				return errno = EINVAL, -1;
+
+		switch (*types++) {
+		case 'i':
+			if (log_dec_get(dec, &v, 8) == -1)
+				return -1;
+
+			LOG_DEC_CATF((int) v);
+			break;
+
+		case 'l':
+			if (log_dec_get(dec, &v, 8) == -1)
+				return -1;
+
+			LOG_DEC_CATF((long int) v);
+			break;
+
+		case 'q':
+			if (log_dec_get(dec, &v, 8) == -1)
+				return -1;
+
+			LOG_DEC_CATF((long long int) v);
+			break;
+
+		case 'p':
+			if (log_dec_get(dec, &v, 8) == -1)
+				return -1;
+
+			LOG_DEC_CATF((void *) (uintptr_t) v);
+			break;
+
+		case 'd':
+			if (log_dec_get(dec, &d, 8) == -1)
+				return -1;
+
+			LOG_DEC_CATF(d);
+			break;
+
+		case 's':
+			if (log_dec_get(dec, &len, 4) == -1)
+				return -1;
+
+			if (len == LOG_BIN_NULL)
+				str = NULL;
+
+			else if (!(str = log_dec_str(dec, len)))
+				return -1;
+
+			LOG_DEC_CATF(str);
+			free(str);
+			break;
+
+		default:
+			return errno = EINVAL, -1;
+		}
+	}
+
+	obuf_cats(&dec->ob, p);
+
+	return 0;
+}
+
+/* forget the formats of a previous log */
+static
+void log_dec_reset(log_dec_t *dec)
+{
+	int i;
+
+	for (i = 0; dec->fmts && i < LOG_BIN_FORMATS; i++) {
+		free(dec->fmts[i].fmt);
+		free(dec->fmts[i].types);
+	}
+
+	free(dec->fmts);
+	free(dec->ident);
+
+	dec->fmts  = NULL;
+	dec->ident = NULL;
+}
+
+static
+int log_dec_record(log_dec_t *dec)
+{
+	uint32_t id, line, len, nargs, version;
+	char magic[8], types[LOG_BIN_MAXARGS + 1], kind, *str;
+	int precs[LOG_BIN_MAXARGS];
+	int64_t t;
+	int32_t err;
+	uint8_t prio;
+
+	if (log_dec_get(dec, &kind, 1) == -1)
+		return -1;
+
+	switch (kind) {
+	/* a log may be continued by another process */
+	case LOG_BIN_HEADER:
+		log_dec_reset(dec);
+
+		if (log_dec_get(dec, magic, 8) == -1 ||
+				memcmp(magic, LOG_BIN_MAGIC, 8) ||
+				log_dec_get(dec, &version, 4) == -1 ||
+				version != LOG_BIN_VERSION ||
+				log_dec_get(dec, &dec->opts, 4) == -1 ||
+				log_dec_get(dec, &dec->pid, 4) == -1 ||
+				log_dec_get(dec, &len, 4) == -1)
+			return errno = EINVAL, -1;
+
+		if (!(dec->ident = log_dec_str(dec, len)))
+			return -1;
+
+		return 0;
+
+	case LOG_BIN_FORMAT:
+		if (log_dec_get(dec, &id, 4) == -1 ||
+				log_dec_get(dec, &line, 4) == -1 ||
+				log_dec_get(dec, &nargs, 4) == -1)
+			return -1;
+
+		if (id == 0 || id > LOG_BIN_FORMATS || nargs > LOG_BIN_MAXARGS)
+			return errno = EINVAL, -1;
+
+		if (!dec->fmts && !(dec->fmts = calloc(LOG_BIN_FORMATS,
+				sizeof(*dec->fmts))))
+			return -1;
+
+		free(dec->fmts[id - 1].fmt);
+		free(dec->fmts[id - 1].types);
+
+		dec->fmts[id - 1].fmt = NULL;
+
+		if (!(dec->fmts[id - 1].types = log_dec_str(dec, nargs)))
+			return -1;
+
+		/* the source file is not needed for rendering */
+		if (log_dec_get(dec, &len, 4) == -1 ||
+				!(str = log_dec_str(dec, len)))
+			return -1;
+
+		free(str);
+
+		if (log_dec_get(dec, &len, 4) == -1 ||
+				!(dec->fmts[id - 1].fmt = log_dec_str(dec, len)))
+			return -1;
+
+		/* the arguments are rendered with the format, they must match */
+		if (log_bin_types(dec->fmts[id - 1].fmt, types, precs) != (int) nargs ||
+				strcmp(types, dec->fmts[id - 1].types))
+			return errno = EINVAL, -1;
+
+		return 0;
+
+	case LOG_BIN_MSG:
+		if (log_dec_get(dec, &id, 4) == -1 ||
+				log_dec_get(dec, &prio, 1) == -1 ||
+				log_dec_get(dec, &t, 8) == -1 ||
+				log_dec_get(dec, &err, 4) == -1)
+			return -1;
+
+		if (id == 0 || id > LOG_BIN_FORMATS || !dec->fmts ||
+				!dec->fmts[id - 1].fmt)
+			return errno = EINVAL, -1;
+
+		log_dec_head(dec, prio, t);
+
+		if (log_dec_render(dec, dec->fmts[id - 1].fmt,
+				dec->fmts[id - 1].types) == -1)
+			return -1;
+
+		break;
+
+	case LOG_BIN_TEXT:
+		if (log_dec_get(dec, &prio, 1) == -1 ||
+				log_dec_get(dec, &t, 8) == -1 ||
+				log_dec_get(dec, &err, 4) == -1 ||
+				log_dec_get(dec, &len, 4) == -1 ||
+				(size_t) (dec->end - dec->p) < len)
+			return errno = EINVAL, -1;
+
+		log_dec_head(dec, prio, t);
+		obuf_catb(&dec->ob, dec->p, len);
+		dec->p += len;
+		break;
+
+	default:
+		return errno = EINVAL, -1;
+	}
+
+	if (err >= 0)
+		obuf_catf(&dec->ob, ": %s", strerror(err));
+
+	obuf_catb(&dec->ob, "\n", 1);
+
+	return 0;
+}
+
+/* write the complete messages of a ring file from the oldest to the newest */
+static
+int log_map_dump(log_dec_t *dec, const char *buf, size_t len)
+{
+	log_map_t m;
+	log_maprec_t rec;
+	const char *ring = buf + sizeof(m);
+	uint64_t pos;
+	uint32_t off, n;
+
+	if (len < sizeof(m))
+		return errno = EINVAL, -1;
+
+	memcpy(&m, buf, sizeof(m));
+
+	if (m.version != LOG_MAP_VERSION || m.size == 0 ||
+			(m.size & (m.size - 1)) || len < sizeof(m) + m.size ||
+			m.tail < m.head || m.tail - m.head > m.size)
+		return errno = EINVAL, -1;
+
+	dec->opts = m.opts;
+
+	if (!(dec->ident = str_dupn(m.ident, strnlen(m.ident, sizeof(m.ident)))))
+		return -1;
+
+	for (pos = m.head; pos < m.tail; ) {
+		off = pos & (m.size - 1);
+
+		memcpy(&n, ring + off, 4);
+
+		if (n == LOG_WRAP) {
+			pos += m.size - off;
+			continue;
+		}
+
+		if (m.size - off < sizeof(rec))
+			return errno = EINVAL, -1;
+
+		memcpy(&rec, ring + off, sizeof(rec));
+		n = rec.len & ~LOG_MAP_DONE;
+
+		if (m.size - off < LOG_MAP_RECSIZE(n))
+			return errno = EINVAL, -1;
+
+		pos += LOG_MAP_RECSIZE(n);
+
+		/* the writer died while copying the message */
+		if (!(rec.len & LOG_MAP_DONE))
+			continue;
+
+		dec->pid = rec.pid;
+		log_dec_head(dec, rec.prio, rec.time);
+		obuf_catb(&dec->ob, ring + off + sizeof(rec), n);
+		obuf_catb(&dec->ob, "\n", 1);
+	}
+
+	return 0;
+}
+
+int log_decode(int in, int out)
+{
+	log_dec_t dec;
+	char *buf = NULL, *tmp;
+	size_t len = 0, size = 0;
+	ssize_t n;
+	int map, rc = -1;
+
+	memset(&dec, 0, sizeof(dec));
+
+	/* read the whole log */
+	for (;;) {
+		if (len == size) {
+			size = size ? size * 2 : 65536;
+
+			if (!(tmp = realloc(buf, size)))
+				goto out;
+
+			buf = tmp;
+		}
+
+		if ((n = read(in, buf + len, size - len)) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			goto out;
+		}
+
+		if (n == 0)
+			break;
+
+		len += n;
+	}
+
+	dec.p   = buf;
+	dec.end = buf + len;
+
+	map = len >= 8 && !memcmp(buf, LOG_MAP_MAGIC, 8);
+
+	/* every log starts with a header */
+	if (!map && (len == 0 || buf[0] != LOG_BIN_HEADER)) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	if (obuf_init(&dec.ob, out, NULL, LOG_BATCHSIZE, 0) == -1)
+		goto out;
+
+	if (map) {
+		if (log_map_dump(&dec, buf, len) == 0)
+			dec.p = dec.end;
+	} else {
+		while (dec.p < dec.end)
+			if (log_dec_record(&dec) == -1)
+				break;
+	}
+
+	/* output up to a malformed record is still written */
+	if (obuf_free(&dec.ob) == 0 && dec.p == dec.end)
+		rc = 0;
+
+out:
+	log_dec_reset(&dec);
+	free(buf);
+
+	return rc;
+}
@@ -0,0 +1,160 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "obuf.h"
+#include "str.h"
+
+int obuf_init(obuf_t *ob, int fd, char *buf, int size, int flags)
+{
+	if (buf && size <= 0)
+		return errno = EINVAL, -1;
+
+	if (size <= 0)
+		size = OBUF_SIZE;
+
+	flags &= OBUF_LINE;
+
+	if (!buf) {
+		if (!(buf = malloc(size)))
+			return -1;
+
+		flags |= OBUF_ALLOC;
+	}
+
+	ob->fd     = fd;
+	ob->buf    = buf;
+	ob->size   = size;
+	ob->len    = 0;
+	ob->thresh = size;
+	ob->flags  = flags;
+	ob->error  = 0;
+
+	return 0;
+}
+
+/* write the buffered bytes followed by len bytes of src */
+static
+int __obuf_writev(obuf_t *ob, const char *src, int len)
+{
+	struct iovec iov[2];
+	int i = 0, n = 0;
+	ssize_t res;
+
+	if (ob->error)
+		return errno = ob->error, -1;
+
+	if (ob->len > 0) {
+		iov[n].iov_base = ob->buf;
+		iov[n].iov_len  = ob->len;
+		n++;
+	}
+
+	if (len > 0) {
+		iov[n].iov_base = (char *) src;
+		iov[n].iov_len  = len;
+		n++;
+	}
+
+	ob->len = 0;
+
+	while (i < n) {
+		if ((res = writev(ob->fd, iov + i, n - i)) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			ob->error = errno;
+			return -1;
+		}
+
+		/* no progress on a non-empty write would loop forever */
+		if (res == 0) {
+			ob->error = EIO;
+			return errno = EIO, -1;
+		}
+
+		/* skip what was written, possibly ending within an iovec */
+		for (; i < n && (size_t) res >= iov[i].iov_len; i++)
+			res -= iov[i].iov_len;
+
+		if (i < n) {
+			iov[i].iov_base  = (char *) iov[i].iov_base + res;
+			iov[i].iov_len  -= res;
+		}
+	}
+
+	return 0;
+}
+
+int obuf_flush(obuf_t *ob)
+{
+	return __obuf_writev(ob, NULL, 0);
+}
+
+int obuf_free(obuf_t *ob)
+{
+	int rc = obuf_flush(ob);
+
+	if (ob->flags & OBUF_ALLOC)
+		free(ob->buf);
+
+	ob->buf  = NULL;
+	ob->size = 0;
+
+	return rc;
+}
+
+int obuf_commit(obuf_t *ob, int len)
+{
+	ob->len += len;
+
+	if (ob->len >= ob->thresh ||
+			((ob->flags & OBUF_LINE) &&
+			 memchr(ob->buf + ob->len - len, '\n', len)))
+		return obuf_flush(ob);
+
+	return 0;
+}
+
+int obuf_catb(obuf_t *ob, const void *src, int len)
+{
+	if (ob->error)
+		return errno = ob->error, -1;
+
+	/* make room for data smaller than the buffer, so it can be combined
+	 * with later appends */
+	if (len > ob->size - ob->len && len < ob->size)
+		if (obuf_flush(ob) == -1)
+			return -1;
+
+	/* larger data goes out together with the buffer, without a copy */
+	if (len > ob->size - ob->len)
+		return __obuf_writev(ob, src, len) == -1 ? -1 : len;
+
+	memcpy(ob->buf + ob->len, src, len);
+
+	return obuf_commit(ob, len) == -1 ? -1 : len;
+}
+
+int obuf_cats(obuf_t *ob, const char *src)
+{
+	return obuf_catb(ob, src, str_len(src));
+}
@@ -15,12 +15,19 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
 
 #include <unistd.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "cext.h"
+#include "char.h"
+#include "flist.h"
+#include "obuf.h"
 #include "printf.h"
 #include "str.h"
+#include "stralloc.h"
+
+#include "float/internal.h"
 
 enum __printf_flags {
 	PFL_ALT    = 0x01,
@@ -30,6 +37,9 @@ enum __printf_flags {
 	PFL_SIGN   = 0x10,
 	PFL_UPPER  = 0x20,
 	PFL_SIGNED = 0x40,
+	PFL_WARG   = 0x80,  /* width is taken from the arguments */
+	PFL_PARG   = 0x100, /* precision is taken from the arguments */
+	PFL_LDBL   = 0x200, /* long double argument */
 };
 
 enum __printf_rank {
@@ -43,38 +53,110 @@ enum __printf_rank {
 #define PFR_MIN PFR_CHAR
 #define PFR_MAX PFR_LLONG
 
-enum __printf_state {
-	PFS_NORMAL,
-	PFS_FLAGS,
-	PFS_WIDTH,
-	PFS_PREC,
-	PFS_MOD,
-	PFS_CONV,
-};
-
 typedef struct {
 	unsigned int f; /* flags */
 	int l;          /* length */
 	int p;          /* precision */
-	int s;          /* state */
 	unsigned int w; /* width */
+	char c;         /* conversion, 0 for literal text */
 } __printf_t;
 
-#define EMIT(C) { if (idx < size - 1) { *str++ = C; } idx++; }
+/* compiled format: literal runs and conversions; the text of all literal
+ * runs is stored after the ops */
+struct printf_prog {
+	int nops;
+	char *text;
+	struct {
+		__printf_t f;
+		int off; /* offset of literal text */
+		int len; /* length of literal text */
+	} ops[];
+};
+
+/* size of the stack buffer tried first by vasprintf and vdprintf */
+#define PRINTF_STACKSIZE 256
+
+/* output buffer; growable buffers start on the stack and move to the heap
+ * once they overflow */
+typedef struct printf_out {
+	char *buf; /* buffer */
+	int size;  /* size of buffer */
+	int idx;   /* length of output, including what did not fit */
+	int grow;  /* buffer may be enlarged */
+	int heap;  /* buffer was obtained by malloc(3) */
+	int error; /* enlarging the buffer failed */
+} __printf_out_t;
 
 static
-int __printf_int(char *str, int size, unsigned long long int val,
-		int base, __printf_t f)
+int __printf_grow(__printf_out_t *out, int len)
 {
-	static const char lcdigits[] = "0123456789abcdef";
-	static const char ucdigits[] = "0123456789ABCDEF";
-	const char *digits;
+	int size = out->size;
+	char *buf;
+
+	if (!out->grow || out->error)
+		return 0;
+
+	while (size < out->idx + len + 1)
+		size *= 2;
+
+	if (out->heap)
+		buf = realloc(out->buf, size);
+
+	else if ((buf = malloc(size)))
+		memcpy(buf, out->buf, out->idx);
+
+	if (!buf) {
+		out->error = 1;
+		return 0;
+	}
 
-	int idx = 0, ndigits = 0, nchars, minus = 0;
-	unsigned long long int tmpval;
+	out->buf  = buf;
+	out->size = size;
+	out->heap = 1;
 
-	/* select type of digits */
-	digits = (f.f & PFL_UPPER) ? ucdigits : lcdigits;
+	return 1;
+}
+
+static inline
+void __printf_emit(__printf_out_t *out, char c)
+{
+	if (out->idx < out->size - 1 || __printf_grow(out, 1))
+		out->buf[out->idx] = c;
+
+	out->idx++;
+}
+
+static
+void __printf_emitn(__printf_out_t *out, const char *s, int len)
+{
+	int room;
+
+	if (out->idx + len > out->size - 1)
+		__printf_grow(out, len);
+
+	room = out->size - 1 - out->idx;
+
+	if (room > 0)
+		memcpy(out->buf + out->idx, s, len < room ? len : room);
+
+	out->idx += len;
+}
+
+#define EMIT(C) __printf_emit(out, C);
+
+void printf_write(printf_out_t *out, const char *buf, int len)
+{
+	__printf_emitn(out, buf, len);
+}
+
+static
+void __printf_int(__printf_out_t *out, unsigned long long int val,
+		int base, __printf_t f)
+{
+	int ndigits = 0, nchars, minus = 0;
+
+	/* enough for 64 bit octal */
+	char buf[24], *p = buf + sizeof(buf);
 
 	/* separate out the minus */
 	if (f.f & PFL_SIGNED && (signed long long int) val < 0) {
@@ -82,17 +164,19 @@ int __printf_int(char *str, int size, unsigned long long int val,
 		val = (unsigned long long int) (-(signed long long int) val);
 	}
 
-	/* count number of digits needed */
-	tmpval = val;
+	if (base == 10)
+		ndigits = str_fmt_u64(p = buf, val);
 
-	while (tmpval) {
-		tmpval /= base;
-		ndigits++;
-	}
+	else if (base == 16)
+		ndigits = str_fmt_x64(p = buf, val, f.f & PFL_UPPER);
 
-	/* zero still requires space */
-	if (val == 0)
-		ndigits = 1;
+	/* generate octal numbers from right to left */
+	else {
+		do {
+			*--p = '0' + val % 8;
+			ndigits++;
+		} while ((val /= 8));
+	}
 
 	/* compute number of nondigits */
 	nchars = f.p > ndigits ? f.p : ndigits;
@@ -105,7 +189,7 @@ int __printf_int(char *str, int size, unsigned long long int val,
 	if (f.f & PFL_ALT) {
 		if (base == 16)
 			nchars += 2;
-		else if (base == 8 && val != 0)
+		else if (base == 8 && *p != '0')
 			nchars += 1;
 	}
 
@@ -117,14 +201,6 @@ int __printf_int(char *str, int size, unsigned long long int val,
 		}
 	}
 
-	/* zero padding */
-	if ((f.f & PFL_ZERO) > 0) {
-		while (f.w > nchars) {
-			EMIT('0')
-			f.w--;
-		}
-	}
-
 	/* nondigits */
 	if (minus)
 		EMIT('-')
@@ -141,27 +217,25 @@ int __printf_int(char *str, int size, unsigned long long int val,
 			EMIT((f.f & PFL_UPPER) ? 'X' : 'x');
 		}
 
-		else if (base == 8 && val != 0)
+		else if (base == 8 && *p != '0')
 			EMIT('0')
 	}
 
+	/* zero padding goes between sign and digits */
+	if ((f.f & PFL_ZERO) > 0) {
+		while (f.w > nchars) {
+			EMIT('0')
+			f.w--;
+		}
+	}
+
 	/* precision */
 	while (f.p > ndigits) {
 		EMIT('0')
 		f.p--;
 	}
 
-	/* generate the number from right to left */
-	str += ndigits;
-
-	do {
-		if (idx < size)
-			*--str = digits[val % base];
-
-		idx++;
-	} while ((val /= base));
-
-	str += ndigits;
+	__printf_emitn(out, p, ndigits);
 
 	/* late space padding */
 	if ((f.f & PFL_LEFT) > 0) {
@@ -170,36 +244,472 @@ int __printf_int(char *str, int size, unsigned long long int val,
 			f.w--;
 		}
 	}
+}
 
-	return idx;
+static
+void __printf_pad(__printf_out_t *out, char c, int n)
+{
+	while (n-- > 0)
+		EMIT(c)
 }
 
-/* supported formats:
-** - format flags: #, 0, -, ' ', +
-** - field width
-** - argument precision
-** - length mods: hh, h, l, and ll
-** - conversion spec: d, i, u, o, x, X, c, s, p, P, n */
-int _lucid_vsnprintf(char *str, int size, const char *fmt, va_list _ap)
+/* emit digit i of 0.digits * 10^x, zero outside the generated digits */
+#define DIGIT(i) ((i) >= 0 && (i) < ndigits ? digits[i] : '0')
+
+static
+void __printf_float(__printf_out_t *out, double val, __printf_t f)
 {
-	/* generic counter */
-	int i;
+	char digits[FLOAT_DIGITS_MAX], expbuf[8];
+	int ndigits = 0, x = 0, nchars, nexp = 0, minus, style, i, trim;
+	const char *special = NULL;
 
-	/* generic pointer */
-	const char *p;
+	minus = __builtin_signbit(val) != 0;
+	val   = minus ? -val : val;
 
-	/* keep track of string length */
-	int idx = 0;
+	if (f.p < 0)
+		f.p = 6;
 
-	/* save pointer to start of current conversion */
-	const char *ccp = fmt;
+	style = f.c | 0x20;
+	trim  = 0;
 
-	/* current character in format */
-	char c;
+	if (val != val)
+		special = (f.f & PFL_UPPER) ? "NAN" : "nan";
 
-	/* current conversion data */
-	__printf_t f;
+	else if (val > 1.7976931348623157e308)
+		special = (f.f & PFL_UPPER) ? "INF" : "inf";
+
+	else if (style == 'f')
+		ndigits = __float_digits(val, FLOAT_DIGITS_FIX, f.p, digits, &x);
+
+	else if (style == 'e')
+		ndigits = __float_digits(val, FLOAT_DIGITS_SIG, f.p, digits, &x);
+
+	/* %g picks %e or %f by the exponent after rounding to the precision
+	 * and drops trailing zeros unless the alternate form is requested */
+	else {
+		f.p     = f.p ? f.p : 1;
+		ndigits = __float_digits(val, FLOAT_DIGITS_SIG, f.p - 1, digits, &x);
+
+		if (ndigits == 0)
+			x = 1;
+
+		if (x - 1 >= -4 && x - 1 < f.p) {
+			style = 'f';
+			f.p   = f.p - x;
+		}
+
+		else {
+			style = 'e';
+			f.p   = f.p - 1;
+		}
+
+		if (!(f.f & PFL_ALT)) {
+			while (ndigits > 0 && digits[ndigits - 1] == '0')
+				ndigits--;
+
+			trim = 1;
+		}
+	}
+
+	if (special) {
+		nchars = 3;
+		f.f   &= ~PFL_ZERO;
+	}
+
+	else if (style == 'f') {
+		if (trim)
+			f.p = ndigits > x ? ndigits - x : 0;
+
+		nchars = (x > 0 ? x : 1) + f.p;
+
+		if (f.p > 0 || (f.f & PFL_ALT))
+			nchars++;
+	}
+
+	else {
+		if (ndigits == 0)
+			x = 1;
+
+		if (trim)
+			f.p = ndigits > 1 ? ndigits - 1 : 0;
+
+		i    = x - 1 < 0 ? 1 - x : x - 1;
+		nexp = str_fmt_u32(expbuf + 2, i) + 2;
+
+		expbuf[0] = (f.f & PFL_UPPER) ? 'E' : 'e';
+		expbuf[1] = x - 1 < 0 ? '-' : '+';
+
+		if (i < 10) {
+			expbuf[3] = expbuf[2];
+			expbuf[2] = '0';
+			nexp++;
+		}
+
+		nchars = 1 + f.p + nexp;
+
+		if (f.p > 0 || (f.f & PFL_ALT))
+			nchars++;
+	}
+
+	if (minus || (f.f & (PFL_SIGN | PFL_BLANK)))
+		nchars++;
+
+	if ((f.f & (PFL_LEFT|PFL_ZERO)) == 0)
+		__printf_pad(out, ' ', (int) f.w - nchars);
+
+	if (minus)
+		EMIT('-')
+
+	else if (f.f & PFL_SIGN)
+		EMIT('+')
+
+	else if (f.f & PFL_BLANK)
+		EMIT(' ')
+
+	if (f.f & PFL_ZERO)
+		__printf_pad(out, '0', (int) f.w - nchars);
+
+	if (special)
+		__printf_emitn(out, special, 3);
+
+	else if (style == 'f') {
+		if (x <= 0)
+			EMIT('0')
+		else if (ndigits >= x)
+			__printf_emitn(out, digits, x);
+		else {
+			__printf_emitn(out, digits, ndigits);
+			__printf_pad(out, '0', x - ndigits);
+		}
+
+		if (f.p > 0 || (f.f & PFL_ALT))
+			EMIT('.')
+
+		for (i = 0; i < f.p; i++)
+			EMIT(DIGIT(x + i))
+	}
+
+	else {
+		EMIT(DIGIT(0))
+
+		if (f.p > 0 || (f.f & PFL_ALT))
+			EMIT('.')
+
+		if (f.p < ndigits) {
+			__printf_emitn(out, digits + 1, f.p);
+		} else {
+			__printf_emitn(out, digits + 1, ndigits > 1 ? ndigits - 1 : 0);
+			__printf_pad(out, '0', f.p - (ndigits > 1 ? ndigits - 1 : 0));
+		}
+
+		__printf_emitn(out, expbuf, nexp);
+	}
+
+	if (f.f & PFL_LEFT)
+		__printf_pad(out, ' ', (int) f.w - nchars);
+}
+
+#undef DIGIT
+
+/* parse a conversion specification following a '%'; returns a pointer to
+ * the character after it */
+static
+const char *__printf_parse(const char *fmt, __printf_t *f)
+{
+	f->f = 0;
+	f->l = PFR_INT;
+	f->p = -1;
+	f->w = 0;
+
+	/* flags */
+	for (;; fmt++) {
+		if (*fmt == '#')
+			f->f |= PFL_ALT;
+
+		else if (*fmt == '0') {
+			if (!(f->f & PFL_LEFT))
+				f->f |= PFL_ZERO;
+		}
+
+		else if (*fmt == '-') {
+			f->f &= ~PFL_ZERO; /* left overrides zero */
+			f->f |=  PFL_LEFT;
+		}
+
+		else if (*fmt == ' ')
+			f->f |= PFL_BLANK;
+
+		else if (*fmt == '+') {
+			f->f &= ~PFL_BLANK; /* sign overrides blank */
+			f->f |=  PFL_SIGN;
+		}
+
+		else
+			break;
+	}
+
+	/* width */
+	if (*fmt == '*') {
+		f->f |= PFL_WARG;
+		fmt++;
+	}
+
+	else {
+		for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+			f->w = f->w * 10  + (*fmt - '0');
+	}
+
+	/* precision */
+	if (*fmt == '.') {
+		f->p = 0;
+		fmt++;
+
+		if (*fmt == '*') {
+			f->f |= PFL_PARG;
+			fmt++;
+		}
+
+		else {
+			for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+				f->p = f->p * 10  + (*fmt - '0');
+		}
+	}
+
+	/* length modifiers */
+	for (;; fmt++) {
+		if (*fmt == 'h')
+			f->l--;
+
+		else if (*fmt == 'l')
+			f->l++;
+
+		else if (*fmt == 'L')
+			f->f |= PFL_LDBL;
+
+		else
+			break;
+	}
+
+	if (f->l > PFR_MAX)
+		f->l = PFR_MAX;
+
+	if (f->l < PFR_MIN)
+		f->l = PFR_MIN;
+
+	/* a format ending in the middle of a conversion has no conversion
+	 * character and is copied like an unknown conversion */
+	if ((f->c = *fmt))
+		fmt++;
+
+	return fmt;
+}
+
+/* extension conversions: encoders write through a small buffer that is
+ * flushed whenever it fills up */
+static
+void __printf_stralloc(printf_out_t *out, const printf_spec_t *spec,
+		va_list *ap)
+{
+	const stralloc_t *sa = va_arg(*ap, const stralloc_t *);
+	int len;
+
+	if (!sa) {
+		printf_write(out, "(null)", 6);
+		return;
+	}
+
+	len = sa->len;
+
+	if (spec->prec >= 0 && len > spec->prec)
+		len = spec->prec;
+
+	printf_write(out, sa->s, len);
+}
+
+static
+void __printf_base64(printf_out_t *out, const printf_spec_t *spec,
+		va_list *ap)
+{
+	static const char b64[64] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	size_t n = va_arg(*ap, size_t);
+	const unsigned char *in = va_arg(*ap, const void *);
+	char buf[256];
+	int i = 0;
+
+	for (; n >= 3; n -= 3, in += 3) {
+		buf[i++] = b64[in[0] >> 2];
+		buf[i++] = b64[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+		buf[i++] = b64[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+		buf[i++] = b64[in[2] & 0x3f];
+
+		if (i == sizeof(buf)) {
+			printf_write(out, buf, i);
+			i = 0;
+		}
+	}
+
+	if (n > 0) {
+		buf[i++] = b64[in[0] >> 2];
+		buf[i++] = b64[((in[0] & 0x03) << 4) | (n > 1 ? in[1] >> 4 : 0)];
+		buf[i++] = n > 1 ? b64[(in[1] & 0x0f) << 2] : '=';
+		buf[i++] = '=';
+	}
+
+	printf_write(out, buf, i);
+}
+
+static
+void __printf_hex(printf_out_t *out, const printf_spec_t *spec, va_list *ap)
+{
+	static const char hex[16] = "0123456789abcdef";
+
+	size_t n = va_arg(*ap, size_t);
+	const unsigned char *in = va_arg(*ap, const void *);
+	char buf[256];
+	int i = 0;
+
+	for (; n > 0; n--, in++) {
+		buf[i++] = hex[*in >> 4];
+		buf[i++] = hex[*in & 0x0f];
+
+		if (i == sizeof(buf)) {
+			printf_write(out, buf, i);
+			i = 0;
+		}
+	}
+
+	printf_write(out, buf, i);
+}
+
+/* same output as flist32_encode() and flist64_encode() */
+static
+void __printf_flist(printf_out_t *out, const printf_spec_t *spec,
+		va_list *ap)
+{
+	const flist32_t *list32 = NULL;
+	const flist64_t *list64 = NULL;
+	const flag32_t *flag32 = NULL;
+	const flag64_t *flag64 = NULL;
+	const char *delim;
+	int i, first = 1;
+	char clmod;
+
+	if (spec->len > 0) {
+		list64 = va_arg(*ap, const flist64_t *);
+		flag64 = va_arg(*ap, const flag64_t *);
+	}
+
+	else {
+		list32 = va_arg(*ap, const flist32_t *);
+		flag32 = va_arg(*ap, const flag32_t *);
+	}
+
+	clmod = (char) va_arg(*ap, int);
+	delim = va_arg(*ap, const char *);
+
+#define FLIST_WRITE(LIST, FLAG) do { \
+		for (i = 0; LIST[i].key; i++) { \
+			if (!(FLAG->mask & LIST[i].val)) \
+				continue; \
+			if (!first) \
+				printf_write(out, delim, str_len(delim)); \
+			if (!(FLAG->flag & LIST[i].val)) \
+				printf_write(out, &clmod, 1); \
+			printf_write(out, LIST[i].key, str_len(LIST[i].key)); \
+			first = 0; \
+		} \
+	} while (0)
+
+	if (list64)
+		FLIST_WRITE(list64, flag64);
+	else
+		FLIST_WRITE(list32, flag32);
+
+#undef FLIST_WRITE
+}
+
+static
+printf_conv_t *__printf_exttab[128] = {
+	['B'] = __printf_base64,
+	['H'] = __printf_hex,
+	['M'] = __printf_flist,
+	['S'] = __printf_stralloc,
+};
+
+/* conversions and length modifiers of C99 cannot be replaced */
+int printf_register(char c, printf_conv_t *conv)
+{
+	if (!char_isalpha(c) || strchr("aAcdeEfFgGhijlLnopPqstuxXz", c))
+		return errno = EINVAL, -1;
+
+	__atomic_store_n(&__printf_exttab[(int) c], conv, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static inline
+printf_conv_t *__printf_extconv(char c)
+{
+	if ((unsigned char) c >= 128)
+		return NULL;
+
+	return __atomic_load_n(&__printf_exttab[(int) c], __ATOMIC_ACQUIRE);
+}
+
+/* run an extension conversion and apply the field width afterwards; right
+ * justified output is moved behind the padding in place */
+static
+void __printf_ext(__printf_out_t *out, __printf_t f, va_list *ap,
+		printf_conv_t *conv)
+{
+	printf_spec_t spec;
+	int start = out->idx, len, pad, avail, i;
+
+	/* removed after the format was compiled */
+	if (!conv)
+		return;
+
+	spec.conv = f.c;
+	spec.alt  = (f.f & PFL_ALT) != 0;
+	spec.len  = f.l - PFR_INT;
+	spec.prec = f.p;
 
+	conv(out, &spec, ap);
+
+	len = out->idx - start;
+	pad = (int) f.w - len;
+
+	if (pad <= 0)
+		return;
+
+	__printf_pad(out, ' ', pad);
+
+	if (f.f & PFL_LEFT)
+		return;
+
+	/* only bytes below avail were stored */
+	avail = out->size - 1;
+
+	for (i = start + len - 1; i >= start; i--)
+		if (i + pad < avail)
+			out->buf[i + pad] = out->buf[i];
+
+	for (i = start; i < start + pad && i < avail; i++)
+		out->buf[i] = ' ';
+}
+
+/* supported formats:
+** - format flags: #, 0, -, ' ', +
+** - field width
+** - argument precision
+** - length mods: hh, h, l, ll, and L
+** - conversion spec: d, i, u, o, x, X, e, E, f, F, g, G, c, s, p, P, n
+** - extension conversions, see __printf_ext */
+static
+void __printf_conv(__printf_out_t *out, __printf_t f, va_list *ap)
+{
 	/* arguments */
 	union {
 		/* signed argument */
@@ -208,20 +718,17 @@ int _lucid_vsnprintf(char *str, int size, const char *fmt, va_list _ap)
 		/* unsigned argument */
 		unsigned long long int u;
 
-		/* float argument */
-		double f;
-
 		/* character argument */
 		int c;
 
 		/* string argument */
 		const char *s;
 
-		/* pointer argument */
-		void *p;
-
 		/* number argument */
 		int *n;
+
+		/* floating-point argument */
+		double f;
 	} arg;
 
 	/* base used for integer conversions */
@@ -230,319 +737,384 @@ int _lucid_vsnprintf(char *str, int size, const char *fmt, va_list _ap)
 	/* number of consumed bytes in conversions */
 	int len;
 
-	/* don't consume original ap */
-	va_list ap;
-	va_copy(ap, _ap);
+	if (f.f & PFL_WARG) {
+		len = va_arg(*ap, int);
 
-	/* initialize conversion data */
-	f.f = 0;
-	f.l = PFR_INT;
-	f.p = -1;
-	f.s = PFS_NORMAL;
-	f.w = 0;
-
-	if (size > 0)
-		memset(str, 0, size);
-
-	while ((c = *fmt++)) {
-		switch (f.s) {
-		case PFS_NORMAL:
-			if (c == '%') {
-				f.f = 0;
-				f.l = PFR_INT;
-				f.p = -1;
-				f.s = PFS_FLAGS;
-				f.w = 0;
-				ccp = &c;
-			}
+		if (len < 0) {
+			len  = -len;
+			f.f &= ~PFL_ZERO; /* left overrides zero */
+			f.f |=  PFL_LEFT;
+		}
+
+		f.w = len;
+	}
 
-			else
-				EMIT(c)
+	if (f.f & PFL_PARG) {
+		f.p = va_arg(*ap, int);
 
+		if (f.p < 0)
+			f.p = 0;
+	}
+
+	switch (f.c) {
+	case 'P':
+		f.f |= PFL_UPPER;
+
+	case 'p':
+		base = 16;
+		f.p  = (8 * sizeof(void *) + 3)/4;
+		f.f |= PFL_ALT;
+
+		arg.u = (unsigned long long int) (unsigned long int) va_arg(*ap, void *);
+
+		goto is_integer;
+
+	case 'd':
+	case 'i': /* signed conversion */
+		base = 10;
+		f.f |= PFL_SIGNED;
+
+		switch (f.l) {
+		case PFR_CHAR:
+			arg.d = (signed char) va_arg(*ap, signed int);
 			break;
 
-		case PFS_FLAGS:
-			switch (c) {
-			case '#':
-				f.f |= PFL_ALT;
-				break;
-
-			case '0':
-				if (!(f.f & PFL_LEFT))
-					f.f |= PFL_ZERO;
-				break;
-
-			case '-':
-				f.f &= ~PFL_ZERO; /* left overrides zero */
-				f.f |=  PFL_LEFT;
-				break;
-
-			case ' ':
-				f.f |= PFL_BLANK;
-				break;
-
-			case '+':
-				f.f &= ~PFL_BLANK; /* sign overrides blank */
-				f.f |=  PFL_SIGN;
-				break;
-
-			default:
-				f.s = PFS_WIDTH;
-				fmt--;
-				break;
-			}
+		case PFR_SHORT:
+			arg.d = (signed short int) va_arg(*ap, signed int);
+			break;
 
+		case PFR_INT:
+			arg.d = (signed int) va_arg(*ap, signed int);
 			break;
 
-		case PFS_WIDTH:
-			if (c == '-') {
-					f.f &= PFL_ZERO; /* left overrides zero */
-					f.f |= PFL_LEFT;
-			}
+		case PFR_LONG:
+			arg.d = (signed long int) va_arg(*ap, signed long int);
+			break;
+
+		case PFR_LLONG:
+			arg.d = (signed long long int) va_arg(*ap, signed long long int);
+			break;
 
-			else if (c >= '0' && c <= '9')
-				f.w = f.w * 10  + (c - '0');
+		default:
+			arg.d = (signed long long int) va_arg(*ap, signed int);
+			break;
+		}
 
-			else if (c == '*') {
-				f.w = va_arg(ap, int);
+		arg.u = (unsigned long long int) arg.d;
 
-				if (f.w < 0) {
-					f.w = -f.w;
-					f.f &= PFL_ZERO; /* left overrides zero */
-					f.f |= PFL_LEFT;
-				}
-			}
+		goto is_integer;
 
-			else if (c == '.') {
-				f.p = 0;
-				f.s = PFS_PREC;
-			}
+	case 'o':
+		base = 8;
+		goto is_unsigned;
 
-			else {
-				f.s = PFS_MOD;
-				fmt--;
-			}
+	case 'u':
+		base = 10;
+		goto is_unsigned;
+
+	case 'X':
+		f.f |= PFL_UPPER;
+
+	case 'x':
+		base = 16;
+		goto is_unsigned;
 
+	is_unsigned:
+		switch (f.l) {
+		case PFR_CHAR:
+			arg.u = (unsigned char) va_arg(*ap, unsigned int);
 			break;
 
-		case PFS_PREC:
-			if (c >= '0' && c <= '9')
-				f.p = f.p * 10  + (c - '0');
+		case PFR_SHORT:
+			arg.u = (unsigned short int) va_arg(*ap, unsigned int);
+			break;
 
-			else if (c == '*') {
-				f.p = va_arg(ap, int);
+		case PFR_INT:
+			arg.u = (unsigned int) va_arg(*ap, unsigned int);
+			break;
 
-				if (f.p < 0)
-					f.p = 0;
-			}
+		case PFR_LONG:
+			arg.u = (unsigned long int) va_arg(*ap, unsigned long int);
+			break;
 
-			else {
-				f.s = PFS_MOD;
-				fmt--;
-			}
+		case PFR_LLONG:
+			arg.u = (unsigned long long int) va_arg(*ap, unsigned long long int);
+			break;
 
+		default:
+			arg.u = (unsigned long long int) va_arg(*ap, unsigned int);
 			break;
+		}
 
-		case PFS_MOD:
-			switch (c) {
-			case 'h':
-				f.l--;
-				break;
+	is_integer:
+		__printf_int(out, arg.u, base, f);
+		break;
+
+	case 'E':
+	case 'F':
+	case 'G':
+		f.f |= PFL_UPPER;
+
+	case 'e':
+	case 'f':
+	case 'g': /* floating-point conversion */
+		if (f.f & PFL_LDBL)
+			arg.f = (double) va_arg(*ap, long double);
+		else
+			arg.f = va_arg(*ap, double);
+
+		__printf_float(out, arg.f, f);
+		break;
+
+	case 'c': /* character conversion */
+		arg.c = (char) va_arg(*ap, int);
+		EMIT(arg.c)
+		break;
+
+	case 's': /* string conversion */
+		arg.s = va_arg(*ap, const char *);
+		arg.s = arg.s ? arg.s : "(null)";
+
+		/* a string need not be terminated within its precision */
+		len = f.p != -1 ? (int) strnlen(arg.s, f.p) : str_len(arg.s);
+
+		if ((f.f & (PFL_LEFT|PFL_ZERO)) == 0) {
+			while (f.w > len) {
+				EMIT(' ')
+				f.w--;
+			}
+		}
 
-			case 'l':
-				f.l++;
-				break;
+		if ((f.f & PFL_ZERO) > 0) {
+			while (f.w > len) {
+				EMIT('0')
+				f.w--;
+			}
+		}
+
+		__printf_emitn(out, arg.s, len);
 
-			default:
-				f.s = PFS_CONV;
-				fmt--;
-				break;
+		if ((f.f & PFL_LEFT) > 0) {
+			while (f.w > len) {
+				EMIT(' ')
+				f.w--;
 			}
+		}
+
+		break;
+
+	case 'n':
+		arg.n  = va_arg(*ap, int *);
+		*arg.n = out->idx;
+
+		break;
+
+	case '%':
+		EMIT(f.c)
+		break;
+
+	default:
+		__printf_ext(out, f, ap, __printf_extconv(f.c));
+		break;
+	}
+}
+
+/* conversions not listed above or registered as extension are copied to the
+ * output unchanged */
+static
+int __printf_isconv(char c)
+{
+	return c && (strchr("PpdioulXxeEfFgGcsn%", c) || __printf_extconv(c));
+}
+
+static
+void __printf_format(__printf_out_t *out, const char *fmt, va_list _ap)
+{
+	const char *p;
+	__printf_t f;
+
+	/* don't consume original ap */
+	va_list ap;
+	va_copy(ap, _ap);
 
+	while (*fmt) {
+		/* copy literal text up to the next conversion at once */
+		if (!(p = strchr(fmt, '%')))
+			p = fmt + str_len(fmt);
+
+		__printf_emitn(out, fmt, p - fmt);
+
+		if (!*p)
 			break;
 
-		case PFS_CONV:
-			f.s = PFS_NORMAL;
+		fmt = __printf_parse(p + 1, &f);
 
-			if (f.l > PFR_MAX)
-				f.l = PFR_MAX;
+		if (__printf_isconv(f.c))
+			__printf_conv(out, f, &ap);
+		else
+			__printf_emitn(out, p, fmt - p);
+	}
 
-			if (f.l < PFR_MIN)
-				f.l = PFR_MIN;
+	va_end(ap);
+}
 
-			switch (c) {
-			case 'P':
-				f.f |= PFL_UPPER;
+/* render a compiled format */
+static
+void __printf_exec(__printf_out_t *out, const printf_prog_t *prog,
+		va_list _ap)
+{
+	int i;
 
-			case 'p':
-				base = 16;
-				f.p  = (8 * sizeof(void *) + 3)/4;
-				f.f |= PFL_ALT;
+	va_list ap;
+	va_copy(ap, _ap);
 
-				arg.u = (unsigned long long int) (unsigned long int) va_arg(ap, void *);
+	for (i = 0; i < prog->nops; i++) {
+		if (prog->ops[i].f.c)
+			__printf_conv(out, prog->ops[i].f, &ap);
+		else
+			__printf_emitn(out, prog->text + prog->ops[i].off,
+					prog->ops[i].len);
+	}
 
-				goto is_integer;
+	va_end(ap);
+}
 
-			case 'd':
-			case 'i': /* signed conversion */
-				base = 10;
-				f.f |= PFL_SIGNED;
+/* render either a format string or a compiled format */
+static
+void __printf_render(__printf_out_t *out, const char *fmt,
+		const printf_prog_t *prog, va_list ap)
+{
+	if (prog)
+		__printf_exec(out, prog, ap);
+	else
+		__printf_format(out, fmt, ap);
+}
 
-				switch (f.l) {
-				case PFR_CHAR:
-					arg.d = (signed char) va_arg(ap, signed int);
-					break;
+static
+int __printf_vsnprintf(char *str, int size, const char *fmt,
+		const printf_prog_t *prog, va_list ap)
+{
+	__printf_out_t out = {
+		.buf  = str,
+		.size = str && size > 0 ? size : 0,
+	};
 
-				case PFR_SHORT:
-					arg.d = (signed short int) va_arg(ap, signed int);
-					break;
+	__printf_render(&out, fmt, prog, ap);
 
-				case PFR_INT:
-					arg.d = (signed int) va_arg(ap, signed int);
-					break;
+	/* only the terminating null byte is written, not the whole buffer */
+	if (out.size > 0)
+		str[out.idx < size - 1 ? out.idx : size - 1] = '\0';
 
-				case PFR_LONG:
-					arg.d = (signed long int) va_arg(ap, signed long int);
-					break;
+	return out.idx;
+}
 
-				case PFR_LLONG:
-					arg.d = (signed long long int) va_arg(ap, signed long long int);
-					break;
+/* format into buf and spill to the heap on overflow; on success the result
+ * is null-terminated and must be freed if out->heap is set */
+static
+int __printf_vbuf(__printf_out_t *out, char *buf, int size,
+		const char *fmt, const printf_prog_t *prog, va_list ap)
+{
+	out->buf   = buf;
+	out->size  = size;
+	out->idx   = 0;
+	out->grow  = 1;
+	out->heap  = 0;
+	out->error = 0;
 
-				default:
-					arg.d = (signed long long int) va_arg(ap, signed int);
-					break;
-				}
+	__printf_render(out, fmt, prog, ap);
 
-				arg.u = (unsigned long long int) arg.d;
+	if (out->error) {
+		if (out->heap)
+			free(out->buf);
 
-				goto is_integer;
+		return -1;
+	}
 
-			case 'o':
-				base = 8;
-				goto is_unsigned;
+	out->buf[out->idx] = '\0';
 
-			case 'u':
-				base = 10;
-				goto is_unsigned;
+	return out->idx;
+}
 
-			case 'X':
-				f.f |= PFL_UPPER;
+static
+int __printf_vasprintf(char **ptr, const char *fmt,
+		const printf_prog_t *prog, va_list ap)
+{
+	char stack[PRINTF_STACKSIZE], *buf;
+	__printf_out_t out;
+	int len;
 
-			case 'x':
-				base = 16;
-				goto is_unsigned;
+	if ((len = __printf_vbuf(&out, stack, sizeof(stack), fmt, prog, ap)) == -1)
+		return -1;
 
-			is_unsigned:
-				switch (f.l) {
-				case PFR_CHAR:
-					arg.u = (unsigned char) va_arg(ap, unsigned int);
-					break;
+	/* return an exact-size copy; if shrinking fails, the larger buffer is
+	 * still valid */
+	if (out.heap) {
+		if (!(buf = realloc(out.buf, len + 1)))
+			buf = out.buf;
+	}
 
-				case PFR_SHORT:
-					arg.u = (unsigned short int) va_arg(ap, unsigned int);
-					break;
+	else if ((buf = malloc(len + 1)))
+		memcpy(buf, stack, len + 1);
 
-				case PFR_INT:
-					arg.u = (unsigned int) va_arg(ap, unsigned int);
-					break;
+	else
+		return -1;
 
-				case PFR_LONG:
-					arg.u = (unsigned long int) va_arg(ap, unsigned long int);
-					break;
+	*ptr = buf;
 
-				case PFR_LLONG:
-					arg.u = (unsigned long long int) va_arg(ap, unsigned long long int);
-					break;
+	return len;
+}
 
-				default:
-					arg.u = (unsigned long long int) va_arg(ap, unsigned int);
-					break;
-				}
+/* render into the free space of an output buffer; output that does not fit
+ * continues on the heap and is written together with the buffer */
+static
+int __printf_vobuf(obuf_t *ob, const char *fmt, const printf_prog_t *prog,
+		va_list ap)
+{
+	__printf_out_t out;
+	int len;
 
-			is_integer:
-				len = __printf_int(str, size, arg.u, base, f);
+	if (ob->error)
+		return errno = ob->error, -1;
 
-				str += len;
-				idx += len;
-				break;
+	/* avoid spilling small conversions from a nearly full buffer */
+	if (ob->size - ob->len < PRINTF_STACKSIZE && obuf_flush(ob) == -1)
+		return -1;
 
-			case 'c': /* character conversion */
-				arg.c = (char) va_arg(ap, int);
-				EMIT(arg.c)
-				break;
+	len = __printf_vbuf(&out, ob->buf + ob->len, ob->size - ob->len,
+			fmt, prog, ap);
 
-			case 's': /* string conversion */
-				arg.s = va_arg(ap, const char *);
-				arg.s = arg.s ? arg.s : "(null)";
-				len   = str_len(arg.s);
+	if (len == -1)
+		return -1;
 
-			is_string:
-				if (f.p != -1 && len > f.p)
-					len = f.p;
+	if (!out.heap)
+		return obuf_commit(ob, len) == -1 ? -1 : len;
 
-				if ((f.f & (PFL_LEFT|PFL_ZERO)) == 0) {
-					while (f.w > len) {
-						EMIT(' ')
-						f.w--;
-					}
-				}
+	len = obuf_catb(ob, out.buf, len);
+	free(out.buf);
 
-				if ((f.f & PFL_ZERO) > 0) {
-					while (f.w > len) {
-						EMIT('0')
-						f.w--;
-					}
-				}
-
-				for (i = len; i; i--)
-					EMIT(*arg.s++)
-
-				if ((f.f & PFL_LEFT) > 0) {
-					while (f.w > len) {
-						EMIT(' ')
-						f.w--;
-					}
-				}
+	return len;
+}
 
-				break;
-
-			case 'n':
-				arg.n  = va_arg(ap, int *);
-				*arg.n = idx;
-
-				break;
+static
+int __printf_vdprintf(int fd, const char *fmt,
+		const printf_prog_t *prog, va_list ap)
+{
+	char stack[PRINTF_STACKSIZE];
+	obuf_t ob;
+	int len;
 
-			case '%':
-				EMIT(c)
-				break;
-
-			default:
-				/* no padding for unknown conversion */
-				f.w =  0;
-				f.p = -1;
-
-				arg.s = ccp;
-				len   = str_len(arg.s);
-				fmt   = ccp + len;
-
-				p = str_chr(arg.s + 1, '%', len - 1);
-
-				if (p != 0) {
-					len = p - arg.s - 1;
-					fmt = p - 1;
-				}
-
-				goto is_string;
-			}
+	obuf_init(&ob, fd, stack, sizeof(stack), 0);
 
-			break;
-		}
-	}
+	if ((len = __printf_vobuf(&ob, fmt, prog, ap)) == -1 ||
+			obuf_flush(&ob) == -1)
+		return -1;
 
-	va_end(ap);
+	return len;
+}
 
-	return idx;
+int _lucid_vsnprintf(char *str, int size, const char *fmt, va_list ap)
+{
+	return __printf_vsnprintf(str, size, fmt, NULL, ap);
 }
 
 int _lucid_asprintf(char **ptr, const char *fmt, /*args*/ ...)
@@ -579,45 +1151,201 @@ int _lucid_snprintf(char *str, int size, const char *fmt, /*args*/ ...)
 
 int _lucid_vasprintf(char **ptr, const char *fmt, va_list ap)
 {
-	va_list ap2;
-	int len;
-	char *buf;
+	return __printf_vasprintf(ptr, fmt, NULL, ap);
+}
 
-	/* don't consume the original ap, we'll need it again */
-	va_copy(ap2, ap);
+int _lucid_vdprintf(int fd, const char *fmt, va_list ap)
+{
+	return __printf_vdprintf(fd, fmt, NULL, ap);
+}
 
-	/* get required size */
-	len = _lucid_vsnprintf(0, 0, fmt, ap2);
+int _lucid_vprintf(const char *fmt, va_list ap)
+{
+	return _lucid_vdprintf(1, fmt, ap);
+}
+
+printf_prog_t *printf_compile(const char *fmt)
+{
+	printf_prog_t *prog;
+	const char *p, *q;
+	int i, n, len = str_len(fmt);
+	__printf_t f;
+
+	/* every conversion yields at most one op and one literal run after it */
+	for (n = 1, p = fmt; (p = strchr(p, '%')); p++)
+		n += 2;
+
+	if (!(prog = malloc(sizeof(*prog) + n * sizeof(prog->ops[0]) + len + 1)))
+		return NULL;
+
+	prog->text = (char *) &prog->ops[n];
+	prog->nops = 0;
+
+	for (i = -1, n = 0, p = fmt; *p; p = q) {
+		/* literal text up to the next conversion */
+		if (*p != '%') {
+			if (!(q = strchr(p, '%')))
+				q = p + str_len(p);
+
+			f.c = 0;
+		}
+
+		else
+			q = __printf_parse(p + 1, &f);
+
+		/* "%%" and unknown conversions are literal text, too */
+		if (f.c == '%' && q - p == 2)
+			p++, f.c = 0;
 
-	va_end(ap2);
+		else if (f.c && !__printf_isconv(f.c))
+			f.c = 0;
 
-	/* if size is 0, no buffer is allocated
-	** just set *ptr to NULL and return size */
-	if (len > 0) {
-		if (!(buf = malloc(len + 1)))
-			return -1;
+		if (f.c) {
+			i++;
+			prog->ops[i].f = f;
+			continue;
+		}
 
-		_lucid_vsnprintf(buf, len + 1, fmt, ap);
+		/* merge adjacent literal runs */
+		if (i < 0 || prog->ops[i].f.c) {
+			i++;
+			prog->ops[i].f.c = 0;
+			prog->ops[i].off = n;
+			prog->ops[i].len = 0;
+		}
 
-		*ptr = buf;
+		memcpy(prog->text + n, p, q - p);
+		prog->ops[i].len += q - p;
+		n += q - p;
 	}
 
-	return len;
+	prog->nops = i + 1;
+
+	return prog;
 }
 
-int _lucid_vdprintf(int fd, const char *fmt, va_list ap)
+const printf_prog_t *printf_compile_once(printf_prog_t **cache, const char *fmt)
 {
-	char *buf;
-	int buflen, len;
+	printf_prog_t *prog, *expected = NULL;
 
-	buflen = _lucid_vasprintf(&buf, fmt, ap);
-	len = write(fd, buf, buflen);
-	free(buf);
+	if ((prog = __atomic_load_n(cache, __ATOMIC_ACQUIRE)))
+		return prog;
 
-	return len;
+	if (!(prog = printf_compile(fmt)))
+		return NULL;
+
+	/* another thread may have been faster */
+	if (!__atomic_compare_exchange_n(cache, &expected, prog, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		printf_free(prog);
+		return expected;
+	}
+
+	return prog;
 }
 
-int _lucid_vprintf(const char *fmt, va_list ap)
+void printf_free(printf_prog_t *prog)
 {
-	return _lucid_vdprintf(1, fmt, ap);
+	free(prog);
+}
+
+int printf_exec_vsnprintf(const printf_prog_t *prog, char *str, int size,
+		va_list ap)
+{
+	if (!prog)
+		return errno = EINVAL, -1;
+
+	return __printf_vsnprintf(str, size, NULL, prog, ap);
+}
+
+int printf_exec_snprintf(const printf_prog_t *prog, char *str, int size,
+		/*args*/ ...)
+{
+	va_list ap;
+	va_start(ap, size);
+
+	return printf_exec_vsnprintf(prog, str, size, ap);
+}
+
+int printf_exec_vasprintf(const printf_prog_t *prog, char **ptr, va_list ap)
+{
+	if (!prog)
+		return errno = EINVAL, -1;
+
+	return __printf_vasprintf(ptr, NULL, prog, ap);
+}
+
+int printf_exec_asprintf(const printf_prog_t *prog, char **ptr, /*args*/ ...)
+{
+	va_list ap;
+	va_start(ap, ptr);
+
+	return printf_exec_vasprintf(prog, ptr, ap);
+}
+
+int printf_exec_vdprintf(const printf_prog_t *prog, int fd, va_list ap)
+{
+	if (!prog)
+		return errno = EINVAL, -1;
+
+	return __printf_vdprintf(fd, NULL, prog, ap);
+}
+
+int printf_exec_dprintf(const printf_prog_t *prog, int fd, /*args*/ ...)
+{
+	va_list ap;
+	va_start(ap, fd);
+
+	return printf_exec_vdprintf(prog, fd, ap);
+}
+
+int printf_exec_vstralloc(const printf_prog_t *prog, stralloc_t *sa,
+		va_list ap)
+{
+	char stack[PRINTF_STACKSIZE];
+	__printf_out_t out;
+	int len, rc;
+
+	if (!prog)
+		return errno = EINVAL, -1;
+
+	if ((len = __printf_vbuf(&out, stack, sizeof(stack), NULL, prog, ap)) == -1)
+		return -1;
+
+	rc = stralloc_catb(sa, out.buf, len);
+
+	if (out.heap)
+		free(out.buf);
+
+	return rc == -1 ? -1 : len;
+}
+
+int printf_exec_stralloc(const printf_prog_t *prog, stralloc_t *sa,
+		/*args*/ ...)
+{
+	va_list ap;
+	va_start(ap, sa);
+
+	return printf_exec_vstralloc(prog, sa, ap);
+}
+
+int obuf_vcatf(obuf_t *ob, const char *fmt, va_list ap)
+{
+	return __printf_vobuf(ob, fmt, NULL, ap);
+}
+
+int obuf_catf(obuf_t *ob, const char *fmt, /*args*/ ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+
+	return obuf_vcatf(ob, fmt, ap);
+}
+
+int obuf_vcatp(obuf_t *ob, const printf_prog_t *prog, va_list ap)
+{
+	if (!prog)
+		return errno = EINVAL, -1;
+
+	return __printf_vobuf(ob, NULL, prog, ap);
 }
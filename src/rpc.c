@@ -25,18 +25,25 @@
 #include "str.h"
 #include "uio.h"
 
-struct rpc_env __rpc_env = { RTLD_DEFAULT, NULL };
+__thread struct rpc_env __rpc_env = { NULL };
+
+/* library of the methods, set once for the process */
+static void *rpc_handle = RTLD_DEFAULT;
 
 void rpc_init(const char *lib)
 {
+	void *handle;
+
 	if (!lib)
 		return;
 
-	__rpc_env.handle = dlopen(lib, RTLD_NOW);
-	if (!__rpc_env.handle) {
+	handle = dlopen(lib, RTLD_NOW);
+	if (!handle) {
 		error_set(errno, "failed to load RPC library: %s", dlerror());
 		return;
 	}
+
+	__atomic_store_n(&rpc_handle, handle, __ATOMIC_RELEASE);
 }
 
 void rpc_remote_enable(struct sockaddr_in *addr)
@@ -73,6 +80,7 @@ void __rpc_call_symbols_init(const char *name, struct __rpc_call_symbols *sym)
 static
 void __rpc_call_init(const char *name, struct __rpc_call *call)
 {
+	void *handle = __atomic_load_n(&rpc_handle, __ATOMIC_ACQUIRE);
 	char *ebuf;
 
 	/* find rpc type data */
@@ -81,14 +89,14 @@ void __rpc_call_init(const char *name, struct __rpc_call *call)
 
 	/* find method */
 	dlerror();
-	*(void **)(&call->entry) = dlsym(__rpc_env.handle, sym.controller);
+	*(void **)(&call->entry) = dlsym(handle, sym.controller);
 	if ((ebuf = dlerror()) != NULL) {
 		error_set(errno, "undefined method (%s): %s", name, ebuf);
 		return;
 	}
 
 	dlerror();
-	const rtti_t **atypep = dlsym(__rpc_env.handle, sym.atype);
+	const rtti_t **atypep = dlsym(handle, sym.atype);
 	if ((ebuf = dlerror()) != NULL) {
 		error_set(errno, "unknown method type: %s", ebuf);
 		return;
@@ -96,7 +104,7 @@ void __rpc_call_init(const char *name, struct __rpc_call *call)
 	call->atype = *atypep;
 
 	dlerror();
-	const rtti_t **rtypep = dlsym(__rpc_env.handle, sym.rtype);
+	const rtti_t **rtypep = dlsym(handle, sym.rtype);
 	if ((ebuf = dlerror()) != NULL) {
 		error_set(errno, "unknown method type: %s", ebuf);
 		return;
@@ -55,14 +55,12 @@ char *rtti_data_encode(const rtti_t *type, const void *data)
 	if (d->length == 0)
 		return str_dup("null");
 
-	char *ebuf;
-	if ((ebuf = base64_encode(d->data, d->length)) == NULL) {
+	char *buf = NULL;
+	if (_lucid_asprintf(&buf, "\"%B\"", d->length, d->data) == -1) {
 		error_set(errno, "failed to encode binary data");
 		return NULL;
 	}
 
-	char *buf = NULL;
-	_lucid_asprintf(&buf, "\"%s\"", ebuf);
 	return buf;
 }
 
@@ -30,9 +30,9 @@ char *rtti_flist32_encode(const rtti_t *type, const void *data)
 	const flag32_t *flag32 = data;
 	const char *delim = type->args[1].s;
 	char clmod = (char)type->args[2].i;
-	char *buf, *str = flist32_encode(list, flag32, clmod, delim);
+	char *buf;
 
-	_lucid_asprintf(&buf, "\"%s\"", str);
+	_lucid_asprintf(&buf, "\"%M\"", list, flag32, (int) clmod, delim);
 	return buf;
 }
 
@@ -42,9 +42,9 @@ char *rtti_flist64_encode(const rtti_t *type, const void *data)
 	const flag64_t *flag64 = data;
 	const char *delim = type->args[1].s;
 	char clmod = (char)type->args[2].i;
-	char *buf, *str = flist64_encode(list, flag64, clmod, delim);
+	char *buf;
 
-	_lucid_asprintf(&buf, "\"%s\"", str);
+	_lucid_asprintf(&buf, "\"%lM\"", list, flag64, (int) clmod, delim);
 	return buf;
 }
 
@@ -0,0 +1,59 @@
+// Copyright (c) 2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "rtti.h"
+#include "str.h"
+
+#include "internal.h"
+
+char *rtti_float_encode(const rtti_t *type, const void *data)
+{
+	char tmp[STR_FMT_DBL_MAX], *buf;
+	int len;
+
+	if (type->size == sizeof(float))
+		len = str_fmt_float(tmp, CAST(float, data));
+	else
+		len = str_fmt_double(tmp, CAST(double, data));
+
+	if (!(buf = malloc(len + 1)))
+		return NULL;
+
+	memcpy(buf, tmp, len);
+	buf[len] = '\0';
+
+	return buf;
+}
+
+void rtti_float_decode(const rtti_t *type, const char **buf, void *data)
+{
+	int res;
+
+	if (type->size == sizeof(float))
+		res = str_tofloat(*buf, &CAST(float, data), str_len(*buf));
+	else
+		res = str_todouble(*buf, &CAST(double, data), str_len(*buf));
+
+	if (res == 0) {
+		error_set(EINVAL, "failed to decode float near '%.16s'", *buf);
+		return;
+	}
+
+	*buf += res;
+}
@@ -14,10 +14,10 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
 #include "error.h"
-#include "printf.h"
 #include "rtti.h"
 #include "str.h"
 
@@ -25,20 +25,28 @@
 
 char *rtti_int_encode(const rtti_t *type, const void *data)
 {
-	char *buf = NULL;
+	char tmp[STR_FMT_MAX], *buf;
+	int len;
 
+	/* convert into a local buffer and allocate the exact size once */
 	switch (type->size * 10 + type->args[0].i) {
-	case 10: _lucid_asprintf(&buf, "%"PRIu8,  CAST(uint8_t, data));  break;
-	case 11: _lucid_asprintf(&buf, "%"PRIi8,  CAST(int8_t, data));   break;
-	case 20: _lucid_asprintf(&buf, "%"PRIu16, CAST(uint16_t, data)); break;
-	case 21: _lucid_asprintf(&buf, "%"PRIi16, CAST(int16_t, data));  break;
-	case 40: _lucid_asprintf(&buf, "%"PRIu32, CAST(uint32_t, data)); break;
-	case 41: _lucid_asprintf(&buf, "%"PRIi32, CAST(int32_t, data));  break;
-	case 80: _lucid_asprintf(&buf, "%"PRIu64, CAST(uint64_t, data)); break;
-	case 81: _lucid_asprintf(&buf, "%"PRIi64, CAST(int64_t, data));  break;
-	default: assert_not_reached();
+	case 10: len = str_fmt_u32(tmp, CAST(uint8_t, data));  break;
+	case 11: len = str_fmt_i64(tmp, CAST(int8_t, data));   break;
+	case 20: len = str_fmt_u32(tmp, CAST(uint16_t, data)); break;
+	case 21: len = str_fmt_i64(tmp, CAST(int16_t, data));  break;
+	case 40: len = str_fmt_u32(tmp, CAST(uint32_t, data)); break;
+	case 41: len = str_fmt_i64(tmp, CAST(int32_t, data));  break;
+	case 80: len = str_fmt_u64(tmp, CAST(uint64_t, data)); break;
+	case 81: len = str_fmt_i64(tmp, CAST(int64_t, data));  break;
+	default: assert_not_reached(); return NULL;
 	}
 
+	if (!(buf = malloc(len + 1)))
+		return NULL;
+
+	memcpy(buf, tmp, len);
+	buf[len] = '\0';
+
 	return buf;
 }
 
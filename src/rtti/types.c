@@ -20,6 +20,8 @@
 
 const rtti_t rtti_bool_type     = RTTI_BOOL_TYPE(uint8);
 const rtti_t rtti_data_type     = RTTI_DATA_TYPE;
+const rtti_t rtti_float_type    = RTTI_FLOAT_TYPE(float);
+const rtti_t rtti_double_type   = RTTI_FLOAT_TYPE(double);
 const rtti_t rtti_int8_type     = RTTI_INT_TYPE(int8,   1);
 const rtti_t rtti_uint8_type    = RTTI_INT_TYPE(uint8,  0);
 const rtti_t rtti_int16_type    = RTTI_INT_TYPE(int16,  1);
@@ -30,6 +32,8 @@ const rtti_t rtti_int64_type    = RTTI_INT_TYPE(int64,  1);
 const rtti_t rtti_uint64_type   = RTTI_INT_TYPE(uint64, 0);
 const rtti_t rtti_bool_ptype    = RTTI_POINTER_TYPE(&rtti_bool_type);
 const rtti_t rtti_data_ptype    = RTTI_POINTER_TYPE(&rtti_data_type);
+const rtti_t rtti_float_ptype   = RTTI_POINTER_TYPE(&rtti_float_type);
+const rtti_t rtti_double_ptype  = RTTI_POINTER_TYPE(&rtti_double_type);
 const rtti_t rtti_int8_ptype    = RTTI_POINTER_TYPE(&rtti_int8_type);
 const rtti_t rtti_uint8_ptype   = RTTI_POINTER_TYPE(&rtti_uint8_type);
 const rtti_t rtti_int16_ptype   = RTTI_POINTER_TYPE(&rtti_int16_type);
@@ -14,6 +14,14 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
 
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "char.h"
 #include "scanf.h"
 #include "str.h"
@@ -52,10 +60,55 @@ typedef struct {
 	int w; /* width */
 } __scanf_t;
 
+/* parse an optionally signed decimal integer from the first n bytes of str;
+** runs of eight digits are validated and combined with a few multiplications
+** instead of one at a time */
+static
+int __scanf_dec(const char *str, unsigned long long int *val, int n)
+{
+	const char *p = str, *end = str + n, *digits;
+	unsigned long long int v = 0;
+	uint64_t chunk;
+	int minus = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		minus = (*p++ == '-');
+
+	digits = p;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (end - p >= 8) {
+		memcpy(&chunk, p, 8);
+
+		if ((chunk & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL ||
+				((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) !=
+				0x3030303030303030ULL)
+			break;
+
+		chunk = (chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+		chunk = (chunk & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+		chunk = (chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32;
+
+		v  = v * 100000000ULL + chunk;
+		p += 8;
+	}
+#endif
+
+	while (p < end && (unsigned char) (*p - '0') < 10)
+		v = v * 10 + (*p++ - '0');
+
+	if (p == digits)
+		return 0;
+
+	*val = minus ? -v : v;
+
+	return p - str;
+}
+
 /* supported formats:
 ** - field width
-** - length mods: hh, h, l, and ll
-** - conversion spec: d, i, u, o, x, X, c, s, p, P, n */
+** - length mods: hh, h, l, ll, and L
+** - conversion spec: d, i, u, o, x, X, e, E, f, F, g, G, c, s, p, P, n */
 int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 {
 	/* keep track of converted arguments */
@@ -74,6 +127,10 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 
 		/* string argument */
 		char *s;
+
+		/* floating-point arguments */
+		float f;
+		double d;
 	} arg;
 
 	/* base used for integer conversions */
@@ -85,6 +142,9 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 	/* pointer for string conversion */
 	char *sp;
 
+	/* end of input, so the remaining length is known without rescanning */
+	const char *end = str + str_len(str);
+
 	/* don't consume original ap */
 	va_list ap;
 	va_copy(ap, _ap);
@@ -93,7 +153,7 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 	f.f = 0;
 	f.l = SFR_INT;
 	f.s = SFS_NORMAL;
-	f.w = str_len(str);
+	f.w = end - str;
 
 	while ((c = *fmt++)) {
 		switch (f.s) {
@@ -102,7 +162,7 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 				f.f = 0;
 				f.l = SFR_INT;
 				f.s = SFS_FLAGS;
-				f.w = str_len(str);
+				f.w = end - str;
 			}
 
 			else if (char_isspace(c))
@@ -167,6 +227,10 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 				f.l++;
 				break;
 
+			case 'L':
+				f.l = SFR_LLONG;
+				break;
+
 			default:
 				f.s = SFS_CONV;
 				fmt--;
@@ -215,7 +279,14 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 					break;
 				}
 
-				len = str_toumax(str, &arg.u, base, f.w);
+				/* never look past the end of input */
+				if (f.w > end - str)
+					f.w = end - str;
+
+				if (base == 10)
+					len = __scanf_dec(str, &arg.u, f.w);
+				else
+					len = str_toumax(str, &arg.u, base, f.w);
 
 				if (len <= 0) {
 					f.s = SFS_ERR;
@@ -255,6 +326,52 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 
 				break;
 
+			case 'E':
+			case 'F':
+			case 'G':
+			case 'e':
+			case 'f':
+			case 'g': /* floating-point conversion */
+				while (char_isspace(*str))
+					str++;
+
+				if (!*str) {
+					f.s = SFS_EOF;
+					break;
+				}
+
+				/* parse floats directly to avoid double rounding */
+				if (f.l <= SFR_INT)
+					len = str_tofloat(str, &arg.f, f.w);
+				else
+					len = str_todouble(str, &arg.d, f.w);
+
+				if (len <= 0) {
+					f.s = SFS_ERR;
+					break;
+				}
+
+				str += len;
+				converted++;
+
+				if (!(f.f & SFL_NOOP)) {
+					switch (f.l) {
+					case SFR_LONG:
+						*va_arg(ap, double *) = arg.d;
+						break;
+
+					case SFR_LLONG:
+						*va_arg(ap, long double *) = arg.d;
+						break;
+
+					default:
+						*va_arg(ap, float *) = arg.f;
+						break;
+					}
+				}
+
+				break;
+
 			case 'c': /* character conversion */
 				/* default width = 1 */
 				f.w = (f.f & SFL_WIDTH) ? f.w : 1;
@@ -289,7 +406,7 @@ int _lucid_vsscanf(const char *str, const char *fmt, va_list _ap)
 				break;
 
 			case 's': /* string conversion */
-				if (!(f.f & SFL_NOOP)) {
+				if ((f.f & SFL_NOOP)) {
 					while (f.w-- && !char_isspace(*str)) {
 						if (!*str) {
 							f.s = SFS_EOF;
@@ -389,3 +506,487 @@ int _lucid_sscanf(const char *str, const char *fmt, /*args*/ ...)
 
 	return _lucid_vsscanf(str, fmt, ap);
 }
+
+enum __scanf_op {
+	SOP_SPACE, /* skip white space */
+	SOP_TEXT,  /* match literal text */
+	SOP_INT,
+	SOP_FLOAT,
+	SOP_STR,
+	SOP_CHAR,
+	SOP_PTR,
+	SOP_COUNT,
+};
+
+struct scanf_prog {
+	int nops;
+	int ncols;
+	char *text;
+	struct {
+		int op;   /* SOP_* */
+		int base; /* base of integer conversions */
+		int l;    /* length */
+		int w;    /* width, -1 if unlimited */
+		int col;  /* column, -1 if suppressed */
+		int size; /* size of a column element */
+		int off;  /* offset of literal text */
+		int len;  /* length of literal text */
+	} ops[];
+};
+
+/* size of the read buffer used for input that cannot be mapped */
+#define SCANF_BUFSIZE 65536
+
+scanf_prog_t *scanf_compile(const char *fmt)
+{
+	scanf_prog_t *prog;
+	int i, n, noop, w, l, len = str_len(fmt);
+	char c;
+
+	/* every format character yields at most one op */
+	if (!(prog = malloc(sizeof(*prog) + (len + 1) * sizeof(prog->ops[0]) + len)))
+		return NULL;
+
+	prog->text  = (char *) &prog->ops[len + 1];
+	prog->ncols = 0;
+
+	for (i = -1, n = 0; (c = *fmt++);) {
+		if (char_isspace(c)) {
+			if (i < 0 || prog->ops[i].op != SOP_SPACE) {
+				i++;
+				prog->ops[i].op  = SOP_SPACE;
+				prog->ops[i].w   = -1;
+				prog->ops[i].col = -1;
+			}
+
+			continue;
+		}
+
+		if (c != '%' || *fmt == '%') {
+			if (c == '%')
+				fmt++;
+
+			/* merge adjacent literal text */
+			if (i < 0 || prog->ops[i].op != SOP_TEXT) {
+				i++;
+				prog->ops[i].op  = SOP_TEXT;
+				prog->ops[i].w   = -1;
+				prog->ops[i].col = -1;
+				prog->ops[i].off = n;
+				prog->ops[i].len = 0;
+			}
+
+			prog->text[n++] = c;
+			prog->ops[i].len++;
+			continue;
+		}
+
+		noop = 0;
+		w    = -1;
+		l    = SFR_INT;
+
+		if (*fmt == '*') {
+			noop = 1;
+			fmt++;
+		}
+
+		if (char_isdigit(*fmt))
+			for (w = 0; char_isdigit(*fmt); fmt++)
+				w = w * 10 + (*fmt - '0');
+
+		for (; *fmt == 'h' || *fmt == 'l' || *fmt == 'L'; fmt++)
+			l = *fmt == 'h' ? l - 1 : *fmt == 'l' ? l + 1 : SFR_LLONG;
+
+		if (l > SFR_MAX)
+			l = SFR_MAX;
+
+		if (l < SFR_MIN)
+			l = SFR_MIN;
+
+		i++;
+		prog->ops[i].base = 10;
+		prog->ops[i].l    = l;
+		prog->ops[i].w    = w;
+
+		switch ((c = *fmt++)) {
+		case 'd':
+		case 'u':
+			prog->ops[i].op = SOP_INT;
+			break;
+
+		case 'i':
+			prog->ops[i].op   = SOP_INT;
+			prog->ops[i].base = 0;
+			break;
+
+		case 'o':
+			prog->ops[i].op   = SOP_INT;
+			prog->ops[i].base = 8;
+			break;
+
+		case 'X':
+		case 'x':
+			prog->ops[i].op   = SOP_INT;
+			prog->ops[i].base = 16;
+			break;
+
+		case 'E':
+		case 'F':
+		case 'G':
+		case 'e':
+		case 'f':
+		case 'g':
+			prog->ops[i].op = SOP_FLOAT;
+			break;
+
+		case 's':
+			prog->ops[i].op = SOP_STR;
+			break;
+
+		case 'c':
+			prog->ops[i].op = SOP_CHAR;
+			prog->ops[i].w  = w < 0 ? 1 : w;
+			break;
+
+		case 'P':
+		case 'p':
+			prog->ops[i].op = SOP_PTR;
+			break;
+
+		case 'n':
+			prog->ops[i].op = SOP_COUNT;
+			break;
+
+		default:
+			free(prog);
+			return errno = EINVAL, NULL;
+		}
+
+		switch (prog->ops[i].op) {
+		case SOP_INT:
+			prog->ops[i].size = l == SFR_CHAR  ? sizeof(char) :
+			                    l == SFR_SHORT ? sizeof(short int) :
+			                    l == SFR_INT   ? sizeof(int) :
+			                    l == SFR_LONG  ? sizeof(long int) :
+			                    sizeof(long long int);
+			break;
+
+		case SOP_FLOAT:
+			prog->ops[i].size = l == SFR_LONG  ? sizeof(double) :
+			                    l == SFR_LLONG ? sizeof(long double) :
+			                    sizeof(float);
+			break;
+
+		case SOP_STR:
+			/* strings are stored in fixed size cells */
+			if (w <= 0 && !noop) {
+				free(prog);
+				return errno = EINVAL, NULL;
+			}
+
+			prog->ops[i].size = w + 1;
+			break;
+
+		case SOP_CHAR:
+			prog->ops[i].size = prog->ops[i].w;
+			break;
+
+		case SOP_PTR:
+			prog->ops[i].size = sizeof(void *);
+			break;
+
+		case SOP_COUNT:
+			prog->ops[i].size = sizeof(int);
+			break;
+		}
+
+		prog->ops[i].col = noop ? -1 : prog->ncols++;
+	}
+
+	prog->nops = i + 1;
+
+	return prog;
+}
+
+int scanf_ncols(const scanf_prog_t *prog)
+{
+	return prog->ncols;
+}
+
+int scanf_colsize(const scanf_prog_t *prog, int col)
+{
+	int i;
+
+	for (i = 0; i < prog->nops; i++)
+		if (prog->ops[i].op >= SOP_INT && prog->ops[i].col == col)
+			return prog->ops[i].size;
+
+	return errno = EINVAL, -1;
+}
+
+void scanf_free(scanf_prog_t *prog)
+{
+	free(prog);
+}
+
+/* scan one line into row of cols; returns 0 if all directives matched */
+static
+int __scanf_line(const scanf_prog_t *prog, const char *str, const char *end,
+		scanf_cols_t *cols, size_t row)
+{
+	const char *line = str;
+	unsigned long long int u;
+	float fv;
+	double dv;
+	char *dst;
+	int i, n, len;
+
+	for (i = 0; i < prog->nops; i++) {
+		/* conversions other than %c and %n skip leading white space */
+		switch (prog->ops[i].op) {
+		case SOP_INT:
+		case SOP_FLOAT:
+		case SOP_STR:
+		case SOP_PTR:
+			while (str < end && char_isspace(*str))
+				str++;
+
+			if (str == end)
+				return -1;
+		}
+
+		n = end - str;
+
+		if (prog->ops[i].w >= 0 && prog->ops[i].w < n)
+			n = prog->ops[i].w;
+
+		dst = NULL;
+
+		if (prog->ops[i].col >= 0)
+			dst = (char *) cols->cols[prog->ops[i].col] + row * prog->ops[i].size;
+
+		switch (prog->ops[i].op) {
+		case SOP_SPACE:
+			while (str < end && char_isspace(*str))
+				str++;
+
+			break;
+
+		case SOP_TEXT:
+			len = prog->ops[i].len;
+
+			if (end - str < len ||
+					memcmp(str, prog->text + prog->ops[i].off, len))
+				return -1;
+
+			str += len;
+			break;
+
+		case SOP_INT:
+		case SOP_PTR:
+			if (prog->ops[i].base == 10 && prog->ops[i].op == SOP_INT)
+				len = __scanf_dec(str, &u, n);
+			else
+				len = str_toumax(str, &u, prog->ops[i].op == SOP_PTR ?
+						0 : prog->ops[i].base, n);
+
+			if (len <= 0)
+				return -1;
+
+			str += len;
+
+			if (!dst)
+				break;
+
+			if (prog->ops[i].op == SOP_PTR) {
+				*(void **) dst = (void *) (unsigned long int) u;
+				break;
+			}
+
+			switch (prog->ops[i].l) {
+			case SFR_CHAR:
+				*(unsigned char *) dst = u;
+				break;
+
+			case SFR_SHORT:
+				*(unsigned short int *) dst = u;
+				break;
+
+			case SFR_INT:
+				*(unsigned int *) dst = u;
+				break;
+
+			case SFR_LONG:
+				*(unsigned long int *) dst = u;
+				break;
+
+			default:
+				*(unsigned long long int *) dst = u;
+				break;
+			}
+
+			break;
+
+		case SOP_FLOAT:
+			/* parse floats directly to avoid double rounding */
+			if (prog->ops[i].l <= SFR_INT) {
+				if ((len = str_tofloat(str, &fv, n)) <= 0)
+					return -1;
+
+				if (dst)
+					*(float *) dst = fv;
+			}
+
+			else {
+				if ((len = str_todouble(str, &dv, n)) <= 0)
+					return -1;
+
+				if (dst && prog->ops[i].l == SFR_LONG)
+					*(double *) dst = dv;
+				else if (dst)
+					*(long double *) dst = dv;
+			}
+
+			str += len;
+			break;
+
+		case SOP_STR:
+			for (len = 0; len < n && !char_isspace(str[len]); len++);
+
+			if (dst) {
+				memcpy(dst, str, len);
+				dst[len] = '\0';
+			}
+
+			str += len;
+			break;
+
+		case SOP_CHAR:
+			if (n < prog->ops[i].w)
+				return -1;
+
+			if (dst)
+				memcpy(dst, str, n);
+
+			str += n;
+			break;
+
+		case SOP_COUNT:
+			if (dst)
+				*(int *) dst = str - line;
+
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* scan complete lines of buf; a trailing partial line only if eof is set */
+static
+size_t __scanf_lines(const scanf_prog_t *prog, const char *buf, size_t len,
+		scanf_cols_t *cols, int eof)
+{
+	const char *p = buf, *end = buf + len, *eol;
+
+	while (p < end && cols->rows < cols->size) {
+		if (!(eol = memchr(p, '\n', end - p))) {
+			if (!eof)
+				break;
+
+			eol = end;
+		}
+
+		if (__scanf_line(prog, p, eol, cols, cols->rows) == 0)
+			cols->rows++;
+
+		else {
+			if (cols->nbad < cols->badsize)
+				cols->bad[cols->nbad] = cols->lines;
+
+			cols->nbad++;
+		}
+
+		cols->lines++;
+		p = eol < end ? eol + 1 : eol;
+	}
+
+	return p - buf;
+}
+
+size_t scanf_exec_buf(const scanf_prog_t *prog, const char *buf, size_t len,
+		scanf_cols_t *cols)
+{
+	return __scanf_lines(prog, buf, len, cols, 1);
+}
+
+int scanf_exec_fd(const scanf_prog_t *prog, int fd, scanf_cols_t *cols)
+{
+	struct stat sb;
+	char *buf, *tmp;
+	size_t size = SCANF_BUFSIZE, len = 0, done;
+	off_t offset, base;
+	ssize_t n;
+
+	/* regular files are scanned in place from the current offset; files
+	** in /proc report a size of zero and are read instead */
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0 &&
+			(offset = lseek(fd, 0, SEEK_CUR)) != -1) {
+		if (offset >= sb.st_size)
+			return 0;
+
+		/* mappings start at a page boundary */
+		base = offset - offset % sysconf(_SC_PAGESIZE);
+		buf  = mmap(NULL, sb.st_size - base, PROT_READ, MAP_PRIVATE, fd, base);
+
+		if (buf != MAP_FAILED) {
+			madvise(buf, sb.st_size - base, MADV_SEQUENTIAL);
+			done = __scanf_lines(prog, buf + (offset - base),
+					sb.st_size - offset, cols, 1);
+			munmap(buf, sb.st_size - base);
+
+			return lseek(fd, offset + done, SEEK_SET) == -1 ? -1 : 0;
+		}
+	}
+
+	if (!(buf = malloc(size)))
+		return -1;
+
+	while (cols->rows < cols->size) {
+		/* a single line fills the whole buffer */
+		if (len == size) {
+			if (!(tmp = realloc(buf, size * 2))) {
+				free(buf);
+				return -1;
+			}
+
+			buf   = tmp;
+			size *= 2;
+		}
+
+		if ((n = read(fd, buf + len, size - len)) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			free(buf);
+			return -1;
+		}
+
+		len += n;
+		done = __scanf_lines(prog, buf, len, cols, n == 0);
+
+		memmove(buf, buf + done, len - done);
+		len -= done;
+
+		if (n == 0)
+			break;
+	}
+
+	free(buf);
+
+	/* hand lines not scanned back to seekable files */
+	if (len > 0)
+		lseek(fd, -(off_t) len, SEEK_CUR);
+
+	return 0;
+}
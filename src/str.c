@@ -14,6 +14,7 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "char.h"
@@ -22,6 +23,8 @@
 #include "str.h"
 #include "strtok.h"
 
+#include "float/internal.h"
+
 int str_check(const char *str, int allowed)
 {
 	int i, n;
@@ -105,6 +108,23 @@ char *str_dup(const char *str)
 	return memdup(str, str_len(str) + 1);
 }
 
+char *str_dupn(const char *str, int n)
+{
+	char *buf;
+	int len = 0;
+
+	while (len < n && str[len])
+		len++;
+
+	if (!(buf = malloc(len + 1)))
+		return NULL;
+
+	memcpy(buf, str, len);
+	buf[len] = '\0';
+
+	return buf;
+}
+
 int str_equal(const char *str1, const char *str2)
 {
 	return str_cmp(str1, str2) == 0;
@@ -420,3 +440,147 @@ int str_toumax(const char *str, unsigned long long int *val, int base, int n)
 	return p - str;
 }
 
+
+static const char DIGIT_PAIRS[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static inline
+int __str_ndigits32(uint32_t v)
+{
+	if (v < 10)         return 1;
+	if (v < 100)        return 2;
+	if (v < 1000)       return 3;
+	if (v < 10000)      return 4;
+	if (v < 100000)     return 5;
+	if (v < 1000000)    return 6;
+	if (v < 10000000)   return 7;
+	if (v < 100000000)  return 8;
+	if (v < 1000000000) return 9;
+	return 10;
+}
+
+/* write exactly n digits of v ending at end, two at a time */
+static inline
+void __str_fmt_digits(char *end, uint32_t v, int n)
+{
+	while (n >= 2) {
+		end -= 2;
+		memcpy(end, DIGIT_PAIRS + 2 * (v % 100), 2);
+		v /= 100;
+		n -= 2;
+	}
+
+	if (n)
+		*--end = '0' + v;
+}
+
+int str_fmt_u32(char *dst, uint32_t val)
+{
+	int n = __str_ndigits32(val);
+
+	__str_fmt_digits(dst + n, val, n);
+
+	return n;
+}
+
+int str_fmt_u64(char *dst, uint64_t val)
+{
+	uint32_t hi, mid, lo;
+	int n;
+
+	if (val <= UINT32_MAX)
+		return str_fmt_u32(dst, val);
+
+	/* split into blocks of eight digits, so the digit loops only ever
+	 * divide 32 bit values */
+	lo  = val % 100000000;
+	val = val / 100000000;
+
+	if (val < 100000000) {
+		n = str_fmt_u32(dst, val);
+		__str_fmt_digits(dst + n + 8, lo, 8);
+		return n + 8;
+	}
+
+	mid = val % 100000000;
+	hi  = val / 100000000;
+
+	n = str_fmt_u32(dst, hi);
+	__str_fmt_digits(dst + n + 8, mid, 8);
+	__str_fmt_digits(dst + n + 16, lo, 8);
+
+	return n + 16;
+}
+
+int str_fmt_i64(char *dst, int64_t val)
+{
+	if (val >= 0)
+		return str_fmt_u64(dst, val);
+
+	*dst = '-';
+
+	return str_fmt_u64(dst + 1, -(uint64_t) val) + 1;
+}
+
+int str_fmt_x64(char *dst, uint64_t val, int upper)
+{
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	int i, n;
+
+	n = val ? (64 - __builtin_clzll(val) + 3) / 4 : 1;
+
+	for (i = n - 1; i >= 0; i--, val >>= 4)
+		dst[i] = digits[val & 0xf];
+
+	return n;
+}
+
+int str_fmt_double(char *dst, double val)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	return __float_fmt(dst, &__float_double, bits);
+}
+
+int str_fmt_float(char *dst, float val)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	return __float_fmt(dst, &__float_single, bits);
+}
+
+int str_todouble(const char *str, double *val, int n)
+{
+	uint64_t bits;
+	int len;
+
+	if ((len = __float_parse(str, n, &__float_double, &bits)) > 0)
+		memcpy(val, &bits, sizeof(bits));
+
+	return len;
+}
+
+int str_tofloat(const char *str, float *val, int n)
+{
+	uint64_t bits;
+	uint32_t fbits;
+	int len;
+
+	if ((len = __float_parse(str, n, &__float_single, &bits)) > 0) {
+		fbits = (uint32_t) bits;
+		memcpy(val, &fbits, sizeof(fbits));
+	}
+
+	return len;
+}
@@ -72,6 +72,7 @@ char *stralloc_finalize(stralloc_t *sa)
 		return 0;
 
 	memcpy(buf, sa->s, sa->len);
+	buf[sa->len] = '\0';
 	return buf;
 }
 
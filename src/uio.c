@@ -17,12 +17,21 @@
 #include <unistd.h>
 #include <errno.h>
 #include <dirent.h>
+#include <stdlib.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "char.h"
 #include "cext.h"
@@ -69,141 +78,709 @@ int uio_open(const char *filename, const char *flags, mode_t mode)
 	return open(filename, f, mode ? mode : 0666);
 }
 
-int uio_read(int fd, char **str, int len)
+int uio_reader_init(uio_reader_t *r, int fd, char *buf, int size, int flags)
 {
-	int buflen;
-	char *buf = malloc(len + 1);
+	if (buf && size <= 0)
+		return errno = EINVAL, -1;
 
-	if ((buflen = read(fd, buf, len)) == -1) {
-		free(buf);
-		return -1;
+	if (size <= 0)
+		size = UIO_READER_SIZE;
+
+	flags &= UIO_READER_SHARED;
+
+	if (lseek(fd, 0, SEEK_CUR) != -1)
+		flags |= UIO_READER_SEEK;
+
+	if (!buf) {
+		if (!(buf = malloc(size)))
+			return -1;
+
+		flags |= UIO_READER_ALLOC;
 	}
 
-	*str = buf;
-	return buflen;
+	r->fd    = fd;
+	r->buf   = buf;
+	r->size  = size;
+	r->start = 0;
+	r->end   = 0;
+	r->flags = flags;
+	r->eof   = 0;
+
+	return 0;
 }
 
-int uio_read_netstring(int fd, char **str)
+int uio_reader_free(uio_reader_t *r)
 {
-	int ret = 0, len = 0, oldlen = 0;
-	char c;
+	int rc = 0, errno_orig;
+
+	/* hand unconsumed bytes back to the descriptor */
+	if ((r->flags & UIO_READER_SEEK) && r->end > r->start)
+		if (lseek(r->fd, r->start - r->end, SEEK_CUR) == -1)
+			rc = -1;
 
-	while ((ret = read(fd, &c, 1)) == 1) {
-		if (char_isdigit(c)) {
-			len = (len * 10) + (c - '0');
+	if (r->flags & UIO_READER_ALLOC) {
+		errno_orig = errno;
+		free(r->buf);
+		errno = errno_orig;
+	}
 
-			if (len < oldlen)
-				return errno = ERANGE, -1;
+	r->buf   = NULL;
+	r->size  = 0;
+	r->start = 0;
+	r->end   = 0;
 
-			oldlen = len;
+	return rc;
+}
+
+/* read at least one more byte into the buffer, want is the number of bytes
+ * the current operation is still missing */
+static
+int uio_reader_fill(uio_reader_t *r, int want)
+{
+	int len;
+	char *buf;
+
+	if (r->eof)
+		return 0;
+
+	if (r->start == r->end)
+		r->start = r->end = 0;
+
+	if (r->end == r->size) {
+		if (r->start > 0) {
+			memmove(r->buf, r->buf + r->start, r->end - r->start);
+			r->end  -= r->start;
+			r->start = 0;
 		}
 
-		else if (c == ':')
-			break;
+		else if (!(r->flags & UIO_READER_ALLOC))
+			return errno = ENOBUFS, -1;
 
-		else
-			return errno = EINVAL, -1;
+		else if (r->size > INT_MAX / 2)
+			return errno = ENOMEM, -1;
+
+		else if (!(buf = realloc(r->buf, r->size * 2)))
+			return -1;
+
+		else {
+			r->buf   = buf;
+			r->size *= 2;
+		}
 	}
 
-	if (ret < 0)
-		return -1;
+	len = r->size - r->end;
+
+	/* bytes read from pipes and sockets cannot be handed back */
+	if ((r->flags & (UIO_READER_SHARED|UIO_READER_SEEK)) == UIO_READER_SHARED
+			&& len > want)
+		len = want;
+
+	while ((len = read(r->fd, r->buf + r->end, len)) == -1)
+		if (errno != EINTR)
+			return -1;
 
 	if (len == 0)
-		return 0;
+		r->eof = 1;
 
-	char *buf = NULL;
-	ret = uio_read(fd, &buf, len);
+	r->end += len;
+	return len;
+}
+
+int uio_reader_peek(uio_reader_t *r, int len, const char **view)
+{
+	while (r->end - r->start < len && !r->eof)
+		if (uio_reader_fill(r, len - (r->end - r->start)) == -1)
+			return -1;
+
+	*view = r->buf + r->start;
+
+	if (r->end - r->start < len)
+		len = r->end - r->start;
+
+	return len;
+}
+
+/* consume len bytes and copy them to dst unless it is NULL */
+static
+int uio_reader_take(uio_reader_t *r, char *dst, int len)
+{
+	int n, done = 0;
+
+	while (done < len) {
+		if (r->start == r->end) {
+			/* large reads bypass the buffer */
+			if (dst && len - done >= r->size && !r->eof) {
+				if ((n = read(r->fd, dst + done, len - done)) == -1) {
+					if (errno == EINTR)
+						continue;
+
+					return -1;
+				}
+
+				if (n == 0)
+					r->eof = 1;
 
-	if (read(fd, &c, 1) == 1) {
-		if (c == ',') {
-			*str = buf;
-			return ret;
+				done += n;
+				continue;
+			}
+
+			if ((n = uio_reader_fill(r, len - done)) == -1)
+				return -1;
+
+			if (n == 0)
+				break;
 		}
 
-		else {
-			if (buf) free(buf);
+		if ((n = r->end - r->start) > len - done)
+			n = len - done;
+
+		if (dst)
+			memcpy(dst + done, r->buf + r->start, n);
+
+		r->start += n;
+		done     += n;
+
+		if (r->eof && r->start == r->end)
+			break;
+	}
+
+	return done;
+}
+
+int uio_reader_skip(uio_reader_t *r, int len)
+{
+	return uio_reader_take(r, NULL, len);
+}
+
+int uio_reader_read_exact(uio_reader_t *r, void *dst, int len)
+{
+	return uio_reader_take(r, dst, len);
+}
+
+/* consume up to and including the first delim1 or delim2, the latter being
+ * ignored if negative */
+static
+int uio_reader_scan(uio_reader_t *r, int delim1, int delim2, const char **view)
+{
+	int len, scanned = 0;
+	char *p, *hit;
+
+	for (;;) {
+		p   = r->buf + r->start + scanned;
+		len = r->end - r->start - scanned;
+		hit = memchr(p, delim1, len);
+
+		if (delim2 >= 0 && (p = memchr(p, delim2, hit ? hit - p : len)))
+			hit = p;
+
+		if (hit) {
+			len = hit - (r->buf + r->start) + 1;
+			break;
+		}
+
+		/* do not search the same bytes again after the next fill */
+		scanned = r->end - r->start;
+
+		if (r->eof) {
+			len = scanned;
+			break;
+		}
+
+		if (uio_reader_fill(r, 1) == -1)
+			return -1;
+	}
+
+	*view = r->buf + r->start;
+	r->start += len;
+	return len;
+}
+
+int uio_reader_read_until(uio_reader_t *r, int delim, const char **view)
+{
+	return uio_reader_scan(r, (unsigned char) delim, -1, view);
+}
+
+int uio_reader_read_line(uio_reader_t *r, const char **line, int *len)
+{
+	int n, l;
+
+	if ((n = l = uio_reader_scan(r, '\n', -1, line)) <= 0) {
+		*len = 0;
+		return n;
+	}
+
+	if ((*line)[l - 1] == '\n')
+		l--;
+
+	if (l > 0 && (*line)[l - 1] == '\r')
+		l--;
+
+	*len = l;
+	return n;
+}
+
+int uio_reader_read_netstring(uio_reader_t *r, const char **str, int *len)
+{
+	const char *p;
+	int n, hdr, total, digit, plen = 0;
+
+	*len = 0;
+
+	/* length prefix of at most 10 digits, terminated by a colon */
+	for (hdr = 0; ; hdr++) {
+		if ((n = uio_reader_peek(r, hdr + 1, &p)) == -1)
+			return -1;
+
+		if (n <= hdr) {
+			if (hdr == 0)
+				return 0;
+
+			r->start = r->end;
 			return errno = EINVAL, -1;
 		}
+
+		if (p[hdr] == ':' && hdr > 0)
+			break;
+
+		digit = p[hdr] - '0';
+
+		if (!char_isdigit(p[hdr]) || hdr == 10) {
+			r->start += hdr + 1;
+			return errno = EINVAL, -1;
+		}
+
+		if (plen > (INT_MAX - 12 - digit) / 10) {
+			r->start += hdr + 1;
+			return errno = ERANGE, -1;
+		}
+
+		plen = plen * 10 + digit;
 	}
 
-	else {
-		if (buf) free(buf);
+	total = hdr + 1 + plen + 1;
+
+	if ((n = uio_reader_peek(r, total, &p)) == -1)
 		return -1;
+
+	if (n < total || p[total - 1] != ',') {
+		r->start += n;
+		return errno = EINVAL, -1;
 	}
+
+	*str = p + hdr + 1;
+	*len = plen;
+
+	r->start += total;
+	return total;
+}
+
+/* the uio_read_* functions may be mixed with plain reads on fd, so they use
+ * a shared reader with a small buffer that is released before returning */
+#define UIO_WRAPPER_SIZE 512
+
+int uio_read(int fd, char **str, int len)
+{
+	uio_reader_t r;
+	char buf[UIO_WRAPPER_SIZE], *dst;
+	int n;
+
+	if (len < 0)
+		return errno = EINVAL, -1;
+
+	if (!(dst = malloc(len + 1)))
+		return -1;
+
+	if (uio_reader_init(&r, fd, buf, sizeof(buf), UIO_READER_SHARED) == -1)
+		goto err;
+
+	n = uio_reader_read_exact(&r, dst, len);
+
+	if (uio_reader_free(&r) == -1 || n == -1)
+		goto err;
+
+	dst[n] = '\0';
+	*str = dst;
+	return n;
+
+err:
+	n = errno;
+	free(dst);
+	errno = n;
+	return -1;
+}
+
+int uio_read_netstring(int fd, char **str)
+{
+	uio_reader_t r;
+	const char *p;
+	char *dst;
+	int n, len, errno_orig;
+
+	if (uio_reader_init(&r, fd, NULL, UIO_WRAPPER_SIZE, UIO_READER_SHARED) == -1)
+		return -1;
+
+	if ((n = uio_reader_read_netstring(&r, &p, &len)) > 0 && len > 0) {
+		if (!(dst = malloc(len + 1)))
+			n = -1;
+
+		else {
+			memcpy(dst, p, len);
+			dst[len] = '\0';
+			*str = dst;
+		}
+	}
+
+	if (uio_reader_free(&r) == -1 && n > 0) {
+		errno_orig = errno;
+
+		if (len > 0)
+			free(*str);
+
+		errno = errno_orig;
+		n = -1;
+	}
+
+	return n == -1 ? -1 : len;
+}
+
+/* maximum length of a netstring header: 20 digits and the colon */
+#define UIO_NETSTRING_HDR 21
+
+/* number of netstrings passed to a single writev(2) */
+#define UIO_NETSTRING_BATCH 128
+
+static
+int uio_netstring_header(char *hdr, size_t len)
+{
+	char digits[UIO_NETSTRING_HDR];
+	int n = 0, i = 0;
+
+	do {
+		digits[n++] = '0' + len % 10;
+	} while (len /= 10);
+
+	while (n > 0)
+		hdr[i++] = digits[--n];
+
+	hdr[i++] = ':';
+	return i;
+}
+
+/* write all of iov, continuing after partial writes */
+static
+ssize_t uio_writev_all(int fd, struct iovec *iov, int n)
+{
+	ssize_t res, total = 0;
+
+	while (n > 0) {
+		if ((res = writev(fd, iov, n)) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		total += res;
+
+		for (; n > 0 && (size_t) res >= iov->iov_len; iov++, n--)
+			res -= iov->iov_len;
+
+		if (n > 0) {
+			iov->iov_base  = (char *) iov->iov_base + res;
+			iov->iov_len  -= res;
+		}
+	}
+
+	return total;
 }
 
 int uio_write_netstring(int fd, char *str)
 {
-	size_t len = str_len(str);
-	char *netstr = NULL;
+	struct iovec iov;
 
-	asprintf(&netstr, "%u:%s,", len, str);
-	return write(fd, netstr, str_len(netstr));
+	iov.iov_base = str;
+	iov.iov_len  = str_len(str);
+
+	return uio_write_netstringv(fd, &iov, 1);
+}
+
+ssize_t uio_write_netstringv(int fd, const struct iovec *iov, int iovcnt)
+{
+	char hdr[UIO_NETSTRING_BATCH][UIO_NETSTRING_HDR];
+	struct iovec out[UIO_NETSTRING_BATCH * 3];
+	ssize_t res, total = 0;
+	int i, n;
+
+	if (iovcnt < 0)
+		return errno = EINVAL, -1;
+
+	while (iovcnt > 0) {
+		for (i = 0, n = 0; i < UIO_NETSTRING_BATCH && i < iovcnt; i++) {
+			out[n].iov_base = hdr[i];
+			out[n].iov_len  = uio_netstring_header(hdr[i], iov[i].iov_len);
+			n++;
+
+			out[n++] = iov[i];
+
+			out[n].iov_base = ",";
+			out[n].iov_len  = 1;
+			n++;
+		}
+
+		if ((res = uio_writev_all(fd, out, n)) == -1)
+			return -1;
+
+		total  += res;
+		iov    += i;
+		iovcnt -= i;
+	}
+
+	return total;
 }
 
 int uio_read_eof(int fd, char **str)
 {
 	static const size_t CHUNKSIZE = 4096;
-	int chunks = 1, len = 0;
-	char *buf = malloc(chunks * CHUNKSIZE + 1);
+	size_t size = CHUNKSIZE, len = 0;
+	struct stat sb;
+	off_t offset;
+	ssize_t n;
+	char *buf, *tmp;
+	int errno_orig;
+
+	if (fstat(fd, &sb) == -1)
+		return -1;
+
+	/* regular files are read into a buffer of their remaining size, with
+	 * room for the terminator and one byte to notice that end of file was
+	 * reached or that the file grew meanwhile */
+	if (S_ISREG(sb.st_mode) && (offset = lseek(fd, 0, SEEK_CUR)) != -1 &&
+			sb.st_size > offset) {
+		if (sb.st_size - offset > INT_MAX - 2)
+			return errno = EFBIG, -1;
+
+		size = sb.st_size - offset + 2;
+	}
+
+	if (!(buf = malloc(size)))
+		return -1;
 
 	for (;;) {
-		int bytes_read = read(fd, buf+len, CHUNKSIZE);
+		/* pipes, sockets and growing files double the buffer */
+		if (len + 1 == size) {
+			if (size > INT_MAX / 2) {
+				errno = EFBIG;
+				goto err;
+			}
 
-		if (bytes_read == -1) {
-			free(buf);
-			return -1;
+			if (!(tmp = realloc(buf, size * 2)))
+				goto err;
+
+			buf   = tmp;
+			size *= 2;
 		}
 
-		len += bytes_read;
-		buf[len] = '\0';
+		if ((n = read(fd, buf + len, size - len - 1)) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			goto err;
+		}
 
-		if (bytes_read == 0)
+		if (n == 0)
 			break;
 
-		if (bytes_read == CHUNKSIZE) {
-			chunks++;
-			buf = realloc(buf, chunks * CHUNKSIZE + 1);
-		}
+		len += n;
 	}
 
+	buf[len] = '\0';
 	*str = buf;
 	return len;
+
+err:
+	errno_orig = errno;
+	free(buf);
+	errno = errno_orig;
+	return -1;
 }
 
-int uio_read_eol(int fd, char **line)
+int uio_read_eofn(int fd, char *buf, int size)
 {
-	static const size_t CHUNKSIZE = 4096;
-	int chunks = 1, len = 0;
-	char *buf = malloc(chunks * CHUNKSIZE + 1);
+	int len = 0;
+	ssize_t n;
 	char c;
 
-	while (1) {
-		switch(read(fd, &c, 1)) {
-		case -1:
-			free(buf);
+	if (size < 0)
+		return errno = EINVAL, -1;
+
+	while (len < size) {
+		if ((n = read(fd, buf + len, size - len)) == -1) {
+			if (errno == EINTR)
+				continue;
+
 			return -1;
+		}
 
-		case 0:
-			goto out;
+		if (n == 0)
+			return len;
 
-		default:
-			if (c == '\n' || c == '\r')
-				goto out;
+		len += n;
+	}
 
-			if (len >= chunks * CHUNKSIZE) {
-				chunks++;
-				buf = realloc(buf, chunks * CHUNKSIZE + 1);
-			}
+	/* the buffer is full, make sure that was all */
+	while ((n = read(fd, &c, 1)) == -1)
+		if (errno != EINTR)
+			return -1;
+
+	if (n > 0)
+		return errno = EFBIG, -1;
+
+	return len;
+}
+
+int uio_map_eof(int fd, const char **view, size_t *len)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	struct stat sb;
+	off_t offset, base;
+	char *map;
 
-			buf[len++] = c;
+	if (fstat(fd, &sb) == -1)
+		return -1;
+
+	if (!S_ISREG(sb.st_mode))
+		return errno = ENODEV, -1;
+
+	if ((offset = lseek(fd, 0, SEEK_CUR)) == -1)
+		return -1;
+
+	if (sb.st_size <= offset) {
+		*view = "";
+		*len  = 0;
+		return 0;
+	}
+
+	if ((uintmax_t) (sb.st_size - offset) > SIZE_MAX - pagesize)
+		return errno = EFBIG, -1;
+
+	/* mappings start at a page boundary */
+	base = offset - offset % pagesize;
+
+	map = mmap(NULL, sb.st_size - base, PROT_READ, MAP_SHARED, fd, base);
+
+	if (map == MAP_FAILED)
+		return -1;
+
+	posix_madvise(map, sb.st_size - base, POSIX_MADV_SEQUENTIAL);
+
+	if (lseek(fd, sb.st_size, SEEK_SET) == -1) {
+		munmap(map, sb.st_size - base);
+		return -1;
+	}
+
+	*view = map + (offset - base);
+	*len  = sb.st_size - offset;
+	return 0;
+}
+
+int uio_unmap_eof(const char *view, size_t len)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	size_t skew = (uintptr_t) view % pagesize;
+
+	if (len == 0)
+		return 0;
+
+	return munmap((char *) view - skew, len + skew);
+}
+
+int uio_read_stream(int fd, uio_stream_t *cb, void *data)
+{
+	static const size_t CHUNKSIZE = 256 * 1024;
+	static const size_t ALIGNMENT = 4096;
+	int errno_orig, regular;
+	struct stat sb;
+	off_t offset = 0;
+	ssize_t len;
+	void *buf;
+
+	if (fstat(fd, &sb) == -1)
+		return -1;
+
+	/* regular files get explicit readahead hints, pipes and sockets
+	 * are simply read until end of file */
+	regular = S_ISREG(sb.st_mode);
+
+	if (regular) {
+		if ((offset = lseek(fd, 0, SEEK_CUR)) == -1)
+			return -1;
+
+		posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	if ((errno = posix_memalign(&buf, ALIGNMENT, CHUNKSIZE)) != 0)
+		return -1;
+
+	for (;;) {
+		len = read(fd, buf, CHUNKSIZE);
+
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+
+			errno_orig = errno;
+			free(buf);
+			errno = errno_orig;
+			return -1;
+		}
+
+		if (len == 0)
 			break;
+
+		/* let the kernel fetch the next chunk while this one is processed */
+		if (regular) {
+			offset += len;
+			posix_fadvise(fd, offset, CHUNKSIZE, POSIX_FADV_WILLNEED);
 		}
+
+		cb(buf, len, data);
 	}
 
-out:
-	*line = buf;
-	return len;
+	free(buf);
+	return 0;
+}
+
+int uio_read_eol(int fd, char **line)
+{
+	uio_reader_t r;
+	const char *p;
+	char *dst;
+	int n;
+
+	if (uio_reader_init(&r, fd, NULL, UIO_WRAPPER_SIZE, UIO_READER_SHARED) == -1)
+		return -1;
+
+	if ((n = uio_reader_scan(&r, '\n', '\r', &p)) > 0 &&
+			(p[n - 1] == '\n' || p[n - 1] == '\r'))
+		n--;
+
+	if (n == -1 || !(dst = malloc(n + 1))) {
+		uio_reader_free(&r);
+		return -1;
+	}
+
+	memcpy(dst, p, n);
+	dst[n] = '\0';
+
+	if (uio_reader_free(&r) == -1) {
+		n = errno;
+		free(dst);
+		errno = n;
+		return -1;
+	}
+
+	*line = dst;
+	return n;
 }
 
 void uio_close(int fd)
@@ -268,17 +845,21 @@ int uio_mkdir(const char *path, mode_t mode)
 
 	strtok_t _st, *st = &_st, *p;
 
-	int curdir = uio_open(".", "r", 0);
+	/* components are resolved relative to a directory descriptor, the
+	 * working directory of the process is left alone */
+	int dirfd = open(path[0] == '/' ? "/" : ".", O_RDONLY|O_DIRECTORY), fd;
 
-	if (curdir == -1)
+	if (dirfd == -1)
 		return -1;
 
-	if (!strtok_init_str(st, path, "/", 0))
+	if (!strtok_init_str(st, path, "/", 0)) {
+		close(dirfd);
 		return -1;
+	}
 
 	strtok_for_each(st, p) {
-		if (mkdir(p->token, 0755) == -1) {
-			if (errno != EEXIST || stat(p->token, &sb) == -1) {
+		if (mkdirat(dirfd, p->token, 0755) == -1) {
+			if (errno != EEXIST || fstatat(dirfd, p->token, &sb, 0) == -1) {
 				ok = 0;
 				break;
 			}
@@ -290,17 +871,19 @@ int uio_mkdir(const char *path, mode_t mode)
 			}
 		}
 
-		if (chdir(p->token) == -1) {
+		if ((fd = openat(dirfd, p->token, O_RDONLY|O_DIRECTORY)) == -1) {
 			ok = 0;
 			break;
 		}
+
+		close(dirfd);
+		dirfd = fd;
 	}
 
-	if (ok && chmod(".", mode) == -1)
+	if (ok && fchmod(dirfd, mode) == -1)
 		ok = 0;
 
-	fchdir(curdir);
-	close(curdir);
+	close(dirfd);
 
 	strtok_free(st);
 	return ok ? 0 : -1;
@@ -397,12 +980,45 @@ int uio_unlink(const char *path)
 	return 0;
 }
 
-static sigjmp_buf __uio_copy_sigjmp_env;
+/* SIGBUS is delivered to the thread that touched the mapping, so each thread
+ * has its own jump target; the handler is installed once for the process */
+static __thread sigjmp_buf *__uio_copy_sigjmp_env;
+static struct sigaction __uio_copy_sigbus_old;
+static pthread_once_t __uio_copy_sigbus_once = PTHREAD_ONCE_INIT;
+
+static
+void __uio_copy_sigbus_handler(int sig, siginfo_t *info, void *ctx)
+{
+	sigjmp_buf *env = __uio_copy_sigjmp_env;
+
+	if (env)
+		siglongjmp(*env, 1);
+
+	/* not raised by uio_copy: pass it on to the previous disposition */
+	if (__uio_copy_sigbus_old.sa_flags & SA_SIGINFO)
+		__uio_copy_sigbus_old.sa_sigaction(sig, info, ctx);
+
+	else if (__uio_copy_sigbus_old.sa_handler != SIG_IGN &&
+			__uio_copy_sigbus_old.sa_handler != SIG_DFL)
+		__uio_copy_sigbus_old.sa_handler(sig);
+
+	else {
+		signal(SIGBUS, SIG_DFL);
+		raise(SIGBUS);
+	}
+}
 
 static
-void __uio_copy_sigbus_handler(int sig)
+void __uio_copy_sigbus_install(void)
 {
-	siglongjmp(__uio_copy_sigjmp_env, 1);
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = __uio_copy_sigbus_handler;
+	sa.sa_flags     = SA_SIGINFO|SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+
+	sigaction(SIGBUS, &sa, &__uio_copy_sigbus_old);
 }
 
 static
@@ -433,40 +1049,36 @@ void __uio_copy_sparse_memcpy(void *dst, const void *src, int len)
 	}
 }
 
-int uio_copy(int srcfd, int dstfd)
+/* copy the data between start and end in user space */
+static
+int __uio_copy_mmap(int srcfd, int dstfd, off_t start, off_t end)
 {
 	static const size_t CHUNKSIZE = 4096 * 1024;
-	int errno_orig;
-	int rc = -1, bufsize = 0;
-	void *srcbuf = MAP_FAILED, *dstbuf = MAP_FAILED;
-
-	/* install SIGBUS handler for mmap */
-	void (*oldhandler)(int) = signal(SIGBUS, __uio_copy_sigbus_handler);
 
-	/* get file length */
-	struct stat sb;
+	/* changed after sigsetjmp() and used after the jump */
+	volatile int rc = -1;
+	volatile size_t bufsize = 0;
+	void *volatile srcbuf = MAP_FAILED, *volatile dstbuf = MAP_FAILED;
+	sigjmp_buf env;
+	off_t offset;
 
-	if (fstat(srcfd, &sb) == -1)
-		goto out;
+	/* catch SIGBUS from a source file truncated while it is mapped */
+	pthread_once(&__uio_copy_sigbus_once, __uio_copy_sigbus_install);
 
-	/* create sparse file */
-	if (ftruncate(dstfd, sb.st_size) == -1)
-		goto out;
-
-	if (sb.st_size < 1) {
-		rc = 0;
+	/* save environment for non-local jump */
+	if (sigsetjmp(env, 1) != 0) {
+		errno = EIO;
 		goto out;
 	}
 
-	/* save environment for non-local jump */
-	if (sigsetjmp(__uio_copy_sigjmp_env, 1) != 0)
-		goto out;
+	__uio_copy_sigjmp_env = &env;
 
-	int offset = 0;
+	/* mappings start at a page boundary, the bytes before start are
+	 * either copied already or part of a hole */
+	offset = start - start % sysconf(_SC_PAGESIZE);
 
-	while (offset < sb.st_size) {
-		bufsize = sb.st_size - offset;
-		bufsize = bufsize > CHUNKSIZE ? CHUNKSIZE : bufsize;
+	while (offset < end) {
+		bufsize = end - offset > CHUNKSIZE ? CHUNKSIZE : end - offset;
 
 		/* map source file */
 		srcbuf = mmap(0, bufsize, PROT_READ, MAP_SHARED, srcfd, offset);
@@ -499,14 +1111,357 @@ int uio_copy(int srcfd, int dstfd)
 	rc = 0;
 
 out:
+	__uio_copy_sigjmp_env = NULL;
+
 	if (srcbuf && srcbuf != MAP_FAILED)
 		munmap(srcbuf, bufsize);
 
 	if (dstbuf && dstbuf != MAP_FAILED)
 		munmap(dstbuf, bufsize);
 
+	return rc;
+}
+
+/* in-kernel copy methods, from fastest to most widely supported */
+enum {
+	UIO_COPY_RANGE,
+	UIO_COPY_SENDFILE,
+	UIO_COPY_MMAP,
+	UIO_COPY_PREAD, /* uio_copy_parallel() only */
+};
+
+/* copy the data between start and end with the first method that works on
+ * these files, method is kept for the following ranges */
+static
+int __uio_copy_range(int srcfd, int dstfd, off_t start, off_t end, int *method)
+{
+	loff_t in, out;
+	ssize_t n;
+
+	while (start < end) {
+		switch (*method) {
+		case UIO_COPY_RANGE:
+			in = out = start;
+			n = copy_file_range(srcfd, &in, dstfd, &out, end - start, 0);
+			break;
+
+		case UIO_COPY_SENDFILE:
+			if (lseek(dstfd, start, SEEK_SET) == -1)
+				return -1;
+
+			in = start;
+			n = sendfile(dstfd, srcfd, &in, end - start);
+			break;
+
+		default:
+			return __uio_copy_mmap(srcfd, dstfd, start, end);
+		}
+
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+
+			/* not supported by the kernel or for these files */
+			if (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+					errno == EOPNOTSUPP) {
+				(*method)++;
+				continue;
+			}
+
+			return -1;
+		}
+
+		/* source was truncated meanwhile */
+		if (n == 0)
+			return errno = EIO, -1;
+
+		start += n;
+	}
+
+	return 0;
+}
+
+int uio_copy(int srcfd, int dstfd)
+{
+	int rc = -1, method = UIO_COPY_RANGE, errno_orig;
+	off_t srcpos, dstpos, data, hole;
+	struct stat sb, db;
+
+	if (fstat(srcfd, &sb) == -1 || fstat(dstfd, &db) == -1)
+		return -1;
+
+	/* the destination is emptied first */
+	if (sb.st_dev == db.st_dev && sb.st_ino == db.st_ino)
+		return errno = EINVAL, -1;
+
+#ifdef FICLONE
+	/* a reflink shares all extents with the source and copies nothing */
+	if (ioctl(dstfd, FICLONE, srcfd) == 0)
+		return ftruncate(dstfd, sb.st_size);
+#endif
+
+	/* SEEK_DATA and SEEK_HOLE move the offset of srcfd, sendfile(2) the
+	 * one of dstfd */
+	if ((srcpos = lseek(srcfd, 0, SEEK_CUR)) == -1 ||
+			(dstpos = lseek(dstfd, 0, SEEK_CUR)) == -1)
+		return -1;
+
+	/* create sparse file, holes of the source are never written */
+	if (ftruncate(dstfd, 0) == -1 || ftruncate(dstfd, sb.st_size) == -1)
+		goto out;
+
+	for (data = 0; data < sb.st_size; data = hole) {
+		if ((data = lseek(srcfd, data, SEEK_DATA)) == -1) {
+			/* only a hole remains */
+			if (errno == ENXIO)
+				break;
+
+			goto out;
+		}
+
+		if ((hole = lseek(srcfd, data, SEEK_HOLE)) == -1)
+			goto out;
+
+		if (hole > sb.st_size)
+			hole = sb.st_size;
+
+		if (__uio_copy_range(srcfd, dstfd, data, hole, &method) == -1)
+			goto out;
+	}
+
+	rc = 0;
+
+out:
 	errno_orig = errno;
-	signal(SIGBUS, oldhandler);
+	lseek(srcfd, srcpos, SEEK_SET);
+	lseek(dstfd, dstpos, SEEK_SET);
 	errno = errno_orig;
+
 	return rc;
 }
+
+/* state shared by the workers of uio_copy_parallel() */
+struct uio_copy_job {
+	int srcfd;
+	int dstfd;
+	off_t size;
+	off_t chunk;
+	off_t next;  /* start of the next range to hand out */
+	off_t done;  /* bytes handled so far, protected by lock */
+	int error;   /* errno of the first failed range, 0 if none */
+	const uio_copy_options_t *opts;
+	pthread_mutex_t lock;
+};
+
+/* size of the pread(2) and pwrite(2) buffer of each worker */
+#define UIO_COPY_BUFSIZE (1024 * 1024)
+
+static
+ssize_t __uio_copy_pread(int srcfd, int dstfd, off_t offset, size_t len, char *buf)
+{
+	ssize_t n, w, res;
+
+	if ((n = pread(srcfd, buf, len, offset)) <= 0)
+		return n;
+
+	for (w = 0; w < n; w += res)
+		while ((res = pwrite(dstfd, buf + w, n - w, offset + w)) == -1)
+			if (errno != EINTR)
+				return -1;
+
+	return n;
+}
+
+/* copy the data between start and end with positional I/O only, so the
+ * workers do not interfere with each other */
+static
+int __uio_copy_parallel_range(struct uio_copy_job *job, off_t start, off_t end,
+		char **buf, int *method)
+{
+	off_t in, out, data, hole;
+	ssize_t n;
+
+	/* the offset moved by SEEK_DATA is not used, so workers may share it */
+	for (data = start; data < end; data = hole) {
+		if ((data = lseek(job->srcfd, data, SEEK_DATA)) == -1) {
+			if (errno == ENXIO)
+				break;
+
+			return -1;
+		}
+
+		if (data >= end)
+			break;
+
+		if ((hole = lseek(job->srcfd, data, SEEK_HOLE)) == -1)
+			return -1;
+
+		if (hole > end)
+			hole = end;
+
+		while (data < hole) {
+			if (*method == UIO_COPY_RANGE) {
+				in = out = data;
+				n = copy_file_range(job->srcfd, &in, job->dstfd, &out,
+						hole - data, 0);
+			}
+
+			else {
+				if (!*buf && !(*buf = malloc(UIO_COPY_BUFSIZE)))
+					return -1;
+
+				n = __uio_copy_pread(job->srcfd, job->dstfd, data,
+						hole - data > UIO_COPY_BUFSIZE ?
+						UIO_COPY_BUFSIZE : hole - data, *buf);
+			}
+
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+
+				if (*method == UIO_COPY_RANGE && (errno == ENOSYS ||
+						errno == EXDEV || errno == EINVAL ||
+						errno == EOPNOTSUPP)) {
+					*method = UIO_COPY_PREAD;
+					continue;
+				}
+
+				return -1;
+			}
+
+			/* source was truncated meanwhile */
+			if (n == 0)
+				return errno = EIO, -1;
+
+			data += n;
+		}
+	}
+
+	return 0;
+}
+
+static
+void *__uio_copy_parallel_worker(void *arg)
+{
+	struct uio_copy_job *job = arg;
+	int method = UIO_COPY_RANGE, error = 0;
+	off_t start, end;
+	char *buf = NULL;
+
+	while (!__atomic_load_n(&job->error, __ATOMIC_RELAXED)) {
+		start = __atomic_fetch_add(&job->next, job->chunk, __ATOMIC_RELAXED);
+
+		if (start >= job->size)
+			break;
+
+		end = job->size - start > job->chunk ? start + job->chunk : job->size;
+
+		if (__uio_copy_parallel_range(job, start, end, &buf, &method) == -1) {
+			/* keep the first error, the other workers stop */
+			__atomic_compare_exchange_n(&job->error, &error, errno, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			break;
+		}
+
+		/* counted under the lock so progress never goes backwards */
+		if (job->opts->progress) {
+			pthread_mutex_lock(&job->lock);
+			job->done += end - start;
+			job->opts->progress(job->done, job->size, job->opts->data);
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+int uio_copy_parallel(int srcfd, int dstfd, const uio_copy_options_t *opts)
+{
+	static const uio_copy_options_t defaults = { 0, 0, NULL, NULL };
+
+	long pagesize = sysconf(_SC_PAGESIZE);
+	struct uio_copy_job job;
+	struct stat sb, db;
+	pthread_t *tids;
+	off_t srcpos, chunks;
+	int i, n, threads;
+
+	if (!opts)
+		opts = &defaults;
+
+	if (opts->threads < 0 || opts->chunk < 0)
+		return errno = EINVAL, -1;
+
+	if (fstat(srcfd, &sb) == -1 || fstat(dstfd, &db) == -1)
+		return -1;
+
+	if (sb.st_dev == db.st_dev && sb.st_ino == db.st_ino)
+		return errno = EINVAL, -1;
+
+#ifdef FICLONE
+	if (ioctl(dstfd, FICLONE, srcfd) == 0) {
+		if (ftruncate(dstfd, sb.st_size) == -1)
+			return -1;
+
+		if (opts->progress)
+			opts->progress(sb.st_size, sb.st_size, opts->data);
+
+		return 0;
+	}
+#endif
+
+	if ((srcpos = lseek(srcfd, 0, SEEK_CUR)) == -1)
+		return -1;
+
+	if (ftruncate(dstfd, 0) == -1 || ftruncate(dstfd, sb.st_size) == -1)
+		return -1;
+
+	job.srcfd = srcfd;
+	job.dstfd = dstfd;
+	job.size  = sb.st_size;
+	job.chunk = opts->chunk ? opts->chunk : UIO_COPY_CHUNK;
+	job.next  = 0;
+	job.done  = 0;
+	job.error = 0;
+	job.opts  = opts;
+
+	/* ranges of whole pages keep workers off each other's pages */
+	job.chunk = (job.chunk + pagesize - 1) / pagesize * pagesize;
+
+	if ((threads = opts->threads) == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	chunks = (job.size + job.chunk - 1) / job.chunk;
+
+	if (threads > chunks)
+		threads = chunks;
+
+	if (threads < 1)
+		threads = 1;
+
+	if (!(tids = malloc((threads - 1) * sizeof(pthread_t) + 1)))
+		return -1;
+
+	pthread_mutex_init(&job.lock, NULL);
+
+	/* the calling thread is a worker too, fewer threads are fine */
+	for (n = 0; n < threads - 1; n++)
+		if (pthread_create(&tids[n], NULL, __uio_copy_parallel_worker, &job))
+			break;
+
+	__uio_copy_parallel_worker(&job);
+
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_mutex_destroy(&job.lock);
+	free(tids);
+
+	lseek(srcfd, srcpos, SEEK_SET);
+
+	if (job.error)
+		return errno = job.error, -1;
+
+	return 0;
+}
@@ -18,6 +18,8 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
 
+#include <string.h>
+
 #include "whirlpool.h"
 
 void whirlpool_add(whirlpool_t * const context,
@@ -47,6 +49,39 @@ void whirlpool_add(whirlpool_t * const context,
 		value >>= 8;
 	}
 
+	/* byte-aligned input on a byte-aligned buffer can be copied as is */
+	if (rem == 0 && gap == 0) {
+		unsigned long n = srcbits >> 3;
+		int chunk;
+
+		while (n > 0) {
+			chunk = WBLOCKBYTES - pos;
+
+			if (n < chunk)
+				chunk = n;
+
+			memcpy(&buf[pos], &src[srcpos], chunk);
+
+			pos    += chunk;
+			srcpos += chunk;
+			n      -= chunk;
+
+			if (pos == WBLOCKBYTES) {
+				/* process data block */
+				whirlpool_transform(context);
+
+				/* reset buf */
+				pos = 0;
+			}
+		}
+
+		buf[pos] = 0;
+
+		context->bits = pos * 8;
+		context->pos  = pos;
+		return;
+	}
+
 	/* process data in chunks of 8 bits */
 	while (srcbits > 8) {
 		/* take a byte from the source */
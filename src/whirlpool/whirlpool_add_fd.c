@@ -0,0 +1,33 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// The Whirlpool algorithm was developed by
+//                Paulo S. L. M. Barreto <pbarreto@scopus.com.br> and
+//                Vincent Rijmen <vincent.rijmen@cryptomathic.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+#include "uio.h"
+#include "whirlpool.h"
+
+static
+void __whirlpool_add_chunk(const void *buf, size_t len, void *data)
+{
+	whirlpool_add(data, buf, (unsigned long) len * 8);
+}
+
+int whirlpool_add_fd(whirlpool_t * const context, int fd)
+{
+	return uio_read_stream(fd, __whirlpool_add_chunk, context);
+}
@@ -18,31 +18,17 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
 
-#include "cext.h"
 #include "str.h"
-#include "stralloc.h"
 #include "whirlpool.h"
 
 char *whirlpool_digest(const char *str)
 {
 	whirlpool_t ctx;
-	stralloc_t sa;
-	char *buf;
 	uint8_t digest[DIGESTBYTES];
-	int i;
 
 	whirlpool_init(&ctx);
 	whirlpool_add(&ctx, (const unsigned char * const) str, str_len(str)*8);
 	whirlpool_finalize(&ctx, digest);
 
-	stralloc_init(&sa);
-
-	for (i = 0; i < DIGESTBYTES; i++)
-		stralloc_catf(&sa, "%02X", digest[i]);
-
-	buf = stralloc_finalize(&sa);
-
-	stralloc_free(&sa);
-
-	return buf;
+	return whirlpool_hex(digest);
 }
@@ -0,0 +1,38 @@
+// Copyright (C) 2006-2007 Benedikt Böhm <hollow@gentoo.org>
+//
+// The Whirlpool algorithm was developed by
+//                Paulo S. L. M. Barreto <pbarreto@scopus.com.br> and
+//                Vincent Rijmen <vincent.rijmen@cryptomathic.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+
+#include <stdlib.h>
+
+#include "whirlpool.h"
+
+char *whirlpool_digest_fd(int fd)
+{
+	whirlpool_t ctx;
+	uint8_t digest[DIGESTBYTES];
+
+	whirlpool_init(&ctx);
+
+	if (whirlpool_add_fd(&ctx, fd) == -1)
+		return NULL;
+
+	whirlpool_finalize(&ctx, digest);
+
+	return whirlpool_hex(digest);
+}
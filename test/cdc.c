@@ -0,0 +1,356 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "cdc.h"
+#include "log.h"
+
+#define CDC_TEST_LEN (4 * 1024 * 1024)
+
+typedef struct {
+	cdc_chunk_t chunks[4096];
+	int n;
+	int stop;
+} cdc_list_t;
+
+static
+int cdc_collect(const cdc_chunk_t *chunk, void *data)
+{
+	cdc_list_t *list = data;
+
+	if (list->n == list->stop || list->n == 4096)
+		return 42;
+
+	list->chunks[list->n] = *chunk;
+	list->chunks[list->n].data = NULL;
+	list->n++;
+
+	return 0;
+}
+
+static
+unsigned char *cdc_random(size_t len, uint64_t seed)
+{
+	unsigned char *buf = malloc(len);
+	size_t i;
+
+	if (!buf)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		buf[i] = seed >> 24;
+	}
+
+	return buf;
+}
+
+static
+int cdc_list_cmp(const cdc_list_t *a, const cdc_list_t *b)
+{
+	int i;
+
+	if (a->n != b->n)
+		return 1;
+
+	for (i = 0; i < a->n; i++)
+		if (a->chunks[i].offset != b->chunks[i].offset ||
+				a->chunks[i].len != b->chunks[i].len ||
+				memcmp(a->chunks[i].digest, b->chunks[i].digest,
+				       DIGEST_MAXBYTES))
+			return 1;
+
+	return 0;
+}
+
+static
+int cdc_init_t(void)
+{
+	int i, res, rc = 0;
+	cdc_t cdc;
+
+	struct test {
+		size_t min, avg, max;
+		int res;
+	} T[] = {
+		{ 2048,  8192,  65536,  0 },
+		{ 64,    128,   256,    0 },
+		{ 32,    128,   256,   -1 },
+		{ 8192,  8192,  65536, -1 },
+		{ 2048,  65536, 65536, -1 },
+		{ 2048,  8192,  CDC_MAX_SIZE + 1, -1 },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		res = cdc_init(&cdc, T[i].min, T[i].avg, T[i].max);
+
+		if (res != T[i].res || (res == -1 && errno != EINVAL))
+			rc += log_error("[%s/%02d] E[%d] R[%d]",
+			                __FUNCTION__, i, T[i].res, res);
+	}
+
+	return rc;
+}
+
+static
+int cdc_buf_t(const unsigned char *buf, cdc_list_t *list)
+{
+	int i, rc = 0;
+	uint64_t offset = 0;
+	cdc_t cdc;
+	digest_ctx_t ctx;
+	unsigned char digest[DIGEST_MAXBYTES];
+
+	cdc_init(&cdc, 2048, 8192, 65536);
+	cdc.digest = &digest_sha256;
+
+	list->n = 0;
+	list->stop = -1;
+
+	if (cdc_buf(&cdc, buf, CDC_TEST_LEN, cdc_collect, list) != 0)
+		return log_error("[%s] E[0] R[-1]", __FUNCTION__);
+
+	/* chunks must be contiguous, within bounds and correctly hashed */
+	for (i = 0; i < list->n; i++) {
+		cdc_chunk_t *c = &list->chunks[i];
+
+		memset(digest, 0, sizeof(digest));
+		digest_init(&ctx, cdc.digest);
+		digest_update(&ctx, buf + c->offset, c->len);
+		digest_final(&ctx, digest);
+
+		if (c->offset != offset || c->len > cdc.max ||
+				(c->len < cdc.min && i != list->n - 1) ||
+				memcmp(digest, c->digest, DIGEST_MAXBYTES))
+			rc += log_error("[%s/%02d] E[%llu] R[%llu+%lu]", __FUNCTION__, i,
+			                (unsigned long long) offset,
+			                (unsigned long long) c->offset,
+			                (unsigned long) c->len);
+
+		offset += c->len;
+	}
+
+	if (offset != CDC_TEST_LEN)
+		rc += log_error("[%s] E[%d] R[%llu]", __FUNCTION__,
+		                CDC_TEST_LEN, (unsigned long long) offset);
+
+	/* the average should roughly match the requested one */
+	if (list->n < CDC_TEST_LEN / 16384 || list->n > CDC_TEST_LEN / 4096)
+		rc += log_error("[%s] E[~%d] R[%d]", __FUNCTION__,
+		                CDC_TEST_LEN / 8192, list->n);
+
+	return rc;
+}
+
+static
+int cdc_shift_t(const unsigned char *buf, const cdc_list_t *orig)
+{
+	int i, j, shared = 0, rc = 0;
+	unsigned char *shifted;
+	cdc_list_t *list;
+	cdc_t cdc;
+
+	if (!(shifted = malloc(CDC_TEST_LEN + 100)) ||
+			!(list = calloc(1, sizeof(*list)))) {
+		free(shifted);
+		return log_perror("[%s] malloc", __FUNCTION__);
+	}
+
+	/* insert 100 bytes at the front; only the first chunk may change */
+	memset(shifted, 0xaa, 100);
+	memcpy(shifted + 100, buf, CDC_TEST_LEN);
+
+	cdc_init(&cdc, 2048, 8192, 65536);
+	cdc.digest = &digest_sha256;
+	list->stop = -1;
+
+	cdc_buf(&cdc, shifted, CDC_TEST_LEN + 100, cdc_collect, list);
+
+	for (i = 0, j = 0; i < list->n && j < orig->n; ) {
+		if (list->chunks[i].offset < orig->chunks[j].offset + 100)
+			i++;
+		else if (list->chunks[i].offset > orig->chunks[j].offset + 100)
+			j++;
+		else {
+			if (!memcmp(list->chunks[i].digest, orig->chunks[j].digest,
+					DIGEST_MAXBYTES))
+				shared++;
+			i++, j++;
+		}
+	}
+
+	if (shared < orig->n - 2)
+		rc += log_error("[%s] E[%d] R[%d]", __FUNCTION__, orig->n - 2, shared);
+
+	free(list);
+	free(shifted);
+
+	return rc;
+}
+
+static
+int cdc_threads_t(const unsigned char *buf, const cdc_list_t *orig)
+{
+	int i, res, rc = 0;
+	cdc_list_t *list;
+	cdc_t cdc;
+
+	int T[] = { 1, 4, 16 };
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	if (!(list = calloc(1, sizeof(*list))))
+		return log_perror("[%s] calloc", __FUNCTION__);
+
+	cdc_init(&cdc, 2048, 8192, 65536);
+	cdc.digest = &digest_sha256;
+
+	for (i = 0; i < TS; i++) {
+		cdc.threads = T[i];
+		list->n = 0;
+		list->stop = -1;
+
+		res = cdc_buf(&cdc, buf, CDC_TEST_LEN, cdc_collect, list);
+
+		if (res != 0 || cdc_list_cmp(orig, list))
+			rc += log_error("[%s/%02d] E[%d] R[%d]",
+			                __FUNCTION__, i, orig->n, list->n);
+
+		/* stopping must return the callback's value and leave no
+		 * chunks behind */
+		list->n = 0;
+		list->stop = 10;
+
+		res = cdc_buf(&cdc, buf, CDC_TEST_LEN, cdc_collect, list);
+
+		if (res != 42 || list->n != 10)
+			rc += log_error("[%s/%02d] E[42/10] R[%d/%d]",
+			                __FUNCTION__, i, res, list->n);
+	}
+
+	free(list);
+
+	return rc;
+}
+
+static
+int cdc_fd_t(const unsigned char *buf, const cdc_list_t *orig)
+{
+	int i, fd, res, pfd[2], status, rc = 0;
+	char path[] = "/tmp/cdctest-XXXXXX";
+	cdc_list_t *list;
+	pid_t pid;
+	cdc_t cdc;
+
+	if (!(list = calloc(1, sizeof(*list))))
+		return log_perror("[%s] calloc", __FUNCTION__);
+
+	if ((fd = mkstemp(path)) == -1) {
+		free(list);
+		return log_perror("[%s] mkstemp(%s)", __FUNCTION__, path);
+	}
+
+	unlink(path);
+
+	if (write(fd, buf, CDC_TEST_LEN) != CDC_TEST_LEN) {
+		close(fd);
+		free(list);
+		return log_perror("[%s] write", __FUNCTION__);
+	}
+
+	cdc_init(&cdc, 2048, 8192, 65536);
+	cdc.digest = &digest_sha256;
+
+	for (i = 0; i < 4; i++) {
+		cdc.threads = i % 2 ? 4 : 0;
+		list->n = 0;
+		list->stop = -1;
+
+		/* regular files are mapped, pipes are read */
+		if (i < 2) {
+			lseek(fd, 0, SEEK_SET);
+			res = cdc_fd(&cdc, fd, cdc_collect, list);
+		}
+
+		else {
+			if (pipe(pfd) == -1 || (pid = fork()) == -1) {
+				rc += log_perror("[%s/%02d] pipe/fork", __FUNCTION__, i);
+				continue;
+			}
+
+			if (pid == 0) {
+				close(pfd[0]);
+				_exit(write(pfd[1], buf, CDC_TEST_LEN) != CDC_TEST_LEN);
+			}
+
+			close(pfd[1]);
+			res = cdc_fd(&cdc, pfd[0], cdc_collect, list);
+			close(pfd[0]);
+			waitpid(pid, &status, 0);
+		}
+
+		if (res != 0 || cdc_list_cmp(orig, list))
+			rc += log_error("[%s/%02d] E[%d] R[%d]",
+			                __FUNCTION__, i, orig->n, list->n);
+	}
+
+	close(fd);
+	free(list);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+	unsigned char *buf;
+	cdc_list_t *list;
+
+	log_options_t log_options = {
+		.log_ident  = "cdc",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	if (!(buf = cdc_random(CDC_TEST_LEN, 0x2545f4914f6cdd1d)) ||
+			!(list = calloc(1, sizeof(*list))))
+		return log_perror("malloc");
+
+	rc += cdc_init_t();
+	rc += cdc_buf_t(buf, list);
+	rc += cdc_shift_t(buf, list);
+	rc += cdc_threads_t(buf, list);
+	rc += cdc_fd_t(buf, list);
+
+	free(list);
+	free(buf);
+
+	log_close();
+
+	return rc;
+}
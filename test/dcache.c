@@ -0,0 +1,269 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "dcache.h"
+#include "log.h"
+#include "whirlpool.h"
+
+static
+void dcache_fake_stat(struct stat *sb, int ino, int mtime)
+{
+	memset(sb, 0, sizeof(*sb));
+
+	sb->st_mode = S_IFREG|0644;
+	sb->st_dev  = 42;
+	sb->st_ino  = ino;
+	sb->st_size = ino * 100;
+	sb->st_mtim.tv_sec = mtime;
+	sb->st_ctim.tv_sec = mtime;
+}
+
+static
+int dcache_lookup_t(const char *path)
+{
+	int i, res, rc = 0;
+	dcache_t dc;
+	struct stat sb;
+	unsigned char digest[DIGESTBYTES], result[DIGESTBYTES];
+
+	struct test {
+		int ino;
+		int mtime;
+		int res;
+	} T[] = {
+		{ 1, 1000, 1 },
+		{ 1, 1001, 0 },
+		{ 2, 1000, 1 },
+		{ 3, 1000, 0 },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	if (dcache_open(&dc, path, 16) == -1)
+		return log_perror("[%s] dcache_open(%s)", __FUNCTION__, path);
+
+	for (i = 1; i <= 2; i++) {
+		dcache_fake_stat(&sb, i, 1000);
+		memset(digest, i, DIGESTBYTES);
+
+		if (dcache_store(&dc, &sb, digest) != 1)
+			rc += log_error("[%s] dcache_store(%d)", __FUNCTION__, i);
+	}
+
+	dcache_close(&dc);
+
+	/* entries must survive reopening the cache */
+	if (dcache_open(&dc, path, 0) == -1)
+		return log_perror("[%s] dcache_open(%s)", __FUNCTION__, path);
+
+	for (i = 0; i < TS; i++) {
+		dcache_fake_stat(&sb, T[i].ino, T[i].mtime);
+		memset(digest, T[i].ino, DIGESTBYTES);
+
+		res = dcache_lookup(&dc, &sb, result);
+
+		if (res != T[i].res || (res && memcmp(digest, result, DIGESTBYTES)))
+			rc += log_error("[%s/%02d] E[%d] R[%d]",
+			                __FUNCTION__, i, T[i].res, res);
+	}
+
+	/* overfill the table; the most recent store must always be found */
+	for (i = 100; i < 200; i++) {
+		dcache_fake_stat(&sb, i, 1000);
+		memset(digest, i, DIGESTBYTES);
+
+		dcache_store(&dc, &sb, digest);
+
+		if (dcache_lookup(&dc, &sb, result) != 1 ||
+				memcmp(digest, result, DIGESTBYTES))
+			rc += log_error("[%s/%02d] E[1] R[0]", __FUNCTION__, i);
+	}
+
+	dcache_close(&dc);
+
+	return rc;
+}
+
+static
+int dcache_digest_path_t(const char *path, const char *file)
+{
+	int i, rc = 0;
+	dcache_t dc;
+	char *expected, *digest;
+
+	if (dcache_open(&dc, path, 16) == -1)
+		return log_perror("[%s] dcache_open(%s)", __FUNCTION__, path);
+
+	expected = whirlpool_digest_path(file);
+
+	for (i = 0; i < 2; i++) {
+		digest = dcache_digest_path(&dc, file);
+
+		if (!expected || !digest || strcmp(expected, digest))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, expected, digest);
+
+		free(digest);
+	}
+
+	free(expected);
+	dcache_close(&dc);
+
+	return rc;
+}
+
+/* concurrent creators with different sizes must agree on one header */
+/* the sequence counter is the first member of every slot */
+static
+uint32_t *dcache_slot_seq(dcache_t *dc, uint32_t i)
+{
+	size_t stride = (dc->maplen - ((char *) dc->slots - (char *) dc->map)) /
+	                (dc->mask + 1);
+
+	return (uint32_t *) ((char *) dc->slots + i * stride);
+}
+
+static
+int dcache_repair_t(const char *path)
+{
+	int i, odd, res, rc = 0;
+	uint32_t j;
+	dcache_t dc, writer;
+	struct stat sb;
+	unsigned char digest[DIGESTBYTES], result[DIGESTBYTES];
+
+	dcache_fake_stat(&sb, 1, 1000);
+	memset(digest, 1, DIGESTBYTES);
+
+	if (dcache_open(&writer, path, 16) == -1)
+		return log_perror("[%s] dcache_open(%s)", __FUNCTION__, path);
+
+	if (dcache_store(&writer, &sb, digest) != 1)
+		rc += log_error("[%s] dcache_store(1)", __FUNCTION__);
+
+	/* pretend the store died between claiming and publishing its slot */
+	for (j = 0; j <= writer.mask; j++)
+		if (*dcache_slot_seq(&writer, j))
+			*dcache_slot_seq(&writer, j) |= 1;
+
+	/* the slot must be left alone while another writer is open, and be
+	 * reset and its entry dropped once we are the only one */
+	for (i = 0; i < 2; i++) {
+		if (i == 1)
+			dcache_close(&writer);
+
+		if (dcache_open(&dc, path, 0) == -1)
+			return log_perror("[%s] dcache_open(%s)", __FUNCTION__, path);
+
+		for (odd = 0, j = 0; j <= dc.mask; j++)
+			odd += *dcache_slot_seq(&dc, j) & 1;
+
+		res = dcache_lookup(&dc, &sb, result);
+
+		if (odd != 1 - i || res != 0)
+			rc += log_error("[%s/%02d] E[%d,0] R[%d,%d]",
+			                __FUNCTION__, i, 1 - i, odd, res);
+
+		dcache_close(&dc);
+	}
+
+	return rc;
+}
+
+static
+int dcache_create_t(const char *path)
+{
+	int i, j, status, bits, rc = 0;
+	pid_t pids[8];
+	dcache_t dc;
+
+	for (i = 0; i < 20; i++) {
+		unlink(path);
+
+		for (j = 0; j < 8; j++) {
+			if ((pids[j] = fork()) == 0) {
+				if (dcache_open(&dc, path, 16 << j) == -1)
+					_exit(255);
+
+				/* report log2(nslots) */
+				for (bits = 0; dc.mask >> bits; bits++);
+
+				dcache_close(&dc);
+				_exit(bits);
+			}
+		}
+
+		for (bits = -1, j = 0; j < 8; j++) {
+			waitpid(pids[j], &status, 0);
+
+			if (!WIFEXITED(status) || WEXITSTATUS(status) == 255 ||
+					(bits != -1 && WEXITSTATUS(status) != bits))
+				rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+				                bits, WEXITSTATUS(status));
+
+			bits = WEXITSTATUS(status);
+		}
+	}
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+	char path[] = "/tmp/dcachetest-XXXXXX";
+
+	log_options_t log_options = {
+		.log_ident  = "dcache",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	if (!mkdtemp(path))
+		return log_perror("mkdtemp(%s)", path);
+
+	char cache[sizeof(path) + 8];
+	strcpy(cache, path);
+	strcat(cache, "/cache");
+
+	rc += dcache_lookup_t(cache);
+	unlink(cache);
+
+	rc += dcache_digest_path_t(cache, argv[0]);
+	unlink(cache);
+
+	rc += dcache_repair_t(cache);
+	unlink(cache);
+
+	rc += dcache_create_t(cache);
+	unlink(cache);
+
+	rmdir(path);
+
+	log_close();
+
+	return rc;
+}
@@ -0,0 +1,271 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "delta.h"
+#include "log.h"
+
+#define DELTA_TEST_LEN (1024 * 1024)
+
+static
+int delta_tmpfile(const void *buf, size_t len)
+{
+	char path[] = "/tmp/deltatest-XXXXXX";
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1)
+		return -1;
+
+	unlink(path);
+
+	if (len > 0 && write(fd, buf, len) != (ssize_t) len) {
+		close(fd);
+		return -1;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+/* compare the contents of fd with buf */
+static
+int delta_check(int fd, const unsigned char *buf, size_t len)
+{
+	struct stat sb;
+	unsigned char *tmp;
+	int rc;
+
+	if (fstat(fd, &sb) == -1 || (size_t) sb.st_size != len)
+		return 1;
+
+	if (!(tmp = malloc(len + 1)))
+		return 1;
+
+	rc = pread(fd, tmp, len, 0) != (ssize_t) len || memcmp(tmp, buf, len);
+
+	free(tmp);
+	return rc;
+}
+
+static
+void delta_random(unsigned char *buf, size_t len, uint64_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		buf[i] = seed >> 24;
+	}
+}
+
+/* build the new version of old according to test case i */
+static
+size_t delta_modify(int i, const unsigned char *old, size_t oldlen,
+		unsigned char *new)
+{
+	size_t len = oldlen;
+
+	memcpy(new, old, oldlen);
+
+	switch (i) {
+	case 0: /* unchanged */
+		break;
+
+	case 1: /* a few bytes changed */
+		new[1000]++;
+		new[300000] = ~new[300000];
+		break;
+
+	case 2: /* insertion */
+		memmove(new + 100001, new + 100000, len - 100000);
+		new[100000] = 42;
+		len++;
+		break;
+
+	case 3: /* deletion */
+		memmove(new + 500000, new + 500777, len - 500777);
+		len -= 777;
+		break;
+
+	case 4: /* blocks moved around */
+		memcpy(new, old + 200000, 100000);
+		memcpy(new + 200000, old, 100000);
+		break;
+
+	case 5: /* appended and truncated */
+		delta_random(new + len, 5000, 7);
+		len += 5000;
+		break;
+
+	case 6:
+		len = 123457;
+		break;
+
+	case 7: /* completely different */
+		delta_random(new, len, 99);
+		break;
+
+	case 8: /* empty */
+		len = 0;
+		break;
+	}
+
+	return len;
+}
+
+static
+int delta_patch_t(int inplace)
+{
+	int i, oldfd, newfd, deltafd, outfd, rc = 0;
+	size_t oldlen = DELTA_TEST_LEN, newlen;
+	unsigned char *old, *new;
+	delta_sig_t sig;
+	struct stat sb;
+
+	/* maximum delta size per test case; in-place deltas cannot copy from
+	 * regions already overwritten, so data shifted backwards is inserted */
+	off_t T[2][9] = {
+		{ 64, 3000, 3000, 3000, 6000, 6000, 1000, DELTA_TEST_LEN + 100, 64 },
+		{ 64, 3000, DELTA_TEST_LEN, 3000, 110000, 6000, 1000, DELTA_TEST_LEN + 100, 64 },
+	};
+
+	int TS = sizeof(T[0]) / sizeof(T[0][0]);
+
+	old = malloc(DELTA_TEST_LEN + 8192);
+	new = malloc(DELTA_TEST_LEN + 8192);
+
+	if (!old || !new) {
+		free(old);
+		free(new);
+		return log_perror("[%s] malloc", __FUNCTION__);
+	}
+
+	delta_random(old, oldlen, 0x2545f4914f6cdd1d);
+
+	/* make the last block short */
+	oldlen -= 100;
+
+	for (i = 0; i < TS; i++) {
+		newlen = delta_modify(i, old, oldlen, new);
+
+		oldfd   = delta_tmpfile(old, oldlen);
+		newfd   = delta_tmpfile(new, newlen);
+		deltafd = delta_tmpfile(NULL, 0);
+		outfd   = delta_tmpfile(NULL, 0);
+
+		if (delta_sig_fd(&sig, oldfd, 1024, i % 2 ? &digest_sha256 : NULL) == -1 ||
+				delta_fd(&sig, newfd, deltafd, inplace ? DELTA_INPLACE : 0) == -1) {
+			rc += log_perror("[%s/%02d] delta_fd", __FUNCTION__, i);
+			goto next;
+		}
+
+		fstat(deltafd, &sb);
+
+		if (sb.st_size > T[inplace][i])
+			rc += log_error("[%s/%02d] E[<=%d] R[%d]", __FUNCTION__, i,
+			                (int) T[inplace][i], (int) sb.st_size);
+
+		lseek(deltafd, 0, SEEK_SET);
+
+		if (inplace) {
+			if (delta_patch_inplace(oldfd, deltafd) == -1 ||
+					delta_check(oldfd, new, newlen))
+				rc += log_error("[%s/%02d] E[0] R[%d]",
+				                __FUNCTION__, i, errno);
+		}
+
+		else {
+			if (delta_patch(oldfd, deltafd, outfd) == -1 ||
+					delta_check(outfd, new, newlen))
+				rc += log_error("[%s/%02d] E[0] R[%d]",
+				                __FUNCTION__, i, errno);
+		}
+
+next:
+		delta_sig_free(&sig);
+		close(oldfd);
+		close(newfd);
+		close(deltafd);
+		close(outfd);
+	}
+
+	free(old);
+	free(new);
+
+	return rc;
+}
+
+static
+int delta_invalid_t(void)
+{
+	int fd, deltafd, rc = 0;
+	unsigned char buf[4096];
+	delta_sig_t sig;
+
+	memset(buf, 'x', sizeof(buf));
+
+	fd      = delta_tmpfile(buf, sizeof(buf));
+	deltafd = delta_tmpfile(NULL, 0);
+
+	/* in-place patching requires an in-place delta */
+	delta_sig_fd(&sig, fd, 0, NULL);
+	delta_fd(&sig, fd, deltafd, 0);
+	lseek(deltafd, 0, SEEK_SET);
+
+	if (delta_patch_inplace(fd, deltafd) != -1 || errno != EINVAL)
+		rc += log_error("[%s/%02d] E[EINVAL] R[%d]", __FUNCTION__, 0, errno);
+
+	/* truncated delta */
+	if (ftruncate(deltafd, 20) == -1 || lseek(deltafd, 0, SEEK_SET) == -1 ||
+			delta_patch(fd, deltafd, deltafd) != -1 || errno != EINVAL)
+		rc += log_error("[%s/%02d] E[EINVAL] R[%d]", __FUNCTION__, 1, errno);
+
+	delta_sig_free(&sig);
+	close(fd);
+	close(deltafd);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident  = "delta",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	rc += delta_patch_t(0);
+	rc += delta_patch_t(1);
+	rc += delta_invalid_t();
+
+	log_close();
+
+	return rc;
+}
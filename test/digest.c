@@ -0,0 +1,243 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "digest.h"
+#include "log.h"
+
+/* patterned input; a plain counter would align with block boundaries */
+static
+unsigned char *digest_pattern(size_t len, int c)
+{
+	unsigned char *buf = malloc(len + 1);
+	size_t i;
+
+	if (!buf)
+		return NULL;
+
+	for (i = 0; i < len; i++)
+		buf[i] = c ? c : i % 251;
+
+	return buf;
+}
+
+static
+char *digest_pieces(const digest_t *type, const unsigned char *buf,
+		size_t len, size_t piece)
+{
+	digest_ctx_t ctx;
+	unsigned char digest[DIGEST_MAXBYTES];
+	size_t n;
+
+	digest_init(&ctx, type);
+
+	while (len > 0) {
+		n = len < piece ? len : piece;
+		digest_update(&ctx, buf, n);
+		buf += n;
+		len -= n;
+	}
+
+	digest_final(&ctx, digest);
+
+	return digest_hex(type, digest);
+}
+
+static
+int digest_vectors_t(void)
+{
+	int i, j, rc = 0;
+	const digest_t *type;
+	unsigned char *buf;
+	char *digest;
+
+	size_t P[] = { 1, 63, 64, 1000, 1024, 8193, (size_t) -1 };
+	int PS = sizeof(P) / sizeof(P[0]);
+
+	struct test {
+		const char *name;
+		size_t len;
+		int c;
+		const char *digest;
+	} T[] = {
+		{ "sha256",  0, 0,
+		  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "sha256", 1000000, 'a',
+		  "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+		{ "blake3",  0, 0,
+		  "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+		{ "blake3",  1023, 0,
+		  "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+		{ "blake3",  1024, 0,
+		  "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+		{ "blake3",  1025, 0,
+		  "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+		{ "blake3",  2048, 0,
+		  "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+		{ "blake3",  2049, 0,
+		  "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+		{ "blake3",  8192, 0,
+		  "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" },
+		{ "blake3",  8193, 0,
+		  "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+		{ "blake3",  9216, 0,
+		  "e5ef79624045ef3e98fd23342e61d7eb965997b32928f9de591cd0d465a223fb" },
+		{ "blake3", 31744, 0,
+		  "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+		{ "blake3", 102400, 0,
+		  "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+		{ "blake3", 1000000, 0,
+		  "5e82c663d164c54e4fcdfcd70e3ca464662228bdbad45cce2e0c2bff999064ef" },
+		{ "blake3", 1000000, 'a',
+		  "616f575a1b58d4c9797d4217b9730ae5e6eb319d76edef6549b46f4efe31ff8b" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		type = digest_byname(T[i].name);
+		buf  = digest_pattern(T[i].len, T[i].c);
+
+		if (!type || !buf) {
+			rc += log_error("[%s/%02d] E[%s] R[NULL]",
+			                __FUNCTION__, i, T[i].name);
+			free(buf);
+			continue;
+		}
+
+		/* results must not depend on how the input is split up */
+		for (j = 0; j < PS; j++) {
+			digest = digest_pieces(type, buf, T[i].len, P[j]);
+
+			if (!digest || strcasecmp(T[i].digest, digest))
+				rc += log_error("[%s/%02d/%d] E[%s] R[%s]",
+				                __FUNCTION__, i, j, T[i].digest, digest);
+
+			free(digest);
+		}
+
+		free(buf);
+	}
+
+	return rc;
+}
+
+static
+int digest_str_t(void)
+{
+	int i, rc = 0;
+	char *digest;
+
+	struct test {
+		const char *name;
+		const char *str;
+		const char *digest;
+	} T[] = {
+		{ "sha256", "abc",
+		  "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "sha256", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+		  "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+		{ "blake3", "abc",
+		  "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		digest = digest_str(digest_byname(T[i].name), T[i].str);
+
+		if (!digest || strcasecmp(T[i].digest, digest))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, T[i].digest, digest);
+
+		free(digest);
+	}
+
+	if (digest_byname("md4"))
+		rc += log_error("[%s/%02d] E[NULL] R[md4]", __FUNCTION__, i);
+
+	return rc;
+}
+
+static
+int digest_fd_t(void)
+{
+	int i, fd, rc = 0;
+	char path[] = "/tmp/digesttest-XXXXXX";
+	char *expected, *digest;
+	unsigned char *buf;
+	size_t len = 1000000;
+
+	const char *N[] = { "whirlpool", "sha256", "blake3" };
+	int NS = sizeof(N) / sizeof(N[0]);
+
+	if ((fd = mkstemp(path)) == -1)
+		return log_perror("[%s] mkstemp(%s)", __FUNCTION__, path);
+
+	unlink(path);
+
+	if (!(buf = digest_pattern(len, 0)) || write(fd, buf, len) != (ssize_t) len) {
+		free(buf);
+		close(fd);
+		return log_perror("[%s] write", __FUNCTION__);
+	}
+
+	for (i = 0; i < NS; i++) {
+		expected = digest_pieces(digest_byname(N[i]), buf, len, len);
+
+		lseek(fd, 0, SEEK_SET);
+		digest = digest_fd(digest_byname(N[i]), fd);
+
+		if (!expected || !digest || strcmp(expected, digest))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, expected, digest);
+
+		free(expected);
+		free(digest);
+	}
+
+	free(buf);
+	close(fd);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident  = "digest",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	rc += digest_vectors_t();
+	rc += digest_str_t();
+	rc += digest_fd_t();
+
+	log_close();
+
+	return rc;
+}
@@ -0,0 +1,280 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "error.h"
+#include "log.h"
+#include "str.h"
+
+#define ERROR_TEST_THREADS 4
+
+/* message of a frame as rendered by error_describe() */
+static
+char *error_msg(const error_frame_t *frame)
+{
+	char *desc, *msg;
+
+	if (!(desc = error_describe(frame, "in")))
+		return NULL;
+
+	/* the message is on the second line, indented by ten spaces */
+	msg = strchr(desc, '\n');
+	msg = str_dup(msg ? msg + 11 : "");
+
+	if ((desc = strchr(msg, '\n')))
+		*desc = '\0';
+
+	return msg;
+}
+
+static
+int error_format_t(void)
+{
+	int i, rc = 0;
+	char buf[16], *msg, *raw;
+	void *p = (void *) 0x1234;
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	const char *T[] = {
+		"a 42 -7 1099511627776 ff z",
+		"[hello] [wor] [  x] (null)",
+		"3.1 1.000000e+10 0x0000000000001234 %",
+		"  8|4096|12345678901",
+		"1.500000",
+		"original",
+		"[wxyz] [xy]",
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	error_set(0, "a %d %hd %lld %x %c", 42, (short) -7, 1LL << 40, 255, 'z');
+	error_set(0, "[%s] [%.3s] [%3s] %s", "hello", "world", "x", (char *) NULL);
+	error_set(0, "%.1f %e %p %%", 3.14, 1e10, p);
+	error_set(0, "%*d|%zu|%lu", 3, 8, (size_t) 4096, 12345678901UL);
+
+	/* not stored: long double */
+	error_set(0, "%Lf", 1.5L);
+
+	/* strings are copied when the frame is pushed */
+	str_cpy(buf, "original");
+	error_set(0, "%s", buf);
+	str_cpy(buf, "changed");
+
+	/* an unterminated buffer right before an inaccessible page */
+	raw = mmap(NULL, 2 * pagesize, PROT_READ|PROT_WRITE,
+	           MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if (raw == MAP_FAILED)
+		return log_perror("[%s] mmap", __FUNCTION__);
+
+	mprotect(raw + pagesize, pagesize, PROT_NONE);
+	memcpy(raw + pagesize - 4, "wxyz", 4);
+	error_set(0, "[%.4s] [%.*s]", raw + pagesize - 4, 2, raw + pagesize - 3);
+
+	if (error_count(__lucid_error) != TS)
+		rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, 0,
+		                TS, error_count(__lucid_error));
+
+	for (i = TS - 1; i >= 0; i--) {
+		msg = error_msg(error_pop(__lucid_error));
+
+		if (!msg || strcmp(msg, T[i]))
+			rc += log_error("[%s/%02d] E[%s] R[%s]", __FUNCTION__, i,
+			                T[i], msg);
+
+		free(msg);
+	}
+
+	if (!error_empty(__lucid_error))
+		rc += log_error("[%s/%02d] E[empty] R[%d]", __FUNCTION__, TS,
+		                error_count(__lucid_error));
+
+	munmap(raw, 2 * pagesize);
+
+	return rc;
+}
+
+static
+int error_pool_t(void)
+{
+	int i, rc = 0;
+	char *msg;
+
+	for (i = 0; i < ERROR_FRAMES + 8; i++)
+		error_set(EINVAL, "frame %d", i);
+
+	if (error_count(__lucid_error) != ERROR_FRAMES ||
+			__lucid_error->dropped != 8)
+		rc += log_error("[%s/%02d] E[%d,8] R[%d,%d]", __FUNCTION__, 0,
+		                ERROR_FRAMES, error_count(__lucid_error),
+		                __lucid_error->dropped);
+
+	/* the top frame is the most recent, the bottom one the cause */
+	msg = error_msg(error_pop(__lucid_error));
+
+	if (!msg || strcmp(msg, "frame 39"))
+		rc += log_error("[%s/%02d] E[frame 39] R[%s]", __FUNCTION__, 1, msg);
+
+	free(msg);
+
+	while (error_count(__lucid_error) > 1)
+		error_pop(__lucid_error);
+
+	msg = error_msg(error_pop(__lucid_error));
+
+	if (!msg || strcmp(msg, "frame 0"))
+		rc += log_error("[%s/%02d] E[frame 0] R[%s]", __FUNCTION__, 2, msg);
+
+	free(msg);
+
+	/* the pool is kept */
+	error_clear();
+
+	if (!error_empty(__lucid_error) || !__lucid_error->frames)
+		rc += log_error("[%s/%02d] E[empty] R[%d]", __FUNCTION__, 3,
+		                error_count(__lucid_error));
+
+	/* a frame without a message does not show the one of its slot before */
+	error_set(0, "%ls", L"stale");
+	error_clear();
+	error_set(0, NULL);
+
+	msg = error_describe(error_pop(__lucid_error), "in");
+
+	if (!msg || strstr(msg, "stale"))
+		rc += log_error("[%s/%02d] E[] R[%s]", __FUNCTION__, 4, msg);
+
+	free(msg);
+
+	return rc;
+}
+
+static
+void *error_thread(void *arg)
+{
+	long i, id = (long) arg, rc = 0;
+	char *msg;
+
+	for (i = 0; i < 1000; i++) {
+		error_set(ENOENT, "thread %ld %ld", id, i);
+		error_pass("pass %ld", i);
+		error_do;
+
+		if (error_count(__lucid_error) != 3)
+			rc++;
+
+		error_pop(__lucid_error);
+		error_pop(__lucid_error);
+		msg = error_msg(error_pop(__lucid_error));
+
+		if (!msg || strncmp(msg, "thread ", 7) || strtol(msg + 7, NULL, 10) != id)
+			rc++;
+
+		free(msg);
+		error_clear();
+	}
+
+	return (void *) rc;
+}
+
+static
+int error_thread_t(void)
+{
+	pthread_t threads[ERROR_TEST_THREADS];
+	void *res;
+	long n;
+	int rc = 0;
+
+	error_set(EPERM, "main");
+
+	for (n = 0; n < ERROR_TEST_THREADS; n++)
+		pthread_create(&threads[n], NULL, error_thread, (void *) n);
+
+	for (n = 0; n < ERROR_TEST_THREADS; n++) {
+		pthread_join(threads[n], &res);
+
+		if (res)
+			rc += log_error("[%s/%02d] E[0] R[%ld]", __FUNCTION__, (int) n,
+			                (long) res);
+	}
+
+	/* other threads do not see the stack of the main thread */
+	if (error_count(__lucid_error) != 1)
+		rc += log_error("[%s/%02d] E[1] R[%d]", __FUNCTION__,
+		                ERROR_TEST_THREADS, error_count(__lucid_error));
+
+	error_clear();
+
+	return rc;
+}
+
+static
+int error_trace_t(void)
+{
+	char path[] = "/tmp/errortest-XXXXXX", buf[1024];
+	int fd, len, rc = 0;
+
+	if ((fd = mkstemp(path)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	unlink(path);
+
+	error_set(EIO, "cause %d", 1);
+	error_pass("context %s", "a");
+	error_pass(NULL);
+	error_dump(fd);
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	close(fd);
+
+	buf[len > 0 ? len : 0] = '\0';
+
+	if (!strstr(buf, "in   error_trace_t") || !strstr(buf, "from error_trace_t") ||
+			!strstr(buf, "by   error_trace_t") || !strstr(buf, "cause 1") ||
+			!strstr(buf, "context a") || !error_empty(__lucid_error))
+		rc += log_error("[%s/%02d] E[trace] R[%s]", __FUNCTION__, 0, buf);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident = "error",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	rc += error_format_t();
+	rc += error_pool_t();
+	rc += error_thread_t();
+	rc += error_trace_t();
+
+	error_free(__lucid_error);
+	log_close();
+
+	return rc;
+}
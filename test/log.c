@@ -0,0 +1,908 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "scanf.h"
+#include "str.h"
+
+#define LOG_TEST_THREADS  4
+#define LOG_TEST_MESSAGES 5000
+
+static
+void log_stderr(void)
+{
+	log_options_t log_options = {
+		.log_ident = "log",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+}
+
+/* log to a temporary file; returns its descriptor */
+static
+int log_file(int opts, int ring, int overflow)
+{
+	char path[] = "/tmp/logtest-XXXXXX";
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1)
+		return -1;
+
+	unlink(path);
+
+	log_options_t log_options = {
+		.log_ident    = "log",
+		.log_dest     = LOGD_FILE,
+		.log_fd       = dup(fd),
+		.log_opts     = opts,
+		.log_ring     = ring,
+		.log_overflow = overflow,
+	};
+
+	log_init(&log_options);
+
+	return fd;
+}
+
+/* read back everything logged to fd */
+static
+char *log_read(int fd, size_t *len)
+{
+	struct stat sb;
+	char *buf;
+
+	if (fstat(fd, &sb) == -1 || !(buf = malloc(sb.st_size + 1)))
+		return NULL;
+
+	*len = pread(fd, buf, sb.st_size, 0);
+	buf[*len] = '\0';
+
+	return buf;
+}
+
+static
+int log_sync_t(void)
+{
+	int i, fd, rc = 0;
+	size_t len;
+	char *buf;
+
+	struct test {
+		int opts;
+		const char *out;
+	} T[] = {
+		{ 0, "hello 42\n" },
+		{ LOGO_PRIO, "[error]: hello 42\n" },
+		{ LOGO_PRIO|LOGO_IDENT, "[error] log: hello 42\n" },
+		{ LOGO_ASYNC, "hello 42\n" },
+		{ LOGO_ASYNC|LOGO_IDENT, " log: hello 42\n" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if ((fd = log_file(T[i].opts, 0, LOGQ_DROP)) == -1)
+			return log_perror("[%s] mkstemp", __FUNCTION__);
+
+		log_error("hello %d", 42);
+		log_debug("not logged");
+		log_close();
+
+		buf = log_read(fd, &len);
+		close(fd);
+
+		log_stderr();
+
+		if (!buf || strcmp(buf, T[i].out))
+			rc += log_error("[%s/%02d] E[%s] R[%s]", __FUNCTION__, i,
+			                T[i].out, buf);
+
+		free(buf);
+	}
+
+	return rc;
+}
+
+static
+int log_prefix_t(void)
+{
+	int i, fd, day, pid[2], rc = 0;
+	char mon[4], clock[9], *buf, *p;
+	size_t len;
+	pid_t child;
+
+	if ((fd = log_file(LOGO_PRIO|LOGO_TIME|LOGO_IDENT|LOGO_PID, 0, LOGQ_DROP)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	log_error("hello %d", 42);
+
+	/* the cached pid is updated in a child */
+	if ((child = fork()) == 0) {
+		log_error("hello %d", 42);
+		_exit(0);
+	}
+
+	waitpid(child, NULL, 0);
+	log_close();
+
+	buf = log_read(fd, &len);
+	close(fd);
+
+	log_stderr();
+
+	for (i = 0, p = buf; i < 2; i++, p = p && (p = strchr(p, '\n')) ? p + 1 : NULL) {
+		if (!p || _lucid_sscanf(p, "[error] %3s %d %8s log[%d]: hello 42",
+				mon, &day, clock, &pid[i]) != 4 || clock[2] != ':' ||
+				pid[i] != (i ? child : getpid()))
+			rc += log_error("[%s/%02d] E[%d] R[%s]", __FUNCTION__, i,
+			                (int) (i ? child : getpid()), p);
+	}
+
+	free(buf);
+
+	return rc;
+}
+
+static
+int log_callsite_t(void)
+{
+	int i, fd, calls = 0, rc = 0;
+	size_t len;
+	char *buf;
+
+	const char *out =
+		"info 0\n"
+		"info 1\n"
+		"info 2\n"
+		"debug 2\n"
+		"info 3\n"
+		"debug 3\n"
+		"info 4\n";
+
+	if ((fd = log_file(0, 0, LOGQ_DROP)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	/* arguments of disabled sites are only evaluated when first reached */
+	for (i = 0; i < 6; i++) {
+		if (i == 2)
+			log_site_enable("test/log.c", 0, 1);
+
+		if (i == 4)
+			log_site_enable("log.c", 0, -1);
+
+		if (i == 5)
+			log_site_enable("log.c", __LINE__ + 2, 0);
+
+		LOG(LOGP_INFO, "info %d", (calls++, i));
+		LOG(LOGP_DEBUG, "debug %d", (calls++, i));
+	}
+
+	log_close();
+
+	buf = log_read(fd, &len);
+	close(fd);
+
+	log_stderr();
+
+	if (!buf || strcmp(buf, out) || calls != 8)
+		rc += log_error("[%s/%02d] E[%s,8] R[%s,%d]", __FUNCTION__, 0,
+		                out, buf, calls);
+
+	free(buf);
+
+	return rc;
+}
+
+static
+int log_ratelimit_t(void)
+{
+	int i, fd, rline, sline, line, rc = 0;
+	unsigned long n, r = 0, rsup = 0, s = 0, ssup = 0;
+	size_t len;
+	char *buf, *p, *q;
+
+	if ((fd = log_file(0, 0, LOGQ_DROP)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	for (i = 0; i < 1000; i++) {
+		rline = __LINE__ + 1;
+		LOG_RATELIMIT(LOGP_INFO, 10, 5, "r %d", i);
+		sline = __LINE__ + 1;
+		LOG_SAMPLE(LOGP_INFO, 10, "s %d", i);
+	}
+
+	/* reports the remaining suppressed messages */
+	log_close();
+
+	buf = log_read(fd, &len);
+	close(fd);
+
+	log_stderr();
+
+	if (!buf)
+		return log_perror("[%s] read", __FUNCTION__);
+
+	for (p = buf; *p; p = strchr(p, '\n') + 1) {
+		if (*p == 'r')
+			r++;
+		else if (*p == 's')
+			s++;
+		else if ((q = strstr(p, "log.c:")) &&
+				_lucid_sscanf(q, "log.c:%d: %lu", &line, &n) == 2) {
+			if (line == rline)
+				rsup += n;
+			else if (line == sline)
+				ssup += n;
+		}
+	}
+
+	/* the loop takes far less than a second, so the burst is all that passes */
+	if (r < 5 || r > 15 || r + rsup != 1000)
+		rc += log_error("[%s/%02d] E[5,995] R[%lu,%lu]", __FUNCTION__, 0,
+		                r, rsup);
+
+	if (s != 100 || ssup != 900)
+		rc += log_error("[%s/%02d] E[100,900] R[%lu,%lu]", __FUNCTION__, 1,
+		                s, ssup);
+
+	free(buf);
+
+	/* errno is saved before the arguments are evaluated */
+	if ((fd = log_file(0, 0, LOGQ_DROP)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	for (i = 0; i < 100; i++) {
+		errno = ENOENT;
+		LOG_PRATELIMIT(LOGP_INFO, 10, 2, "p %d%s", i, (errno = 0, ""));
+		errno = EACCES;
+		LOG_PSAMPLE(LOGP_INFO, 50, "q %d", i);
+	}
+
+	log_close();
+
+	buf = log_read(fd, &len);
+	close(fd);
+
+	log_stderr();
+
+	if (!buf)
+		return log_perror("[%s] read", __FUNCTION__);
+
+	if (!strstr(buf, "p 0: No such file or directory\n") ||
+			!strstr(buf, "p 1: No such file or directory\n") ||
+			strstr(buf, "p 99: ") ||
+			!strstr(buf, "q 0: Permission denied\n") ||
+			!strstr(buf, "q 50: Permission denied\n") ||
+			strstr(buf, "q 1: "))
+		rc += log_error("[%s/%02d] E[p 0: %s] R[%s]", __FUNCTION__, 2,
+		                strerror(ENOENT), buf);
+
+	free(buf);
+
+	return rc;
+}
+
+static
+void *log_async_thread(void *arg)
+{
+	int i, id = (long) arg;
+
+	for (i = 0; i < LOG_TEST_MESSAGES; i++)
+		log_info("t%d m%d", id, i);
+
+	return NULL;
+}
+
+static
+int log_async_t(void)
+{
+	int i, fd, rc = 0, next[LOG_TEST_THREADS];
+	int tid[LOG_TEST_THREADS * LOG_TEST_MESSAGES];
+	int seq[LOG_TEST_THREADS * LOG_TEST_MESSAGES];
+	void *arrays[] = { tid, seq };
+	pthread_t threads[LOG_TEST_THREADS];
+	scanf_cols_t cols;
+	scanf_prog_t *prog;
+	size_t len;
+	char *buf;
+
+	/* a small ring makes producers wrap around and wait for the writer */
+	if ((fd = log_file(LOGO_ASYNC, 1024, LOGQ_BLOCK)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	for (i = 0; i < LOG_TEST_THREADS; i++)
+		pthread_create(&threads[i], NULL, log_async_thread, (void *) (long) i);
+
+	for (i = 0; i < LOG_TEST_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	log_close();
+
+	buf = log_read(fd, &len);
+	close(fd);
+
+	log_stderr();
+
+	if (!buf)
+		return log_perror("[%s] read", __FUNCTION__);
+
+	memset(&cols, 0, sizeof(cols));
+	cols.cols = arrays;
+	cols.size = LOG_TEST_THREADS * LOG_TEST_MESSAGES;
+
+	prog = scanf_compile("t%d m%d");
+	scanf_exec_buf(prog, buf, len, &cols);
+	scanf_free(prog);
+	free(buf);
+
+	if (cols.rows != LOG_TEST_THREADS * LOG_TEST_MESSAGES || cols.nbad)
+		return log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, 0,
+		                 LOG_TEST_THREADS * LOG_TEST_MESSAGES, (int) cols.rows);
+
+	/* messages of each thread keep their order */
+	memset(next, 0, sizeof(next));
+
+	for (i = 0; i < (int) cols.rows; i++) {
+		if (tid[i] < 0 || tid[i] >= LOG_TEST_THREADS || seq[i] != next[tid[i]]) {
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, 1,
+			                tid[i] < 0 || tid[i] >= LOG_TEST_THREADS ?
+			                -1 : next[tid[i]], seq[i]);
+			break;
+		}
+
+		next[tid[i]]++;
+	}
+
+	return rc;
+}
+
+static
+int log_overflow_t(void)
+{
+	int i, fd, n = 0, rc = 0;
+	unsigned long lost;
+	char *buf, *p, *eol;
+	size_t len;
+
+	/* the writer polls too rarely to keep up with a tight loop */
+	if ((fd = log_file(LOGO_ASYNC, 1024, LOGQ_COUNT)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	for (i = 0; i < LOG_TEST_MESSAGES; i++)
+		log_info("m%d", i);
+
+	log_close();
+
+	buf = log_read(fd, &len);
+	close(fd);
+
+	log_stderr();
+
+	if (!buf)
+		return log_perror("[%s] read", __FUNCTION__);
+
+	/* every message is either written or counted as dropped */
+	for (p = buf; (eol = strchr(p, '\n')); p = eol + 1) {
+		if (*p == 'm')
+			n++;
+
+		else if (_lucid_sscanf(p, "%lu log messages dropped", &lost) == 1)
+			n += lost;
+	}
+
+	if (n != LOG_TEST_MESSAGES)
+		rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, 0,
+		                LOG_TEST_MESSAGES, n);
+
+	free(buf);
+
+	return rc;
+}
+
+static
+int log_reinit_t(void)
+{
+	int i, fd, n, rc = 0;
+	pthread_t threads[LOG_TEST_THREADS];
+	char *buf, *p, *eol;
+	size_t len;
+
+	if ((fd = log_file(LOGO_ASYNC, 1024, LOGQ_BLOCK)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	for (i = 0; i < LOG_TEST_THREADS; i++)
+		pthread_create(&threads[i], NULL, log_async_thread, (void *) (long) i);
+
+	/* switch between synchronous and asynchronous connections while
+	 * messages are logged; the last one is asynchronous */
+	for (i = 0; i < 50; i++) {
+		log_options_t log_options = {
+			.log_ident    = "log",
+			.log_dest     = LOGD_FILE,
+			.log_fd       = dup(fd),
+			.log_opts     = i % 2 ? 0 : LOGO_ASYNC,
+			.log_ring     = 1024,
+			.log_overflow = LOGQ_BLOCK,
+		};
+
+		log_init(&log_options);
+		usleep(100);
+	}
+
+	for (i = 0; i < LOG_TEST_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	log_close();
+
+	buf = log_read(fd, &len);
+	close(fd);
+
+	log_stderr();
+
+	if (!buf)
+		return log_perror("[%s] read", __FUNCTION__);
+
+	for (n = 0, p = buf; (eol = strchr(p, '\n')); p = eol + 1)
+		if (*p == 't')
+			n++;
+
+	if (n != LOG_TEST_THREADS * LOG_TEST_MESSAGES)
+		rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, 0,
+		                LOG_TEST_THREADS * LOG_TEST_MESSAGES, n);
+
+	free(buf);
+
+	return rc;
+}
+
+/* messages covering every kind of deferred argument */
+static
+void log_binary_calls(void)
+{
+	static char *raw;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	char fmt[16];
+
+	/* an unterminated buffer right before an inaccessible page */
+	if (!raw) {
+		raw = mmap(NULL, 2 * pagesize, PROT_READ|PROT_WRITE,
+		           MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		mprotect(raw + pagesize, pagesize, PROT_NONE);
+		raw += pagesize - 4;
+		memcpy(raw, "wxyz", 4);
+	}
+
+	log_error("hello %d", 42);
+	log_warn("%ld %lld %u %x %c %hd", -5L, 1LL << 40, 7u, 255, 'z', 3);
+	log_info("%s|%10s|%-4s|%.2s|%s", "a", "b", "c", "defg", (char *) NULL);
+	log_info("%*d|%-*.*f|%%", 6, 42, 9, 3, 3.14159);
+	log_notice("%g %e %P", 0.1, 1e300, (void *) 0x1234);
+	log_info("%.4s|%.*s|%.*s", raw, 4, raw, 2, raw + 1);
+
+	/* not deferred: long double */
+	log_info("%Lf", 1.5L);
+
+	errno = ENOENT;
+	log_perror("open %s", "x");
+
+	/* a format buffer reused for another format */
+	str_cpy(fmt, "a %d");
+	log_info(fmt, 1);
+	str_cpy(fmt, "b %s");
+	log_info(fmt, "x");
+
+	LOG(LOGP_INFO, "site %d %s", 7, "y");
+}
+
+static
+int log_binary_t(void)
+{
+	int i, fd, bfd, tfd, n, rc = 0;
+	pthread_t threads[LOG_TEST_THREADS];
+	char path[] = "/tmp/logtest-XXXXXX";
+	char *expected, *buf, *text, *p, *q, *eol;
+	size_t len;
+
+	struct test {
+		int dest;
+		int opts;
+	} T[] = {
+		{ LOGD_BINARY,           0 },
+		{ LOGD_BINARY|LOGD_FILE, 0 },
+		{ LOGD_BINARY,           LOGO_ASYNC },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	/* the text rendering the decoder has to reproduce */
+	if ((fd = log_file(LOGO_PRIO|LOGO_IDENT|LOGO_PID, 0, LOGQ_DROP)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	log_binary_calls();
+	log_close();
+
+	expected = log_read(fd, &len);
+	close(fd);
+
+	log_stderr();
+
+	for (i = 0; i < TS; i++) {
+		if ((bfd = mkstemp(path)) == -1 || unlink(path) == -1 ||
+				(fd = log_file(LOGO_PRIO|LOGO_IDENT|LOGO_PID|T[i].opts,
+				0, LOGQ_BLOCK)) == -1)
+			return log_perror("[%s] mkstemp", __FUNCTION__);
+
+		str_cpy(path + 13, "XXXXXX");
+
+		log_options_t log_options = {
+			.log_ident    = "log",
+			.log_dest     = T[i].dest,
+			.log_fd       = dup(fd),
+			.log_binfd    = dup(bfd),
+			.log_opts     = LOGO_PRIO|LOGO_IDENT|LOGO_PID|T[i].opts,
+			.log_overflow = LOGQ_BLOCK,
+		};
+
+		log_init(&log_options);
+
+		log_binary_calls();
+
+		/* rings of different threads are not ordered against each other */
+		log_flush();
+
+		for (n = 0; n < LOG_TEST_THREADS; n++)
+			pthread_create(&threads[n], NULL, log_async_thread,
+			               (void *) (long) n);
+
+		for (n = 0; n < LOG_TEST_THREADS; n++)
+			pthread_join(threads[n], NULL);
+
+		log_close();
+
+		text = log_read(fd, &len);
+		close(fd);
+
+		/* decode into the file that had the text log */
+		if ((tfd = mkstemp(path)) == -1 || unlink(path) == -1)
+			return log_perror("[%s] mkstemp", __FUNCTION__);
+
+		str_cpy(path + 13, "XXXXXX");
+
+		log_stderr();
+
+		if (lseek(bfd, 0, SEEK_SET) == -1 || log_decode(bfd, tfd) == -1)
+			rc += log_perror("[%s/%02d] log_decode", __FUNCTION__, i);
+
+		buf = log_read(tfd, &len);
+		close(tfd);
+		close(bfd);
+
+		if (!expected || !buf || strncmp(buf, expected, str_len(expected)))
+			rc += log_error("[%s/%02d] E[%s] R[%s]", __FUNCTION__, i,
+			                expected, buf);
+
+		/* the other destination gets the same text; messages of
+		 * different threads may be ordered differently */
+		if ((T[i].dest & LOGD_FILE) && (!text || !expected ||
+				strncmp(text, expected, str_len(expected))))
+			rc += log_error("[%s/%02d] E[%s] R[%s]", __FUNCTION__, i,
+			                expected, text);
+
+		for (n = 0, p = buf; p && (eol = strchr(p, '\n')); p = eol + 1)
+			if ((q = strstr(p, "]: t")) && q < eol)
+				n++;
+
+		if (n != LOG_TEST_THREADS * LOG_TEST_MESSAGES)
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+			                LOG_TEST_THREADS * LOG_TEST_MESSAGES, n);
+
+		free(text);
+		free(buf);
+	}
+
+	free(expected);
+
+	return rc;
+}
+
+/* log to a new ring file; returns its descriptor */
+static
+int log_map(int opts, int size)
+{
+	char path[] = "/tmp/logtest-XXXXXX";
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1)
+		return -1;
+
+	unlink(path);
+
+	log_options_t log_options = {
+		.log_ident    = "log",
+		.log_dest     = LOGD_MMAP,
+		.log_mapfd    = dup(fd),
+		.log_mapsize  = size,
+		.log_opts     = opts,
+		.log_overflow = LOGQ_BLOCK,
+	};
+
+	log_init(&log_options);
+
+	return fd;
+}
+
+/* dump a ring file */
+static
+char *log_map_read(int fd)
+{
+	char path[] = "/tmp/logtest-XXXXXX";
+	char *buf = NULL;
+	size_t len;
+	int tfd;
+
+	if ((tfd = mkstemp(path)) == -1)
+		return NULL;
+
+	unlink(path);
+
+	if (lseek(fd, 0, SEEK_SET) != -1 && log_decode(fd, tfd) != -1)
+		buf = log_read(tfd, &len);
+
+	close(tfd);
+
+	return buf;
+}
+
+static
+int log_mmap_t(void)
+{
+	int i, j, n, fd, first, status, rc = 0;
+	pthread_t threads[LOG_TEST_THREADS];
+	char *buf, *p, *q, *eol;
+	pid_t child;
+
+	struct test {
+		int size;
+		int opts;
+		int threads;
+	} T[] = {
+		{ 4096,    0,                                  0 },
+		{ 4 << 20, LOGO_PRIO|LOGO_IDENT|LOGO_PID,      1 },
+		{ 4 << 20, LOGO_PRIO|LOGO_IDENT|LOGO_ASYNC,    1 },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if ((fd = log_map(T[i].opts, T[i].size)) == -1)
+			return log_perror("[%s] mkstemp", __FUNCTION__);
+
+		if (T[i].threads) {
+			for (n = 0; n < LOG_TEST_THREADS; n++)
+				pthread_create(&threads[n], NULL, log_async_thread,
+				               (void *) (long) n);
+
+			for (n = 0; n < LOG_TEST_THREADS; n++)
+				pthread_join(threads[n], NULL);
+		} else {
+			for (n = 0; n < 1000; n++)
+				log_info("m %d", n);
+		}
+
+		log_close();
+
+		buf = log_map_read(fd);
+		close(fd);
+
+		log_stderr();
+
+		if (!buf) {
+			rc += log_perror("[%s/%02d] log_decode", __FUNCTION__, i);
+			continue;
+		}
+
+		/* a small ring keeps the most recent messages */
+		if (!T[i].threads) {
+			n = first = -1;
+
+			for (p = buf; (eol = strchr(p, '\n')); p = eol + 1) {
+				if (_lucid_sscanf(p, "m %d", &j) != 1 || (n >= 0 && j != n + 1))
+					break;
+
+				if (first < 0)
+					first = j;
+
+				n = j;
+			}
+
+			if (*p || n != 999 || first <= 0)
+				rc += log_error("[%s/%02d] E[m 999] R[%s]", __FUNCTION__, i, buf);
+		} else {
+			for (n = 0, p = buf; (eol = strchr(p, '\n')); p = eol + 1)
+				if (!strncmp(p, "[info ] log", 11) &&
+						(q = strstr(p, ": t")) && q < eol)
+					n++;
+
+			if (n != LOG_TEST_THREADS * LOG_TEST_MESSAGES)
+				rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+				                LOG_TEST_THREADS * LOG_TEST_MESSAGES, n);
+		}
+
+		free(buf);
+	}
+
+	/* messages of a killed process survive, and the next process
+	 * continues the ring */
+	if ((fd = log_map(0, 0)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	if ((child = fork()) == 0) {
+		for (n = 0; n < 100; n++)
+			log_info("c %d", n);
+
+		kill(getpid(), SIGKILL);
+	}
+
+	waitpid(child, &status, 0);
+
+	log_close();
+
+	if ((n = dup(fd)) == -1)
+		return log_perror("[%s] dup", __FUNCTION__);
+
+	log_options_t log_options = {
+		.log_ident   = "log",
+		.log_dest    = LOGD_MMAP,
+		.log_mapfd   = n,
+	};
+
+	log_init(&log_options);
+	log_info("after");
+	log_close();
+
+	buf = log_map_read(fd);
+	close(fd);
+
+	log_stderr();
+
+	for (n = 0, p = buf; p && (eol = strchr(p, '\n')); p = eol + 1)
+		if (_lucid_sscanf(p, "c %d", &j) == 1 && j == n)
+			n++;
+
+	if (!buf || !WIFSIGNALED(status) || n != 100 || !strstr(buf, "\nafter\n"))
+		rc += log_error("[%s/%02d] E[c 0..c 99,after] R[%s]", __FUNCTION__,
+		                TS, buf);
+
+	free(buf);
+
+	return rc;
+}
+
+static
+int log_fork_t(void)
+{
+	int i, j, n, fd, status, rc = 0;
+	char *buf, *p, *eol;
+	size_t len;
+	pid_t child;
+
+	struct test {
+		int overflow;
+		int die;
+	} T[] = {
+		{ LOGQ_BLOCK, 0 },
+		{ LOGQ_DROP,  0 },
+		{ LOGQ_BLOCK, 1 },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if ((fd = log_file(LOGO_ASYNC, 1024, T[i].overflow)) == -1)
+			return log_perror("[%s] mkstemp", __FUNCTION__);
+
+		log_info("parent");
+
+		/* the child has no writer thread: nothing may hang or get lost,
+		 * and log_close() must not join the writer of the parent */
+		if ((child = fork()) == 0) {
+			/* a fresh writer, to check that records are not lost on
+			 * exit */
+			if (T[i].die) {
+				log_options_t log_options = {
+					.log_ident    = "log",
+					.log_dest     = LOGD_FILE,
+					.log_fd       = dup(fd),
+					.log_opts     = LOGO_ASYNC,
+					.log_ring     = 1024,
+					.log_overflow = T[i].overflow,
+				};
+
+				log_init(&log_options);
+			}
+
+			for (j = 0; j < LOG_TEST_MESSAGES; j++)
+				log_info("c%d", j);
+
+			if (T[i].die)
+				log_error_and_die("died");
+
+			log_close();
+			_exit(0);
+		}
+
+		waitpid(child, &status, 0);
+		log_close();
+
+		buf = log_read(fd, &len);
+		close(fd);
+
+		log_stderr();
+
+		if (!buf)
+			return log_perror("[%s] read", __FUNCTION__);
+
+		for (n = 0, p = buf; (eol = strchr(p, '\n')); p = eol + 1)
+			if (*p == 'c')
+				n++;
+
+		if (!WIFEXITED(status) ||
+				WEXITSTATUS(status) != (T[i].die ? EXIT_FAILURE : 0) ||
+				n != LOG_TEST_MESSAGES || !strstr(buf, "parent\n") ||
+				(T[i].die && !strstr(buf, "died\n")))
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+			                LOG_TEST_MESSAGES, n);
+
+		free(buf);
+	}
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_stderr();
+
+	rc += log_sync_t();
+	rc += log_prefix_t();
+	rc += log_callsite_t();
+	rc += log_ratelimit_t();
+	rc += log_async_t();
+	rc += log_overflow_t();
+	rc += log_reinit_t();
+	rc += log_binary_t();
+	rc += log_mmap_t();
+	rc += log_fork_t();
+
+	log_close();
+
+	return rc;
+}
@@ -0,0 +1,211 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "obuf.h"
+#include "str.h"
+
+static
+int obuf_tmpfile(void)
+{
+	char path[] = "/tmp/obuftest-XXXXXX";
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1)
+		return -1;
+
+	unlink(path);
+	return fd;
+}
+
+/* number of bytes written to fd so far */
+static
+int obuf_written(int fd)
+{
+	return lseek(fd, 0, SEEK_CUR);
+}
+
+/* compare the contents of fd with str */
+static
+int obuf_check(int fd, const char *str)
+{
+	char buf[1024];
+	int len = str_len(str);
+
+	if (obuf_written(fd) != len)
+		return 1;
+
+	return pread(fd, buf, len, 0) != len || memcmp(buf, str, len);
+}
+
+static
+int obuf_cat_t(void)
+{
+	int i, j, fd, rc = 0;
+	char buf[16];
+	obuf_t ob;
+
+	struct test {
+		int flags;
+		int thresh;
+		const char *in[3];
+		int written;
+		const char *out;
+	} T[] = {
+		{ 0, 0, { "abc", "def", NULL }, 0, "abcdef" },
+		{ 0, 0, { "0123456789", "abcdefg", NULL }, 10, "0123456789abcdefg" },
+		{ 0, 0, { "0123456789", "abcdefghijklmnopq", NULL }, 27, "0123456789abcdefghijklmnopq" },
+		{ 0, 0, { "0123456789abcdef", "x", NULL }, 16, "0123456789abcdefx" },
+		{ OBUF_LINE, 0, { "abc", "d\ne", NULL }, 6, "abcd\ne" },
+		{ OBUF_LINE, 0, { "abc", "def", NULL }, 0, "abcdef" },
+		{ 0, 4, { "ab", "cd", "ef" }, 4, "abcdef" },
+		{ 0, 0, { "", "", NULL }, 0, "" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if ((fd = obuf_tmpfile()) == -1)
+			return log_perror("[%s] mkstemp", __FUNCTION__);
+
+		obuf_init(&ob, fd, buf, sizeof(buf), T[i].flags);
+
+		if (T[i].thresh)
+			ob.thresh = T[i].thresh;
+
+		for (j = 0; j < 3 && T[i].in[j]; j++)
+			if (obuf_cats(&ob, T[i].in[j]) != (int) str_len(T[i].in[j]))
+				rc += log_error("[%s/%02d] E[%d] R[-1]", __FUNCTION__, i,
+				                (int) str_len(T[i].in[j]));
+
+		if (obuf_written(fd) != T[i].written)
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+			                T[i].written, obuf_written(fd));
+
+		if (obuf_flush(&ob) == -1 || ob.len != 0 || obuf_check(fd, T[i].out))
+			rc += log_error("[%s/%02d] E[%s] R[%d]", __FUNCTION__, i,
+			                T[i].out, obuf_written(fd));
+
+		close(fd);
+	}
+
+	return rc;
+}
+
+static
+int obuf_catf_t(void)
+{
+	int fd, len, rc = 0;
+	char buf[300], str[401], out[1024];
+	obuf_t ob;
+
+	if ((fd = obuf_tmpfile()) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	memset(str, 'x', 400);
+	str[400] = '\0';
+
+	obuf_init(&ob, fd, buf, sizeof(buf), 0);
+
+	/* fits into the free space */
+	if ((len = obuf_catf(&ob, "%d:%s", 42, "foo")) != 6 || ob.len != 6)
+		rc += log_error("[%s/%02d] E[6] R[%d]", __FUNCTION__, 0, len);
+
+	/* larger than the whole buffer */
+	if ((len = obuf_catf(&ob, "<%s>", str)) != 402 || obuf_written(fd) != 408)
+		rc += log_error("[%s/%02d] E[402] R[%d]", __FUNCTION__, 1, len);
+
+	/* does not fit the remaining space after a few appends */
+	obuf_catb(&ob, str, 100);
+
+	if ((len = obuf_catf(&ob, "%.250s", str)) != 250 ||
+			obuf_written(fd) != 508 || ob.len != 250)
+		rc += log_error("[%s/%02d] E[250] R[%d]", __FUNCTION__, 2, len);
+
+	obuf_flush(&ob);
+
+	snprintf(out, sizeof(out), "42:foo<%s>%.100s%.250s", str, str, str);
+
+	if (obuf_check(fd, out))
+		rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, 3,
+		                (int) str_len(out), obuf_written(fd));
+
+	close(fd);
+
+	return rc;
+}
+
+static
+int obuf_error_t(void)
+{
+	int rc = 0;
+	obuf_t ob;
+
+	/* allocated storage */
+	if (obuf_init(&ob, -1, NULL, 0, 0) == -1 || ob.size != OBUF_SIZE)
+		return log_perror("[%s/%02d] obuf_init", __FUNCTION__, 0);
+
+	if (obuf_cats(&ob, "foo") != 3)
+		rc += log_error("[%s/%02d] E[3] R[-1]", __FUNCTION__, 1);
+
+	if (obuf_flush(&ob) != -1 || errno != EBADF)
+		rc += log_error("[%s/%02d] E[EBADF] R[%d]", __FUNCTION__, 2, errno);
+
+	/* errors are sticky */
+	errno = 0;
+
+	if (obuf_cats(&ob, "bar") != -1 || errno != EBADF || ob.error != EBADF)
+		rc += log_error("[%s/%02d] E[EBADF] R[%d]", __FUNCTION__, 3, errno);
+
+	if (obuf_free(&ob) != -1 || ob.buf != NULL)
+		rc += log_error("[%s/%02d] E[-1] R[0]", __FUNCTION__, 4);
+
+	/* caller storage needs a size */
+	errno = 0;
+
+	if (obuf_init(&ob, -1, (char *) &rc, 0, 0) != -1 || errno != EINVAL)
+		rc += log_error("[%s/%02d] E[EINVAL] R[%d]", __FUNCTION__, 5, errno);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident = "obuf",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	rc += obuf_cat_t();
+	rc += obuf_catf_t();
+	rc += obuf_error_t();
+
+	log_close();
+
+	return rc;
+}
@@ -0,0 +1,370 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flist.h"
+#include "log.h"
+#include "printf.h"
+
+/* compare against the C library */
+#undef snprintf
+
+static
+int printf_snprintf_t(void)
+{
+	int i, len, rc = 0;
+	char expected[64], result[64];
+
+	struct test {
+		const char *fmt;
+		long long int val;
+	} T[] = {
+		{ "%d",       0 },
+		{ "%d",       -42 },
+		{ "%5d|",     42 },
+		{ "%-5d|",    42 },
+		{ "%05d",     -42 },
+		{ "%+d",      42 },
+		{ "% d",      42 },
+		{ "%.4d",     42 },
+		{ "%8.4d",    -42 },
+		{ "%x",       0xbeef },
+		{ "%#X",      0xbeef },
+		{ "%#o",      8 },
+		{ "%#o",      0 },
+		{ "%lld",     -9223372036854775807LL },
+		{ "%llu",     -1LL },
+		{ "%llo",     -1LL },
+		{ "%hhd",     300 },
+		{ "%hu",      70000 },
+		{ "a%%b%dc",  1 },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if (strstr(T[i].fmt, "ll")) {
+			snprintf(expected, sizeof(expected), T[i].fmt, T[i].val);
+			len = _lucid_snprintf(result, sizeof(result), T[i].fmt, T[i].val);
+		}
+
+		else {
+			snprintf(expected, sizeof(expected), T[i].fmt, (int) T[i].val);
+			len = _lucid_snprintf(result, sizeof(result), T[i].fmt, (int) T[i].val);
+		}
+
+		if (len != (int) strlen(expected) || strcmp(expected, result))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, expected, result);
+	}
+
+	return rc;
+}
+
+static
+int printf_float_t(void)
+{
+	int i, j, len, rc = 0;
+	char expected[1500], result[1500];
+
+	const char *F[] = {
+		"%f", "%.0f", "%.1f", "%#.0f", "%e", "%.0e", "%#.0e", "%E",
+		"%g", "%G", "%#g", "%.0g", "%.17g", "%.20e", "%.1100f", "%12.3f|",
+		"%-12.3e|", "%+g", "% g", "%010.2f", "%F",
+	};
+
+	double T[] = {
+		0.0, -0.0, 0.5, 1.5, 2.5, -2.5, 0.125, 99.5, 0.1, 1e-5, 1e-4,
+		123456, 1234567, 1e22, 1e23, 5e-324, 2.2250738585072014e-308,
+		1.7976931348623157e308, 1.0 / 0.0, -1.0 / 0.0,
+	};
+
+	int FS = sizeof(F) / sizeof(F[0]);
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		for (j = 0; j < FS; j++) {
+			snprintf(expected, sizeof(expected), F[j], T[i]);
+			len = _lucid_snprintf(result, sizeof(result), F[j], T[i]);
+
+			if (len != (int) strlen(expected) || strcmp(expected, result))
+				rc += log_error("[%s/%02d] %s E[%.64s] R[%.64s]",
+				                __FUNCTION__, i, F[j], expected, result);
+		}
+	}
+
+	return rc;
+}
+
+/* test extension: writes the int argument in roman numerals up to 10 */
+static
+void roman(printf_out_t *out, const printf_spec_t *spec, va_list *ap)
+{
+	static const char *R[] = {
+		"", "I", "II", "III", "IV", "V", "VI", "VII", "VIII", "IX", "X",
+	};
+
+	const char *r = R[va_arg(*ap, int) % 11];
+
+	printf_write(out, r, strlen(r));
+}
+
+#define TEST_A 0x1
+#define TEST_B 0x2
+#define TEST_C 0x4
+
+FLIST32_START(test_list)
+FLIST32_NODE(TEST, A)
+FLIST32_NODE(TEST, B)
+FLIST32_NODE(TEST, C)
+FLIST32_END
+
+static
+int printf_ext_t(void)
+{
+	int i, len, rc = 0;
+	char result[64];
+	stralloc_t sa = { "stralloc", 8, 0 };
+	flag32_t flags = { TEST_A | TEST_C, TEST_A | TEST_B | TEST_C };
+
+	struct test {
+		const char *fmt;
+		size_t n;
+		const char *data;
+		const char *expected;
+	} T[] = {
+		{ "%B",      0, "",       "" },
+		{ "%B",      1, "f",      "Zg==" },
+		{ "%B",      2, "fo",     "Zm8=" },
+		{ "%B",      3, "foo",    "Zm9v" },
+		{ "%B",      4, "foob",   "Zm9vYg==" },
+		{ "%B",      6, "foobar", "Zm9vYmFy" },
+		{ "%H",      3, "\x00\xab\xff", "00abff" },
+		{ "%8H|",    2, "\x01\x02", "    0102|" },
+		{ "%-8H|",   2, "\x01\x02", "0102    |" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		len = _lucid_snprintf(result, sizeof(result), T[i].fmt, T[i].n, T[i].data);
+
+		if (len != (int) strlen(T[i].expected) || strcmp(T[i].expected, result))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, T[i].expected, result);
+	}
+
+	/* strings, precision and width */
+	_lucid_snprintf(result, sizeof(result), "%S|%.3S|%10S|%S", &sa, &sa, &sa, NULL);
+
+	if (strcmp(result, "stralloc|str|  stralloc|(null)"))
+		rc += log_error("[%s/%02d] E[stralloc|str|  stralloc|(null)] R[%s]",
+		                __FUNCTION__, i++, result);
+
+	/* flag lists like flist32_encode() */
+	_lucid_snprintf(result, sizeof(result), "%M", test_list, &flags, '~', ",");
+
+	if (strcmp(result, "A,~B,C"))
+		rc += log_error("[%s/%02d] E[A,~B,C] R[%s]", __FUNCTION__, i++, result);
+
+	/* right justification survives truncation */
+	len = _lucid_snprintf(result, 6, "%8H", (size_t) 2, "\x01\x02");
+
+	if (len != 8 || strcmp(result, "    0"))
+		rc += log_error("[%s/%02d] E[8,    0] R[%d,%s]",
+		                __FUNCTION__, i++, len, result);
+
+	/* registered conversions */
+	if (printf_register('d', roman) != -1 || errno != EINVAL)
+		rc += log_error("[%s/%02d] E[-1,EINVAL] R[0]", __FUNCTION__, i++);
+
+	printf_register('Y', roman);
+	_lucid_snprintf(result, sizeof(result), "%Y/%Y/%d", 4, 9, 10);
+	printf_register('Y', NULL);
+
+	if (strcmp(result, "IV/IX/10"))
+		rc += log_error("[%s/%02d] E[IV/IX/10] R[%s]", __FUNCTION__, i++, result);
+
+	_lucid_snprintf(result, sizeof(result), "%Y", 4);
+
+	if (strcmp(result, "%Y"))
+		rc += log_error("[%s/%02d] E[%%Y] R[%s]", __FUNCTION__, i++, result);
+
+	return rc;
+}
+
+static
+int printf_truncate_t(void)
+{
+	int i, len, rc = 0;
+	char buf[16];
+
+	int T[] = { 0, 1, 5, 12, 13, 16 };
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		memset(buf, 'x', sizeof(buf));
+
+		len = _lucid_snprintf(buf, T[i], "%s %d", "hello", 123456);
+
+		/* the result is terminated and nothing beyond it is touched */
+		if (len != 12 ||
+				(T[i] > 0 && (strncmp(buf, "hello 123456", T[i] - 1) ||
+				              buf[(T[i] > 13 ? 13 : T[i]) - 1] != '\0')) ||
+				(T[i] < 15 && buf[T[i] > 13 ? 13 : T[i]] != 'x'))
+			rc += log_error("[%s/%02d] E[12] R[%d]", __FUNCTION__, i, len);
+	}
+
+	return rc;
+}
+
+static
+int printf_asprintf_t(void)
+{
+	int i, len, rc = 0;
+	char *buf, *expected, str[1001];
+
+	memset(str, 'a', 1000);
+	str[1000] = '\0';
+
+	/* lengths around the stack buffer size and far beyond */
+	int T[] = { 0, 1, 254, 255, 256, 257, 1000 };
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		buf = NULL;
+		len = _lucid_asprintf(&buf, "%.*s%n", T[i], str, &len);
+
+		expected = str + 1000 - T[i];
+
+		if (len != T[i] || !buf || strcmp(expected, buf))
+			rc += log_error("[%s/%02d] E[%d] R[%d]",
+			                __FUNCTION__, i, T[i], len);
+
+		free(buf);
+	}
+
+	len = _lucid_asprintf(&buf, "%5000d|%s", 42, str);
+
+	if (len != 6001 || strlen(buf) != 6001 || buf[4998] != '4' ||
+			strcmp(buf + 5001, str))
+		rc += log_error("[%s/%02d] E[6001] R[%d]", __FUNCTION__, i, len);
+
+	free(buf);
+
+	return rc;
+}
+
+static
+int printf_compile_t(void)
+{
+	int i, len, rc = 0;
+	char expected[128], result[128];
+	const printf_prog_t *prog;
+	printf_prog_t *cache;
+	stralloc_t sa;
+
+	const char *T[] = {
+		"",
+		"plain text",
+		"%s|%d|%x",
+		"%%%s%%|%5d%%",
+		"%-*s|%*d|%.*s",
+		"%y %s %q",
+		"trailing %",
+		"%hhu %llx %c %p",
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		cache = NULL;
+
+		/* the cached program must be compiled only once */
+		if (!(prog = printf_compile_once(&cache, T[i])) ||
+				printf_compile_once(&cache, T[i]) != prog) {
+			rc += log_error("[%s/%02d] E[prog] R[NULL]", __FUNCTION__, i);
+			continue;
+		}
+
+		if (strchr(T[i], '*')) {
+			_lucid_snprintf(expected, sizeof(expected), T[i], 6, "ab", -4, 7, 2, "xyz");
+			len = printf_exec_snprintf(prog, result, sizeof(result), 6, "ab", -4, 7, 2, "xyz");
+		}
+
+		else if (strstr(T[i], "%hhu")) {
+			_lucid_snprintf(expected, sizeof(expected), T[i], 258, 1ULL << 40, 'z', &i);
+			len = printf_exec_snprintf(prog, result, sizeof(result), 258, 1ULL << 40, 'z', &i);
+		}
+
+		else {
+			_lucid_snprintf(expected, sizeof(expected), T[i], "str", -1, 255);
+			len = printf_exec_snprintf(prog, result, sizeof(result), "str", -1, 255);
+		}
+
+		if (len != (int) strlen(expected) || strcmp(expected, result))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, expected, result);
+
+		printf_free(cache);
+	}
+
+	/* appending to a dynamic string */
+	cache = NULL;
+	stralloc_init(&sa);
+	stralloc_copys(&sa, "x=");
+
+	prog = printf_compile_once(&cache, "%d,%s");
+
+	if (printf_exec_stralloc(prog, &sa, 42, "y") != 4 ||
+			sa.len != 6 || memcmp(sa.s, "x=42,y", 6))
+		rc += log_error("[%s/%02d] E[x=42,y] R[%.*s]",
+		                __FUNCTION__, i, (int) sa.len, sa.s);
+
+	printf_free(cache);
+	stralloc_free(&sa);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident  = "printf",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	rc += printf_snprintf_t();
+	rc += printf_float_t();
+	rc += printf_ext_t();
+	rc += printf_truncate_t();
+	rc += printf_asprintf_t();
+	rc += printf_compile_t();
+
+	log_close();
+
+	return rc;
+}
@@ -0,0 +1,365 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "scanf.h"
+#include "str.h"
+
+static
+int sscanf_t(void)
+{
+	int i, rc = 0;
+	char s[32];
+	int a, b;
+	long long int ll;
+
+	struct test {
+		const char *str;
+		const char *fmt;
+		int rc;
+		int a, b;
+		long long int ll;
+		const char *s;
+	} T[] = {
+		{ "1 2", "%d %d", 2, 1, 2, 0, "" },
+		{ "-17:x42", "%d:x%d", 2, -17, 42, 0, "" },
+		{ "12345678901234567 3", "%lld %d", 2, 0, 3, 12345678901234567LL, "" },
+		{ "-9223372036854775807 1", "%lld %d", 2, 0, 1, -9223372036854775807LL, "" },
+		{ "123456789", "%4d%d", 2, 1234, 56789, 0, "" },
+		{ "0x1f 017", "%i %i", 2, 31, 15, 0, "" },
+		{ "foo 42", "%s %d", 2, 0, 42, 0, "foo" },
+		{ "foo bar 42", "%*s %s %d", 2, 0, 42, 0, "bar" },
+		{ "7 -", "%d %d", 1, 7, 0, 0, "" },
+		{ "", "%d", -1, 0, 0, 0, "" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		a = b = 0;
+		ll = 0;
+		s[0] = '\0';
+
+		if (strstr(T[i].fmt, "%lld"))
+			rc += _lucid_sscanf(T[i].str, T[i].fmt, &ll, &b) != T[i].rc ||
+			      ll != T[i].ll || b != T[i].b ?
+			      log_error("[%s/%02d] E[%lld,%d] R[%lld,%d]", __FUNCTION__, i,
+			                T[i].ll, T[i].b, ll, b) : 0;
+
+		else if (strstr(T[i].fmt, "%s"))
+			rc += _lucid_sscanf(T[i].str, T[i].fmt, s, &b) != T[i].rc ||
+			      strcmp(s, T[i].s) || b != T[i].b ?
+			      log_error("[%s/%02d] E[%s,%d] R[%s,%d]", __FUNCTION__, i,
+			                T[i].s, T[i].b, s, b) : 0;
+
+		else if (_lucid_sscanf(T[i].str, T[i].fmt, &a, &b) != T[i].rc ||
+				a != T[i].a || b != T[i].b)
+			rc += log_error("[%s/%02d] E[%d,%d] R[%d,%d]", __FUNCTION__, i,
+			                T[i].a, T[i].b, a, b);
+	}
+
+	return rc;
+}
+
+static
+int scanf_compile_t(void)
+{
+	int i, j, rc = 0;
+	scanf_prog_t *prog;
+
+	struct test {
+		const char *fmt;
+		int ncols;
+		int size[3];
+	} T[] = {
+		{ "%15s %lu %lf", 3, { 16, sizeof(unsigned long int), sizeof(double) } },
+		{ "%hhd:%*d:%hd", 2, { 1, sizeof(short int), 0 } },
+		{ "cpu%*d %lld %f", 2, { sizeof(long long int), sizeof(float), 0 } },
+		{ "%3c%n%%", 2, { 3, sizeof(int), 0 } },
+		{ "%s", -1, { 0 } },
+		{ "%d %[a-z]", -1, { 0 } },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if (!(prog = scanf_compile(T[i].fmt))) {
+			if (T[i].ncols != -1)
+				rc += log_error("[%s/%02d] E[%d] R[NULL]", __FUNCTION__, i,
+				                T[i].ncols);
+
+			continue;
+		}
+
+		if (scanf_ncols(prog) != T[i].ncols)
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+			                T[i].ncols, scanf_ncols(prog));
+
+		for (j = 0; j < T[i].ncols; j++)
+			if (scanf_colsize(prog, j) != T[i].size[j])
+				rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+				                T[i].size[j], scanf_colsize(prog, j));
+
+		scanf_free(prog);
+	}
+
+	return rc;
+}
+
+static
+int scanf_exec_buf_t(void)
+{
+	const char *in =
+		"eth0 1024 0.5\n"
+		"lo 77 -2\n"
+		"\n"
+		"broken line\n"
+		"wlan0 12345678901234 1e3\n"
+		"toolongname 1 1\n"
+		"last 9 0.25";
+
+	size_t bad[4];
+	char name[4][6];
+	unsigned long long int bytes[4];
+	double ratio[4];
+	void *arrays[] = { name, bytes, ratio };
+	scanf_cols_t cols = { arrays, 4, 0, 0, bad, 4, 0 };
+	scanf_prog_t *prog;
+	size_t len;
+	int rc = 0;
+
+	if (!(prog = scanf_compile("%5s %llu %lf")))
+		return log_perror("[%s] scanf_compile", __FUNCTION__);
+
+	len = scanf_exec_buf(prog, in, str_len(in), &cols);
+
+	if (len != str_len(in) || cols.lines != 7 || cols.rows != 4 || cols.nbad != 3)
+		rc += log_error("[%s/%02d] E[7,4,3] R[%d,%d,%d]", __FUNCTION__, 0,
+		                (int) cols.lines, (int) cols.rows, (int) cols.nbad);
+
+	else if (bad[0] != 2 || bad[1] != 3 || bad[2] != 5)
+		rc += log_error("[%s/%02d] E[2,3,5] R[%d,%d,%d]", __FUNCTION__, 1,
+		                (int) bad[0], (int) bad[1], (int) bad[2]);
+
+	/* "toolongname 1 1" stops the %5s early and fails to match %llu */
+	else if (strcmp(name[0], "eth0") || strcmp(name[2], "wlan0") ||
+			strcmp(name[3], "last") || bytes[1] != 77 ||
+			bytes[2] != 12345678901234ULL || ratio[0] != 0.5 ||
+			ratio[1] != -2 || ratio[2] != 1000 || ratio[3] != 0.25)
+		rc += log_error("[%s/%02d] E[eth0,77,0.5] R[%s,%llu,%f]", __FUNCTION__,
+		                2, name[0], bytes[1], ratio[0]);
+
+	/* columns are full: nothing more is consumed */
+	if (scanf_exec_buf(prog, in, str_len(in), &cols) != 0 || cols.rows != 4)
+		rc += log_error("[%s/%02d] E[0] R[%d]", __FUNCTION__, 3, (int) cols.rows);
+
+	scanf_free(prog);
+
+	return rc;
+}
+
+#define SCANF_TEST_ROWS 100000
+
+static
+int scanf_exec_fd_t(int mapped)
+{
+	char path[] = "/tmp/scanftest-XXXXXX", line[64];
+	int i, fd, len, pfd[2], rc = 0;
+	unsigned int *id;
+	long long int *val;
+	void *arrays[2];
+	scanf_cols_t cols;
+	scanf_prog_t *prog;
+	pid_t pid = 0;
+
+	id  = malloc(SCANF_TEST_ROWS * sizeof(*id));
+	val = malloc(SCANF_TEST_ROWS * sizeof(*val));
+
+	arrays[0] = id;
+	arrays[1] = val;
+
+	memset(&cols, 0, sizeof(cols));
+	cols.cols = arrays;
+	cols.size = SCANF_TEST_ROWS;
+
+	if (!(prog = scanf_compile("id=%u val=%lld")))
+		return log_perror("[%s] scanf_compile", __FUNCTION__);
+
+	if (mapped) {
+		if ((fd = mkstemp(path)) == -1)
+			return log_perror("[%s] mkstemp", __FUNCTION__);
+
+		unlink(path);
+	}
+
+	else if (pipe(pfd) == -1)
+		return log_perror("[%s] pipe", __FUNCTION__);
+
+	else if ((pid = fork()) == 0) {
+		close(pfd[0]);
+		fd = pfd[1];
+	}
+
+	else {
+		close(pfd[1]);
+		fd = -1;
+	}
+
+	/* the file or the writing child produces all lines */
+	if (fd != -1) {
+		for (i = 0; i < SCANF_TEST_ROWS; i++) {
+			memcpy(line, "id=", 3);
+			len  = 3 + str_fmt_u32(line + 3, i);
+			memcpy(line + len, " val=", 5);
+			len += 5;
+			len += str_fmt_i64(line + len, (long long int) i * -1000003);
+			line[len++] = '\n';
+
+			if (write(fd, line, len) != len)
+				break;
+		}
+
+		if (!mapped)
+			_exit(0);
+
+		/* scanning starts at the current offset */
+		lseek(fd, 0, SEEK_SET);
+	}
+
+	else
+		fd = pfd[0];
+
+	if (scanf_exec_fd(prog, fd, &cols) == -1)
+		rc += log_perror("[%s/%02d] scanf_exec_fd", __FUNCTION__, mapped);
+
+	else if (cols.rows != SCANF_TEST_ROWS || cols.nbad != 0)
+		rc += log_error("[%s/%02d] E[%d,0] R[%d,%d]", __FUNCTION__, mapped,
+		                SCANF_TEST_ROWS, (int) cols.rows, (int) cols.nbad);
+
+	else for (i = 0; i < SCANF_TEST_ROWS; i++) {
+		if (id[i] != (unsigned int) i || val[i] != (long long int) i * -1000003) {
+			rc += log_error("[%s/%02d] E[%d,%lld] R[%u,%lld]", __FUNCTION__,
+			                mapped, i, (long long int) i * -1000003, id[i], val[i]);
+			break;
+		}
+	}
+
+	close(fd);
+
+	if (!mapped)
+		waitpid(pid, NULL, 0);
+
+	scanf_free(prog);
+	free(id);
+	free(val);
+
+	return rc;
+}
+
+/* a mapped file is scanned from its offset and continued where a full column
+ * storage stopped, like a file that is read */
+static
+int scanf_exec_fd_offset_t(void)
+{
+	char path[] = "/tmp/scanftest-XXXXXX", line[16];
+	int i, fd, rc = 0;
+	unsigned int id[4], val[4];
+	void *arrays[] = { id, val };
+	scanf_cols_t cols;
+	scanf_prog_t *prog;
+
+	struct test {
+		int first;
+		int rows;
+		off_t offset;
+	} T[] = {
+		{ 3, 4, 77 },
+		{ 7, 3, 110 },
+		{ 0, 0, 110 },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	if (!(prog = scanf_compile("id=%u val=%u")))
+		return log_perror("[%s] scanf_compile", __FUNCTION__);
+
+	if ((fd = mkstemp(path)) == -1)
+		return log_perror("[%s] mkstemp", __FUNCTION__);
+
+	unlink(path);
+
+	/* ten lines of eleven bytes */
+	for (i = 0; i < 10; i++) {
+		memcpy(line, "id=0 val=0\n", 11);
+		line[3] = line[9] = '0' + i;
+
+		if (write(fd, line, 11) != 11)
+			return log_perror("[%s] write", __FUNCTION__);
+	}
+
+	lseek(fd, 33, SEEK_SET);
+
+	for (i = 0; i < TS; i++) {
+		memset(&cols, 0, sizeof(cols));
+		cols.cols = arrays;
+		cols.size = 4;
+
+		if (scanf_exec_fd(prog, fd, &cols) == -1)
+			rc += log_perror("[%s/%02d] scanf_exec_fd", __FUNCTION__, i);
+
+		else if ((int) cols.rows != T[i].rows ||
+				(T[i].rows > 0 && (id[0] != (unsigned int) T[i].first ||
+				val[T[i].rows - 1] != (unsigned int) T[i].first + T[i].rows - 1)) ||
+				lseek(fd, 0, SEEK_CUR) != T[i].offset)
+			rc += log_error("[%s/%02d] E[%d,%d] R[%d,%u]", __FUNCTION__, i,
+			                T[i].rows, T[i].first, (int) cols.rows, id[0]);
+	}
+
+	close(fd);
+	scanf_free(prog);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident = "scanf",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	rc += sscanf_t();
+	rc += scanf_compile_t();
+	rc += scanf_exec_buf_t();
+	rc += scanf_exec_fd_t(0);
+	rc += scanf_exec_fd_t(1);
+	rc += scanf_exec_fd_offset_t();
+
+	log_close();
+
+	return rc;
+}
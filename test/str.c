@@ -15,11 +15,13 @@
 // Free Software Foundation, Inc.,
 // 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "log.h"
+#include "rtti.h"
 #include "str.h"
 
 static
@@ -291,6 +293,304 @@ int str_toupper_t(void)
 	return rc;
 }
 
+static
+int str_fmt_t(void)
+{
+	int i, j, len, rc = 0;
+	char expected[32], result[32];
+	uint64_t v, p;
+
+	uint64_t T[] = {
+		0, 1, 9, 10, 99, 100, 12345, UINT32_MAX, (uint64_t) UINT32_MAX + 1,
+		99999999999999999ULL, 100000000000000000ULL, INT64_MAX,
+		(uint64_t) INT64_MIN, UINT64_MAX,
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		snprintf(expected, sizeof(expected), "%llu", (unsigned long long) T[i]);
+		len = str_fmt_u64(result, T[i]);
+		result[len] = '\0';
+
+		if (strcmp(expected, result))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, expected, result);
+
+		snprintf(expected, sizeof(expected), "%lld", (long long) T[i]);
+		len = str_fmt_i64(result, T[i]);
+		result[len] = '\0';
+
+		if (strcmp(expected, result))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, expected, result);
+
+		snprintf(expected, sizeof(expected), "%llX", (unsigned long long) T[i]);
+		len = str_fmt_x64(result, T[i], 1);
+		result[len] = '\0';
+
+		if (strcmp(expected, result))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, expected, result);
+	}
+
+	/* every digit count around every power of ten */
+	for (i = 0, p = 1; i < 20; i++, p *= 10) {
+		for (j = -1; j <= 1; j++) {
+			v = p + j;
+
+			snprintf(expected, sizeof(expected), "%llu", (unsigned long long) v);
+
+			if (v <= UINT32_MAX)
+				len = str_fmt_u32(result, v);
+			else
+				len = str_fmt_u64(result, v);
+
+			result[len] = '\0';
+
+			if (strcmp(expected, result))
+				rc += log_error("[%s/%02d] E[%s] R[%s]",
+				                __FUNCTION__, i, expected, result);
+		}
+	}
+
+	return rc;
+}
+
+static
+int str_fmt_double_t(void)
+{
+	int i, len, rc = 0;
+	char result[STR_FMT_DBL_MAX + 1];
+
+	struct test {
+		double val;
+		const char *str;
+	} T[] = {
+		{ 0.0,                     "0" },
+		{ -0.0,                    "-0" },
+		{ 1.0,                     "1" },
+		{ 0.1,                     "0.1" },
+		{ 0.3,                     "0.3" },
+		{ 0.1 + 0.2,               "0.30000000000000004" },
+		{ 1.5e-5,                  "1.5e-05" },
+		{ 0.0001,                  "0.0001" },
+		{ 123456789012345.0,       "123456789012345" },
+		{ 1e16,                    "1e+16" },
+		{ 9007199254740993.0,      "9007199254740992" },
+		{ 5e-324,                  "5e-324" },
+		{ 2.2250738585072014e-308, "2.2250738585072014e-308" },
+		{ 1.7976931348623157e308,  "1.7976931348623157e+308" },
+		{ -1.25e100,               "-1.25e+100" },
+		{ 1.0 / 0.0,               "inf" },
+		{ -1.0 / 0.0,              "-inf" },
+		{ 0.0 / 0.0,               "nan" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		len = str_fmt_double(result, T[i].val);
+		result[len] = '\0';
+
+		if (strcmp(T[i].str, result))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, T[i].str, result);
+	}
+
+	/* single precision has its own shortest digits */
+	len = str_fmt_float(result, 0.1f);
+	result[len] = '\0';
+
+	if (strcmp("0.1", result))
+		rc += log_error("[%s/%02d] E[0.1] R[%s]", __FUNCTION__, i, result);
+
+	return rc;
+}
+
+static
+int str_fmt_roundtrip_t(void)
+{
+	int i, len, rc = 0;
+	char buf[STR_FMT_DBL_MAX + 1], *enc;
+	const char *p;
+	uint64_t bits, x = 0x9e3779b97f4a7c15ULL;
+	uint32_t fbits;
+	double val, back;
+	float fval, fback;
+
+	double T[] = {
+		0.0, -0.0, 1.0, 0.1, 1.0 / 3.0, 5e-324, 2.2250738585072009e-308,
+		2.2250738585072014e-308, 1.7976931348623157e308, 9007199254740993.0,
+		123456789.125, 1e23, 8.41e21, 4.9406564584124654e-324,
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	/* edge values first, then pseudo-random finite bit patterns */
+	for (i = 0; i < TS + 10000; i++) {
+		if (i < TS)
+			val = T[i];
+
+		else {
+			x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+			bits = x;
+
+			if (((bits >> 52) & 0x7ff) == 0x7ff)
+				bits ^= 1ULL << 62;
+
+			memcpy(&val, &bits, sizeof(val));
+		}
+
+		len = str_fmt_double(buf, val);
+		buf[len] = '\0';
+		back = 0;
+
+		if (str_todouble(buf, &back, len) != len ||
+				memcmp(&val, &back, sizeof(val)))
+			rc += log_error("[%s/%02d] E[%.17g] R[%s,%.17g]",
+			                __FUNCTION__, i, val, buf, back);
+
+		memcpy(&fbits, &x, sizeof(fbits));
+
+		if (i < TS)
+			fval = (float) T[i];
+
+		else {
+			if (((fbits >> 23) & 0xff) == 0xff)
+				fbits ^= 1U << 30;
+
+			memcpy(&fval, &fbits, sizeof(fval));
+		}
+
+		len = str_fmt_float(buf, fval);
+		buf[len] = '\0';
+		fback = 0;
+
+		if (str_tofloat(buf, &fback, len) != len ||
+				memcmp(&fval, &fback, sizeof(fval)))
+			rc += log_error("[%s/%02d] E[%.9g] R[%s,%.9g]",
+			                __FUNCTION__, i, (double) fval, buf, (double) fback);
+	}
+
+	/* the rtti float types go through the same code */
+	for (i = 0; i < TS; i++) {
+		if (!(enc = rtti_encode(&rtti_double_type, &T[i]))) {
+			rc += log_error("[%s/%02d] E[%.17g] R[NULL]",
+			                __FUNCTION__, i, T[i]);
+			continue;
+		}
+
+		p    = enc;
+		back = 0;
+		rtti_decode(&rtti_double_type, &p, &back);
+
+		if (*p || memcmp(&T[i], &back, sizeof(back)))
+			rc += log_error("[%s/%02d] E[%.17g] R[%s,%.17g]",
+			                __FUNCTION__, i, T[i], enc, back);
+
+		free(enc);
+
+		fval = (float) T[i];
+
+		if (!(enc = rtti_encode(&rtti_float_type, &fval))) {
+			rc += log_error("[%s/%02d] E[%.9g] R[NULL]",
+			                __FUNCTION__, i, (double) fval);
+			continue;
+		}
+
+		p     = enc;
+		fback = 0;
+		rtti_decode(&rtti_float_type, &p, &fback);
+
+		if (*p || memcmp(&fval, &fback, sizeof(fback)))
+			rc += log_error("[%s/%02d] E[%.9g] R[%s,%.9g]",
+			                __FUNCTION__, i, (double) fval, enc, (double) fback);
+
+		free(enc);
+	}
+
+	return rc;
+}
+
+static
+int str_todouble_t(void)
+{
+	int i, len, rc = 0, err, experr;
+	double val, expected;
+	float fval, fexpected;
+
+	struct test {
+		const char *str;
+		int len;
+	} T[] = {
+		{ "0",                        1 },
+		{ "-0.0",                     4 },
+		{ "  1.5",                    5 },
+		{ "1e5x",                     3 },
+		{ "1e",                       1 },
+		{ ".5",                       2 },
+		{ "1.",                       2 },
+		{ "0.1",                      3 },
+		{ "3.14159265358979323846",  22 },
+		{ "1e23",                     4 },
+		{ "9007199254740993",        16 },
+		{ "2.4703282292062327e-324", 23 },
+		{ "2.4703282292062328e-324", 23 },
+		{ "1.7976931348623158e308",  22 },
+		{ "1e400",                    5 },
+		{ "1e-400",                   6 },
+		{ "1e-310",                   6 },
+		{ "1e-40",                    5 },
+		/* exactly halfway between two doubles, plus one more digit */
+		{ "9007199254740993.0000000000000000000000001", 42 },
+		{ "-INF",                     4 },
+		{ "infinity",                 8 },
+		{ "abc",                      0 },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		/* overflow and underflow set ERANGE like strtod(3) */
+		val = 0;
+		errno = 0;
+		len = str_todouble(T[i].str, &val, strlen(T[i].str));
+		err = errno == ERANGE;
+		errno = 0;
+		expected = strtod(T[i].str, NULL);
+		experr = errno == ERANGE;
+
+		if (len != T[i].len || memcmp(&val, &expected, sizeof(val)) ||
+				err != experr)
+			rc += log_error("[%s/%02d] E[%d,%.17g,%d] R[%d,%.17g,%d]",
+			                __FUNCTION__, i, T[i].len, expected, experr,
+			                len, val, err);
+
+		fval = 0;
+		errno = 0;
+		len  = str_tofloat(T[i].str, &fval, strlen(T[i].str));
+		err = errno == ERANGE;
+		errno = 0;
+		fexpected = strtof(T[i].str, NULL);
+		experr = errno == ERANGE;
+
+		if (len != T[i].len || fval != fexpected || err != experr)
+			rc += log_error("[%s/%02d] E[%d,%.9g,%d] R[%d,%.9g,%d]",
+			                __FUNCTION__, i, T[i].len, (double) fexpected,
+			                experr, len, (double) fval, err);
+	}
+
+	/* nan is not equal to itself */
+	len = str_todouble("nan", &val, 3);
+
+	if (len != 3 || val == val)
+		rc += log_error("[%s/%02d] E[3,nan] R[%d,%.17g]",
+		                __FUNCTION__, i, len, val);
+
+	return rc;
+}
+
 int main(int argc, char *argv[])
 {
 	int rc = EXIT_SUCCESS;
@@ -304,10 +604,14 @@ int main(int argc, char *argv[])
 	log_init(&log_options);
 
 	rc += str_check_t();
+	rc += str_fmt_t();
+	rc += str_fmt_double_t();
+	rc += str_fmt_roundtrip_t();
 	rc += str_path_basedirname_t();
 	rc += str_path_concat_t();
 	rc += str_path_isabs_t();
 	rc += str_path_isdot_t();
+	rc += str_todouble_t();
 	rc += str_tolower_t();
 	rc += str_toupper_t();
 
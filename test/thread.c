@@ -0,0 +1,220 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "log.h"
+#include "printf.h"
+#include "str.h"
+#include "uio.h"
+#include "whirlpool.h"
+
+#define THREAD_TEST_MAX  8
+#define THREAD_TEST_OPS  20000
+
+static char thread_dir[] = "/tmp/threadtest-XXXXXX";
+static char *thread_digest;
+
+/* one worker: every iteration exercises the modules that used to keep
+ * process-wide state; returns the number of wrong results */
+static
+void *thread_worker(void *arg)
+{
+	long id = (long) arg, rc = 0;
+	char buf[64], ref[64], path[128], *p;
+	int i, src, dst;
+	struct stat sb;
+
+	for (i = 0; i < THREAD_TEST_OPS; i++) {
+		/* error stacks are per thread */
+		error_set(EINVAL, "op %d of %ld", i, id);
+		error_pass("context %ld", id);
+
+		_lucid_snprintf(ref, sizeof(ref), "op %d of %ld", i, id);
+
+		if (error_count(__lucid_error) != 2)
+			rc++;
+
+		error_pop(__lucid_error);
+		p = error_describe(error_pop(__lucid_error), "in");
+
+		if (!p || !strstr(p, ref))
+			rc++;
+
+		free(p);
+		error_clear();
+
+		/* formatting */
+		_lucid_snprintf(buf, sizeof(buf), "%d-%ld-%x-%s", i, id, i, "x");
+		snprintf(ref, sizeof(ref), "%d-%ld-%x-%s", i, id, i, "x");
+
+		if (strcmp(buf, ref))
+			rc++;
+
+		/* logging */
+		log_info("t%ld m%d", id, i);
+
+		if (i % 64)
+			continue;
+
+		if (!(p = whirlpool_digest("thread")) || strcmp(p, thread_digest))
+			rc++;
+
+		free(p);
+
+		/* directories are created without changing the working
+		 * directory, relative paths of other threads stay valid */
+		_lucid_snprintf(path, sizeof(path), "%s/%ld/%d/a/b", thread_dir, id, i);
+
+		if (uio_mkdir(path, 0700) == -1 || stat(path, &sb) == -1)
+			rc++;
+
+		_lucid_snprintf(path, sizeof(path), "%s/%ld/%d/f", thread_dir, id, i);
+
+		if ((src = open("/proc/self/exe", O_RDONLY)) == -1 ||
+				(dst = open(path, O_RDWR|O_CREAT|O_TRUNC, 0600)) == -1 ||
+				uio_copy(src, dst) == -1)
+			rc++;
+
+		close(src);
+		close(dst);
+	}
+
+	return (void *) rc;
+}
+
+static
+double thread_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static
+int thread_scale_t(void)
+{
+	pthread_t threads[THREAD_TEST_MAX];
+	char path[] = "/tmp/threadtest-XXXXXX", *buf, *p;
+	int i, n, fd, lines, max, rc = 0;
+	double start, secs, base = 0;
+	void *res;
+	struct stat sb;
+
+	max = sysconf(_SC_NPROCESSORS_ONLN);
+	max = max < 2 ? 2 : max > THREAD_TEST_MAX ? THREAD_TEST_MAX : max;
+
+	/* 1, 2, 4, ... threads, and max */
+	for (n = 1; n <= max; n = n < max && n * 2 > max ? max : n * 2) {
+		if ((fd = mkstemp(path)) == -1)
+			return log_perror("[%s] mkstemp", __FUNCTION__);
+
+		unlink(path);
+		str_cpy(path + 16, "XXXXXX");
+
+		log_options_t log_options = {
+			.log_ident    = "thread",
+			.log_dest     = LOGD_FILE,
+			.log_fd       = dup(fd),
+			.log_opts     = LOGO_ASYNC,
+			.log_overflow = LOGQ_BLOCK,
+		};
+
+		log_init(&log_options);
+
+		start = thread_now();
+
+		for (i = 0; i < n; i++)
+			pthread_create(&threads[i], NULL, thread_worker, (void *) (long) i);
+
+		for (i = 0; i < n; i++) {
+			pthread_join(threads[i], &res);
+
+			if (res)
+				rc += log_error("[%s/%02d] E[0] R[%ld]", __FUNCTION__, n,
+				                (long) res);
+		}
+
+		log_close();
+
+		secs = thread_now() - start;
+
+		/* every message arrived */
+		lines = 0;
+
+		if (fstat(fd, &sb) == 0 && (buf = malloc(sb.st_size + 1))) {
+			buf[pread(fd, buf, sb.st_size, 0)] = '\0';
+
+			for (p = buf; (p = strchr(p, '\n')); p++)
+				lines++;
+
+			free(buf);
+		}
+
+		close(fd);
+
+		log_options.log_dest = LOGD_STDERR;
+		log_options.log_opts = LOGO_PRIO|LOGO_IDENT;
+		log_init(&log_options);
+
+		if (lines != n * THREAD_TEST_OPS)
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, n,
+			                n * THREAD_TEST_OPS, lines);
+
+		if (n == 1)
+			base = THREAD_TEST_OPS / secs;
+
+		log_info("%d threads: %.0f ops/s, %.2fx", n,
+		         n * THREAD_TEST_OPS / secs, n * THREAD_TEST_OPS / secs / base);
+	}
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident = "thread",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	if (!mkdtemp(thread_dir) || !(thread_digest = whirlpool_digest("thread")))
+		return log_perror("mkdtemp");
+
+	rc += thread_scale_t();
+
+	uio_unlink(thread_dir);
+	free(thread_digest);
+	log_close();
+
+	return rc;
+}
@@ -0,0 +1,598 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "str.h"
+#include "uio.h"
+
+static
+int uio_tmpfile(const char *str)
+{
+	char path[] = "/tmp/uiotest-XXXXXX";
+	int fd, len = str_len(str);
+
+	if ((fd = mkstemp(path)) == -1)
+		return -1;
+
+	unlink(path);
+
+	if (write(fd, str, len) != len || lseek(fd, 0, SEEK_SET) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* a pipe holding str */
+static
+int uio_tmppipe(const char *str)
+{
+	int fds[2], len = str_len(str);
+
+	if (pipe(fds) == -1)
+		return -1;
+
+	if (write(fds[1], str, len) != len) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	close(fds[1]);
+	return fds[0];
+}
+
+static
+int uio_reader_line_t(void)
+{
+	int i, n, len, fd, rc = 0;
+	char buf[8], out[256];
+	const char *line;
+	uio_reader_t r;
+
+	struct test {
+		int size;
+		const char *in;
+		const char *out;
+	} T[] = {
+		{ 0, "", "" },
+		{ 0, "foo\nbar\n", "foo|bar|" },
+		{ 0, "foo\r\nbar", "foo|bar|" },
+		{ 0, "\n\nfoo\r\r\n", "||foo\r|" },
+		{ 8, "0123\n4567\n89", "0123|4567|89|" },
+		{ 8, "01234567\nab", "ENOBUFS" },
+		{ 4, "0123456789\n0123456789abcdef", "0123456789|0123456789abcdef|" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if ((fd = uio_tmpfile(T[i].in)) == -1)
+			return log_perror("[%s/%02d] uio_tmpfile", __FUNCTION__, i);
+
+		/* a size of 8 uses fixed storage, others grow from size */
+		if (T[i].size == 8)
+			uio_reader_init(&r, fd, buf, sizeof(buf), 0);
+		else
+			uio_reader_init(&r, fd, NULL, T[i].size, 0);
+
+		out[0] = '\0';
+
+		while ((n = uio_reader_read_line(&r, &line, &len)) > 0)
+			snprintf(out + str_len(out), sizeof(out) - str_len(out),
+			         "%.*s|", len, line);
+
+		if (n == -1)
+			snprintf(out, sizeof(out), "%s",
+			         errno == ENOBUFS ? "ENOBUFS" : "ERROR");
+
+		if (strcmp(out, T[i].out))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, T[i].out, out);
+
+		uio_reader_free(&r);
+		close(fd);
+	}
+
+	return rc;
+}
+
+static
+int uio_reader_until_t(void)
+{
+	int i, n, fd, rc = 0;
+	char buf[4], out[256];
+	const char *rec;
+	uio_reader_t r;
+
+	struct test {
+		int delim;
+		const char *in;
+		const char *out;
+	} T[] = {
+		{ ',', "a,bb,ccc", "[a,][bb,][ccc]" },
+		{ ',', ",,", "[,][,]" },
+		{ ':', "3:foo,4:barz,", "[3:]" },
+		{ '\0', "ab", "[ab]" },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if ((fd = uio_tmppipe(T[i].in)) == -1)
+			return log_perror("[%s/%02d] uio_tmppipe", __FUNCTION__, i);
+
+		uio_reader_init(&r, fd, buf, sizeof(buf), 0);
+		out[0] = '\0';
+
+		/* the second record of the third test does not fit the buffer */
+		while ((n = uio_reader_read_until(&r, T[i].delim, &rec)) > 0)
+			snprintf(out + str_len(out), sizeof(out) - str_len(out),
+			         "[%.*s]", n, rec);
+
+		if (n == -1 && errno != ENOBUFS)
+			rc += log_perror("[%s/%02d] uio_reader_read_until",
+			                 __FUNCTION__, i);
+
+		else if (strcmp(out, T[i].out))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i, T[i].out, out);
+
+		uio_reader_free(&r);
+		close(fd);
+	}
+
+	return rc;
+}
+
+static
+int uio_reader_exact_t(void)
+{
+	int n, fd, rc = 0;
+	char buf[8], out[32];
+	const char *view;
+	uio_reader_t r;
+
+	if ((fd = uio_tmpfile("0123456789abcdefghijklmnopqrstuvwxyz")) == -1)
+		return log_perror("[%s/%02d] uio_tmpfile", __FUNCTION__, 0);
+
+	uio_reader_init(&r, fd, buf, sizeof(buf), 0);
+
+	if ((n = uio_reader_peek(&r, 3, &view)) != 3 || memcmp(view, "012", 3))
+		rc += log_error("[%s/%02d] E[3] R[%d]", __FUNCTION__, 0, n);
+
+	/* partly buffered, the rest is read directly */
+	if ((n = uio_reader_read_exact(&r, out, 20)) != 20 ||
+			memcmp(out, "0123456789abcdefghij", 20))
+		rc += log_error("[%s/%02d] E[20] R[%d]", __FUNCTION__, 1, n);
+
+	if ((n = uio_reader_skip(&r, 3)) != 3)
+		rc += log_error("[%s/%02d] E[3] R[%d]", __FUNCTION__, 2, n);
+
+	if ((n = uio_reader_peek(&r, 9, &view)) != -1 || errno != ENOBUFS)
+		rc += log_error("[%s/%02d] E[ENOBUFS] R[%d]", __FUNCTION__, 3, n);
+
+	if ((n = uio_reader_read_exact(&r, out, 4)) != 4 || memcmp(out, "nopq", 4))
+		rc += log_error("[%s/%02d] E[4] R[%d]", __FUNCTION__, 4, n);
+
+	/* unconsumed bytes are handed back */
+	if (uio_reader_free(&r) == -1 || (n = lseek(fd, 0, SEEK_CUR)) != 27)
+		rc += log_error("[%s/%02d] E[27] R[%d]", __FUNCTION__, 5, n);
+
+	uio_reader_init(&r, fd, NULL, 0, 0);
+
+	if ((n = uio_reader_read_exact(&r, out, 32)) != 9 || memcmp(out, "rstuvwxyz", 9))
+		rc += log_error("[%s/%02d] E[9] R[%d]", __FUNCTION__, 6, n);
+
+	if ((n = uio_reader_peek(&r, 1, &view)) != 0)
+		rc += log_error("[%s/%02d] E[0] R[%d]", __FUNCTION__, 7, n);
+
+	uio_reader_free(&r);
+
+	/* caller storage needs a size */
+	errno = 0;
+
+	if (uio_reader_init(&r, fd, buf, 0, 0) != -1 || errno != EINVAL)
+		rc += log_error("[%s/%02d] E[EINVAL] R[%d]", __FUNCTION__, 8, errno);
+
+	close(fd);
+
+	return rc;
+}
+
+static
+int uio_netstring_t(void)
+{
+	int i, n, len, fd, rc = 0;
+	char buf[32], out[64];
+	const char *str;
+	uio_reader_t r;
+
+	struct iovec iov[] = {
+		{ "foo", 3 },
+		{ "", 0 },
+		{ "a,b\n", 4 },
+	};
+
+	struct test {
+		const char *in;
+		int rc;
+		const char *out;
+	} T[] = {
+		{ "3:foo,", 6, "foo" },
+		{ "0:,", 3, "" },
+		{ "", 0, "" },
+		{ "3:fo", EINVAL, NULL },
+		{ "3:fooX", EINVAL, NULL },
+		{ ":,", EINVAL, NULL },
+		{ "x:,", EINVAL, NULL },
+		{ "12345678901:", EINVAL, NULL },
+		{ "2147483647:", ERANGE, NULL },
+		{ "40:0123456789012345678901234567890123456789,", ENOBUFS, NULL },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	for (i = 0; i < TS; i++) {
+		if ((fd = uio_tmpfile(T[i].in)) == -1)
+			return log_perror("[%s/%02d] uio_tmpfile", __FUNCTION__, i);
+
+		uio_reader_init(&r, fd, buf, sizeof(buf), 0);
+
+		n = uio_reader_read_netstring(&r, &str, &len);
+
+		if (T[i].out && (n != T[i].rc || len != str_len(T[i].out) ||
+				memcmp(str, T[i].out, len)))
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i, T[i].rc, n);
+
+		if (!T[i].out && (n != -1 || errno != T[i].rc))
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i, T[i].rc, errno);
+
+		uio_reader_free(&r);
+		close(fd);
+	}
+
+	/* batched output */
+	if ((fd = uio_tmpfile("")) == -1)
+		return log_perror("[%s/%02d] uio_tmpfile", __FUNCTION__, i);
+
+	if ((n = uio_write_netstringv(fd, iov, 3)) != 16)
+		rc += log_error("[%s/%02d] E[16] R[%d]", __FUNCTION__, i, n);
+
+	if ((n = uio_write_netstring(fd, "hello")) != 8)
+		rc += log_error("[%s/%02d] E[8] R[%d]", __FUNCTION__, i + 1, n);
+
+	if ((n = pread(fd, out, sizeof(out), 0)) != 24 ||
+			memcmp(out, "3:foo,0:,4:a,b\n,5:hello,", 24))
+		rc += log_error("[%s/%02d] E[24] R[%d]", __FUNCTION__, i + 2, n);
+
+	/* frames are parsed from the buffer without copying */
+	lseek(fd, 0, SEEK_SET);
+	uio_reader_init(&r, fd, buf, sizeof(buf), 0);
+	out[0] = '\0';
+
+	while ((n = uio_reader_read_netstring(&r, &str, &len)) > 0)
+		snprintf(out + str_len(out), sizeof(out) - str_len(out),
+		         "[%.*s]", len, str);
+
+	if (n != 0 || strcmp(out, "[foo][][a,b\n][hello]"))
+		rc += log_error("[%s/%02d] E[[foo][][a,b\\n][hello]] R[%s]",
+		                __FUNCTION__, i + 3, out);
+
+	uio_reader_free(&r);
+	close(fd);
+
+	return rc;
+}
+
+static
+int uio_read_eof_t(void)
+{
+	int i, n, fd, rc = 0;
+	char *in, *str, buf[5000];
+	const char *view;
+	size_t len;
+
+	/* larger than a page, not a multiple of it */
+	if (!(in = malloc(10001)))
+		return log_perror("[%s/%02d] malloc", __FUNCTION__, 0);
+
+	for (i = 0; i < 10000; i++)
+		in[i] = 'a' + i % 26;
+
+	in[10000] = '\0';
+
+	for (i = 0; i < 2; i++) {
+		if ((fd = i ? uio_tmppipe(in) : uio_tmpfile(in)) == -1)
+			return log_perror("[%s/%02d] uio_tmp", __FUNCTION__, i);
+
+		if (read(fd, buf, sizeof(buf)) != sizeof(buf))
+			return log_perror("[%s/%02d] read", __FUNCTION__, i);
+
+		str = NULL;
+
+		if ((n = uio_read_eof(fd, &str)) != 5000 || strcmp(str, in + 5000))
+			rc += log_error("[%s/%02d] E[5000] R[%d]", __FUNCTION__, i, n);
+
+		free(str);
+
+		if ((n = uio_read_eof(fd, &str)) != 0 || strcmp(str, ""))
+			rc += log_error("[%s/%02d] E[0] R[%d]", __FUNCTION__, i, n);
+
+		free(str);
+		close(fd);
+	}
+
+	/* caller storage */
+	if ((fd = uio_tmppipe("0123456789")) == -1)
+		return log_perror("[%s/%02d] uio_tmppipe", __FUNCTION__, 2);
+
+	if ((n = uio_read_eofn(fd, buf, 4)) != -1 || errno != EFBIG)
+		rc += log_error("[%s/%02d] E[EFBIG] R[%d]", __FUNCTION__, 2, n);
+
+	if ((n = uio_read_eofn(fd, buf, 5)) != 5 || memcmp(buf, "56789", 5))
+		rc += log_error("[%s/%02d] E[5] R[%d]", __FUNCTION__, 3, n);
+
+	close(fd);
+
+	/* mapped view from an offset inside the second page */
+	if ((fd = uio_tmpfile(in)) == -1)
+		return log_perror("[%s/%02d] uio_tmpfile", __FUNCTION__, 4);
+
+	lseek(fd, 5000, SEEK_SET);
+
+	if (uio_map_eof(fd, &view, &len) == -1)
+		rc += log_perror("[%s/%02d] uio_map_eof", __FUNCTION__, 4);
+
+	else {
+		if (len != 5000 || memcmp(view, in + 5000, len) ||
+				lseek(fd, 0, SEEK_CUR) != 10000)
+			rc += log_error("[%s/%02d] E[5000] R[%d]", __FUNCTION__, 5, (int) len);
+
+		if (uio_unmap_eof(view, len) == -1)
+			rc += log_perror("[%s/%02d] uio_unmap_eof", __FUNCTION__, 6);
+	}
+
+	if (uio_map_eof(fd, &view, &len) == -1 || len != 0)
+		rc += log_error("[%s/%02d] E[0] R[%d]", __FUNCTION__, 7, (int) len);
+
+	close(fd);
+
+	if ((fd = uio_tmppipe(in + 9990)) == -1)
+		return log_perror("[%s/%02d] uio_tmppipe", __FUNCTION__, 8);
+
+	if (uio_map_eof(fd, &view, &len) != -1 || errno != ENODEV)
+		rc += log_error("[%s/%02d] E[ENODEV] R[%d]", __FUNCTION__, 8, errno);
+
+	close(fd);
+	free(in);
+
+	return rc;
+}
+
+static
+int uio_copy_t(void)
+{
+	int i, srcfd, dstfd, rc = 0;
+	static char src[3 << 20], dst[3 << 20];
+	struct stat sb;
+
+	/* data at both ends of a sparse file, the destination holds more stale
+	 * data than that */
+	if ((srcfd = uio_tmpfile("abc")) == -1 || (dstfd = uio_tmpfile("")) == -1)
+		return log_perror("[%s/%02d] uio_tmpfile", __FUNCTION__, 0);
+
+	memset(src, 'S', sizeof(src));
+
+	if (write(dstfd, src, sizeof(src)) != sizeof(src) ||
+			pwrite(srcfd, "xyz", 3, (2 << 20) - 3) != 3)
+		return log_perror("[%s/%02d] write", __FUNCTION__, 0);
+
+	lseek(srcfd, 1, SEEK_SET);
+	lseek(dstfd, 2, SEEK_SET);
+
+	if (uio_copy(srcfd, dstfd) == -1)
+		rc += log_perror("[%s/%02d] uio_copy", __FUNCTION__, 0);
+
+	memset(src, 0, sizeof(src));
+	memcpy(src, "abc", 3);
+	memcpy(src + (2 << 20) - 3, "xyz", 3);
+
+	if (fstat(dstfd, &sb) == -1 || sb.st_size != 2 << 20)
+		rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, 1,
+		                2 << 20, (int) sb.st_size);
+
+	if ((i = pread(dstfd, dst, sizeof(dst), 0)) != 2 << 20 ||
+			memcmp(src, dst, 2 << 20))
+		rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, 2, 2 << 20, i);
+
+	/* offsets are preserved */
+	if (lseek(srcfd, 0, SEEK_CUR) != 1 || lseek(dstfd, 0, SEEK_CUR) != 2)
+		rc += log_error("[%s/%02d] E[1,2] R[%d,%d]", __FUNCTION__, 3,
+		                (int) lseek(srcfd, 0, SEEK_CUR),
+		                (int) lseek(dstfd, 0, SEEK_CUR));
+
+	if (uio_copy(srcfd, srcfd) != -1 || errno != EINVAL)
+		rc += log_error("[%s/%02d] E[EINVAL] R[%d]", __FUNCTION__, 4, errno);
+
+	close(srcfd);
+	close(dstfd);
+
+	return rc;
+}
+
+struct uio_progress {
+	int calls;
+	off_t done;
+	int backwards;
+};
+
+static
+void uio_progress(off_t done, off_t total, void *data)
+{
+	struct uio_progress *p = data;
+
+	if (done < p->done || done > total)
+		p->backwards++;
+
+	p->calls++;
+	p->done = done;
+}
+
+static
+int uio_copy_parallel_t(void)
+{
+	int i, srcfd, dstfd, rc = 0;
+	static char src[5 << 20], dst[5 << 20];
+	struct uio_progress progress;
+	struct stat sb;
+
+	struct test {
+		int threads;
+		off_t chunk;
+	} T[] = {
+		{ 1, 0 },
+		{ 4, 65536 },
+		{ 3, 100000 },
+		{ 0, 0 },
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	/* data, a hole and data again, not ending on a page boundary */
+	for (i = 0; i < (2 << 20); i++)
+		src[i] = 'a' + i % 26;
+
+	memset(src + (2 << 20), 0, 2 << 20);
+	memset(src + (4 << 20), 'z', 12345);
+
+	for (i = 0; i < TS; i++) {
+		if ((srcfd = uio_tmpfile("")) == -1 || (dstfd = uio_tmpfile("x")) == -1)
+			return log_perror("[%s/%02d] uio_tmpfile", __FUNCTION__, i);
+
+		if (pwrite(srcfd, src, 2 << 20, 0) != 2 << 20 ||
+				pwrite(srcfd, src + (4 << 20), 12345, 4 << 20) != 12345)
+			return log_perror("[%s/%02d] pwrite", __FUNCTION__, i);
+
+		memset(&progress, 0, sizeof(progress));
+
+		uio_copy_options_t opts = {
+			.threads  = T[i].threads,
+			.chunk    = T[i].chunk,
+			.progress = uio_progress,
+			.data     = &progress,
+		};
+
+		if (uio_copy_parallel(srcfd, dstfd, &opts) == -1)
+			rc += log_perror("[%s/%02d] uio_copy_parallel", __FUNCTION__, i);
+
+		else if (fstat(dstfd, &sb) == -1 || sb.st_size != (4 << 20) + 12345 ||
+				pread(dstfd, dst, sizeof(dst), 0) != sb.st_size ||
+				memcmp(src, dst, sb.st_size))
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+			                (4 << 20) + 12345, (int) sb.st_size);
+
+		else if (progress.done != sb.st_size || progress.backwards)
+			rc += log_error("[%s/%02d] E[%d] R[%d]", __FUNCTION__, i,
+			                (int) sb.st_size, (int) progress.done);
+
+		close(srcfd);
+		close(dstfd);
+	}
+
+	return rc;
+}
+
+/* the uio_read_* functions leave the rest of the input on the descriptor */
+static
+int uio_read_t(void)
+{
+	int i, n, fd, rc = 0;
+	char *str, rest[64];
+
+	const char *in = "foo\r\n3:bar,0:,ab\n";
+
+	for (i = 0; i < 2; i++) {
+		if ((fd = i ? uio_tmppipe(in) : uio_tmpfile(in)) == -1)
+			return log_perror("[%s/%02d] uio_tmp", __FUNCTION__, i);
+
+		str = NULL;
+
+		if ((n = uio_read_eol(fd, &str)) != 3 || strcmp(str, "foo"))
+			rc += log_error("[%s/%02d] E[foo] R[%d]", __FUNCTION__, i, n);
+
+		free(str);
+
+		if ((n = uio_read_eol(fd, &str)) != 0 || strcmp(str, ""))
+			rc += log_error("[%s/%02d] E[] R[%d]", __FUNCTION__, i, n);
+
+		free(str);
+		str = NULL;
+
+		if ((n = uio_read_netstring(fd, &str)) != 3 || strcmp(str, "bar"))
+			rc += log_error("[%s/%02d] E[bar] R[%d]", __FUNCTION__, i, n);
+
+		free(str);
+
+		if ((n = uio_read_netstring(fd, &str)) != 0)
+			rc += log_error("[%s/%02d] E[0] R[%d]", __FUNCTION__, i, n);
+
+		if ((n = uio_read_netstring(fd, &str)) != -1 || errno != EINVAL)
+			rc += log_error("[%s/%02d] E[EINVAL] R[%d]", __FUNCTION__, i, n);
+
+		if ((n = read(fd, rest, sizeof(rest))) != 2 || memcmp(rest, "b\n", 2))
+			rc += log_error("[%s/%02d] E[2] R[%d]", __FUNCTION__, i, n);
+
+		close(fd);
+	}
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident = "uio",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_PRIO|LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	rc += uio_reader_line_t();
+	rc += uio_reader_until_t();
+	rc += uio_reader_exact_t();
+	rc += uio_netstring_t();
+	rc += uio_read_eof_t();
+	rc += uio_copy_t();
+	rc += uio_copy_parallel_t();
+	rc += uio_read_t();
+
+	log_close();
+
+	return rc;
+}
@@ -15,6 +15,7 @@
 // Free Software Foundation, Inc.,
 // 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
+#include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -137,6 +138,58 @@ int whirlpool_digest_t(void)
 	return rc;
 }
 
+static
+int whirlpool_digest_fd_t(void)
+{
+	int fd, i, rc = 0;
+	char *expected, *digest;
+	char tempt[] = "/tmp/whirlpooltest-XXXXXX";
+
+	char astring[1000001];
+
+	bzero(astring, 1000001);
+	memset(astring, 'a', 1000000);
+
+	const char *T[] = {
+		"",
+		"abc",
+		"12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+		astring,
+	};
+
+	int TS = sizeof(T) / sizeof(T[0]);
+
+	if ((fd = mkstemp(tempt)) == -1)
+		return log_perror("[%s] mkstemp(%s)", __FUNCTION__, tempt);
+
+	unlink(tempt);
+
+	for (i = 0; i < TS; i++) {
+		if (ftruncate(fd, 0) == -1 ||
+				lseek(fd, 0, SEEK_SET) == -1 ||
+				write(fd, T[i], strlen(T[i])) != strlen(T[i]) ||
+				lseek(fd, 0, SEEK_SET) == -1) {
+			rc += log_perror("[%s/%02d] write", __FUNCTION__, i);
+			continue;
+		}
+
+		expected = whirlpool_digest(T[i]);
+		digest   = whirlpool_digest_fd(fd);
+
+		if (!digest || strcmp(digest, expected))
+			rc += log_error("[%s/%02d] E[%s] R[%s]",
+			                __FUNCTION__, i,
+			                expected, digest);
+
+		free(expected);
+		free(digest);
+	}
+
+	close(fd);
+
+	return rc;
+}
+
 int main(int argc, char *argv[])
 {
 	int rc = EXIT_SUCCESS;
@@ -150,6 +203,7 @@ int main(int argc, char *argv[])
 	log_init(&log_options);
 
 	rc += whirlpool_digest_t();
+	rc += whirlpool_digest_fd_t();
 
 	log_close();
 
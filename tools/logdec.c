@@ -0,0 +1,56 @@
+// Copyright 2006 Benedikt Böhm <hollow@gentoo.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the
+// Free Software Foundation, Inc.,
+// 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+/* render binary logs written with LOGD_BINARY as text */
+int main(int argc, char *argv[])
+{
+	int i, fd, rc = EXIT_SUCCESS;
+
+	log_options_t log_options = {
+		.log_ident = "lucid-logdec",
+		.log_dest  = LOGD_STDERR,
+		.log_opts  = LOGO_IDENT,
+	};
+
+	log_init(&log_options);
+
+	if (argc < 2 && log_decode(STDIN_FILENO, STDOUT_FILENO) == -1)
+		rc = log_perror("<stdin>");
+
+	for (i = 1; i < argc; i++) {
+		if ((fd = open(argv[i], O_RDONLY)) == -1) {
+			rc = log_perror("%s", argv[i]);
+			continue;
+		}
+
+		if (log_decode(fd, STDOUT_FILENO) == -1)
+			rc = log_perror("%s", argv[i]);
+
+		close(fd);
+	}
+
+	log_close();
+
+	return rc;
+}